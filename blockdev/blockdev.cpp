@@ -77,3 +77,68 @@ size_t blockdev::pwrite(const char *str, size_t count, size_t offset)
 		return count;
 	}
 }
+
+template <typename iovec_t>
+bool blockdev::check_vector(const iovec_t *iov, size_t iovcnt, size_t offset)
+{
+	// Check all buffers before transferring any, so that the request
+	// either fails as a whole or is transferred as a whole
+	if((offset % sector_size) != 0) {
+		error = EINVAL;
+		return false;
+	}
+	for(size_t i = 0; i < iovcnt; ++i) {
+		if((iov[i].buf_len % sector_size) != 0) {
+			error = EINVAL;
+			return false;
+		}
+	}
+	error = 0;
+	return true;
+}
+
+size_t blockdev::preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset)
+{
+	if(!check_vector(iov, iovcnt, offset)) {
+		return 0;
+	}
+
+	uint64_t lba = offset / sector_size;
+	size_t total = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		uint64_t sectorcount = iov[i].buf_len / sector_size;
+		if(sectorcount == 0) {
+			continue;
+		}
+		error = read_sectors(iov[i].buf, lba, sectorcount);
+		if(error) {
+			return total;
+		}
+		lba += sectorcount;
+		total += iov[i].buf_len;
+	}
+	return total;
+}
+
+size_t blockdev::pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset)
+{
+	if(!check_vector(iov, iovcnt, offset)) {
+		return 0;
+	}
+
+	uint64_t lba = offset / sector_size;
+	size_t total = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		uint64_t sectorcount = iov[i].buf_len / sector_size;
+		if(sectorcount == 0) {
+			continue;
+		}
+		error = write_sectors(iov[i].buf, lba, sectorcount);
+		if(error) {
+			return total;
+		}
+		lba += sectorcount;
+		total += iov[i].buf_len;
+	}
+	return total;
+}
@@ -23,12 +23,16 @@ struct blockdev : public fd_t {
 
 	size_t pread(void *str, size_t count, size_t offset) final override;
 	size_t pwrite(const char *str, size_t count, size_t offset) final override;
+	size_t preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) final override;
+	size_t pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset) final override;
 
 	virtual cloudabi_errno_t read_sectors(void *str, uint64_t lba, uint64_t sectorcount) = 0;
 	virtual cloudabi_errno_t write_sectors(const void *str, uint64_t lba, uint64_t sectorcount) = 0;
 
 private:
 	bool convert_count_offset(uint64_t &count, uint64_t &offset);
+	template <typename iovec_t>
+	bool check_vector(const iovec_t *iov, size_t iovcnt, size_t offset);
 
 	void set_name(const char *name);
 	// TODO: make this configurable
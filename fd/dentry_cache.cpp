@@ -0,0 +1,281 @@
+#include <fd/dentry_cache.hpp>
+#include <fd/fd.hpp>
+
+using namespace cloudos;
+
+dentry_cache::dentry_cache()
+{
+	for(size_t i = 0; i < NUM_BUCKETS; ++i) {
+		name_buckets[i] = -1;
+		inode_buckets[i] = -1;
+	}
+	// all entries start out in the free list, chained through name_next
+	for(size_t i = 0; i < NUM_ENTRIES; ++i) {
+		entries[i].in_use = false;
+		entries[i].name_next = i + 1 < NUM_ENTRIES ? i + 1 : -1;
+		entries[i].inode_next = entries[i].lru_prev = entries[i].lru_next = -1;
+	}
+	free_head = 0;
+}
+
+uint32_t dentry_cache::hash_name(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen)
+{
+	// FNV-1a over the key
+	uint32_t hash = 2166136261u;
+	auto mix = [&](uint8_t byte) {
+		hash ^= byte;
+		hash *= 16777619u;
+	};
+	for(size_t i = 0; i < sizeof(device); ++i) {
+		mix(static_cast<uint8_t>(device >> (i * 8)));
+	}
+	for(size_t i = 0; i < sizeof(parent); ++i) {
+		mix(static_cast<uint8_t>(parent >> (i * 8)));
+	}
+	for(size_t i = 0; i < namelen; ++i) {
+		mix(name[i]);
+	}
+	return hash;
+}
+
+size_t dentry_cache::inode_bucket(cloudabi_device_t device, cloudabi_inode_t inode)
+{
+	uint64_t key = (inode ^ (device << 32) ^ (device >> 32)) * 0x9e3779b97f4a7c15ull;
+	return (key >> 32) % NUM_BUCKETS;
+}
+
+int dentry_cache::find(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, uint32_t hash)
+{
+	for(int i = name_buckets[hash % NUM_BUCKETS]; i != -1; i = entries[i].name_next) {
+		auto &entry = entries[i];
+		if(entry.hash == hash && entry.device == device && entry.parent == parent
+		&& entry.namelen == namelen && memcmp(entry.name, name, namelen) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void dentry_cache::unlink_lru(int index)
+{
+	auto &entry = entries[index];
+	if(entry.lru_prev == -1) {
+		lru_head = entry.lru_next;
+	} else {
+		entries[entry.lru_prev].lru_next = entry.lru_next;
+	}
+	if(entry.lru_next == -1) {
+		lru_tail = entry.lru_prev;
+	} else {
+		entries[entry.lru_next].lru_prev = entry.lru_prev;
+	}
+	entry.lru_prev = entry.lru_next = -1;
+}
+
+void dentry_cache::touch(int index)
+{
+	if(lru_head == index) {
+		return;
+	}
+	unlink_lru(index);
+	auto &entry = entries[index];
+	entry.lru_next = lru_head;
+	if(lru_head != -1) {
+		entries[lru_head].lru_prev = index;
+	}
+	lru_head = index;
+	if(lru_tail == -1) {
+		lru_tail = index;
+	}
+}
+
+void dentry_cache::unlink_inode_chain(int index)
+{
+	auto &entry = entries[index];
+	if(entry.lookup_errno != 0) {
+		// negative entries are not in an inode chain
+		return;
+	}
+	int16_t *link = &inode_buckets[inode_bucket(entry.device, entry.stat.st_ino)];
+	while(*link != -1) {
+		if(*link == index) {
+			*link = entry.inode_next;
+			entry.inode_next = -1;
+			return;
+		}
+		link = &entries[*link].inode_next;
+	}
+	kernel_panic("dentry cache entry missing from its inode chain");
+}
+
+void dentry_cache::remove(int index)
+{
+	auto &entry = entries[index];
+	assert(entry.in_use);
+
+	int16_t *link = &name_buckets[entry.hash % NUM_BUCKETS];
+	while(*link != index) {
+		assert(*link != -1);
+		link = &entries[*link].name_next;
+	}
+	*link = entry.name_next;
+
+	unlink_inode_chain(index);
+	unlink_lru(index);
+
+	entry.in_use = false;
+	entry.name_next = free_head;
+	free_head = index;
+	stats.entries--;
+}
+
+bool dentry_cache::lookup(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, cloudabi_errno_t *lookup_errno, cloudabi_filestat_t *stat)
+{
+	if(namelen > dentry_cache_entry::NAME_MAX) {
+		stats.misses++;
+		return false;
+	}
+
+	int index = find(device, parent, name, namelen, hash_name(device, parent, name, namelen));
+	if(index == -1) {
+		stats.misses++;
+		return false;
+	}
+
+	touch(index);
+	auto &entry = entries[index];
+	*lookup_errno = entry.lookup_errno;
+	if(entry.lookup_errno == 0) {
+		*stat = entry.stat;
+		stats.hits++;
+	} else {
+		stats.negative_hits++;
+	}
+	return true;
+}
+
+void dentry_cache::insert(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, cloudabi_errno_t lookup_errno, const cloudabi_filestat_t *stat)
+{
+	if(namelen > dentry_cache_entry::NAME_MAX || (lookup_errno != 0 && lookup_errno != ENOENT)) {
+		return;
+	}
+	// "." and ".." are not names of their own inode, so they can't be
+	// invalidated through their parent
+	if((namelen == 1 && name[0] == '.') || (namelen == 2 && name[0] == '.' && name[1] == '.')) {
+		return;
+	}
+
+	uint32_t hash = hash_name(device, parent, name, namelen);
+	int index = find(device, parent, name, namelen, hash);
+	if(index != -1) {
+		auto &entry = entries[index];
+		if(lookup_errno == 0 && entry.lookup_errno == 0 && entry.stat.st_ino == stat->st_ino) {
+			// same file, refresh its metadata
+			entry.stat = *stat;
+			touch(index);
+			return;
+		}
+		remove(index);
+	}
+
+	if(free_head == -1) {
+		// replace the least recently used entry
+		assert(lru_tail != -1);
+		remove(lru_tail);
+		stats.evictions++;
+	}
+
+	index = free_head;
+	auto &entry = entries[index];
+	free_head = entry.name_next;
+
+	entry.in_use = true;
+	entry.device = device;
+	entry.parent = parent;
+	entry.hash = hash;
+	entry.namelen = namelen;
+	memcpy(entry.name, name, namelen);
+	entry.lookup_errno = lookup_errno;
+	if(lookup_errno == 0) {
+		entry.stat = *stat;
+		size_t bucket = inode_bucket(device, stat->st_ino);
+		entry.inode_next = inode_buckets[bucket];
+		inode_buckets[bucket] = index;
+	} else {
+		entry.inode_next = -1;
+	}
+
+	size_t bucket = hash % NUM_BUCKETS;
+	entry.name_next = name_buckets[bucket];
+	name_buckets[bucket] = index;
+
+	entry.lru_prev = entry.lru_next = -1;
+	touch(index);
+
+	stats.insertions++;
+	stats.entries++;
+}
+
+bool dentry_cache::invalidate_entry(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen)
+{
+	if(namelen > dentry_cache_entry::NAME_MAX) {
+		return false;
+	}
+	int index = find(device, parent, name, namelen, hash_name(device, parent, name, namelen));
+	if(index == -1) {
+		return false;
+	}
+
+	auto &entry = entries[index];
+	cloudabi_inode_t inode = 0;
+	bool is_directory = false;
+	if(entry.lookup_errno == 0) {
+		inode = entry.stat.st_ino;
+		is_directory = entry.stat.st_filetype == CLOUDABI_FILETYPE_DIRECTORY;
+	}
+	remove(index);
+	stats.invalidations++;
+
+	if(inode != 0) {
+		// the link count of the file changes as well, and if it was
+		// a removed directory, its inode may be reused
+		invalidate_inode(device, inode);
+		if(is_directory) {
+			invalidate_children(device, inode);
+		}
+	}
+	return true;
+}
+
+void dentry_cache::invalidate_inode(cloudabi_device_t device, cloudabi_inode_t inode)
+{
+	int index = inode_buckets[inode_bucket(device, inode)];
+	while(index != -1) {
+		int next = entries[index].inode_next;
+		if(entries[index].device == device && entries[index].stat.st_ino == inode) {
+			remove(index);
+			stats.invalidations++;
+		}
+		index = next;
+	}
+}
+
+void dentry_cache::invalidate_children(cloudabi_device_t device, cloudabi_inode_t parent)
+{
+	for(size_t i = 0; i < NUM_ENTRIES; ++i) {
+		if(entries[i].in_use && entries[i].device == device && entries[i].parent == parent) {
+			remove(i);
+			stats.invalidations++;
+		}
+	}
+}
+
+void dentry_cache::invalidate_device(cloudabi_device_t device)
+{
+	for(size_t i = 0; i < NUM_ENTRIES; ++i) {
+		if(entries[i].in_use && entries[i].device == device) {
+			remove(i);
+			stats.invalidations++;
+		}
+	}
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cloudabi_types_common.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cloudos {
+
+/** Statistics on the dentry cache. */
+struct dentry_cache_stats {
+	uint64_t hits = 0;
+	uint64_t negative_hits = 0;
+	uint64_t misses = 0;
+	uint64_t insertions = 0;
+	uint64_t evictions = 0;
+	uint64_t invalidations = 0;
+	size_t entries = 0;
+};
+
+/** A cached result of lookup(name) in the directory (device, parent). If
+ * lookup_errno is 0, stat contains the looked up file; otherwise, the entry
+ * is negative and remembers that the name does not exist.
+ */
+struct dentry_cache_entry {
+	static constexpr size_t NAME_MAX = 48;
+
+	cloudabi_device_t device;
+	cloudabi_inode_t parent;
+	uint32_t hash;
+	uint8_t namelen;
+	char name[NAME_MAX];
+	cloudabi_errno_t lookup_errno;
+	cloudabi_filestat_t stat;
+
+	// indices into the entry array, or -1
+	int16_t name_next;
+	int16_t inode_next;
+	int16_t lru_prev;
+	int16_t lru_next;
+	bool in_use;
+};
+
+/** The dentry cache remembers the results of lookup() calls on directories
+ * that take part in it (see fd_t::dentry_cache_inode()), so that traversing
+ * the same path twice does not cause a lookup on every path component again.
+ * Entries are keyed by (device, parent inode, name) and are found using a
+ * hash table; a second hash table on (device, inode of the entry) allows
+ * invalidating all names of a file when it changes. When the cache is full,
+ * the least recently used entry is replaced.
+ *
+ * Only names and file attributes are cached, never opened fds, so that every
+ * caller has its own fd with its own error state. Directories that support
+ * fd_t::lookup_inode() don't need to be opened to traverse through them, so
+ * a cached path costs no requests until its last directory.
+ */
+struct dentry_cache {
+	dentry_cache();
+
+	/** Returns whether an entry exists for this name. If so, lookup_errno
+	 * and stat are filled in like lookup() would.
+	 */
+	bool lookup(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, cloudabi_errno_t *lookup_errno, cloudabi_filestat_t *stat);
+
+	/** Remember the result of a lookup(). Only successful lookups and
+	 * ENOENT results are cached; names that are too long, "." and ".." are
+	 * not cached.
+	 */
+	void insert(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, cloudabi_errno_t lookup_errno, const cloudabi_filestat_t *stat);
+
+	/** The name was created, removed or changed in the parent directory.
+	 * Returns whether an entry for it was cached.
+	 */
+	bool invalidate_entry(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen);
+	/** The metadata of the given inode changed; drop all names pointing at it. */
+	void invalidate_inode(cloudabi_device_t device, cloudabi_inode_t inode);
+	/** Drop all names inside the given directory. */
+	void invalidate_children(cloudabi_device_t device, cloudabi_inode_t parent);
+	/** Drop all entries of a device. */
+	void invalidate_device(cloudabi_device_t device);
+
+	inline dentry_cache_stats &get_stats() { return stats; }
+
+private:
+	static constexpr size_t NUM_ENTRIES = 512;
+	static constexpr size_t NUM_BUCKETS = 256;
+
+	static uint32_t hash_name(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen);
+	static size_t inode_bucket(cloudabi_device_t device, cloudabi_inode_t inode);
+
+	int find(cloudabi_device_t device, cloudabi_inode_t parent, const char *name, size_t namelen, uint32_t hash);
+	void touch(int index);
+	void remove(int index);
+	void unlink_lru(int index);
+	void unlink_inode_chain(int index);
+
+	dentry_cache_entry entries[NUM_ENTRIES];
+	int16_t name_buckets[NUM_BUCKETS];
+	int16_t inode_buckets[NUM_BUCKETS];
+	int16_t free_head = -1;
+	// most recently used first
+	int16_t lru_head = -1;
+	int16_t lru_tail = -1;
+
+	dentry_cache_stats stats;
+};
+
+}
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <memory/smart_ptr.hpp>
+#include <memory/allocation.hpp>
 #include "../oslibc/error.h"
 #include "../oslibc/string.h"
 #include "global.hpp"
@@ -77,6 +78,74 @@ struct fd_t {
 		return 0;
 	}
 
+	/** Vectored variants of read(), write(), pread() and pwrite(). The
+	 * default implementations call the non-vectored variant once per
+	 * buffer, stopping at the first error or short transfer; file
+	 * descriptors that can transfer all buffers in one operation override
+	 * them. If some bytes were transferred before an error occurred, the
+	 * number of bytes transferred is returned and error is set.
+	 */
+	virtual size_t readv(const cloudabi_iovec_t *iov, size_t iovcnt) {
+		error = 0;
+		size_t total = 0;
+		for(size_t i = 0; i < iovcnt; ++i) {
+			size_t r = read(iov[i].buf, iov[i].buf_len);
+			if(error) {
+				break;
+			}
+			total += r;
+			if(r < iov[i].buf_len) {
+				break;
+			}
+		}
+		return total;
+	}
+	virtual size_t writev(const cloudabi_ciovec_t *iov, size_t iovcnt) {
+		error = 0;
+		size_t total = 0;
+		for(size_t i = 0; i < iovcnt; ++i) {
+			size_t r = write(reinterpret_cast<const char*>(iov[i].buf), iov[i].buf_len);
+			if(error) {
+				break;
+			}
+			total += r;
+			if(r < iov[i].buf_len) {
+				break;
+			}
+		}
+		return total;
+	}
+	virtual size_t preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) {
+		error = 0;
+		size_t total = 0;
+		for(size_t i = 0; i < iovcnt; ++i) {
+			size_t r = pread(iov[i].buf, iov[i].buf_len, offset + total);
+			if(error) {
+				break;
+			}
+			total += r;
+			if(r < iov[i].buf_len) {
+				break;
+			}
+		}
+		return total;
+	}
+	virtual size_t pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset) {
+		error = 0;
+		size_t total = 0;
+		for(size_t i = 0; i < iovcnt; ++i) {
+			size_t r = pwrite(reinterpret_cast<const char*>(iov[i].buf), iov[i].buf_len, offset + total);
+			if(error) {
+				break;
+			}
+			total += r;
+			if(r < iov[i].buf_len) {
+				break;
+			}
+		}
+		return total;
+	}
+
 	virtual void datasync()
 	{
 		error = EINVAL;
@@ -87,6 +156,15 @@ struct fd_t {
 		error = EINVAL;
 	}
 
+	/** Called when the last file descriptor referring to this fd is
+	 * closed, just before it is destroyed. Writes back anything this fd
+	 * buffered, and returns the error if that failed; the fd is closed
+	 * regardless.
+	 */
+	virtual cloudabi_errno_t flush_on_close() {
+		return 0;
+	}
+
 	// Returns EPIPE if the file descriptor will never become readable, e.g. because the
 	// other end of the socket is shut down.
 	virtual cloudabi_errno_t get_read_signaler(thread_condition_signaler **s) {
@@ -101,6 +179,28 @@ struct fd_t {
 		return EINVAL;
 	}
 
+	/** For splice(): read up to count bytes into a buffer allocated by this
+	 * fd, which the caller must deallocate if its size is nonzero. If
+	 * offset is given, read at *offset like pread(), otherwise read from
+	 * the current position. The number of bytes read is returned in
+	 * length. Sets error to ENOTSUP if this fd can't do this more cheaply
+	 * than reading into a buffer of the caller.
+	 */
+	virtual Blk splice_read(size_t /*count*/, cloudabi_filesize_t * /*offset*/, size_t *length) {
+		*length = 0;
+		error = ENOTSUP;
+		return {};
+	}
+
+	/** For splice(): the number of bytes write() will accept right now,
+	 * or SIZE_MAX if it accepts anything it's given (possibly by
+	 * blocking). splice() reads no more than this from fds it can't seek
+	 * back in, so bytes out doesn't accept aren't lost.
+	 */
+	virtual size_t write_space() {
+		return SIZE_MAX;
+	}
+
 	/* For directories */
 	/** Look up the given component in this directory. Non-recursive and does not follow symlinks.
 	 * If oflags has O_CREAT set, create the file if it doesn't exist, then return its new inode.
@@ -111,6 +211,19 @@ struct fd_t {
 		error = EINVAL;
 	}
 
+	/** Like lookup() without oflags, but look up the component in the directory with inode
+	 * dir_inode on this->device, which doesn't have to be opened. This allows traversal to
+	 * pass through directories without opening them. Sets error to ENOSYS if this directory
+	 * can't do that; can_lookup_inode() returns whether it is worth trying.
+	 */
+	virtual void lookup_inode(cloudabi_inode_t /*dir_inode*/, const char* /*file*/, size_t /*filelen*/, cloudabi_filestat_t * /*filestat*/) {
+		error = ENOSYS;
+	}
+
+	virtual bool can_lookup_inode() {
+		return false;
+	}
+
 	/** Open the file indicated with the given device and inode number.
 	 * In the cloudabi_fdstat_t, rights_base and rights_inheriting specify the
 	 * initial rights of the newly created file descriptor. The rights that do not apply to
@@ -124,6 +237,15 @@ struct fd_t {
 		return nullptr;
 	}
 
+	/** If the results of lookup() on this directory may be kept in the
+	 * dentry cache, returns the inode number of this directory on
+	 * this->device; otherwise, returns 0. A directory that returns nonzero
+	 * must invalidate the cached entries it changes.
+	 */
+	virtual cloudabi_inode_t dentry_cache_inode() {
+		return 0;
+	}
+
 	/** Write directory entries to the given buffer, until it is filled. Each entry consists of a
 	 * cloudabi_dirent_t object, follwed by cloudabi_dirent_t::d_namlen bytes holding the name of the
 	 * entry. As much of the output buffer as possible is filled, potentially truncating the last entry.
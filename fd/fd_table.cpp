@@ -0,0 +1,172 @@
+#include <fd/fd_table.hpp>
+#include <memory/allocation.hpp>
+
+using namespace cloudos;
+
+static inline size_t bitmap_words(size_t bits) {
+	return (bits + 63) / 64;
+}
+
+fd_table::~fd_table()
+{
+	deallocate_all();
+}
+
+void fd_table::deallocate_all()
+{
+	for(size_t i = 0; i < num_chunks; ++i) {
+		deallocate(chunks[i]);
+	}
+	if(chunks != nullptr) {
+		deallocate({chunks, dir_capacity * sizeof(chunk*)});
+		deallocate({used, dir_capacity * sizeof(uint64_t)});
+		deallocate({free_chunks, bitmap_words(dir_capacity) * sizeof(uint64_t)});
+	}
+	chunks = nullptr;
+	used = nullptr;
+	free_chunks = nullptr;
+	num_chunks = 0;
+	dir_capacity = 0;
+}
+
+void fd_table::add_chunk()
+{
+	if(num_chunks == dir_capacity) {
+		// grow the directory geometrically; the chunks themselves stay
+		size_t new_capacity = dir_capacity == 0 ? 1 : dir_capacity * 2;
+		auto *new_chunks = reinterpret_cast<chunk**>(allocate(new_capacity * sizeof(chunk*)).ptr);
+		auto *new_used = reinterpret_cast<uint64_t*>(allocate(new_capacity * sizeof(uint64_t)).ptr);
+		auto *new_free = reinterpret_cast<uint64_t*>(allocate(bitmap_words(new_capacity) * sizeof(uint64_t)).ptr);
+		if(new_chunks == nullptr || new_used == nullptr || new_free == nullptr) {
+			kernel_panic("Failed to grow fd table");
+		}
+		memset(new_free, 0, bitmap_words(new_capacity) * sizeof(uint64_t));
+		if(chunks != nullptr) {
+			memcpy(new_chunks, chunks, num_chunks * sizeof(chunk*));
+			memcpy(new_used, used, num_chunks * sizeof(uint64_t));
+			memcpy(new_free, free_chunks, bitmap_words(num_chunks) * sizeof(uint64_t));
+			deallocate({chunks, dir_capacity * sizeof(chunk*)});
+			deallocate({used, dir_capacity * sizeof(uint64_t)});
+			deallocate({free_chunks, bitmap_words(dir_capacity) * sizeof(uint64_t)});
+		}
+		chunks = new_chunks;
+		used = new_used;
+		free_chunks = new_free;
+		dir_capacity = new_capacity;
+	}
+
+	chunk *c = allocate<chunk>();
+	if(c == nullptr) {
+		kernel_panic("Failed to allocate fd table chunk");
+	}
+	chunks[num_chunks] = c;
+	used[num_chunks] = 0;
+	free_chunks[num_chunks / 64] |= uint64_t(1) << (num_chunks % 64);
+	num_chunks++;
+}
+
+void fd_table::mark_used(size_t chunk_index, size_t slot)
+{
+	used[chunk_index] |= uint64_t(1) << slot;
+	if(used[chunk_index] == UINT64_MAX) {
+		free_chunks[chunk_index / 64] &= ~(uint64_t(1) << (chunk_index % 64));
+	}
+}
+
+void fd_table::mark_free(size_t chunk_index, size_t slot)
+{
+	used[chunk_index] &= ~(uint64_t(1) << slot);
+	free_chunks[chunk_index / 64] |= uint64_t(1) << (chunk_index % 64);
+}
+
+cloudabi_fd_t fd_table::add(shared_ptr<fd_t> fd, cloudabi_rights_t rights_base, cloudabi_rights_t rights_inheriting)
+{
+	assert(fd);
+
+	size_t chunk_index = num_chunks;
+	for(size_t w = 0; w < bitmap_words(num_chunks); ++w) {
+		if(free_chunks[w] != 0) {
+			chunk_index = w * 64 + __builtin_ctzll(free_chunks[w]);
+			break;
+		}
+	}
+	if(chunk_index == num_chunks) {
+		add_chunk();
+	}
+
+	assert(used[chunk_index] != UINT64_MAX);
+	size_t slot = __builtin_ctzll(~used[chunk_index]);
+	mark_used(chunk_index, slot);
+
+	fd_mapping_t &mapping = chunks[chunk_index]->entries[slot];
+	mapping.fd = fd;
+	mapping.rights_base = rights_base;
+	mapping.rights_inheriting = rights_inheriting;
+	return chunk_index * CHUNK_SIZE + slot;
+}
+
+fd_mapping_t *fd_table::get(cloudabi_fd_t num)
+{
+	size_t chunk_index = num / CHUNK_SIZE;
+	size_t slot = num % CHUNK_SIZE;
+	if(chunk_index >= num_chunks || (used[chunk_index] & (uint64_t(1) << slot)) == 0) {
+		return nullptr;
+	}
+	return &chunks[chunk_index]->entries[slot];
+}
+
+void fd_table::set(cloudabi_fd_t num, fd_mapping_t mapping)
+{
+	assert(mapping.fd);
+	size_t chunk_index = num / CHUNK_SIZE;
+	size_t slot = num % CHUNK_SIZE;
+	while(chunk_index >= num_chunks) {
+		add_chunk();
+	}
+	chunks[chunk_index]->entries[slot] = mapping;
+	mark_used(chunk_index, slot);
+}
+
+bool fd_table::remove(cloudabi_fd_t num)
+{
+	fd_mapping_t *mapping = get(num);
+	if(mapping == nullptr) {
+		return false;
+	}
+	// closing the fd may re-enter this table, so only drop the last
+	// reference once the slot is free
+	shared_ptr<fd_t> fd = mapping->fd;
+	mapping->fd.reset();
+	mark_free(num / CHUNK_SIZE, num % CHUNK_SIZE);
+	return true;
+}
+
+void fd_table::clear()
+{
+	for(size_t c = 0; c < num_chunks; ++c) {
+		while(used[c] != 0) {
+			size_t slot = __builtin_ctzll(used[c]);
+			remove(c * CHUNK_SIZE + slot);
+		}
+	}
+}
+
+void fd_table::copy_from(fd_table &other)
+{
+	deallocate_all();
+	while(num_chunks < other.num_chunks) {
+		add_chunk();
+	}
+	for(size_t c = 0; c < other.num_chunks; ++c) {
+		uint64_t bits = other.used[c];
+		while(bits != 0) {
+			size_t slot = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			chunks[c]->entries[slot] = other.chunks[c]->entries[slot];
+		}
+		used[c] = other.used[c];
+		if(used[c] == UINT64_MAX) {
+			free_chunks[c / 64] &= ~(uint64_t(1) << (c % 64));
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "fd.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cloudos {
+
+struct fd_mapping_t {
+	shared_ptr<fd_t> fd; /* can be empty, in this case, the mapping is unused and can be reused for another fd */
+	cloudabi_rights_t rights_base;
+	cloudabi_rights_t rights_inheriting;
+};
+
+/** The file descriptor table of a process.
+ *
+ * Mappings are stored inline in chunks of CHUNK_SIZE entries. A chunk never
+ * moves once allocated, so an fd_mapping_t pointer stays valid until its
+ * file descriptor is closed, even if file descriptors are added in the
+ * meantime. Only the directory of chunks is reallocated, and it grows
+ * geometrically.
+ *
+ * Free slots are found with a two-level bitmap: every chunk has a word with a
+ * bit per used slot, and a second bitmap has a bit for every chunk that has
+ * at least one free slot. Adding a file descriptor takes the lowest free
+ * number, like POSIX requires, in a number of steps that only depends on the
+ * number of chunks divided by 64.
+ */
+struct fd_table {
+	static constexpr size_t CHUNK_SIZE = 64;
+
+	fd_table() = default;
+	~fd_table();
+	fd_table(fd_table const&) = delete;
+	fd_table &operator=(fd_table const&) = delete;
+
+	/** Returns the number of file descriptor numbers that may be in use. */
+	inline size_t capacity() const { return num_chunks * CHUNK_SIZE; }
+
+	/** Adds the mapping at the lowest free number and returns that number. */
+	cloudabi_fd_t add(shared_ptr<fd_t> fd, cloudabi_rights_t rights_base, cloudabi_rights_t rights_inheriting);
+	/** Returns the mapping for this number, or nullptr if it is not in use. */
+	fd_mapping_t *get(cloudabi_fd_t num);
+	/** Puts the mapping at the given number, closing the fd that was there. */
+	void set(cloudabi_fd_t num, fd_mapping_t mapping);
+	/** Closes the fd with the given number. Returns whether it was in use. */
+	bool remove(cloudabi_fd_t num);
+	/** Closes all fds, keeping the memory for the table. */
+	void clear();
+	/** Replaces the contents of this table by copies of the mappings in other. */
+	void copy_from(fd_table &other);
+
+private:
+	struct chunk {
+		fd_mapping_t entries[CHUNK_SIZE];
+	};
+
+	void add_chunk();
+	void mark_used(size_t chunk_index, size_t slot);
+	void mark_free(size_t chunk_index, size_t slot);
+	void deallocate_all();
+
+	// directory of chunks, with room for dir_capacity chunks
+	chunk **chunks = nullptr;
+	// for every chunk, a bit per slot that is in use
+	uint64_t *used = nullptr;
+	// a bit for every chunk that has at least one free slot
+	uint64_t *free_chunks = nullptr;
+	size_t num_chunks = 0;
+	size_t dir_capacity = 0;
+};
+
+}
@@ -69,12 +69,12 @@ static cloudabi_errno_t for_every_initrd_file(uint8_t *initrd_start, size_t init
 	while((header + 1) <= end /* one more header fits */) {
 		size_t namelen = strnlen(header->name, sizeof(header->name));
 		if(header->name[namelen] != 0) {
-			get_vga_stream() << "Illegal initrd encountered: filename is not null terminated\n";
+			get_vga_stream() << log_error << "Illegal initrd encountered: filename is not null terminated\n";
 			return EIO;
 		}
 		size_t sizelen = strnlen(header->size, sizeof(header->size));
 		if(header->size[sizelen] != 0 && header->size[sizelen] != ' ') {
-			get_vga_stream() << "Illegal initrd encountered: size is not null or space terminated\n";
+			get_vga_stream() << log_error << "Illegal initrd encountered: size is not null or space terminated\n";
 			return EIO;
 		}
 
@@ -85,7 +85,7 @@ static cloudabi_errno_t for_every_initrd_file(uint8_t *initrd_start, size_t init
 		for(size_t i = 0; i < sizelen; ++i) {
 			uint8_t digit = header->size[i] - '0';
 			if(digit >= 8) {
-				get_vga_stream() << "Illegal initrd encountered: size not octal, returning error\n";
+				get_vga_stream() << log_error << "Illegal initrd encountered: size not octal, returning error\n";
 				return EIO;
 			}
 			filesize = filesize * 8 + digit;
@@ -93,7 +93,7 @@ static cloudabi_errno_t for_every_initrd_file(uint8_t *initrd_start, size_t init
 
 		if(reinterpret_cast<uint8_t*>(header + 1) + filesize > end) {
 			/* this data doesn't fit anymore */
-			get_vga_stream() << "Illegal initrd encountered: stopping before end of data, returning error\n";
+			get_vga_stream() << log_error << "Illegal initrd encountered: stopping before end of data, returning error\n";
 			return EIO;
 		}
 
@@ -124,7 +124,7 @@ static cloudabi_errno_t for_every_initrd_file(uint8_t *initrd_start, size_t init
 initrdfs::initrdfs(multiboot_module *initrd)
 {
 	if(initrd == nullptr) {
-		get_vga_stream() << "Not loading initrd.\n";
+		get_vga_stream() << log_warning << "Not loading initrd.\n";
 		return;
 	}
 
@@ -192,7 +192,7 @@ void mem_mapping_t::ensure_backed(size_t page)
 			}
 			if(backing_fd->error != 0) {
 				// TODO: what now?
-				get_vga_stream() << "backing fd pread() failed for a page being backed!\n";
+				get_vga_stream() << log_error << "backing fd pread() failed for a page being backed!\n";
 				bytes_read = 0;
 			}
 		}
@@ -285,7 +285,7 @@ cloudabi_errno_t mem_mapping_t::sync(size_t page, cloudabi_msflags_t flags) {
 	}
 
 	if(flags & CLOUDABI_MS_ASYNC) {
-		get_vga_stream() << "mem_mapping_t::sync: MS_ASYNC given, but unsupported, so reinterpreted as MS_SYNC\n";
+		get_vga_stream() << log_debug << "mem_mapping_t::sync: MS_ASYNC given, but unsupported, so reinterpreted as MS_SYNC\n";
 		flags = CLOUDABI_MS_SYNC;
 	}
 
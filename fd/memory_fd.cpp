@@ -1,4 +1,5 @@
 #include "memory_fd.hpp"
+#include <oslibc/iovec.hpp>
 
 using namespace cloudos;
 
@@ -69,6 +70,32 @@ size_t memory_fd::read(void *dest, size_t count) {
 	return copied;
 }
 
+size_t memory_fd::copy_out(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) {
+	error = 0;
+	if(offset >= file_length) {
+		return 0;
+	}
+	assert(alloc.ptr != nullptr);
+	return veccpy(iov, iovcnt, reinterpret_cast<char*>(alloc.ptr) + offset, file_length - offset, 0);
+}
+
+size_t memory_fd::readv(const cloudabi_iovec_t *iov, size_t iovcnt) {
+	if(alloc.ptr == nullptr) {
+		// subclasses constructed without contents fill them in read()
+		return seekable_fd_t::readv(iov, iovcnt);
+	}
+	size_t copied = copy_out(iov, iovcnt, pos);
+	pos += copied;
+	return copied;
+}
+
+size_t memory_fd::preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) {
+	if(alloc.ptr == nullptr) {
+		return seekable_fd_t::preadv(iov, iovcnt, offset);
+	}
+	return copy_out(iov, iovcnt, offset);
+}
+
 void memory_fd::file_stat_fget(cloudabi_filestat_t *buf) {
 	buf->st_dev = device;
 	buf->st_ino = inode;
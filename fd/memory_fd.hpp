@@ -23,6 +23,8 @@ struct memory_fd : public seekable_fd_t {
 	~memory_fd() override;
 
 	size_t read(void *dest, size_t count) override;
+	size_t readv(const cloudabi_iovec_t *iov, size_t iovcnt) override;
+	size_t preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) override;
 	void file_stat_fget(cloudabi_filestat_t *buf) override;
 
 	void reset();
@@ -30,6 +32,8 @@ struct memory_fd : public seekable_fd_t {
 	void reset(void *address, size_t file_length, cloudabi_inode_t inode = 0);
 
 private:
+	size_t copy_out(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset);
+
 	Blk alloc;
 	size_t file_length;
 	cloudabi_inode_t inode;
@@ -9,6 +9,7 @@
 #include <fd/procfs.hpp>
 #include <fd/pseudo_fd.hpp>
 #include <fd/scheduler.hpp>
+#include <fd/trace.hpp>
 #include <fd/unixsock.hpp>
 #include <fd/vga_fd.hpp>
 #include <global.hpp>
@@ -16,6 +17,7 @@
 #include <memory/map_virtual.hpp>
 #include <oslibc/string.h>
 #include <oslibc/uuid.hpp>
+#include <proc/process_store.hpp>
 #include <term/terminal_store.hpp>
 #include <userland/vdso_support.h>
 
@@ -71,12 +73,6 @@ process_fd::~process_fd()
 
 	assert(threads == nullptr);
 
-	if(fds != nullptr) {
-		deallocate({fds, fd_capacity * sizeof(fd_mapping_t*)});
-		fds = nullptr;
-		fd_capacity = 0;
-	}
-
 	remove_all(&mappings, [&](mem_mapping_list *) {
 		return true;
 	}, [&](mem_mapping_list *item) {
@@ -173,52 +169,12 @@ void process_fd::add_initial_fds() {
 }
 
 cloudabi_fd_t process_fd::add_fd(shared_ptr<fd_t> fd, cloudabi_rights_t rights_base, cloudabi_rights_t rights_inheriting) {
-	cloudabi_fd_t fdnum;
-	bool found = false;
-	// TODO: this doesn't scale, make this search nonlinear
-	for(fdnum = 0; fdnum < fd_capacity; ++fdnum) {
-		if(fds[fdnum] == nullptr) {
-			found = true;
-			break;
-		}
-	}
-
-	if(!found) {
-		// no place for fd's, grow the fd storage
-		// (note, fd_capacity is 0 for the first call of this method)
-		auto old_capacity = fd_capacity;
-		fd_mapping_t **old_fds = fds;
-
-		fd_capacity += 100;
-
-		Blk fds_blk = allocate(fd_capacity * sizeof(fd_mapping_t*));
-		fds = reinterpret_cast<fd_mapping_t**>(fds_blk.ptr);
-
-		memcpy(fds, old_fds, old_capacity * sizeof(fd_mapping_t*));
-		memset(fds + old_capacity, 0, (fd_capacity - old_capacity) * sizeof(fd_mapping_t*));
-		fdnum = old_capacity;
-
-		if(old_fds != nullptr) {
-			deallocate({old_fds, old_capacity * sizeof(fd_mapping_t*)});
-		}
-	}
-
-	fd_mapping_t *mapping = allocate<fd_mapping_t>();
-	assert(fd);
-	mapping->fd = fd;
-	mapping->rights_base = rights_base;
-	mapping->rights_inheriting = rights_inheriting;
-
-	fds[fdnum] = mapping;
-	return fdnum;
+	return fds.add(fd, rights_base, rights_inheriting);
 }
 
 cloudabi_errno_t process_fd::get_fd(fd_mapping_t **r_mapping, cloudabi_fd_t num, cloudabi_rights_t has_rights) {
 	*r_mapping = nullptr;
-	if(num >= fd_capacity) {
-		return EBADF;
-	}
-	fd_mapping_t *mapping = fds[num];
+	fd_mapping_t *mapping = fds.get(num);
 	if(mapping == nullptr || !mapping->fd) {
 		return EBADF;
 	}
@@ -231,14 +187,15 @@ cloudabi_errno_t process_fd::get_fd(fd_mapping_t **r_mapping, cloudabi_fd_t num,
 }
 
 cloudabi_errno_t process_fd::close_fd(cloudabi_fd_t num) {
-	fd_mapping_t *mapping;
-	auto res = get_fd(&mapping, num, 0);
-	if(res == 0) {
-		mapping->fd.reset();
-		deallocate(fds[num]);
-		fds[num] = nullptr;
+	fd_mapping_t *mapping = fds.get(num);
+	if(mapping == nullptr) {
+		return EBADF;
 	}
-	return res;
+	shared_ptr<fd_t> fd = mapping->fd;
+	fds.remove(num);
+	// if this was the last reference, the fd is destroyed when we return,
+	// so this is the last chance to report errors writing it back
+	return fd.use_count() == 1 ? fd->flush_on_close() : 0;
 }
 
 cloudabi_errno_t process_fd::replace_fd(cloudabi_fd_t num, shared_ptr<fd_t> fd, cloudabi_rights_t rights_base, cloudabi_rights_t rights_inheriting) {
@@ -318,8 +275,8 @@ cloudabi_errno_t process_fd::add_mem_mapping(mem_mapping_t *mapping, bool overwr
 		bool covers = end > i_begin && begin < i_end;
 		assert(!(covers && overwrite)); // this should be prevented by mem_unmap
 		if(covers) {
-			get_vga_stream() << "Trying to create a " << mapping->number_of_pages << "-page mapping at address " << mapping->virtual_address << "\n";
-			get_vga_stream() << "Found a " << item->data->number_of_pages << "-page mapping at address " << item->data->virtual_address << "\n";
+			get_vga_stream() << log_error << "Trying to create a " << mapping->number_of_pages << "-page mapping at address " << mapping->virtual_address << "\n";
+			get_vga_stream() << log_error << "Found a " << item->data->number_of_pages << "-page mapping at address " << item->data->virtual_address << "\n";
 			kernel_panic("add_mem_mapping(mapping, false) called for a mapping that overlaps with an existing one");
 		}
 	});
@@ -484,6 +441,15 @@ cloudabi_errno_t process_fd::mem_sync(void *addr, size_t num_pages, cloudabi_msf
 }
 
 bool process_fd::handle_pagefault(void *addr, bool for_writing, bool for_exec)
+{
+	trace(trace_event_type::pagefault, trace_phase::begin, reinterpret_cast<uintptr_t>(addr));
+	accounting.pagefaults++;
+	bool res = resolve_pagefault(addr, for_writing, for_exec);
+	trace(trace_event_type::pagefault, trace_phase::end, reinterpret_cast<uintptr_t>(addr));
+	return res;
+}
+
+bool process_fd::resolve_pagefault(void *addr, bool for_writing, bool for_exec)
 {
 	mem_mapping_t *mapping = nullptr;
 	size_t page_i = 0;
@@ -598,8 +564,9 @@ cloudabi_errno_t process_fd::exec(shared_ptr<fd_t> fd, size_t fdslen, fd_mapping
 	uint32_t **old_page_tables = page_tables;
 	mem_mapping_list *old_mappings = mappings;
 
-	strncpy(name, "exec<-", sizeof(name));
-	strncat(name, fd->name, sizeof(name) - strlen(name) - 1);
+	// name the process after its binary, so profiles can be symbolized
+	strncpy(name, fd->name, sizeof(name));
+	name[sizeof(name) - 1] = 0;
 
 	Blk page_directory_alloc = allocate_aligned(PAGE_SIZE, PAGE_SIZE);
 	if(page_directory_alloc.ptr == nullptr) {
@@ -642,31 +609,23 @@ cloudabi_errno_t process_fd::exec(shared_ptr<fd_t> fd, size_t fdslen, fd_mapping
 		return res;
 	}
 
-	// Close all unused FDs
-	for(cloudabi_fd_t i = 0; i < fd_capacity; ++i) {
-		if(fds[i] == nullptr || !fds[i]->fd) {
-			continue;
-		}
-
-		bool fd_is_used = false;
-		for(cloudabi_fd_t j = 0; j < fdslen; ++j) {
-			// TODO: cloudabi does not allow an fd to be mapped twice in exec()
-			if(new_fds[j]->fd == fds[i]->fd) {
-				fd_is_used = true;
-				break;
-			}
-		}
-
-		if(!fd_is_used) {
-			close_fd(i);
-		}
+	// Keep copies of the mappings that move to the new fd numbers, then
+	// close all FDs and put them in place
+	Blk kept_alloc;
+	if(fdslen > 0) {
+		kept_alloc = allocate(fdslen * sizeof(fd_mapping_t));
 	}
-
-	for(cloudabi_fd_t i = 0; i < fdslen; ++i) {
-		fds[i] = new_fds[i];
+	auto *kept = reinterpret_cast<fd_mapping_t*>(kept_alloc.ptr);
+	for(size_t i = 0; i < fdslen; ++i) {
+		new (&kept[i]) fd_mapping_t(*new_fds[i]);
 	}
-	for(cloudabi_fd_t i = fdslen; i < fd_capacity; ++i) {
-		fds[i] = nullptr;
+	fds.clear();
+	for(size_t i = 0; i < fdslen; ++i) {
+		fds.set(i, kept[i]);
+		kept[i].~fd_mapping_t();
+	}
+	if(kept_alloc.ptr != nullptr) {
+		deallocate(kept_alloc);
 	}
 
 	// temporarily re-install the old page directory, so we unmap from the old page directory
@@ -820,7 +779,13 @@ cloudabi_errno_t process_fd::exec(uint8_t *buffer, size_t buffer_size, uint8_t *
 	memcpy(vdso_address, vdso_blob, vdso_size);
 
 	// choose a pid
+	uint8_t old_pid[sizeof(pid)];
+	memcpy(old_pid, pid, sizeof(pid));
 	generate_random_uuid(pid, sizeof(pid));
+	// init execs before the process store exists, and registers afterwards
+	if(global_state_->process_store) {
+		global_state_->process_store->pid_changed(this, old_pid);
+	}
 
 	// initialize auxv
 	size_t auxv_entries = 9; // including CLOUDABI_AT_NULL
@@ -922,22 +887,7 @@ void process_fd::fork(shared_ptr<thread> otherthread) {
 	running = true;
 
 	// dup all fd's
-	fd_capacity = otherprocess->fd_capacity;
-	Blk fds_blk = allocate(fd_capacity * sizeof(fd_mapping_t*));
-	fds = reinterpret_cast<fd_mapping_t**>(fds_blk.ptr);
-	for(cloudabi_fd_t i = 0; i < fd_capacity; ++i) {
-		fd_mapping_t *old_mapping = otherprocess->fds[i];
-		fd_mapping_t *mapping = nullptr;
-
-		if(old_mapping != nullptr) {
-			mapping = allocate<fd_mapping_t>();
-			mapping->fd = old_mapping->fd;
-			mapping->rights_base = old_mapping->rights_base;
-			mapping->rights_inheriting = old_mapping->rights_inheriting;
-		}
-
-		fds[i] = mapping;
-	}
+	fds.copy_from(otherprocess->fds);
 
 	iterate(otherprocess->mappings, [&](mem_mapping_list *item) {
 		mem_mapping_t *mapping = allocate<mem_mapping_t>(this, item->data);
@@ -969,14 +919,12 @@ shared_ptr<thread> process_fd::add_thread(void *stack_bottom, size_t stack_len,
 void process_fd::exit(cloudabi_exitcode_t c, cloudabi_signal_t s)
 {
 	if(this == global_state_->init) {
-		get_vga_stream() << "init exited with signal " << s << ", exit code " << c << "\n";
+		get_vga_stream() << log_error << "init exited with signal " << s << ", exit code " << c << "\n";
 		kernel_panic("init exited");
 	}
 
 	// close all FDs
-	for(size_t i = 0; i < fd_capacity; ++i) {
-		close_fd(i);
-	}
+	fds.clear();
 
 	// unschedule all threads
 	exit_all_threads();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fd.hpp"
+#include "fd_table.hpp"
 #include "mem_mapping.hpp"
 #include "thread.hpp"
 #include <oslibc/list.hpp>
@@ -16,12 +17,6 @@ typedef linked_list<process_fd*> process_list;
 struct vga_stream;
 struct cv_t;
 
-struct fd_mapping_t {
-	shared_ptr<fd_t> fd; /* can be empty, in this case, the mapping is unused and can be reused for another fd */
-	cloudabi_rights_t rights_base;
-	cloudabi_rights_t rights_inheriting;
-};
-
 typedef linked_list<pair<cloudabi_tid_t, thread_condition_signaler>> thread_wakelist;
 
 struct userland_lock_waiters_t {
@@ -41,6 +36,13 @@ struct userland_condvar_waiters_t {
 
 typedef linked_list<userland_condvar_waiters_t*> userland_condvar_waiters_list;
 
+/** CPU time and event counts of a process, over all its threads. */
+struct process_accounting {
+	uint64_t cpu_tsc = 0;
+	uint64_t context_switches = 0;
+	uint64_t pagefaults = 0;
+};
+
 /** Process file descriptor
  *
  * This file descriptor contains all information necessary for running a
@@ -92,6 +94,8 @@ struct process_fd : public fd_t {
 	cloudabi_errno_t close_fd(cloudabi_fd_t num);
 
 	inline bool is_running() { return running; }
+
+	inline process_accounting &get_accounting() { return accounting; }
 	void exit(cloudabi_exitcode_t exitcode, cloudabi_signal_t exitsignal = 0);
 	void signal(cloudabi_signal_t exitsignal);
 
@@ -157,6 +161,8 @@ struct process_fd : public fd_t {
 	void remove_thread(shared_ptr<thread> t);
 
 private:
+	bool resolve_pagefault(void *addr, bool for_writing, bool for_exec);
+
 	thread_list *threads = nullptr;
 	void add_thread(shared_ptr<thread> thr);
 	void exit_all_threads();
@@ -165,11 +171,11 @@ private:
 	// unique; we don't have shared mutexes yet
 	cloudabi_tid_t last_thread = MAIN_THREAD - 1;
 	uint8_t pid[16] = {0};
+	process_accounting accounting;
 
 	static const int PAGE_DIRECTORY_SIZE = 1024 /* entries */;
 
-	size_t fd_capacity = 0;
-	fd_mapping_t **fds = nullptr;
+	fd_table fds;
 
 	// Page directory, filled with physical addresses to page tables
 	uint32_t *page_directory = nullptr;
@@ -1,6 +1,16 @@
 #include "procfs.hpp"
 #include "global.hpp"
 #include <fd/memory_fd.hpp>
+#include <fd/pseudo_fd.hpp>
+#include <fd/dentry_cache.hpp>
+#include <hw/kernel_log.hpp>
+#include <fd/trace.hpp>
+#include <fd/profiler.hpp>
+#include <fd/process_fd.hpp>
+#include <fd/scheduler.hpp>
+#include <proc/process_store.hpp>
+#include <proc/syscalls.hpp>
+#include <oslibc/uuid.hpp>
 #include <oslibc/numeric.h>
 #include <memory/allocator.hpp>
 #include <time/clock_store.hpp>
@@ -15,6 +25,17 @@ static const int PROCFS_KERNEL_INO = 1;
 static const int PROCFS_UPTIME_INO = 2;
 static const int PROCFS_ALLOCTRACK_INO = 3;
 static const int PROCFS_CMDLINE_INO = 4;
+static const int PROCFS_PSEUDOCACHE_INO = 5;
+static const int PROCFS_DENTRYCACHE_INO = 6;
+static const int PROCFS_LOG_INO = 7;
+static const int PROCFS_TRACE_INO = 8;
+static const int PROCFS_PROCESSES_INO = 9;
+static const int PROCFS_PROFILE_INO = 10;
+static const int PROCFS_SYSCALLS_INO = 11;
+static const int PROCFS_PROCESS_DIR_INO = 12;
+// kernel/process/<pid> has this bit set, and the first 8 bytes of the pid in
+// the other bits
+static const cloudabi_inode_t PROCFS_PROCESS_INO_BIT = 1ull << 63;
 
 namespace cloudos {
 
@@ -49,6 +70,79 @@ struct procfs_cmdline_fd : public memory_fd {
 	size_t read(void *dest, size_t count) override;
 };
 
+struct procfs_pseudocache_fd : public memory_fd {
+	procfs_pseudocache_fd(const char *n) : memory_fd(n) {}
+
+	size_t read(void *dest, size_t count) override;
+};
+
+struct procfs_dentrycache_fd : public memory_fd {
+	procfs_dentrycache_fd(const char *n) : memory_fd(n) {}
+
+	size_t read(void *dest, size_t count) override;
+};
+
+struct procfs_log_fd : public memory_fd {
+	procfs_log_fd(const char *n) : memory_fd(n) {}
+	~procfs_log_fd() override;
+
+	size_t read(void *dest, size_t count) override;
+
+private:
+	Blk rendered = {};
+};
+
+struct procfs_syscalls_fd : public memory_fd {
+	procfs_syscalls_fd(const char *n) : memory_fd(n) {}
+
+	size_t read(void *dest, size_t count) override;
+};
+
+struct procfs_processes_fd : public memory_fd {
+	procfs_processes_fd(const char *n) : memory_fd(n) {}
+
+	size_t read(void *dest, size_t count) override;
+};
+
+/** kernel/process/<pid> shows the statistics of a single process, in the
+ * same format as kernel/processes. It doesn't keep the process alive.
+ */
+struct procfs_process_fd : public memory_fd {
+	procfs_process_fd(shared_ptr<process_fd> p, const char *n) : memory_fd(n), process(p) {}
+
+	size_t read(void *dest, size_t count) override;
+
+private:
+	weak_ptr<process_fd> process;
+};
+
+/** Writing '1' to kernel/trace starts tracing, '0' stops it. Reading it
+ * returns the binary trace; the trace is copied when reading from the start
+ * of the file, so that it doesn't change while it is being read.
+ */
+struct procfs_trace_fd : public memory_fd {
+	procfs_trace_fd(const char *n) : memory_fd(n) {}
+	~procfs_trace_fd() override;
+
+	size_t read(void *dest, size_t count) override;
+	size_t write(const char *buf, size_t count) override;
+
+private:
+	Blk trace = {};
+};
+
+/** Like kernel/trace, but for the sampling profiler. */
+struct procfs_profile_fd : public memory_fd {
+	procfs_profile_fd(const char *n) : memory_fd(n) {}
+	~procfs_profile_fd() override;
+
+	size_t read(void *dest, size_t count) override;
+	size_t write(const char *buf, size_t count) override;
+
+private:
+	Blk profile = {};
+};
+
 }
 
 procfs_directory_fd::procfs_directory_fd(const char (*p)[PROCFS_FILE_MAX], const char *n)
@@ -70,9 +164,9 @@ procfs_directory_fd::procfs_directory_fd(const char (*p)[PROCFS_FILE_MAX], const
 
 	char pathbuf[PROCFS_DEPTH_MAX * (PROCFS_FILE_MAX + 1)];
 	if(to_string(pathbuf, sizeof(pathbuf))) {
-		get_vga_stream() << "A procfs_directory_fd was created with path: " << pathbuf << "\n";
+		get_vga_stream() << log_debug << "A procfs_directory_fd was created with path: " << pathbuf << "\n";
 	} else {
-		get_vga_stream() << "A procfs_directory_fd was created but path didn't fit?\n";
+		get_vga_stream() << log_warning << "A procfs_directory_fd was created but path didn't fit?\n";
 	}
 }
 
@@ -145,6 +239,60 @@ void procfs_directory_fd::lookup(const char *file, size_t filelen, cloudabi_ofla
 		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
 		filestat->st_size = 0;
 		error = 0;
+	} else if(strcmp(pathbuf, "kernel/pseudocache") == 0) {
+		filestat->st_ino = PROCFS_PSEUDOCACHE_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/dentrycache") == 0) {
+		filestat->st_ino = PROCFS_DENTRYCACHE_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/log") == 0) {
+		filestat->st_ino = PROCFS_LOG_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/trace") == 0) {
+		filestat->st_ino = PROCFS_TRACE_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/processes") == 0) {
+		filestat->st_ino = PROCFS_PROCESSES_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/profile") == 0) {
+		filestat->st_ino = PROCFS_PROFILE_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/syscalls") == 0) {
+		filestat->st_ino = PROCFS_SYSCALLS_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strcmp(pathbuf, "kernel/process") == 0 || strcmp(pathbuf, "kernel/process/") == 0) {
+		filestat->st_ino = PROCFS_PROCESS_DIR_INO;
+		filestat->st_filetype = CLOUDABI_FILETYPE_DIRECTORY;
+		filestat->st_size = 0;
+		error = 0;
+	} else if(strncmp(pathbuf, "kernel/process/", 15) == 0) {
+		uint8_t pid[16];
+		const char *pidstr = pathbuf + 15;
+		if(!string_to_uuid(pidstr, strlen(pidstr), pid, sizeof(pid))
+		|| !get_process_store()->find_process(pid)) {
+			error = ENOENT;
+			return;
+		}
+		uint64_t prefix;
+		memcpy(&prefix, pid, sizeof(prefix));
+		filestat->st_ino = PROCFS_PROCESS_INO_BIT | prefix;
+		filestat->st_filetype = CLOUDABI_FILETYPE_REGULAR_FILE;
+		filestat->st_size = 0;
+		error = 0;
 	} else if(strcmp(pathbuf, "kernel") == 0 || strcmp(pathbuf, "kernel/") == 0) {
 		filestat->st_ino = PROCFS_KERNEL_INO;
 		filestat->st_filetype = CLOUDABI_FILETYPE_DIRECTORY;
@@ -167,6 +315,33 @@ shared_ptr<fd_t> procfs_directory_fd::inode_open(cloudabi_device_t dev, cloudabi
 		return make_shared<procfs_alloctrack_fd>("procfs/kernel/alloctracker");
 	} else if(ino == PROCFS_CMDLINE_INO) {
 		return make_shared<procfs_cmdline_fd>("procfs/kernel/cmdline");
+	} else if(ino == PROCFS_PSEUDOCACHE_INO) {
+		return make_shared<procfs_pseudocache_fd>("procfs/kernel/pseudocache");
+	} else if(ino == PROCFS_DENTRYCACHE_INO) {
+		return make_shared<procfs_dentrycache_fd>("procfs/kernel/dentrycache");
+	} else if(ino == PROCFS_LOG_INO) {
+		return make_shared<procfs_log_fd>("procfs/kernel/log");
+	} else if(ino == PROCFS_TRACE_INO) {
+		return make_shared<procfs_trace_fd>("procfs/kernel/trace");
+	} else if(ino == PROCFS_PROCESSES_INO) {
+		return make_shared<procfs_processes_fd>("procfs/kernel/processes");
+	} else if(ino == PROCFS_PROFILE_INO) {
+		return make_shared<procfs_profile_fd>("procfs/kernel/profile");
+	} else if(ino == PROCFS_SYSCALLS_INO) {
+		return make_shared<procfs_syscalls_fd>("procfs/kernel/syscalls");
+	} else if(ino & PROCFS_PROCESS_INO_BIT) {
+		auto process = get_process_store()->find_process_by_prefix(ino, ~PROCFS_PROCESS_INO_BIT);
+		if(!process) {
+			error = ENOENT;
+			return nullptr;
+		}
+		return make_shared<procfs_process_fd>(process, "procfs/kernel/process/*");
+	} else if(ino == PROCFS_PROCESS_DIR_INO) {
+		char pb[3][PROCFS_FILE_MAX];
+		strncpy(pb[0], "kernel", PROCFS_FILE_MAX);
+		strncpy(pb[1], "process", PROCFS_FILE_MAX);
+		pb[2][0] = 0;
+		return make_shared<procfs_directory_fd>(pb, "procfs/kernel/process");
 	} else if(ino == PROCFS_KERNEL_INO) {
 		char pb[2][PROCFS_FILE_MAX];
 		strncpy(pb[0], "kernel", PROCFS_FILE_MAX);
@@ -201,6 +376,331 @@ size_t procfs_cmdline_fd::read(void *dest, size_t count) {
 	}
 }
 
+/**
+ * Appends a "name value\n" line to buf, which is a NUL-terminated string
+ * of at most buflen bytes including the terminator.
+ */
+static void append_counter(char *buf, size_t buflen, const char *name, uint64_t value) {
+	char numbuf[24];
+	strlcat(buf, name, buflen);
+	strlcat(buf, " ", buflen);
+	strlcat(buf, ui64toa_s(value, numbuf, sizeof(numbuf), 10), buflen);
+	strlcat(buf, "\n", buflen);
+}
+
+size_t procfs_pseudocache_fd::read(void *dest, size_t count) {
+	auto &stats = pseudo_fd::get_cache_stats();
+	char buf[512];
+	buf[0] = 0;
+	append_counter(buf, sizeof(buf), "hits", stats.hits);
+	append_counter(buf, sizeof(buf), "misses", stats.misses);
+	append_counter(buf, sizeof(buf), "readahead_pages", stats.readahead_pages);
+	append_counter(buf, sizeof(buf), "writebacks", stats.writebacks);
+	append_counter(buf, sizeof(buf), "written_back_pages", stats.written_back_pages);
+	append_counter(buf, sizeof(buf), "evictions", stats.evictions);
+	append_counter(buf, sizeof(buf), "invalidations", stats.invalidations);
+	append_counter(buf, sizeof(buf), "cached_pages", stats.cached_pages);
+
+	reset(buf, strlen(buf));
+	auto res = memory_fd::read(dest, count);
+	reset();
+	return res;
+}
+
+size_t procfs_dentrycache_fd::read(void *dest, size_t count) {
+	auto &stats = get_dentry_cache()->get_stats();
+	char buf[512];
+	buf[0] = 0;
+	append_counter(buf, sizeof(buf), "hits", stats.hits);
+	append_counter(buf, sizeof(buf), "negative_hits", stats.negative_hits);
+	append_counter(buf, sizeof(buf), "misses", stats.misses);
+	append_counter(buf, sizeof(buf), "insertions", stats.insertions);
+	append_counter(buf, sizeof(buf), "evictions", stats.evictions);
+	append_counter(buf, sizeof(buf), "invalidations", stats.invalidations);
+	append_counter(buf, sizeof(buf), "entries", stats.entries);
+
+	reset(buf, strlen(buf));
+	auto res = memory_fd::read(dest, count);
+	reset();
+	return res;
+}
+
+/** Renders the records in the kernel log into a newly allocated buffer, of
+ * which the first *length_out bytes are used. The caller owns the returned
+ * allocation.
+ */
+static Blk render_kernel_log(size_t *length_out) {
+	auto *log = get_kernel_log();
+	// every record is rendered as "[tsc] level: text\n"
+	static const size_t RECORD_MAX = kernel_log_record::TEXT_MAX + 40;
+	Blk b = allocate(kernel_log::NUM_RECORDS * RECORD_MAX + 1);
+	*length_out = 0;
+	if(b.ptr == nullptr) {
+		return b;
+	}
+	char *buf = reinterpret_cast<char*>(b.ptr);
+	size_t length = 0;
+
+	uint64_t head = log->head();
+	kernel_log_record record;
+	bool line_start = true;
+	for(uint64_t pos = log->oldest(); pos < head; ++pos) {
+		if(!log->read(pos, &record)) {
+			continue;
+		}
+		if(line_start) {
+			char numbuf[24];
+			char prefix[RECORD_MAX - kernel_log_record::TEXT_MAX];
+			prefix[0] = 0;
+			strlcat(prefix, "[", sizeof(prefix));
+			strlcat(prefix, ui64toa_s(record.tsc, numbuf, sizeof(numbuf), 10), sizeof(prefix));
+			strlcat(prefix, "] ", sizeof(prefix));
+			strlcat(prefix, kernel_log_level_name(record.level), sizeof(prefix));
+			strlcat(prefix, ": ", sizeof(prefix));
+			size_t prefixlen = strlen(prefix);
+			memcpy(buf + length, prefix, prefixlen);
+			length += prefixlen;
+		}
+		size_t textlen = record.length < kernel_log_record::TEXT_MAX ? record.length : kernel_log_record::TEXT_MAX;
+		memcpy(buf + length, record.text, textlen);
+		length += textlen;
+		line_start = !record.continued;
+		if(line_start) {
+			buf[length++] = '\n';
+		}
+	}
+
+	*length_out = length;
+	return b;
+}
+
+procfs_log_fd::~procfs_log_fd() {
+	reset();
+	if(rendered.ptr) {
+		deallocate(rendered);
+	}
+}
+
+size_t procfs_log_fd::read(void *dest, size_t count) {
+	// render the log once per pass over the file, so that records written
+	// or overwritten between two reads don't shift the text under pos
+	if(pos == 0 || rendered.ptr == nullptr) {
+		reset();
+		if(rendered.ptr) {
+			deallocate(rendered);
+		}
+		size_t length;
+		rendered = render_kernel_log(&length);
+		if(rendered.ptr == nullptr) {
+			error = ENOMEM;
+			return 0;
+		}
+		reset(rendered.ptr, length);
+	}
+	return memory_fd::read(dest, count);
+}
+
+size_t procfs_syscalls_fd::read(void *dest, size_t count) {
+	// "name calls errors cycles" followed by " log2:count" for every
+	// non-empty latency bucket, per syscall that was called
+	static const size_t LINE_MAX = 32 + 3 * 22 + syscall_stats::NUM_BUCKETS * 25;
+	size_t buflen = NUM_SYSCALLS * LINE_MAX;
+	Blk b = allocate(buflen);
+	if(b.ptr == nullptr) {
+		error = ENOMEM;
+		return 0;
+	}
+	char *buf = reinterpret_cast<char*>(b.ptr);
+	buf[0] = 0;
+
+	auto *stats = get_syscall_stats();
+	char numbuf[24];
+	for(size_t i = 0; i < NUM_SYSCALLS; ++i) {
+		auto &s = stats[i];
+		if(s.calls == 0) {
+			continue;
+		}
+		strlcat(buf, syscall_table[i].name, buflen);
+		strlcat(buf, " ", buflen);
+		strlcat(buf, ui64toa_s(s.calls, numbuf, sizeof(numbuf), 10), buflen);
+		strlcat(buf, " ", buflen);
+		strlcat(buf, ui64toa_s(s.errors, numbuf, sizeof(numbuf), 10), buflen);
+		strlcat(buf, " ", buflen);
+		strlcat(buf, ui64toa_s(s.cycles, numbuf, sizeof(numbuf), 10), buflen);
+		for(size_t j = 0; j < syscall_stats::NUM_BUCKETS; ++j) {
+			if(s.latency[j] == 0) {
+				continue;
+			}
+			strlcat(buf, " ", buflen);
+			strlcat(buf, ui64toa_s(j, numbuf, sizeof(numbuf), 10), buflen);
+			strlcat(buf, ":", buflen);
+			strlcat(buf, ui64toa_s(s.latency[j], numbuf, sizeof(numbuf), 10), buflen);
+		}
+		strlcat(buf, "\n", buflen);
+	}
+
+	reset(buf, strlen(buf));
+	auto res = memory_fd::read(dest, count);
+	reset();
+	deallocate(b);
+	return res;
+}
+
+// "pid name cpu_ns context_switches pagefaults\n"
+static const size_t PROCESS_LINE_MAX = UUID_LEN + sizeof(fd_t::name) + 3 * 22;
+static const char PROCESS_LINE_HEADER[] = "pid name cpu_ns context_switches pagefaults\n";
+
+static void append_process_line(char *buf, size_t buflen, shared_ptr<process_fd> &process) {
+	uint8_t pid[16];
+	char pidbuf[UUID_LEN + 1];
+	char numbuf[24];
+	process->get_pid(pid, sizeof(pid));
+	uuid_to_string(pid, sizeof(pid), pidbuf, sizeof(pidbuf));
+	auto &accounting = process->get_accounting();
+	auto cpu_tsc = get_scheduler()->get_process_cpu_tsc(process.get());
+
+	strlcat(buf, pidbuf, buflen);
+	strlcat(buf, " ", buflen);
+	strlcat(buf, process->name, buflen);
+	strlcat(buf, " ", buflen);
+	strlcat(buf, ui64toa_s(get_clock_store()->tsc_to_ns(cpu_tsc), numbuf, sizeof(numbuf), 10), buflen);
+	strlcat(buf, " ", buflen);
+	strlcat(buf, ui64toa_s(accounting.context_switches, numbuf, sizeof(numbuf), 10), buflen);
+	strlcat(buf, " ", buflen);
+	strlcat(buf, ui64toa_s(accounting.pagefaults, numbuf, sizeof(numbuf), 10), buflen);
+	strlcat(buf, "\n", buflen);
+}
+
+size_t procfs_processes_fd::read(void *dest, size_t count) {
+	auto *store = get_process_store();
+	size_t buflen = (store->size() + 2) * PROCESS_LINE_MAX;
+	Blk b = allocate(buflen);
+	if(b.ptr == nullptr) {
+		error = ENOMEM;
+		return 0;
+	}
+	char *buf = reinterpret_cast<char*>(b.ptr);
+	buf[0] = 0;
+
+	strlcat(buf, PROCESS_LINE_HEADER, buflen);
+	store->iterate_processes([&](shared_ptr<process_fd> process) {
+		append_process_line(buf, buflen, process);
+	});
+	char numbuf[24];
+	strlcat(buf, "- idle ", buflen);
+	strlcat(buf, ui64toa_s(get_clock_store()->tsc_to_ns(get_scheduler()->get_idle_tsc()), numbuf, sizeof(numbuf), 10), buflen);
+	strlcat(buf, " 0 0\n", buflen);
+
+	reset(buf, strlen(buf));
+	auto res = memory_fd::read(dest, count);
+	reset();
+	deallocate(b);
+	return res;
+}
+
+size_t procfs_process_fd::read(void *dest, size_t count) {
+	auto p = process.lock();
+	if(!p) {
+		error = ESRCH;
+		return 0;
+	}
+	char buf[sizeof(PROCESS_LINE_HEADER) + PROCESS_LINE_MAX];
+	buf[0] = 0;
+	strlcat(buf, PROCESS_LINE_HEADER, sizeof(buf));
+	append_process_line(buf, sizeof(buf), p);
+
+	reset(buf, strlen(buf));
+	auto res = memory_fd::read(dest, count);
+	reset();
+	return res;
+}
+
+procfs_trace_fd::~procfs_trace_fd() {
+	reset();
+	if(trace.ptr) {
+		deallocate(trace);
+	}
+}
+
+size_t procfs_trace_fd::read(void *dest, size_t count) {
+	if(pos == 0 || trace.ptr == nullptr) {
+		reset();
+		if(trace.ptr) {
+			deallocate(trace);
+		}
+		size_t length;
+		trace = get_tracer()->snapshot(&length);
+		if(trace.ptr == nullptr) {
+			error = ENOMEM;
+			return 0;
+		}
+		reset(trace.ptr, length);
+	}
+	return memory_fd::read(dest, count);
+}
+
+size_t procfs_trace_fd::write(const char *buf, size_t count) {
+	error = 0;
+	if(count == 0) {
+		return 0;
+	}
+	if(buf[0] == '1') {
+		error = get_tracer()->start();
+		if(error) {
+			return 0;
+		}
+	} else if(buf[0] == '0') {
+		get_tracer()->stop();
+	} else {
+		error = EINVAL;
+		return 0;
+	}
+	return count;
+}
+
+procfs_profile_fd::~procfs_profile_fd() {
+	reset();
+	if(profile.ptr) {
+		deallocate(profile);
+	}
+}
+
+size_t procfs_profile_fd::read(void *dest, size_t count) {
+	if(pos == 0 || profile.ptr == nullptr) {
+		reset();
+		if(profile.ptr) {
+			deallocate(profile);
+		}
+		size_t length;
+		profile = get_profiler()->dump(&length);
+		if(profile.ptr == nullptr) {
+			error = ENOMEM;
+			return 0;
+		}
+		reset(profile.ptr, length);
+	}
+	return memory_fd::read(dest, count);
+}
+
+size_t procfs_profile_fd::write(const char *buf, size_t count) {
+	error = 0;
+	if(count == 0) {
+		return 0;
+	}
+	if(buf[0] == '1') {
+		error = get_profiler()->start();
+		if(error) {
+			return 0;
+		}
+	} else if(buf[0] == '0') {
+		get_profiler()->stop();
+	} else {
+		error = EINVAL;
+		return 0;
+	}
+	return count;
+}
+
 size_t procfs_alloctrack_fd::write(const char *buf, size_t count) {
 	(void)buf;
 	error = 0;
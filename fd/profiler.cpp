@@ -0,0 +1,103 @@
+#include <fd/profiler.hpp>
+#include <fd/process_fd.hpp>
+#include <fd/scheduler.hpp>
+#include <global.hpp>
+#include <hw/interrupt.hpp>
+#include <oslibc/string.h>
+
+using namespace cloudos;
+
+cloudabi_errno_t profiler::start() {
+	enabled = false;
+	if(samples.ptr == nullptr) {
+		samples = allocate(MAX_SAMPLES * sizeof(profile_sample));
+		if(samples.ptr == nullptr) {
+			return ENOMEM;
+		}
+	}
+	num_samples = 0;
+	lost_samples = 0;
+	num_processes = 0;
+	enabled = true;
+	return 0;
+}
+
+void profiler::stop() {
+	enabled = false;
+}
+
+void profiler::remember_process(uint32_t pid, const char *name) {
+	for(size_t i = 0; i < num_processes; ++i) {
+		if(processes[i].pid == pid) {
+			// the name changes on exec, keep the latest one
+			strncpy(processes[i].name, name, sizeof(processes[i].name));
+			processes[i].name[sizeof(processes[i].name) - 1] = 0;
+			return;
+		}
+	}
+	if(num_processes == MAX_PROCESSES) {
+		return;
+	}
+	auto &entry = processes[num_processes++];
+	entry.pid = pid;
+	strncpy(entry.name, name, sizeof(entry.name));
+	entry.name[sizeof(entry.name) - 1] = 0;
+}
+
+void profiler::sample(interrupt_state_t *regs) {
+	// the timer may still run at the fast rate for a tick after stop()
+	if(!enabled) {
+		return;
+	}
+	if(paused || num_samples == MAX_SAMPLES) {
+		lost_samples++;
+		return;
+	}
+
+	auto &s = reinterpret_cast<profile_sample*>(samples.ptr)[num_samples++];
+	s.eip = regs->eip;
+	s.user = regs->cs != 8;
+	s.pid = 0;
+	s.reserved[0] = s.reserved[1] = s.reserved[2] = 0;
+
+	auto thr = get_scheduler()->get_running_thread();
+	if(thr) {
+		auto *process = thr->get_process();
+		uint8_t pid[16];
+		process->get_pid(pid, sizeof(pid));
+		memcpy(&s.pid, pid, sizeof(s.pid));
+		remember_process(s.pid, process->name);
+	}
+}
+
+Blk profiler::dump(size_t *length) {
+	// don't sample while copying, but leave the timer rate alone
+	paused = true;
+
+	*length = sizeof(profile_header) + num_processes * sizeof(profile_process)
+		+ num_samples * sizeof(profile_sample);
+	Blk b = allocate(*length);
+	if(b.ptr == nullptr) {
+		paused = false;
+		*length = 0;
+		return b;
+	}
+
+	auto *header = reinterpret_cast<profile_header*>(b.ptr);
+	header->magic = profile_header::MAGIC;
+	header->version = profile_header::VERSION;
+	header->sample_size = sizeof(profile_sample);
+	header->num_samples = num_samples;
+	header->lost_samples = lost_samples;
+	header->rate_hz = rate_hz;
+	header->num_processes = num_processes;
+	header->reserved = 0;
+
+	auto *p = reinterpret_cast<uint8_t*>(header + 1);
+	memcpy(p, processes, num_processes * sizeof(profile_process));
+	p += num_processes * sizeof(profile_process);
+	memcpy(p, samples.ptr, num_samples * sizeof(profile_sample));
+
+	paused = false;
+	return b;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory/allocation.hpp>
+#include <oslibc/error.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cloudos {
+
+struct interrupt_state_t;
+
+/** A sample of the instruction pointer at a timer interrupt. pid is the
+ * first four bytes of the UUID of the running process, or 0 if no process
+ * was running. user is 1 if the interrupt came from userland. Only the
+ * interrupted instruction pointer is sampled, not the call stack.
+ */
+struct profile_sample {
+	uint32_t eip;
+	uint32_t pid;
+	uint8_t user;
+	uint8_t reserved[3];
+};
+static_assert(sizeof(profile_sample) == 12, "profile_sample must be packed");
+
+/** The name of a process that was sampled, at the time it was sampled. */
+struct profile_process {
+	uint32_t pid;
+	char name[64];
+};
+
+/** The header of kernel/profile, followed by num_processes profile_process
+ * entries and num_samples profile_sample entries.
+ */
+struct profile_header {
+	static constexpr uint32_t MAGIC = 0x46525043; // "CPRF"
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sample_size;
+	uint32_t num_samples;
+	uint32_t lost_samples;
+	uint32_t rate_hz;
+	uint32_t num_processes;
+	uint32_t reserved;
+};
+
+/** The profiler takes samples from the timer interrupt. While it is enabled,
+ * the timer runs SAMPLE_RATE_MULTIPLIER times faster than normally; when the
+ * sample buffer is full, further samples are counted as lost.
+ */
+struct profiler {
+	static constexpr size_t MAX_SAMPLES = 65536;
+	static constexpr size_t MAX_PROCESSES = 64;
+	static constexpr uint32_t SAMPLE_RATE_MULTIPLIER = 64;
+
+	bool enabled = false;
+	// set while the profile is being copied; samples are lost meanwhile
+	bool paused = false;
+
+	/** (Re)start profiling with an empty sample buffer. */
+	cloudabi_errno_t start();
+	void stop();
+
+	/** Set by the timer to the rate at which it samples. */
+	inline void set_rate(uint32_t r) {
+		rate_hz = r;
+	}
+
+	/** Record a sample of the interrupted state. Called from the timer
+	 * interrupt. */
+	void sample(interrupt_state_t *regs);
+
+	/** Returns a newly allocated copy of the profile. The caller owns the
+	 * returned allocation.
+	 */
+	Blk dump(size_t *length);
+
+private:
+	void remember_process(uint32_t pid, const char *name);
+
+	Blk samples = {};
+	size_t num_samples = 0;
+	uint32_t lost_samples = 0;
+	uint32_t rate_hz = 0;
+	profile_process processes[MAX_PROCESSES];
+	size_t num_processes = 0;
+};
+
+}
@@ -1,9 +1,15 @@
 #include "pseudo_fd.hpp"
 #include <fd/scheduler.hpp>
+#include <fd/dentry_cache.hpp>
+#include <fd/trace.hpp>
+#include <oslibc/iovec.hpp>
 #include <oslibc/numeric.h>
+#include <oslibc/utility.hpp>
 
 using namespace cloudos;
 
+static pseudo_cache_stats cache_stats;
+
 static void maybe_deallocate(Blk b) {
 	if(b.size > 0) {
 		deallocate(b);
@@ -34,6 +40,12 @@ pseudo_fd::pseudo_fd(pseudofd_t id, shared_ptr<reversefd_t> r, cloudabi_filetype
 
 pseudo_fd::~pseudo_fd()
 {
+	if(flush_cache() != 0) {
+		get_vga_stream() << log_warning << "pseudo-fd " << name << ": writing back failed, dropping "
+			<< count_dirty_pages() << " dirty pages\n";
+	}
+	drop_cache(false);
+
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::close;
@@ -46,7 +58,11 @@ pseudo_fd::~pseudo_fd()
 }
 
 Blk pseudo_fd::send_request(reverse_request_t *request, const char *buffer, reverse_response_t *response) {
-	return reverse_fd->send_request(request, buffer, response);
+	uint32_t op = static_cast<uint32_t>(request->op);
+	trace(trace_event_type::reverse_request, trace_phase::begin, op);
+	Blk res = reverse_fd->send_request(request, buffer, response);
+	trace(trace_event_type::reverse_request, trace_phase::end, op);
+	return res;
 }
 
 bool pseudo_fd::is_valid_path(const char *path, size_t length)
@@ -83,9 +99,17 @@ bool pseudo_fd::is_readable(size_t &nbytes, bool &hangup)
 	}
 }
 
+void pseudo_fd::register_with_reverse_fd()
+{
+	if(!registered) {
+		reverse_fd->subscribe_fd_read_events(shared_from_this());
+		registered = true;
+	}
+}
+
 cloudabi_errno_t pseudo_fd::get_read_signaler(thread_condition_signaler **s)
 {
-	reverse_fd->subscribe_fd_read_events(shared_from_this());
+	register_with_reverse_fd();
 	*s = &recv_signaler;
 	return 0;
 }
@@ -97,6 +121,313 @@ void pseudo_fd::became_readable()
 
 size_t pseudo_fd::read(void *dest, size_t count)
 {
+	size_t res = pread(dest, count, pos);
+	if(error == 0) {
+		pos += res;
+	}
+	return res;
+}
+
+size_t pseudo_fd::write(const char *str, size_t size)
+{
+	if((flags & CLOUDABI_FDFLAG_APPEND) == 0) {
+		size_t res = pwrite(str, size, pos);
+		if(error == 0) {
+			pos += res;
+		}
+		return res;
+	}
+
+	// Only the other side knows where the file ends, so appends are
+	// written through
+	auto res = flush_cache();
+	if(res != 0) {
+		error = res;
+		return 0;
+	}
+
+	reverse_request_t request;
+	request.pseudofd = pseudo_id;
+	request.op = reverse_request_t::operation::pwrite;
+	request.inode = 0;
+	request.flags = CLOUDABI_FDFLAG_APPEND;
+	request.offset = pos;
+	request.send_length = size;
+	reverse_response_t response;
+	maybe_deallocate(send_request(&request, str, &response));
+	// the file grew, so a cached page at the old end of file is stale
+	drop_cache(true);
+	if(response.result < 0) {
+		error = -response.result;
+	} else {
+		pos = response.result;
+		error = 0;
+	}
+	return size;
+}
+
+size_t pseudo_fd::pread(void *dest, size_t count, size_t offset)
+{
+	if(!is_cacheable()) {
+		return uncached_pread(dest, count, offset);
+	}
+
+	bool sequential = offset == next_sequential_offset;
+	if(!sequential) {
+		readahead_pages = 1;
+	}
+
+	size_t copied = 0;
+	while(copied < count) {
+		uint64_t cur = offset + copied;
+		uint64_t page_offset = cur - cur % PAGE_SIZE;
+		size_t in_page = cur - page_offset;
+
+		auto *page = find_cached_page(page_offset);
+		if(page == nullptr) {
+			cache_stats.misses++;
+
+			// Fetch at least the pages needed for this read, and more
+			// if the file is being read sequentially
+			size_t num_pages = (in_page + count - copied + PAGE_SIZE - 1) / PAGE_SIZE;
+			if(sequential) {
+				num_pages = max(num_pages, readahead_pages);
+				readahead_pages = min(readahead_pages * 2, MAX_READAHEAD_PAGES);
+			}
+			num_pages = min(num_pages, MAX_READAHEAD_PAGES);
+
+			auto res = fill_cache(page_offset, num_pages);
+			if(res != 0) {
+				error = res;
+				return 0;
+			}
+			page = find_cached_page(page_offset);
+			assert(page != nullptr);
+		} else {
+			cache_stats.hits++;
+		}
+
+		if(in_page >= page->valid) {
+			// end of file
+			break;
+		}
+		size_t copy = min(page->valid - in_page, count - copied);
+		memcpy(reinterpret_cast<char*>(dest) + copied, reinterpret_cast<char*>(page->data.ptr) + in_page, copy);
+		copied += copy;
+	}
+
+	next_sequential_offset = offset + copied;
+	error = 0;
+	return copied;
+}
+
+size_t pseudo_fd::pwrite(const char *str, size_t count, size_t offset)
+{
+	if(!is_cacheable()) {
+		return uncached_pwrite(str, count, offset);
+	}
+
+	cloudabi_errno_t res;
+	size_t written = 0;
+	bool became_dirty = false;
+	while(written < count) {
+		uint64_t cur = offset + written;
+		uint64_t page_offset = cur - cur % PAGE_SIZE;
+		size_t in_page = cur - page_offset;
+		size_t copy = min(PAGE_SIZE - in_page, count - written);
+
+		auto *page = find_cached_page(page_offset);
+		if(page == nullptr) {
+			// this write needs another page; write back and evict
+			// first if the cache is full
+			res = make_room_in_cache(1);
+			if(res != 0) {
+				error = res;
+				return written;
+			}
+			// writing back blocks, and another thread may have
+			// cached this page in the meantime
+			page = find_cached_page(page_offset);
+		}
+		if(page == nullptr && copy != PAGE_SIZE) {
+			// partial page write: fetch the rest of the page first
+			cache_stats.misses++;
+			res = fill_cache(page_offset, 1);
+			if(res != 0) {
+				error = res;
+				return written;
+			}
+			page = find_cached_page(page_offset);
+			assert(page != nullptr);
+		} else if(page == nullptr) {
+			page = insert_cached_page(page_offset);
+		} else {
+			cache_stats.hits++;
+		}
+
+		char *data = reinterpret_cast<char*>(page->data.ptr);
+		size_t dirty_begin = in_page;
+		if(in_page > page->valid) {
+			// writing past the end of the file, the gap reads as zeroes
+			memset(data + page->valid, 0, in_page - page->valid);
+			dirty_begin = page->valid;
+		}
+		memcpy(data + in_page, str + written, copy);
+
+		size_t dirty_end = in_page + copy;
+		if(page->is_dirty()) {
+			page->dirty_begin = min(page->dirty_begin, dirty_begin);
+			page->dirty_end = max(page->dirty_end, dirty_end);
+		} else {
+			became_dirty = true;
+			page->dirty_begin = dirty_begin;
+			page->dirty_end = dirty_end;
+		}
+		page->valid = max(page->valid, dirty_end);
+		written += copy;
+	}
+
+	// Cached pages that ended the file before this write are now followed
+	// by more data
+	zero_extend_cached_pages(offset);
+
+	if(became_dirty) {
+		// the other side doesn't know the new size and times yet; lookups
+		// must come to us to find out (see lookup_request())
+		register_with_reverse_fd();
+		invalidate_own_dentries();
+	}
+
+	error = 0;
+	return written;
+}
+
+size_t pseudo_fd::readv(const cloudabi_iovec_t *iov, size_t iovcnt)
+{
+	size_t res = preadv(iov, iovcnt, pos);
+	pos += res;
+	return res;
+}
+
+size_t pseudo_fd::writev(const cloudabi_ciovec_t *iov, size_t iovcnt)
+{
+	if((flags & CLOUDABI_FDFLAG_APPEND) == 0) {
+		size_t res = pwritev(iov, iovcnt, pos);
+		pos += res;
+		return res;
+	}
+
+	// appends are written through, so gather them into a single RPC
+	if(iovcnt == 1) {
+		return write(reinterpret_cast<const char*>(iov[0].buf), iov[0].buf_len);
+	}
+	Blk buf = gather(iov, iovcnt);
+	if(buf.size == 0) {
+		return 0;
+	}
+	size_t res = write(reinterpret_cast<const char*>(buf.ptr), buf.size);
+	deallocate(buf);
+	return res;
+}
+
+size_t pseudo_fd::preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset)
+{
+	if(is_cacheable() || iovcnt == 1) {
+		// for cached files, every buffer is served from the cache
+		return fd_t::preadv(iov, iovcnt, offset);
+	}
+
+	size_t count = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		count += iov[i].buf_len;
+	}
+	count = min(count, size_t(UINT16_MAX));
+	if(count == 0) {
+		error = 0;
+		return 0;
+	}
+
+	Blk buf = allocate(count);
+	if(buf.ptr == nullptr) {
+		error = ENOMEM;
+		return 0;
+	}
+	size_t res = uncached_pread(buf.ptr, count, offset);
+	if(error == 0) {
+		res = veccpy(iov, iovcnt, reinterpret_cast<const char*>(buf.ptr), res, 0);
+	}
+	deallocate(buf);
+	return res;
+}
+
+size_t pseudo_fd::pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset)
+{
+	if(is_cacheable() || iovcnt == 1) {
+		// for cached files, every buffer is written into the cache
+		return fd_t::pwritev(iov, iovcnt, offset);
+	}
+
+	Blk buf = gather(iov, iovcnt);
+	if(buf.size == 0) {
+		return 0;
+	}
+	size_t res = uncached_pwrite(reinterpret_cast<const char*>(buf.ptr), buf.size, offset);
+	deallocate(buf);
+	return error == 0 ? res : 0;
+}
+
+/**
+ * Copies the given buffers into a single allocation of at most UINT16_MAX
+ * bytes, the maximum size of an RPC. If nothing needs to be written or the
+ * allocation failed, returns an empty Blk with error set accordingly.
+ */
+Blk pseudo_fd::gather(const cloudabi_ciovec_t *iov, size_t iovcnt)
+{
+	size_t count = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		count += iov[i].buf_len;
+	}
+	count = min(count, size_t(UINT16_MAX));
+	error = 0;
+	if(count == 0) {
+		return Blk();
+	}
+
+	Blk buf = allocate(count);
+	if(buf.ptr == nullptr) {
+		error = ENOMEM;
+		return Blk();
+	}
+	size_t copied = veccpy(reinterpret_cast<char*>(buf.ptr), count, iov, iovcnt, 0);
+	assert(copied == count);
+	return buf;
+}
+
+/**
+ * Writes back the writes that other open pseudo FDs of this file still
+ * cache, so that data read from the other side includes them.
+ */
+cloudabi_errno_t pseudo_fd::write_back_other_fds()
+{
+	if(!is_cacheable()) {
+		return 0;
+	}
+	auto res = lookup_device_id();
+	if(res != 0) {
+		return res;
+	}
+	reverse_fd->flush_inode(inode, this);
+	return 0;
+}
+
+Blk pseudo_fd::pread_request(size_t count, uint64_t offset, size_t *length)
+{
+	*length = 0;
+	auto res = write_back_other_fds();
+	if(res != 0) {
+		error = res;
+		return {};
+	}
 	if(count > UINT16_MAX) {
 		count = UINT16_MAX;
 	}
@@ -105,53 +436,442 @@ size_t pseudo_fd::read(void *dest, size_t count)
 	request.op = reverse_request_t::operation::pread;
 	request.inode = 0;
 	request.flags = 0;
-	request.offset = pos;
+	request.offset = offset;
 	request.recv_length = count;
 	reverse_response_t response;
 	Blk buf = send_request(&request, nullptr, &response);
 	if(response.result < 0) {
 		error = -response.result;
 		maybe_deallocate(buf);
-		return 0;
+		return {};
 	}
 
 	error = 0;
 	if(response.send_length > count) {
-		get_vga_stream() << "pseudo-fd filesystem returned more data than requested, dropping";
+		get_vga_stream() << log_warning << "pseudo-fd filesystem returned more data than requested, dropping\n";
 		response.send_length = count;
 	}
+	*length = response.send_length;
+	// the access time changed
+	invalidate_own_dentries();
+	return buf;
+}
 
-	memcpy(dest, buf.ptr, response.send_length);
+size_t pseudo_fd::uncached_pread(void *dest, size_t count, uint64_t offset)
+{
+	size_t length;
+	Blk buf = pread_request(count, offset, &length);
+	if(error != 0) {
+		return 0;
+	}
+	memcpy(dest, buf.ptr, length);
 	maybe_deallocate(buf);
-	pos += response.send_length;
-	return response.send_length;
+	return length;
 }
 
-size_t pseudo_fd::write(const char *str, size_t size)
+Blk pseudo_fd::splice_read(size_t count, cloudabi_filesize_t *offset, size_t *length)
+{
+	if(type != CLOUDABI_FILETYPE_REGULAR_FILE) {
+		// pseudo sockets and pipes have no pread; let splice() read()
+		// through its bounce buffer
+		*length = 0;
+		error = ENOTSUP;
+		return {};
+	}
+
+	// the data is read around the cache, so the other side must have
+	// seen the writes still in it
+	auto res = flush_cache();
+	if(res != 0) {
+		*length = 0;
+		error = res;
+		return {};
+	}
+
+	Blk buf = pread_request(count, offset ? *offset : pos, length);
+	if(error == 0) {
+		if(offset) {
+			*offset += *length;
+		} else {
+			pos += *length;
+		}
+	}
+	return buf;
+}
+
+size_t pseudo_fd::uncached_pwrite(const char *str, size_t size, uint64_t offset)
 {
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::pwrite;
 	request.inode = 0;
-	request.flags = flags & CLOUDABI_FDFLAG_APPEND;
-	request.offset = pos;
+	request.flags = 0;
+	request.offset = offset;
 	request.send_length = size;
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, str, &response));
 	if(response.result < 0) {
 		error = -response.result;
-	} else if(flags & CLOUDABI_FDFLAG_APPEND) {
-		pos = response.result;
-		error = 0;
 	} else {
-		pos += size;
+		// size and times changed
+		invalidate_own_dentries();
 		error = 0;
 	}
 	return size;
 }
 
+pseudo_cache_stats &pseudo_fd::get_cache_stats()
+{
+	return cache_stats;
+}
+
+pseudo_cached_page *pseudo_fd::find_cached_page(uint64_t offset)
+{
+	pseudo_page_list *prev = nullptr;
+	for(auto *it = cached_pages; it; prev = it, it = it->next) {
+		if(it->data.offset == offset) {
+			if(prev != nullptr) {
+				// move it to the front, it's now the most recently used
+				prev->next = it->next;
+				it->next = cached_pages;
+				cached_pages = it;
+			}
+			return &it->data;
+		}
+	}
+	return nullptr;
+}
+
+// Never evicts, so the caller must make room first; that way, a fill can't
+// evict the pages it just inserted.
+pseudo_cached_page *pseudo_fd::insert_cached_page(uint64_t offset)
+{
+	assert(offset % PAGE_SIZE == 0);
+	auto *item = allocate<pseudo_page_list>();
+	item->data.offset = offset;
+	item->data.data = allocate(PAGE_SIZE);
+	item->next = cached_pages;
+	cached_pages = item;
+	num_cached_pages++;
+	cache_stats.cached_pages++;
+	return &item->data;
+}
+
+bool pseudo_fd::evict_clean_page()
+{
+	// find the least recently used page that can be dropped without
+	// writing it back
+	pseudo_page_list *victim = nullptr;
+	for(auto *it = cached_pages; it; it = it->next) {
+		if(it->data.can_evict()) {
+			victim = it;
+		}
+	}
+	if(victim == nullptr) {
+		return false;
+	}
+
+	remove_one(&cached_pages, [&](pseudo_page_list *item) {
+		return item == victim;
+	}, [&](pseudo_page_list *item) {
+		deallocate(item->data.data);
+		deallocate(item);
+		num_cached_pages--;
+		cache_stats.cached_pages--;
+	});
+	cache_stats.evictions++;
+	return true;
+}
+
+cloudabi_errno_t pseudo_fd::fill_cache(uint64_t offset, size_t num_pages)
+{
+	assert(offset % PAGE_SIZE == 0);
+	assert(num_pages > 0 && num_pages <= MAX_READAHEAD_PAGES);
+
+	// don't fetch pages that are already cached
+	for(size_t i = 1; i < num_pages; ++i) {
+		uint64_t page_offset = offset + i * PAGE_SIZE;
+		if(find(cached_pages, [&](pseudo_page_list *item) { return item->data.offset == page_offset; })) {
+			num_pages = i;
+			break;
+		}
+	}
+
+	auto res = write_back_other_fds();
+	if(res != 0) {
+		return res;
+	}
+
+	size_t length = num_pages * PAGE_SIZE;
+	reverse_request_t request;
+	request.pseudofd = pseudo_id;
+	request.op = reverse_request_t::operation::pread;
+	request.inode = 0;
+	request.flags = 0;
+	request.offset = offset;
+	request.recv_length = length;
+	reverse_response_t response;
+	Blk buf = send_request(&request, nullptr, &response);
+	if(response.result < 0) {
+		maybe_deallocate(buf);
+		return -response.result;
+	}
+
+	if(response.send_length > length) {
+		get_vga_stream() << log_warning << "pseudo-fd filesystem returned more data than requested, dropping\n";
+		response.send_length = length;
+	}
+	size_t received = response.send_length;
+	if(num_pages > 1) {
+		cache_stats.readahead_pages += num_pages - 1;
+	}
+
+	// make room for the whole batch before inserting any of it; this only
+	// evicts clean pages, so it can't fail or block
+	while((num_cached_pages + num_pages > MAX_CACHED_PAGES
+	    || cache_stats.cached_pages + num_pages > MAX_TOTAL_CACHED_PAGES)
+	   && evict_clean_page()) {
+	}
+
+	for(size_t i = 0; i < num_pages; ++i) {
+		size_t start = i * PAGE_SIZE;
+		if(i > 0 && start >= received) {
+			// past the end of the file; the first page is always
+			// cached, so that end of file is remembered
+			break;
+		}
+		if(find_cached_page(offset + start) != nullptr) {
+			// another thread cached this page while we were waiting
+			// for the response, its contents may be newer
+			continue;
+		}
+		auto *page = insert_cached_page(offset + start);
+		page->valid = received > start ? min(received - start, PAGE_SIZE) : 0;
+		memcpy(page->data.ptr, reinterpret_cast<char*>(buf.ptr) + start, page->valid);
+	}
+	maybe_deallocate(buf);
+
+	// If we wrote past the end of the file the other side knows, the
+	// pages it returned end too early; the gap reads as zeroes
+	zero_extend_cached_pages(cached_file_end());
+	return 0;
+}
+
+cloudabi_errno_t pseudo_fd::flush_cache()
+{
+	pseudo_cached_page *run[MAX_WRITEBACK_PAGES];
+	while(true) {
+		// write back the dirty page with the lowest offset, together
+		// with the dirty pages directly following it
+		pseudo_cached_page *first = nullptr;
+		for(auto *it = cached_pages; it; it = it->next) {
+			if(it->data.is_dirty() && (first == nullptr || it->data.offset < first->offset)) {
+				first = &it->data;
+			}
+		}
+		if(first == nullptr) {
+			return 0;
+		}
+
+		uint64_t start = first->offset + first->dirty_begin;
+		size_t num_pages = 1;
+		run[0] = first;
+		size_t length = first->dirty_end - first->dirty_begin;
+		while(num_pages < MAX_WRITEBACK_PAGES && run[num_pages - 1]->dirty_end == PAGE_SIZE) {
+			uint64_t next_offset = run[num_pages - 1]->offset + PAGE_SIZE;
+			auto *next = find(cached_pages, [&](pseudo_page_list *item) {
+				return item->data.offset == next_offset;
+			});
+			if(next == nullptr || !next->data.is_dirty() || next->data.dirty_begin != 0) {
+				break;
+			}
+			run[num_pages++] = &next->data;
+			length += next->data.dirty_end;
+		}
+
+		Blk buf = allocate(length);
+		size_t copied = 0;
+		size_t written_begin[MAX_WRITEBACK_PAGES];
+		size_t written_end[MAX_WRITEBACK_PAGES];
+		for(size_t i = 0; i < num_pages; ++i) {
+			auto *page = run[i];
+			size_t page_length = page->dirty_end - page->dirty_begin;
+			memcpy(reinterpret_cast<char*>(buf.ptr) + copied, reinterpret_cast<char*>(page->data.ptr) + page->dirty_begin, page_length);
+			copied += page_length;
+			// pages may be written again while the pwrite is in flight,
+			// so mark them clean before sending it; they can't be evicted
+			// until it's done
+			written_begin[i] = page->dirty_begin;
+			written_end[i] = page->dirty_end;
+			page->dirty_begin = page->dirty_end = 0;
+			page->writing_back = true;
+		}
+		assert(copied == length);
+
+		cache_stats.writebacks++;
+		cache_stats.written_back_pages += num_pages;
+		uncached_pwrite(reinterpret_cast<char*>(buf.ptr), length, start);
+		deallocate(buf);
+		for(size_t i = 0; i < num_pages; ++i) {
+			auto *page = run[i];
+			page->writing_back = false;
+			if(error == 0) {
+				continue;
+			}
+			// the data didn't make it, so keep it dirty, together with
+			// anything written while the pwrite was in flight
+			if(page->is_dirty()) {
+				page->dirty_begin = min(page->dirty_begin, written_begin[i]);
+				page->dirty_end = max(page->dirty_end, written_end[i]);
+			} else {
+				page->dirty_begin = written_begin[i];
+				page->dirty_end = written_end[i];
+			}
+		}
+		if(error != 0) {
+			return error;
+		}
+	}
+}
+
+void pseudo_fd::drop_cache(bool keep_dirty)
+{
+	remove_all(&cached_pages, [&](pseudo_page_list *item) {
+		return !keep_dirty || item->data.can_evict();
+	}, [&](pseudo_page_list *item) {
+		deallocate(item->data.data);
+		deallocate(item);
+		num_cached_pages--;
+		cache_stats.cached_pages--;
+	});
+}
+
+bool pseudo_fd::has_dirty_pages(cloudabi_inode_t ino)
+{
+	return device_id_obtained && inode == ino && count_dirty_pages() > 0;
+}
+
+// Returns the end of the file as far as the cached pages know, which is past
+// the end the other side knows if we wrote there.
+uint64_t pseudo_fd::cached_file_end()
+{
+	uint64_t end = 0;
+	iterate(cached_pages, [&](pseudo_page_list *item) {
+		if(item->data.valid > 0) {
+			end = max(end, item->data.offset + item->data.valid);
+		}
+	});
+	return end;
+}
+
+// Cached pages that end before file_end are followed by more data, so their
+// tail up to file_end reads as zeroes.
+void pseudo_fd::zero_extend_cached_pages(uint64_t file_end)
+{
+	for(auto *it = cached_pages; it; it = it->next) {
+		auto &page = it->data;
+		if(page.valid < PAGE_SIZE && page.offset + page.valid < file_end) {
+			size_t new_valid = min(file_end - page.offset, uint64_t(PAGE_SIZE));
+			memset(reinterpret_cast<char*>(page.data.ptr) + page.valid, 0, new_valid - page.valid);
+			page.valid = new_valid;
+		}
+	}
+}
+
+size_t pseudo_fd::count_dirty_pages()
+{
+	size_t num_dirty = 0;
+	iterate(cached_pages, [&](pseudo_page_list *item) {
+		if(item->data.is_dirty()) {
+			num_dirty++;
+		}
+	});
+	return num_dirty;
+}
+
+// Makes room for num_pages more pages by evicting clean ones.
+cloudabi_errno_t pseudo_fd::make_room_in_cache(size_t num_pages)
+{
+	// Only dirty pages can't be evicted; once a pwrite RPC worth of them
+	// piled up, or the kernel is caching too many pages overall, write them
+	// back now so they can be evicted. This keeps the number of pages of
+	// this pseudo FD bounded, however much is written at once.
+	bool memory_pressure = cache_stats.cached_pages + num_pages > MAX_TOTAL_CACHED_PAGES;
+	if(count_dirty_pages() >= MAX_WRITEBACK_PAGES || memory_pressure) {
+		auto res = flush_cache();
+		if(res != 0) {
+			return res;
+		}
+	}
+
+	while((num_cached_pages + num_pages > MAX_CACHED_PAGES
+	    || cache_stats.cached_pages + num_pages > MAX_TOTAL_CACHED_PAGES)
+	   && evict_clean_page()) {
+	}
+	return 0;
+}
+
+void pseudo_fd::invalidate_cache()
+{
+	// Called while the other side may be handling a request, so this
+	// cannot write back; pages written by us are kept and will overwrite
+	// the new contents when flushed
+	cache_stats.invalidations++;
+	drop_cache(true);
+	invalidate_own_dentries();
+}
+
+void pseudo_fd::invalidate_dentries()
+{
+	// Called while the other side may be handling a request, so only
+	// use the inode if it is already known
+	if(!device_id_obtained || inode == 0) {
+		return;
+	}
+	auto *cache = get_dentry_cache();
+	cache->invalidate_children(device, inode);
+	cache->invalidate_inode(device, inode);
+}
+
+cloudabi_inode_t pseudo_fd::dentry_cache_inode()
+{
+	if(type != CLOUDABI_FILETYPE_DIRECTORY) {
+		return 0;
+	}
+	auto res = lookup_device_id();
+	if(res != 0) {
+		error = res;
+		return 0;
+	}
+	return inode;
+}
+
+bool pseudo_fd::invalidate_dentry(const char *file, size_t filelen)
+{
+	if(lookup_device_id() != 0 || inode == 0) {
+		return false;
+	}
+	auto *cache = get_dentry_cache();
+	// the directory's own times and link count change as well
+	cache->invalidate_inode(device, inode);
+	return cache->invalidate_entry(device, inode, file, filelen);
+}
+
+void pseudo_fd::invalidate_own_dentries()
+{
+	if(device_id_obtained && inode != 0) {
+		get_dentry_cache()->invalidate_inode(device, inode);
+	}
+}
+
 void pseudo_fd::datasync()
 {
+	auto res = flush_cache();
+	if(res != 0) {
+		error = res;
+		return;
+	}
+
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::datasync;
@@ -166,6 +886,12 @@ void pseudo_fd::datasync()
 
 void pseudo_fd::sync()
 {
+	auto res = flush_cache();
+	if(res != 0) {
+		error = res;
+		return;
+	}
+
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::sync;
@@ -178,7 +904,51 @@ void pseudo_fd::sync()
 	}
 }
 
+cloudabi_errno_t pseudo_fd::flush_on_close()
+{
+	// if this fails, the pages stay dirty and the destructor tries again
+	return flush_cache();
+}
+
 void pseudo_fd::lookup(const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat)
+{
+	lookup_request(reverse_request_t::operation::lookup, 0, file, filelen, oflags, filestat);
+}
+
+void pseudo_fd::lookup_inode(cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_filestat_t *filestat)
+{
+	if(lookup_inode_unsupported) {
+		error = ENOSYS;
+		return;
+	}
+	lookup_request(reverse_request_t::operation::lookup_inode, dir_inode, file, filelen, 0, filestat);
+	if(error == ENOSYS) {
+		lookup_inode_unsupported = true;
+	}
+}
+
+bool pseudo_fd::can_lookup_inode()
+{
+	return type == CLOUDABI_FILETYPE_DIRECTORY && !lookup_inode_unsupported;
+}
+
+void pseudo_fd::lookup_request(reverse_request_t::operation op, cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat)
+{
+	// Writes cached by other pseudo FDs of this file were done before the
+	// truncate, so they must reach the other side before it; don't let
+	// the lookup truncate. openat() truncates afterwards through
+	// file_stat_fput(), which writes them back first.
+	send_lookup_request(op, dir_inode, file, filelen, oflags & ~CLOUDABI_O_TRUNC, filestat);
+	if(error == 0 && filestat->st_filetype == CLOUDABI_FILETYPE_REGULAR_FILE
+	&& reverse_fd->flush_inode(filestat->st_ino)) {
+		// an open pseudo FD of this file had writes the other side
+		// didn't see yet, so the size and times it returned were
+		// outdated; ask again now that they're written back
+		send_lookup_request(op, dir_inode, file, filelen, 0, filestat);
+	}
+}
+
+void pseudo_fd::send_lookup_request(reverse_request_t::operation op, cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat)
 {
 	auto res = lookup_device_id();
 	if(res != 0) {
@@ -193,14 +963,19 @@ void pseudo_fd::lookup(const char *file, size_t filelen, cloudabi_oflags_t oflag
 
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
-	request.op = reverse_request_t::operation::lookup;
-	request.inode = 0;
+	request.op = op;
+	request.inode = dir_inode;
 	request.flags = oflags;
 	request.send_length = filelen;
 	request.recv_length = 0;
 	reverse_response_t response;
 	Blk b = send_request(&request, file, &response);
 
+	if(oflags & CLOUDABI_O_CREAT) {
+		// this lookup may create the file
+		invalidate_dentry(file, filelen);
+	}
+
 	if (response.result < 0) {
 		maybe_deallocate(b);
 		error = -response.result;
@@ -216,12 +991,12 @@ void pseudo_fd::lookup(const char *file, size_t filelen, cloudabi_oflags_t oflag
 	memcpy(filestat, b.ptr, sizeof(cloudabi_filestat_t));
 	maybe_deallocate(b);
 	if (filestat->st_dev != device) {
-		get_vga_stream() << "Pseudo FD powered filesystem changed device IDs\n";
+		get_vga_stream() << log_warning << "Pseudo FD powered filesystem changed device IDs\n";
 		error = EIO;
 		return;
 	}
 	if (filestat->st_ino != static_cast<unsigned long long>(response.result)) {
-		get_vga_stream() << "Pseudo FD powered filesystem inconsistent in inodes\n";
+		get_vga_stream() << log_warning << "Pseudo FD powered filesystem inconsistent in inodes\n";
 		error = EIO;
 		return;
 	}
@@ -260,6 +1035,10 @@ shared_ptr<fd_t> pseudo_fd::inode_open(cloudabi_device_t st_dev, cloudabi_inode_
 	strncat(new_name, ui64toa_s(st_ino, buf, sizeof(buf), 10), sizeof(new_name) - strlen(new_name) - 1);
 
 	auto new_fd = make_shared<pseudo_fd>(new_pseudo_id, reverse_fd, response.flags, fdstat->fs_flags, new_name);
+	// the new file lives on our device, no need to ask for it
+	new_fd->device = st_dev;
+	new_fd->inode = st_ino;
+	new_fd->device_id_obtained = true;
 	// TODO: check if the rights are actually obtainable before opening the file;
 	// ignore those that don't apply to this filetype, return ENOTCAPABLE if not
 	new_fd->flags = fdstat->fs_flags;
@@ -285,6 +1064,8 @@ cloudabi_inode_t pseudo_fd::file_create(const char *file, size_t filelen, clouda
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, file, &response));
+
+	invalidate_dentry(file, filelen);
 	if(response.result < 0) {
 		error = -response.result;
 		return 0;
@@ -314,7 +1095,7 @@ size_t pseudo_fd::file_readlink(const char *path, size_t pathlen, char *dest, si
 
 	error = 0;
 	if(response.send_length > destlen) {
-		get_vga_stream() << "pseudo-fd filesystem returned more data than requested, dropping";
+		get_vga_stream() << log_warning << "pseudo-fd filesystem returned more data than requested, dropping\n";
 		response.send_length = destlen;
 	}
 
@@ -360,6 +1141,13 @@ void pseudo_fd::file_rename(const char *path1, size_t path1len, shared_ptr<fd_t>
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, pathstr, &response));
+
+	invalidate_dentry(path1, path1len);
+	if(!fd2ps->invalidate_dentry(path2, path2len)) {
+		// the rename may replace a directory we don't know the inode of,
+		// whose entries may be cached
+		get_dentry_cache()->invalidate_device(device);
+	}
 	deallocate(path);
 	if(response.result < 0) {
 		error = -response.result;
@@ -406,6 +1194,10 @@ void pseudo_fd::file_link(const char *path1, size_t path1len, shared_ptr<fd_t> f
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, pathstr, &response));
+
+	// the link count of the source changes, the destination is created
+	invalidate_dentry(path1, path1len);
+	fd2ps->invalidate_dentry(path2, path2len);
 	deallocate(path);
 	if(response.result < 0) {
 		error = -response.result;
@@ -439,6 +1231,8 @@ void pseudo_fd::file_symlink(const char *path1, size_t path1len, const char *pat
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, pathstr, &response));
+
+	invalidate_dentry(path2, path2len);
 	deallocate(path);
 	if(response.result < 0) {
 		error = -response.result;
@@ -458,6 +1252,12 @@ void pseudo_fd::file_unlink(const char *path, size_t pathlen, cloudabi_ulflags_t
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, path, &response));
+
+	if(!invalidate_dentry(path, pathlen) && (flags & CLOUDABI_UNLINK_REMOVEDIR)) {
+		// we don't know the inode of the removed directory, but its
+		// entries may be cached and the inode may be reused
+		get_dentry_cache()->invalidate_device(device);
+	}
 	if(response.result < 0) {
 		error = -response.result;
 	} else {
@@ -473,6 +1273,14 @@ void pseudo_fd::file_stat_fget(cloudabi_filestat_t *buf)
 		return;
 	}
 
+	// the other side can only know the right size and times after it
+	// received our writes
+	res = flush_cache();
+	if(res != 0) {
+		error = res;
+		return;
+	}
+
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::stat_fget;
@@ -493,7 +1301,7 @@ void pseudo_fd::file_stat_fget(cloudabi_filestat_t *buf)
 		memcpy(buf, b.ptr, sizeof(cloudabi_filestat_t));
 		maybe_deallocate(b);
 		if(buf->st_dev != device) {
-			get_vga_stream() << "Pseudo FD powered filesystem changed device ID's";
+			get_vga_stream() << log_warning << "Pseudo FD powered filesystem changed device ID's\n";
 			error = EIO;
 			return;
 		}
@@ -523,6 +1331,8 @@ void pseudo_fd::file_stat_put(const char *path, size_t pathlen, const cloudabi_f
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, bufstr, &response));
+
+	invalidate_dentry(path, pathlen);
 	deallocate(buffer);
 	if(response.result < 0) {
 		error = -response.result;
@@ -539,6 +1349,21 @@ void pseudo_fd::file_stat_fput(const cloudabi_filestat_t *buf, cloudabi_fsflags_
 		return;
 	}
 
+	if(fsflags & CLOUDABI_FILESTAT_SIZE) {
+		// truncating or extending the file changes its contents, so
+		// writes cached before it by this or any other pseudo FD of the
+		// file must reach the other side first
+		res = flush_cache();
+		if(res != 0) {
+			error = res;
+			return;
+		}
+		drop_cache(true);
+		if(is_cacheable()) {
+			reverse_fd->flush_inode(inode, this);
+		}
+	}
+
 	reverse_request_t request;
 	request.pseudofd = pseudo_id;
 	request.op = reverse_request_t::operation::stat_fput;
@@ -548,6 +1373,8 @@ void pseudo_fd::file_stat_fput(const cloudabi_filestat_t *buf, cloudabi_fsflags_
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, reinterpret_cast<const char*>(buf), &response));
+
+	invalidate_own_dentries();
 	if(response.result < 0) {
 		error = -response.result;
 	} else {
@@ -566,6 +1393,9 @@ void pseudo_fd::file_allocate(cloudabi_filesize_t offset, cloudabi_filesize_t le
 
 	reverse_response_t response;
 	maybe_deallocate(send_request(&request, nullptr, &response));
+	// a cached page at the old end of file is stale if the file grew
+	drop_cache(true);
+	invalidate_own_dentries();
 	if(response.result < 0) {
 		error = -response.result;
 	}
@@ -574,6 +1404,18 @@ void pseudo_fd::file_allocate(cloudabi_filesize_t offset, cloudabi_filesize_t le
 
 size_t pseudo_fd::readdir(char *buf, size_t nbyte, cloudabi_dircookie_t cookie)
 {
+	if(!readdirplus_unsupported) {
+		size_t written = readdir_plus(buf, nbyte, cookie);
+		if(error != ENOSYS) {
+			if(error == 0) {
+				// the access time changed
+				invalidate_own_dentries();
+			}
+			return written;
+		}
+		readdirplus_unsupported = true;
+	}
+
 	// readdir is allowed to return either a full buffer of nbyte bytes, or
 	// any smaller amount of dir entries. It's only allowed to return 0
 	// bytes if the directory has no (more) entries, in which case cookie
@@ -612,6 +1454,109 @@ size_t pseudo_fd::readdir(char *buf, size_t nbyte, cloudabi_dircookie_t cookie)
 			break;
 		}
 	}
+	invalidate_own_dentries();
+	error = 0;
+	return written;
+}
+
+size_t pseudo_fd::readdir_plus(char *buf, size_t nbyte, cloudabi_dircookie_t cookie)
+{
+	// readdirplus returns a number of whole records, each consisting of a
+	// dirent, the filestat of the entry and its name. The dirent and name
+	// are copied into the caller's buffer like readdir would, and the
+	// filestat is put into the dentry cache so that the lookups that
+	// usually follow a readdir don't need an RPC each.
+	constexpr size_t record_header = sizeof(cloudabi_dirent_t) + sizeof(cloudabi_filestat_t);
+	cloudabi_inode_t dir_inode = dentry_cache_inode();
+	auto *cache = get_dentry_cache();
+
+	size_t written = 0;
+	bool retry_larger = false;
+	while(written < nbyte) {
+		reverse_request_t request;
+		request.pseudofd = pseudo_id;
+		request.op = reverse_request_t::operation::readdirplus;
+		request.flags = cookie;
+		// ask for enough records to fill the rest of the caller's buffer, and
+		// at least one record with a reasonably long name
+		size_t want = (nbyte - written) * 2 + record_header + dentry_cache_entry::NAME_MAX;
+		request.recv_length = want > UINT16_MAX || retry_larger ? UINT16_MAX : want;
+
+		reverse_response_t response;
+		Blk b = send_request(&request, nullptr, &response);
+		if(response.result == -ENOBUFS && !retry_larger) {
+			// the next record doesn't fit, its name must be long; any
+			// record fits in the largest response
+			maybe_deallocate(b);
+			retry_larger = true;
+			continue;
+		}
+		retry_larger = false;
+		if(response.result < 0) {
+			error = -response.result;
+			maybe_deallocate(b);
+			return 0;
+		} else if(b.size > request.recv_length) {
+			// more data returned than expected
+			error = EIO;
+			maybe_deallocate(b);
+			return 0;
+		}
+
+		cloudabi_dircookie_t next_cookie = response.result;
+		char *records = reinterpret_cast<char*>(b.ptr);
+		size_t pos = 0;
+		size_t num_records = 0;
+		while(pos < b.size && written < nbyte) {
+			if(b.size - pos < record_header) {
+				error = EIO;
+				maybe_deallocate(b);
+				return 0;
+			}
+			cloudabi_dirent_t dirent;
+			cloudabi_filestat_t stat;
+			memcpy(&dirent, records + pos, sizeof(dirent));
+			memcpy(&stat, records + pos + sizeof(dirent), sizeof(stat));
+			const char *name = records + pos + record_header;
+			if(b.size - pos - record_header < dirent.d_namlen) {
+				error = EIO;
+				maybe_deallocate(b);
+				return 0;
+			}
+
+			if(dir_inode != 0 && stat.st_ino != 0) {
+				cache->insert(device, dir_inode, name, dirent.d_namlen, 0, &stat);
+			}
+
+			// the last entry may be truncated, like with readdir
+			size_t entry_size = sizeof(dirent) + dirent.d_namlen;
+			size_t copy = entry_size < nbyte - written ? entry_size : nbyte - written;
+			size_t dirent_copy = copy < sizeof(dirent) ? copy : sizeof(dirent);
+			memcpy(buf + written, &dirent, dirent_copy);
+			if(copy > sizeof(dirent)) {
+				memcpy(buf + written + sizeof(dirent), name, copy - sizeof(dirent));
+			}
+			written += copy;
+			pos += record_header + dirent.d_namlen;
+			num_records++;
+			cookie = dirent.d_next;
+		}
+		maybe_deallocate(b);
+
+		if(pos == b.size) {
+			// all returned records were consumed
+			if(num_records == 0 && next_cookie != 0) {
+				// no progress, but more entries promised
+				error = EIO;
+				return 0;
+			}
+			cookie = next_cookie;
+			if(cookie == 0) {
+				// no more entries
+				break;
+			}
+		}
+	}
 	error = 0;
 	return written;
 }
@@ -642,6 +1587,7 @@ cloudabi_errno_t pseudo_fd::lookup_device_id() {
 		}
 		auto *stat = reinterpret_cast<cloudabi_filestat_t*>(b.ptr);
 		device = stat->st_dev;
+		inode = stat->st_ino;
 		assert(device > 0 || type == CLOUDABI_FILETYPE_SOCKET_STREAM || type == CLOUDABI_FILETYPE_SOCKET_DGRAM);
 		device_id_obtained = true;
 		maybe_deallocate(b);
@@ -3,6 +3,7 @@
 #include "reverse_fd.hpp"
 #include "fd.hpp"
 #include "reverse_proto.hpp"
+#include <oslibc/list.hpp>
 
 namespace cloudos {
 
@@ -10,6 +11,39 @@ using reverse_proto::reverse_request_t;
 using reverse_proto::reverse_response_t;
 using reverse_proto::pseudofd_t;
 
+/** A page of a pseudo FD file, cached in the kernel. The bytes in
+ * [0, valid) reflect the file contents; if valid < PAGE_SIZE, the file ends
+ * inside this page. The bytes in [dirty_begin, dirty_end) were written but
+ * not yet sent to the reverse FD. While writing_back is set, a pwrite of this
+ * page is in flight, and the page stays cached so that its dirty range can be
+ * restored if the pwrite fails.
+ */
+struct pseudo_cached_page {
+	uint64_t offset = 0;
+	Blk data;
+	size_t valid = 0;
+	size_t dirty_begin = 0;
+	size_t dirty_end = 0;
+	bool writing_back = false;
+
+	inline bool is_dirty() const { return dirty_begin != dirty_end; }
+	inline bool can_evict() const { return !is_dirty() && !writing_back; }
+};
+
+typedef linked_list<pseudo_cached_page> pseudo_page_list;
+
+/** Statistics on the pseudo FD page cache, summed over all pseudo FDs. */
+struct pseudo_cache_stats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t readahead_pages = 0;
+	uint64_t writebacks = 0;
+	uint64_t written_back_pages = 0;
+	uint64_t evictions = 0;
+	uint64_t invalidations = 0;
+	size_t cached_pages = 0;
+};
+
 /** A pseudo-fd. This is a file descriptor where all calls on it are converted
  * to RPCs. These RPCs are sent to a given file descriptor, called the "reverse
  * fd". This is usually a socket with the other end given to a process, so that
@@ -19,6 +53,28 @@ using reverse_proto::pseudofd_t;
  *
  * The other side of the reverse FD will create a new pseudo FDs in the open
  * call.
+ *
+ * For regular files, the pseudo FD keeps a small page cache: reads are served
+ * from it, and sequential reads cause readahead of increasingly larger runs
+ * of pages in a single pread RPC. Writes are kept in the cache and coalesced
+ * into pwrite RPCs on sync, datasync, close, or when the cache is full; a
+ * lookup of a file with cached writes writes them back first, so that the
+ * size and times it returns are right. So do a truncate, and a read through
+ * another pseudo FD of the file that goes to the other side. The
+ * other side can drop the cached pages with a gratituous invalidate_cache
+ * message. Vectored reads and writes on other pseudo FDs are done in a single
+ * RPC, instead of one per buffer.
+ *
+ * Pseudo FD directories take part in the dentry cache; they invalidate the
+ * entries their own operations change, and the other side can drop all
+ * entries of a directory with a gratituous invalidate_dentries message, for
+ * changes the kernel didn't see. Reads that reach the other side change the
+ * access time, so they invalidate the cached attributes of the file as well.
+ * Traversal looks up names in directories it passes through using
+ * lookup_inode requests on the directory it started in, so those directories
+ * don't need to be opened and closed. readdir uses the readdirplus request if
+ * the other side supports it, so that the file attributes returned along with
+ * the names fill the dentry cache.
  */
 struct pseudo_fd : public seekable_fd_t, public enable_shared_from_this<pseudo_fd> {
 	pseudo_fd(pseudofd_t id, shared_ptr<reversefd_t> reverse_fd, cloudabi_filetype_t t, cloudabi_fdflags_t f, const char *n);
@@ -30,14 +86,27 @@ struct pseudo_fd : public seekable_fd_t, public enable_shared_from_this<pseudo_f
 	/* For memory, pipes and files */
 	size_t read(void *dest, size_t count) override;
 	size_t write(const char *str, size_t count) override;
+	size_t pread(void *dest, size_t count, size_t offset) override;
+	size_t pwrite(const char *str, size_t count, size_t offset) override;
+	size_t readv(const cloudabi_iovec_t *iov, size_t iovcnt) override;
+	size_t writev(const cloudabi_ciovec_t *iov, size_t iovcnt) override;
+	size_t preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) override;
+	size_t pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset) override;
 	bool is_readable(size_t &nbytes, bool &hangup);
 	cloudabi_errno_t get_read_signaler(thread_condition_signaler **s) override;
 	void became_readable();
+	void invalidate_cache();
+	void invalidate_dentries();
 	void datasync() override;
 	void sync() override;
+	cloudabi_errno_t flush_on_close() override;
+	Blk splice_read(size_t count, cloudabi_filesize_t *offset, size_t *length) override;
 
 	/* For directories */
+	cloudabi_inode_t dentry_cache_inode() override;
 	void lookup(const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat) override;
+	void lookup_inode(cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_filestat_t *filestat) override;
+	bool can_lookup_inode() override;
 	shared_ptr<fd_t> inode_open(cloudabi_device_t st_dev, cloudabi_inode_t st_ino, const cloudabi_fdstat_t *) override;
 	void file_allocate(cloudabi_filesize_t offset, cloudabi_filesize_t length) override;
 	size_t readdir(char *buf, size_t nbyte, cloudabi_dircookie_t cookie) override;
@@ -56,15 +125,70 @@ struct pseudo_fd : public seekable_fd_t, public enable_shared_from_this<pseudo_f
 	void sock_recv(const cloudabi_recv_in_t* in, cloudabi_recv_out_t* out) override;
 	void sock_send(const cloudabi_send_in_t* in, cloudabi_send_out_t* out) override;
 
+	/** Returns whether this pseudo FD caches writes to the given inode that
+	 * were not written back yet.
+	 */
+	bool has_dirty_pages(cloudabi_inode_t inode);
+	cloudabi_errno_t flush_cache();
+
+	static pseudo_cache_stats &get_cache_stats();
+
 private:
 	cloudabi_errno_t lookup_device_id();
+	void register_with_reverse_fd();
+	bool invalidate_dentry(const char *file, size_t filelen);
+	void invalidate_own_dentries();
+	void lookup_request(reverse_request_t::operation op, cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat);
+	void send_lookup_request(reverse_request_t::operation op, cloudabi_inode_t dir_inode, const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat);
+	size_t readdir_plus(char *buf, size_t nbyte, cloudabi_dircookie_t cookie);
 	Blk send_request(reverse_request_t *request, const char *buf, reverse_response_t *response);
 	bool is_valid_path(const char *path, size_t length);
 
+	cloudabi_errno_t write_back_other_fds();
+	Blk pread_request(size_t count, uint64_t offset, size_t *length);
+	size_t uncached_pread(void *dest, size_t count, uint64_t offset);
+	size_t uncached_pwrite(const char *str, size_t count, uint64_t offset);
+	Blk gather(const cloudabi_ciovec_t *iov, size_t iovcnt);
+
+	inline bool is_cacheable() { return type == CLOUDABI_FILETYPE_REGULAR_FILE; }
+	pseudo_cached_page *find_cached_page(uint64_t offset);
+	pseudo_cached_page *insert_cached_page(uint64_t offset);
+	cloudabi_errno_t fill_cache(uint64_t offset, size_t num_pages);
+	bool evict_clean_page();
+	size_t count_dirty_pages();
+	uint64_t cached_file_end();
+	void zero_extend_cached_pages(uint64_t file_end);
+	void drop_cache(bool keep_dirty);
+	cloudabi_errno_t make_room_in_cache(size_t num_pages);
+
+	static constexpr size_t PAGE_SIZE = 4096;
+	static constexpr size_t MAX_CACHED_PAGES = 32;
+	static constexpr size_t MAX_READAHEAD_PAGES = 8;
+	// a single pwrite RPC can carry at most UINT16_MAX bytes
+	static constexpr size_t MAX_WRITEBACK_PAGES = UINT16_MAX / PAGE_SIZE;
+	// Above this number of cached pages over all pseudo FDs, every pseudo FD
+	// starts evicting its own pages before caching new ones.
+	static constexpr size_t MAX_TOTAL_CACHED_PAGES = 1024;
+
 	pseudofd_t pseudo_id;
 	shared_ptr<reversefd_t> reverse_fd;
 	bool device_id_obtained = false;
+	// inode of this file, known once device_id_obtained is set
+	cloudabi_inode_t inode = 0;
+	// set when the other side returned ENOSYS for readdirplus
+	bool readdirplus_unsupported = false;
+	// set when the other side returned ENOSYS for lookup_inode
+	bool lookup_inode_unsupported = false;
+	// set once the reverse FD knows about this pseudo FD
+	bool registered = false;
 	thread_condition_signaler recv_signaler;
+
+	// most recently used page first
+	pseudo_page_list *cached_pages = nullptr;
+	size_t num_cached_pages = 0;
+	// offset just past the last read; a read starting here is sequential
+	uint64_t next_sequential_offset = 0;
+	size_t readahead_pages = 1;
 };
 
 }
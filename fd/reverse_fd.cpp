@@ -18,6 +18,27 @@ void reversefd_t::subscribe_fd_read_events(shared_ptr<pseudo_fd> fd)
 	append(&pseudos, allocate<pseudo_list>(fd));
 }
 
+bool reversefd_t::flush_inode(cloudabi_inode_t inode, pseudo_fd *except)
+{
+	bool flushed = false;
+	while(true) {
+		// flushing blocks and the list may change meanwhile, so start
+		// over after every pseudo FD
+		shared_ptr<pseudo_fd> dirty;
+		for(auto it = pseudos; it != nullptr; it = it->next) {
+			auto pseudo = it->data.lock();
+			if(pseudo && pseudo.get() != except && pseudo->has_dirty_pages(inode)) {
+				dirty = pseudo;
+				break;
+			}
+		}
+		if(!dirty || dirty->flush_cache() != 0) {
+			return flushed;
+		}
+		flushed = true;
+	}
+}
+
 shared_ptr<pseudo_fd> reversefd_t::get_pseudo(reverse_proto::pseudofd_t pseudo_id)
 {
 	// TODO: roll the below loops into one
@@ -44,9 +65,12 @@ void reversefd_t::handle_gratituous_message()
 		// pseudo FD is already closed
 		return;
 	}
-	if(message.flags == 1) {
-		// pseudo became readable
+	if(message.flags == reverse_proto::became_readable) {
 		pseudo->became_readable();
+	} else if(message.flags == reverse_proto::invalidate_cache) {
+		pseudo->invalidate_cache();
+	} else if(message.flags == reverse_proto::invalidate_dentries) {
+		pseudo->invalidate_dentries();
 	}
 }
 
@@ -114,55 +138,69 @@ void reversefd_t::have_bytes_received()
 			handle_gratituous_message();
 			bytes_read = 0;
 		} else {
-			// it's a response, wake up the thread waiting for a
-			// response, it takes ownership of recv_data, set
-			// bytes_read to 0 and call have_bytes_received() after
-			// this if necessary
-			assert(sending_request);
-			response_arrived_cv.notify();
-			return;
+			// it's a response, hand it to the thread waiting for it,
+			// which takes ownership of recv_data
+			auto *item = find(outstanding, [&](outstanding_list *i) {
+				return i->data->tag == message.tag;
+			});
+			if(item != nullptr) {
+				auto *request = item->data;
+				remove_one(&outstanding, [&](outstanding_list *i) {
+					return i == item;
+				}, [](outstanding_list *) {});
+				memcpy(request->response, &message, sizeof(message));
+				request->recv_data = recv_data;
+				request->done = true;
+				request->response_arrived_cv.notify();
+			} else if(recv_data.ptr != nullptr) {
+				// nobody is waiting for this response
+				deallocate(recv_data);
+			}
+			recv_data = {};
+			bytes_read = 0;
 		}
 	}
 }
 
 Blk reversefd_t::send_request(reverse_request_t *request, const char *buffer, reverse_response_t *response) {
-	while(sending_request) {
-		// Lock the reverse_fd. Multiple pseudo FD's may have a reference to
-		// this reverse_fd, and another one may have an outstanding request
-		// already.
-		request_done_cv.wait();
-	}
-	sending_request = true;
-
 	assert(type == CLOUDABI_FILETYPE_SOCKET_STREAM);
 
+	while(writing_request) {
+		// Multiple pseudo FD's may have a reference to this reverse_fd,
+		// and the bytes of their requests must not interleave.
+		request_written_cv.wait();
+	}
+	writing_request = true;
+
+	outstanding_request outstanding_req;
+	outstanding_req.tag = next_tag++;
+	outstanding_req.response = response;
+	outstanding_req.recv_data = {};
+	outstanding_req.done = false;
+	request->tag = outstanding_req.tag;
+	// the response may arrive while the request is still being written
+	outstanding_list item(&outstanding_req);
+	append(&outstanding, &item);
+
+	bool written = false;
 	char *msg = reinterpret_cast<char*>(request);
-	if(write(msg, sizeof(reverse_request_t)) != sizeof(reverse_request_t) || error != 0) {
-		return {};
+	if(write(msg, sizeof(reverse_request_t)) == sizeof(reverse_request_t) && error == 0) {
+		written = request->send_length == 0
+			|| (write(buffer, request->send_length) == request->send_length && error == 0);
 	}
-	if(request->send_length > 0) {
-		if(write(buffer, request->send_length) != request->send_length || error != 0) {
-			return {};
-		}
+	writing_request = false;
+	request_written_cv.notify();
+	if(!written) {
+		remove_one(&outstanding, [&](outstanding_list *i) {
+			return i == &item;
+		}, [](outstanding_list *) {});
+		return {};
 	}
 
-	// wait for a response
-	response_arrived_cv.wait();
-	assert(bytes_read == sizeof(message) + message.send_length);
-
-	// take the response into our buffers (the caller takes ownership over
-	// the buffer in recv_data)
-	memcpy(response, &message, sizeof(message));
-	Blk res = recv_data;
-	recv_data = {};
-
-	bytes_read = 0;
-	sending_request = false;
-	request_done_cv.notify();
-
-	// handle any gratituous messages that might have come in after this
-	// response but before this function reading it?
-	have_bytes_received();
-
-	return res;
+	// wait for the response; the caller takes ownership over the buffer
+	// in recv_data
+	while(!outstanding_req.done) {
+		outstanding_req.response_arrived_cv.wait();
+	}
+	return outstanding_req.recv_data;
 }
@@ -18,6 +18,10 @@ struct reversefd_t : public unixsock {
 	~reversefd_t() override;
 
 	void subscribe_fd_read_events(shared_ptr<pseudo_fd> fd);
+	/** Writes back the cached writes of the subscribed pseudo FDs of the
+	 * given inode, other than except. Returns whether there were any.
+	 */
+	bool flush_inode(cloudabi_inode_t inode, pseudo_fd *except = nullptr);
 	virtual void have_bytes_received() override;
 
 	// send a request and block until we get a response
@@ -28,15 +32,29 @@ private:
 	void handle_gratituous_message();
 	cloudabi_errno_t read_response(reverse_response_t *response, Blk *recv_buf);
 
+	// A request that was sent and is waiting for its response
+	struct outstanding_request {
+		uint64_t tag;
+		reverse_response_t *response;
+		Blk recv_data;
+		bool done;
+		cv_t response_arrived_cv;
+	};
+	typedef linked_list<outstanding_request*> outstanding_list;
+
 	size_t bytes_read = 0;
 	reverse_proto::reverse_response_t message;
 	Blk recv_data;
 
 	pseudo_list *pseudos = nullptr;
 
-	bool sending_request = false;
-	cv_t response_arrived_cv;
-	cv_t request_done_cv;
+	// Requests are tagged, so several of them can be outstanding and the
+	// other side can answer them in any order; only writing a request
+	// has to wait for other requests being written.
+	outstanding_list *outstanding = nullptr;
+	uint64_t next_tag = 1;
+	bool writing_request = false;
+	cv_t request_written_cv;
 };
 
 }
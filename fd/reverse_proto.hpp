@@ -30,13 +30,29 @@ struct reverse_request_t {
 		// the calls below are for UNIX sockets; inode is 0
 		sock_shutdown,
 		sock_recv,
-		sock_send
+		sock_send,
+		// cookie in flags, returns the next cookie in result (0 if last entry); buffer is a
+		// number of whole records of cloudabi_dirent_t + cloudabi_filestat_t + name
+		readdirplus,
+		// filename in buffer; like lookup, but looks it up in the directory
+		// with the given inode instead of in the pseudo FD, which must be on
+		// the same filesystem. Never creates the file.
+		lookup_inode,
 	} op;
 	uint64_t inode = 0;
 	uint64_t flags = 0;
 	uint64_t offset = 0;
 	uint16_t send_length = 0; // bytes following this request (for filenames & writes)
 	uint16_t recv_length = 0; // length to read
+	uint64_t tag = 0; // copied into the response; requests may be answered in any order
+};
+
+// Values for reverse_response_t::flags when gratituous is set; result holds the
+// pseudo FD the message applies to.
+enum gratituous_flags : uint64_t {
+	became_readable = 1,
+	invalidate_cache = 2, // the contents of the pseudo FD changed, drop cached pages
+	invalidate_dentries = 3, // entries in the pseudo FD directory changed, drop cached lookups
 };
 
 struct reverse_response_t {
@@ -45,6 +61,7 @@ struct reverse_response_t {
 	bool gratituous = false;
 	uint16_t send_length = 0; // bytes following this response
 	uint16_t recv_length = 0; // bytes actually read
+	uint64_t tag = 0; // tag of the request this answers; 0 if gratituous
 };
 
 }
@@ -0,0 +1,254 @@
+#include <fd/ring_fd.hpp>
+#include <fd/process_fd.hpp>
+#include <fd/scheduler.hpp>
+#include <fd/splice.hpp>
+#include <proc/syscalls.hpp>
+
+using namespace cloudos;
+using ring_proto::submission_t;
+using ring_proto::completion_t;
+
+/** An argument frame as the system call handlers expect to find it on the
+ * userland stack, so that they can be called for a ring submission.
+ */
+struct syscall_frame {
+	syscall_frame() {
+		memset(stack, 0, sizeof(stack));
+	}
+
+	// must correspond to arguments_t::fill_member()
+	template <typename T>
+	void push(T value) {
+		static_assert(sizeof(T) <= sizeof(uint64_t), "Argument too large");
+		assert(offset + sizeof(uint64_t) <= sizeof(stack));
+		memcpy(stack + offset, &value, sizeof(T));
+		offset += sizeof(T) <= sizeof(uint32_t) ? sizeof(uint32_t) : sizeof(uint64_t);
+	}
+
+	char stack[64];
+	// the handlers skip the return address
+	uint8_t offset = 4;
+};
+
+static bool ring_is_readable(void *r, thread_condition*, thread_condition_data **conditiondata) {
+	auto *ring = reinterpret_cast<ring_fd*>(r);
+	bool readable = ring->completions_available() > 0;
+	if(readable && conditiondata) {
+		*conditiondata = ring->allocate_current_condition_data();
+	}
+	return readable;
+}
+
+ring_fd::ring_fd(const char *n)
+: fd_t(ring_proto::filetype_ring, 0, n)
+{
+	read_signaler.set_already_satisfied_function(ring_is_readable, this);
+}
+
+thread_condition_data *ring_fd::allocate_current_condition_data() {
+	auto *cd = allocate<thread_condition_data_fd_readwrite>();
+	cd->nbytes = num_completions * sizeof(completion_t);
+	cd->flags = 0;
+	return cd;
+}
+
+cloudabi_errno_t ring_fd::get_read_signaler(thread_condition_signaler **s) {
+	*s = &read_signaler;
+	return 0;
+}
+
+size_t ring_fd::read(void *dest, size_t count) {
+	if(count < sizeof(completion_t)) {
+		error = EINVAL;
+		return 0;
+	}
+	if(num_completions == 0) {
+		error = EAGAIN;
+		return 0;
+	}
+
+	size_t n = count / sizeof(completion_t);
+	if(n > num_completions) {
+		n = num_completions;
+	}
+	auto *out = reinterpret_cast<char*>(dest);
+	for(size_t i = 0; i < n; ++i) {
+		memcpy(out + i * sizeof(completion_t), &completions[first_completion], sizeof(completion_t));
+		first_completion = (first_completion + 1) % ring_proto::max_completions;
+	}
+	num_completions -= n;
+	error = 0;
+	return n * sizeof(completion_t);
+}
+
+size_t ring_fd::write(const char *str, size_t count) {
+	if(count % sizeof(submission_t) != 0) {
+		error = EINVAL;
+		return 0;
+	}
+
+	// reserve room for all completions up front, so that submissions that
+	// block don't give other writers the chance to overflow the ring
+	size_t room = ring_proto::max_completions - num_completions - reserved_completions;
+	size_t n = count / sizeof(submission_t);
+	if(n > room) {
+		n = room;
+	}
+	if(n == 0) {
+		error = EAGAIN;
+		return 0;
+	}
+	reserved_completions += n;
+
+	bool cancel = false;
+	for(size_t i = 0; i < n; ++i) {
+		// the submissions are in userland memory, and may be unaligned
+		submission_t submission;
+		memcpy(&submission, str + i * sizeof(submission_t), sizeof(submission_t));
+
+		int64_t result = cancel ? -ECANCELED : execute(submission);
+		if(result < 0 && (submission.flags & ring_proto::link)) {
+			cancel = true;
+		}
+		reserved_completions--;
+		add_completion(submission.user_data, result);
+	}
+
+	read_signaler.condition_broadcast([this]() { return allocate_current_condition_data(); });
+	error = 0;
+	return n * sizeof(submission_t);
+}
+
+void ring_fd::add_completion(uint64_t user_data, int64_t result) {
+	assert(num_completions < ring_proto::max_completions);
+	auto &completion = completions[(first_completion + num_completions) % ring_proto::max_completions];
+	completion.user_data = user_data;
+	completion.result = result;
+	num_completions++;
+}
+
+int64_t ring_fd::execute(submission_t const &submission) {
+	using op = submission_t::operation;
+
+	auto thr = get_scheduler()->get_running_thread();
+	auto *process = thr->get_process();
+
+	if(submission.op == op::nop) {
+		return 0;
+	}
+
+	if(submission.op != op::poll) {
+		// executing operations on this ring from within it would
+		// recurse, or read the completions being produced
+		fd_mapping_t *mapping;
+		auto res = process->get_fd(&mapping, submission.fd, 0);
+		if(res != 0) {
+			return -res;
+		}
+		if(mapping->fd.get() == this) {
+			return -EINVAL;
+		}
+	}
+
+	if(submission.op == op::splice) {
+		return execute_splice(submission);
+	}
+
+	auto *addr = reinterpret_cast<void*>(static_cast<uintptr_t>(submission.addr));
+	auto *addr2 = reinterpret_cast<void*>(static_cast<uintptr_t>(submission.addr2));
+	cloudabi_iovec_t iov = {addr, submission.length};
+
+	syscall_frame frame;
+	syscall_handler handler;
+	switch(submission.op) {
+	case op::read:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<const cloudabi_iovec_t*>(&iov);
+		frame.push<size_t>(1);
+		handler = syscall_fd_read;
+		break;
+	case op::write:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<const cloudabi_iovec_t*>(&iov);
+		frame.push<size_t>(1);
+		handler = syscall_fd_write;
+		break;
+	case op::pread:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<const cloudabi_iovec_t*>(&iov);
+		frame.push<size_t>(1);
+		frame.push<size_t>(submission.offset);
+		handler = syscall_fd_pread;
+		break;
+	case op::pwrite:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<const cloudabi_iovec_t*>(&iov);
+		frame.push<size_t>(1);
+		frame.push<size_t>(submission.offset);
+		handler = syscall_fd_pwrite;
+		break;
+	case op::sock_recv:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<void*>(addr);
+		frame.push<void*>(addr2);
+		handler = syscall_sock_recv;
+		break;
+	case op::sock_send:
+		frame.push<cloudabi_fd_t>(submission.fd);
+		frame.push<void*>(addr);
+		frame.push<void*>(addr2);
+		handler = syscall_sock_send;
+		break;
+	case op::poll:
+		frame.push<void*>(addr);
+		frame.push<void*>(addr2);
+		frame.push<size_t>(submission.length);
+		handler = syscall_poll;
+		break;
+	default:
+		return -ENOSYS;
+	}
+
+	// the frame must not hold more than the handler unpacks; trailing
+	// output pointers that aren't pushed are read as null
+	size_t num = syscall_number(handler);
+	assert(frame.offset <= sizeof(uint32_t) + syscall_table[num].frame_size);
+
+	// count and trace the submission like the equivalent system call
+	syscall_context c(thr.get(), frame.stack);
+	auto res = call_syscall(num, c);
+	if(res != 0) {
+		return -res;
+	}
+	return static_cast<int64_t>(c.result);
+}
+
+int64_t ring_fd::execute_splice(submission_t const &submission) {
+	auto *process = get_scheduler()->get_running_thread()->get_process();
+	bool at_offset = submission.flags & ring_proto::splice_at_offset;
+
+	fd_mapping_t *in;
+	auto res = process->get_fd(&in, submission.fd, CLOUDABI_RIGHT_FD_READ | (at_offset ? CLOUDABI_RIGHT_FD_SEEK : 0));
+	if(res != 0) {
+		return -res;
+	}
+	fd_mapping_t *out;
+	res = process->get_fd(&out, submission.fd2, CLOUDABI_RIGHT_FD_WRITE);
+	if(res != 0) {
+		return -res;
+	}
+	if(out->fd.get() == this) {
+		return -EINVAL;
+	}
+
+	// keep both alive, even if they are closed by another thread
+	auto in_fd = in->fd;
+	auto out_fd = out->fd;
+	cloudabi_filesize_t offset = submission.offset;
+	size_t moved;
+	res = splice(in_fd.get(), at_offset ? &offset : nullptr, out_fd.get(), submission.length, &moved);
+	if(res != 0) {
+		return -res;
+	}
+	return moved;
+}
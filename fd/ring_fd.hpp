@@ -0,0 +1,49 @@
+#pragma once
+
+#include <fd/fd.hpp>
+#include <fd/ring_proto.hpp>
+#include <concur/condition.hpp>
+
+namespace cloudos {
+
+struct thread_condition_data;
+
+/** A submission/completion ring, created with fd_create1(). It allows a
+ * process to execute many fd operations with a single trap into the kernel:
+ * writing an array of ring_proto::submission_t executes them in order, and
+ * their results are read back as an array of ring_proto::completion_t. The
+ * operations are executed by the normal system call handlers, so they have
+ * the same semantics and rights checks as the equivalent system calls,
+ * including blocking the writing thread when they would block, and they
+ * show up in the syscall statistics and trace like those system calls. The
+ * exception is splice, which has no system call; it moves data between two
+ * fds within the kernel, see splice().
+ */
+struct ring_fd : public fd_t {
+	ring_fd(const char *n);
+
+	size_t read(void *dest, size_t count) override;
+	size_t write(const char *str, size_t count) override;
+
+	cloudabi_errno_t get_read_signaler(thread_condition_signaler **s) override;
+
+	inline size_t completions_available() {
+		return num_completions;
+	}
+	thread_condition_data *allocate_current_condition_data();
+
+private:
+	int64_t execute(ring_proto::submission_t const &submission);
+	int64_t execute_splice(ring_proto::submission_t const &submission);
+	void add_completion(uint64_t user_data, int64_t result);
+
+	ring_proto::completion_t completions[ring_proto::max_completions];
+	size_t first_completion = 0;
+	size_t num_completions = 0;
+	// completions that executing submissions will add
+	size_t reserved_completions = 0;
+
+	thread_condition_signaler read_signaler;
+};
+
+}
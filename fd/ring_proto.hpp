@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace ring_proto {
+
+// fd_create1() with this file type creates a ring fd. It is outside of the
+// range of file types CloudABI defines.
+static const uint8_t filetype_ring = 0xc0;
+
+/* A submission. Submissions are queued by writing an array of them to the
+ * ring fd; they are executed in order, within that single fd_write(), with
+ * the same rights checks as the equivalent system calls. A completion is
+ * queued for every executed submission, and completions are taken from the
+ * ring by reading from it. Addresses are userland pointers, widened to 64
+ * bits.
+ */
+struct submission_t {
+	enum class operation : uint8_t {
+		nop = 0,
+		read, // buffer in addr, length in length; returns bytes read
+		write, // buffer in addr, length in length; returns bytes written
+		pread, // like read, at offset
+		pwrite, // like write, at offset
+		sock_recv, // cloudabi_recv_in_t* in addr, cloudabi_recv_out_t* in addr2
+		sock_send, // cloudabi_send_in_t* in addr, cloudabi_send_out_t* in addr2
+		poll, // subscriptions in addr, events in addr2, count in length; returns nevents
+		splice, // move length bytes from fd to fd2 in the kernel; returns bytes moved
+	} op = operation::nop;
+	uint8_t flags = 0;
+	uint16_t reserved = 0;
+	uint32_t fd = 0;
+	uint64_t addr = 0;
+	uint64_t addr2 = 0;
+	uint64_t offset = 0;
+	uint32_t length = 0;
+	uint32_t fd2 = 0;
+	uint64_t user_data = 0; // returned unchanged in the completion
+};
+
+enum submission_flags : uint8_t {
+	// if this submission fails, don't execute the submissions after it
+	// in the same write; they complete with ECANCELED
+	link = 1,
+	// for splice, read fd at offset like pread, instead of from its
+	// position
+	splice_at_offset = 2,
+};
+
+struct completion_t {
+	uint64_t user_data = 0;
+	int64_t result = 0; // < 0 is -errno, >= 0 is the result of the operation
+};
+
+// The maximum number of completions a ring holds. A write that would
+// overflow it only executes as many submissions as there is room for.
+static const size_t max_completions = 256;
+
+}
@@ -2,7 +2,9 @@
 #include "global.hpp"
 #include <fd/process_fd.hpp>
 #include <hw/interrupt.hpp>
+#include <hw/cpu_io.hpp>
 #include <hw/segments.hpp>
+#include <fd/trace.hpp>
 
 extern "C" void switch_thread(void **old_sp, void *sp);
 
@@ -110,12 +112,13 @@ void scheduler::schedule_next()
 		running->next = nullptr;
 
 		if(running->data->is_blocked() || running->data->is_exited() || !running->data->get_process()->is_running()) {
-			get_vga_stream() << "Thread: " << running->data << ", process: " << running->data->get_process() << ", " << running->data->get_process()->name << "\n";
+			get_vga_stream() << log_error << "Thread: " << running->data << ", process: " << running->data->get_process() << ", " << running->data->get_process()->name << "\n";
 			kernel_panic("A thread in the ready list was blocked or had already exited");
 		}
 	}
 
 	if(old_thread != running) {
+		account_slice(old_thread ? old_thread->data.get() : nullptr);
 		if(old_thread != nullptr) {
 			assert(old_thread->next == nullptr);
 			old_thread->data->save_sse_state();
@@ -137,6 +140,7 @@ void scheduler::schedule_next()
 			}
 		}
 
+		trace(trace_event_type::context_switch, trace_phase::instant);
 		if(running != nullptr) {
 			running->data->get_process()->install_page_directory();
 			get_gdt()->set_fsbase(running->data->get_fsbase());
@@ -146,6 +150,53 @@ void scheduler::schedule_next()
 	}
 }
 
+void scheduler::account_slice(thread *old_thread)
+{
+	uint64_t now = rdtsc();
+	uint64_t slice = now - running_since;
+	running_since = now;
+
+	if(old_thread == nullptr) {
+		idle_tsc += slice;
+		return;
+	}
+	old_thread->cpu_tsc += slice;
+	old_thread->context_switches++;
+	if(!old_thread->is_exited()) {
+		// the process of an exited thread may be gone already
+		auto &accounting = old_thread->get_process()->get_accounting();
+		accounting.cpu_tsc += slice;
+		accounting.context_switches++;
+	}
+}
+
+uint64_t scheduler::get_thread_cpu_tsc(thread *thr)
+{
+	uint64_t res = thr->get_cpu_tsc();
+	if(running && running->data.get() == thr) {
+		res += rdtsc() - running_since;
+	}
+	return res;
+}
+
+uint64_t scheduler::get_process_cpu_tsc(process_fd *process)
+{
+	uint64_t res = process->get_accounting().cpu_tsc;
+	if(running && running->data->get_process() == process) {
+		res += rdtsc() - running_since;
+	}
+	return res;
+}
+
+uint64_t scheduler::get_idle_tsc()
+{
+	uint64_t res = idle_tsc;
+	if(!running) {
+		res += rdtsc() - running_since;
+	}
+	return res;
+}
+
 void scheduler::thread_ready(shared_ptr<thread> fd)
 {
 	// add to ready
@@ -23,14 +23,26 @@ struct scheduler {
 
 	shared_ptr<thread> get_running_thread();
 
+	/** CPU time used by the given thread or process in TSC ticks,
+	 * including the time since it was last switched to, if running. */
+	uint64_t get_thread_cpu_tsc(thread *thr);
+	uint64_t get_process_cpu_tsc(process_fd *process);
+	/** Time during which no thread was running, in TSC ticks. */
+	uint64_t get_idle_tsc();
+
 private:
 	void wait_for_next();
 	void schedule_next();
+	void account_slice(thread *old_thread);
 
 	thread_list *running = nullptr;
 	thread_list *ready = nullptr;
 	thread_list *dealloc_later = nullptr;
 	bool waiting_for_ready_task = true;
+
+	// TSC at the last switch
+	uint64_t running_since = 0;
+	uint64_t idle_tsc = 0;
 };
 
 }
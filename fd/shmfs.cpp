@@ -1,4 +1,5 @@
 #include "shmfs.hpp"
+#include <oslibc/iovec.hpp>
 
 using namespace cloudos;
 
@@ -8,6 +9,8 @@ struct shmfd : public fd_t {
 
 	size_t pread(void *str, size_t count, size_t offset) override;
 	size_t pwrite(const char *str, size_t count, size_t offset) override;
+	size_t preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset) override;
+	size_t pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset) override;
 	void file_stat_fput(const cloudabi_filestat_t*, cloudabi_fsflags_t) override;
 	void file_stat_fget(cloudabi_filestat_t *buf) override;
 
@@ -71,6 +74,36 @@ size_t shmfd::pwrite(const char *str, size_t count, size_t offset)
 	return count;
 }
 
+size_t shmfd::preadv(const cloudabi_iovec_t *iov, size_t iovcnt, size_t offset)
+{
+	size_t total = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		total += pread(iov[i].buf, iov[i].buf_len, offset + total);
+	}
+	error = 0;
+	return total;
+}
+
+size_t shmfd::pwritev(const cloudabi_ciovec_t *iov, size_t iovcnt, size_t offset)
+{
+	size_t total = 0;
+	for(size_t i = 0; i < iovcnt; ++i) {
+		total += iov[i].buf_len;
+	}
+	if(total == 0) {
+		error = 0;
+		return 0;
+	}
+	// grow once for all buffers, instead of once per buffer
+	if(alloc.size < offset + total) {
+		resize(offset + total);
+	}
+	size_t copied = veccpy(reinterpret_cast<char*>(alloc.ptr) + offset, total, iov, iovcnt, 0);
+	assert(copied == total);
+	error = 0;
+	return copied;
+}
+
 void shmfd::file_stat_fput(const cloudabi_filestat_t *buf, cloudabi_fsflags_t flags)
 {
 	if(flags & CLOUDABI_FILESTAT_SIZE) {
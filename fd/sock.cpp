@@ -14,31 +14,40 @@ size_t sock_t::read(void *dest, size_t count)
 	cloudabi_iovec_t iovec[1];
 	iovec[0].buf = dest;
 	iovec[0].buf_len = count;
+	return readv(iovec, 1);
+}
+
+size_t sock_t::write(const char *str, size_t count)
+{
+	cloudabi_ciovec_t iovec[1];
+	iovec[0].buf = str;
+	iovec[0].buf_len = count;
+	return writev(iovec, 1);
+}
 
+size_t sock_t::readv(const cloudabi_iovec_t *iov, size_t iovcnt)
+{
 	cloudabi_recv_in_t recv_in[1];
-	recv_in[0].ri_data = &iovec[0];
-	recv_in[0].ri_data_len = 1;
+	recv_in[0].ri_data = iov;
+	recv_in[0].ri_data_len = iovcnt;
 	recv_in[0].ri_fds = nullptr;
 	recv_in[0].ri_fds_len = 0;
 	recv_in[0].ri_flags = 0;
 
 	cloudabi_recv_out_t recv_out[1];
 	recv_out[0].ro_datalen = 0;
+	recv_out[0].ro_fdslen = 0;
 
 	sock_recv(recv_in, recv_out);
 	assert(recv_out[0].ro_fdslen == 0);
 	return recv_out[0].ro_datalen;
 }
 
-size_t sock_t::write(const char *str, size_t count)
+size_t sock_t::writev(const cloudabi_ciovec_t *iov, size_t iovcnt)
 {
-	cloudabi_ciovec_t iovec[1];
-	iovec[0].buf = str;
-	iovec[0].buf_len = count;
-
 	cloudabi_send_in_t send_in[1];
-	send_in[0].si_data = &iovec[0];
-	send_in[0].si_data_len = 1;
+	send_in[0].si_data = iov;
+	send_in[0].si_data_len = iovcnt;
 	send_in[0].si_fds = nullptr;
 	send_in[0].si_fds_len = 0;
 	send_in[0].si_flags = 0;
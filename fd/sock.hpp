@@ -17,6 +17,8 @@ struct sock_t : public fd_t {
 
 	size_t read(void *dest, size_t count) override;
 	size_t write(const char *str, size_t count) override;
+	size_t readv(const cloudabi_iovec_t *iov, size_t iovcnt) override;
+	size_t writev(const cloudabi_ciovec_t *iov, size_t iovcnt) override;
 
 	void sock_shutdown(cloudabi_sdflags_t /*how*/) override
 	{
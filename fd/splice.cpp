@@ -0,0 +1,122 @@
+#include <fd/splice.hpp>
+
+using namespace cloudos;
+
+static const size_t BOUNCE_BUFFER_SIZE = 16384;
+
+// write all of buf to out, returns the number of bytes written
+static size_t write_all(fd_t *out, const char *buf, size_t length) {
+	size_t written = 0;
+	while(written < length) {
+		size_t w = out->write(buf + written, length - written);
+		if(out->error != 0 || w == 0) {
+			break;
+		}
+		written += w;
+	}
+	return written;
+}
+
+// only these can give back bytes that were read but not written
+static bool is_seekable(fd_t *fd) {
+	return fd->type == CLOUDABI_FILETYPE_REGULAR_FILE || fd->type == CLOUDABI_FILETYPE_BLOCK_DEVICE;
+}
+
+// move the read position of in back by count bytes
+static void unread(fd_t *in, cloudabi_filesize_t *offset, size_t count) {
+	if(offset) {
+		*offset -= count;
+	} else {
+		in->seek(-cloudabi_filedelta_t(count), CLOUDABI_WHENCE_CUR);
+	}
+}
+
+cloudabi_errno_t cloudos::splice(fd_t *in, cloudabi_filesize_t *offset, fd_t *out, size_t count, size_t *moved) {
+	*moved = 0;
+	cloudabi_errno_t error = 0;
+
+	// fast path, in gives us a buffer to write from
+	bool use_splice_read = true;
+	while(*moved < count && use_splice_read) {
+		size_t requested = count - *moved;
+		size_t length;
+		Blk buf = in->splice_read(requested, offset, &length);
+		if(in->error == ENOTSUP) {
+			use_splice_read = false;
+			break;
+		}
+		if(in->error != 0) {
+			error = in->error;
+			break;
+		}
+		size_t written = write_all(out, reinterpret_cast<char*>(buf.ptr), length);
+		if(buf.size > 0) {
+			deallocate(buf);
+		}
+		*moved += written;
+		if(written < length) {
+			error = out->error;
+			// only regular files get here, so the position can be
+			// moved back to what was actually moved
+			unread(in, offset, length - written);
+			break;
+		}
+		// a short read means the end of a file, or that a socket has
+		// nothing more to read for now; files may also return less
+		// than requested if in reads in limited chunks
+		if(length == 0 || (in->type != CLOUDABI_FILETYPE_REGULAR_FILE && length < requested)) {
+			break;
+		}
+	}
+
+	if(!use_splice_read) {
+		Blk bounce = allocate(BOUNCE_BUFFER_SIZE);
+		if(bounce.ptr == nullptr) {
+			return ENOMEM;
+		}
+		char *buf = reinterpret_cast<char*>(bounce.ptr);
+		// bytes read from a pipe or socket can't be given back, so
+		// don't read more of them than out will accept
+		bool seekable = offset != nullptr || is_seekable(in);
+		while(*moved < count) {
+			size_t chunk = count - *moved;
+			if(chunk > bounce.size) {
+				chunk = bounce.size;
+			}
+			if(!seekable) {
+				size_t space = out->write_space();
+				if(space == 0) {
+					error = EAGAIN;
+					break;
+				}
+				if(chunk > space) {
+					chunk = space;
+				}
+			}
+			size_t length = offset ? in->pread(buf, chunk, *offset) : in->read(buf, chunk);
+			if(in->error != 0) {
+				error = in->error;
+				break;
+			}
+			if(offset) {
+				*offset += length;
+			}
+			size_t written = write_all(out, buf, length);
+			*moved += written;
+			if(written < length) {
+				error = out->error;
+				if(seekable) {
+					unread(in, offset, length - written);
+				}
+				break;
+			}
+			if(length < chunk) {
+				// end of file, or nothing more to read for now
+				break;
+			}
+		}
+		deallocate(bounce);
+	}
+
+	return *moved > 0 ? 0 : error;
+}
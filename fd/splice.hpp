@@ -0,0 +1,25 @@
+#pragma once
+
+#include <fd/fd.hpp>
+
+namespace cloudos {
+
+/** Move up to count bytes from in to out, without copying them through
+ * userland. If offset is given, in is read at *offset like pread(), and
+ * *offset is advanced; otherwise, in is read from its current position. out
+ * is always written at its current position.
+ *
+ * If in supports splice_read(), like pseudo FD files do, the data is moved in
+ * chunks as large as in returns, straight from the buffer it read into.
+ * Otherwise, it is moved through a kernel bounce buffer.
+ *
+ * Stops at the end of in, or when out accepts less than it was given. Bytes
+ * out didn't accept are left in in: a seekable in is moved back to just after
+ * the last byte moved, and no more is read from a pipe or socket than
+ * out->write_space() allows.
+ * Returns the number of bytes moved in *moved; an error is only returned if
+ * no bytes could be moved.
+ */
+cloudabi_errno_t splice(fd_t *in, cloudabi_filesize_t *offset, fd_t *out, size_t count, size_t *moved);
+
+}
@@ -141,8 +141,8 @@ void thread::interrupt(int int_no, int err_code)
 		return;
 	}
 
-	get_vga_stream() << "Thread " << this << " (process " << process << ", name \"" << process->name << "\") encountered fatal interrupt:\n";
-	get_vga_stream() << "  " << int_num_to_name(int_no, nullptr) << " at eip=0x" << hex << state.eip << dec << "\n";
+	get_vga_stream() << log_error << "Thread " << this << " (process " << process << ", name \"" << process->name << "\") encountered fatal interrupt:\n";
+	get_vga_stream() << log_error << "  " << int_num_to_name(int_no, nullptr) << " at eip=0x" << hex << state.eip << dec << "\n";
 
 	if(int_no == 0x0e /* Page fault */) {
 		auto &stream = get_vga_stream();
@@ -186,59 +186,12 @@ void thread::handle_syscall() {
 
 	syscall_context c(this, reinterpret_cast<void*>(state.useresp));
 	cloudabi_errno_t error;
+	uint32_t syscall = state.eax;
 
-	switch(state.eax) {
-	case 0:  error = syscall_clock_res_get(c); break;
-	case 1:  error = syscall_clock_time_get(c); break;
-	case 2:  error = syscall_condvar_signal(c); break;
-	case 3:  error = syscall_fd_close(c); break;
-	case 4:  error = syscall_fd_create1(c); break;
-	case 5:  error = syscall_fd_create2(c); break;
-	case 6:  error = syscall_fd_datasync(c); break;
-	case 7:  error = syscall_fd_dup(c); break;
-	case 8:  error = syscall_fd_pread(c); break;
-	case 9:  error = syscall_fd_pwrite(c); break;
-	case 10: error = syscall_fd_read(c); break;
-	case 11: error = syscall_fd_replace(c); break;
-	case 12: error = syscall_fd_seek(c); break;
-	case 13: error = syscall_fd_stat_get(c); break;
-	case 14: error = syscall_fd_stat_put(c); break;
-	case 15: error = syscall_fd_sync(c); break;
-	case 16: error = syscall_fd_write(c); break;
-	case 17: error = syscall_file_advise(c); break;
-	case 18: error = syscall_file_allocate(c); break;
-	case 19: error = syscall_file_create(c); break;
-	case 20: error = syscall_file_link(c); break;
-	case 21: error = syscall_file_open(c); break;
-	case 22: error = syscall_file_readdir(c); break;
-	case 23: error = syscall_file_readlink(c); break;
-	case 24: error = syscall_file_rename(c); break;
-	case 25: error = syscall_file_stat_fget(c); break;
-	case 26: error = syscall_file_stat_fput(c); break;
-	case 27: error = syscall_file_stat_get(c); break;
-	case 28: error = syscall_file_stat_put(c); break;
-	case 29: error = syscall_file_symlink(c); break;
-	case 30: error = syscall_file_unlink(c); break;
-	case 31: error = syscall_lock_unlock(c); break;
-	case 32: error = syscall_mem_advise(c); break;
-	case 33: error = syscall_mem_map(c); break;
-	case 34: error = syscall_mem_protect(c); break;
-	case 35: error = syscall_mem_sync(c); break;
-	case 36: error = syscall_mem_unmap(c); break;
-	case 37: error = syscall_poll(c); break;
-	case 38: error = syscall_proc_exec(c); break;
-	case 39: error = syscall_proc_exit(c); break;
-	case 40: error = syscall_proc_fork(c); break;
-	case 41: error = syscall_proc_raise(c); break;
-	case 42: error = syscall_random_get(c); break;
-	case 43: error = syscall_sock_recv(c); break;
-	case 44: error = syscall_sock_send(c); break;
-	case 45: error = syscall_sock_shutdown(c); break;
-	case 46: error = syscall_thread_create(c); break;
-	case 47: error = syscall_thread_exit(c); break;
-	case 48: error = syscall_thread_yield(c); break;
-	default:
-		get_vga_stream() << "Syscall " << state.eax << " unknown, signalling process\n";
+	if(syscall < NUM_SYSCALLS) {
+		error = call_syscall(syscall, c);
+	} else {
+		get_vga_stream() << log_warning << "Syscall " << syscall << " unknown, signalling process\n";
 		process->signal(CLOUDABI_SIGSYS);
 		error = ENOSYS;
 	}
@@ -364,12 +317,12 @@ void thread::drop_userspace_lock(_Atomic(cloudabi_lock_t) *lock)
 	// lock into a write-lock, then unlocks it. so, we only support
 	// unlocking write-locks.
 	if((*lock & CLOUDABI_LOCK_WRLOCKED) == 0) {
-		get_vga_stream() << "drop_userspace_lock: lock not acquired for writing\n";
+		get_vga_stream() << log_warning << "drop_userspace_lock: lock not acquired for writing\n";
 		return;
 	}
 
 	if((*lock & 0x3fffffff) != thread_id) {
-		get_vga_stream() << "drop_userspace_lock: lock not acquired by this thread\n";
+		get_vga_stream() << log_warning << "drop_userspace_lock: lock not acquired by this thread\n";
 		return;
 	}
 
@@ -433,7 +386,7 @@ thread_condition_signaler *thread::wait_userspace_cv_signaler(_Atomic(cloudabi_l
 	userland_condvar_waiters_t *condvar_cv = process->get_or_create_userland_condvar_cv(condvar, lock);
 	if(condvar_cv->lock != lock) {
 		// TODO: ASAN triggers this --- why? Try to continue
-		get_vga_stream() << "*** Bug: condvar lock mismatch from userland ***\n";
+		get_vga_stream() << log_error << "*** Bug: condvar lock mismatch from userland ***\n";
 		condvar_cv->lock = lock;
 	}
 
@@ -514,7 +467,7 @@ void thread::cancel_userspace_cv(_Atomic(cloudabi_lock_t) *lock, _Atomic(cloudab
 
 	if(condvar_cv->lock != lock) {
 		// TODO: ASAN triggers this --- why? Try to continue
-		get_vga_stream() << "*** Bug: condvar lock mismatch from userland ***\n";
+		get_vga_stream() << log_error << "*** Bug: condvar lock mismatch from userland ***\n";
 		condvar_cv->lock = lock;
 	}
 
@@ -59,6 +59,11 @@ struct thread : enable_shared_from_this<thread> {
 
 	inline process_fd *get_process() { return process; }
 
+	/** CPU time used by this thread in TSC ticks, not counting the time
+	 * since it was last switched to. See scheduler::get_thread_cpu_tsc(). */
+	inline uint64_t get_cpu_tsc() { return cpu_tsc; }
+	inline uint64_t get_context_switches() { return context_switches; }
+
 	inline bool is_exited() { return exited; }
 	bool is_ready();
 	inline bool is_blocked() { return blocked; }
@@ -94,6 +99,10 @@ private:
 	bool blocked = false;
 	bool unscheduled = false;
 
+	// accounting, updated by the scheduler
+	uint64_t cpu_tsc = 0;
+	uint64_t context_switches = 0;
+
 	interrupt_state_t state;
 	sse_state_t sse_state;
 	void *userland_stack_top = nullptr;
@@ -0,0 +1,90 @@
+#include <fd/trace.hpp>
+#include <fd/scheduler.hpp>
+#include <fd/process_fd.hpp>
+#include <hw/cpu_io.hpp>
+#include <oslibc/string.h>
+#include <time/clock_store.hpp>
+
+using namespace cloudos;
+
+static uint64_t monotonic_ns() {
+	return get_clock_store()->get_clock(CLOUDABI_CLOCK_MONOTONIC)->get_time(0);
+}
+
+cloudabi_errno_t tracer::start(size_t n) {
+	enabled = false;
+	if(ring.ptr == nullptr || num_events != n) {
+		if(ring.ptr != nullptr) {
+			deallocate(ring);
+		}
+		ring = allocate(n * sizeof(trace_event));
+		if(ring.ptr == nullptr) {
+			num_events = 0;
+			return ENOMEM;
+		}
+		num_events = n;
+	}
+	next_pos = 0;
+	start_tsc = rdtsc();
+	start_ns = monotonic_ns();
+	enabled = true;
+	return 0;
+}
+
+void tracer::stop() {
+	enabled = false;
+}
+
+void tracer::record(trace_event_type type, trace_phase phase, uint32_t arg) {
+	uint64_t pos = __atomic_fetch_add(&next_pos, 1, __ATOMIC_RELAXED);
+	auto &event = reinterpret_cast<trace_event*>(ring.ptr)[pos % num_events];
+	event.tsc = rdtsc();
+	event.pid = 0;
+	event.tid = 0;
+	auto thr = get_scheduler()->get_running_thread();
+	if(thr) {
+		uint8_t pid[16];
+		thr->get_process()->get_pid(pid, sizeof(pid));
+		memcpy(&event.pid, pid, sizeof(event.pid));
+		event.tid = thr->get_thread_id();
+	}
+	event.arg = arg;
+	event.type = type;
+	event.phase = phase;
+	event.reserved = 0;
+}
+
+Blk tracer::snapshot(size_t *length) {
+	// don't record while copying, so the copy isn't torn
+	bool was_enabled = enabled;
+	enabled = false;
+
+	uint64_t recorded = next_pos;
+	size_t count = recorded < num_events ? recorded : num_events;
+	*length = sizeof(trace_header) + count * sizeof(trace_event);
+	Blk b = allocate(*length);
+	if(b.ptr == nullptr) {
+		enabled = was_enabled;
+		*length = 0;
+		return b;
+	}
+
+	auto *header = reinterpret_cast<trace_header*>(b.ptr);
+	header->magic = trace_header::MAGIC;
+	header->version = trace_header::VERSION;
+	header->event_size = sizeof(trace_event);
+	header->num_events = count;
+	header->lost_events = recorded - count;
+	header->start_tsc = start_tsc;
+	header->start_ns = start_ns;
+	header->end_tsc = rdtsc();
+	header->end_ns = monotonic_ns();
+
+	auto *events = reinterpret_cast<trace_event*>(header + 1);
+	for(size_t i = 0; i < count; ++i) {
+		events[i] = reinterpret_cast<trace_event*>(ring.ptr)[(recorded - count + i) % num_events];
+	}
+
+	enabled = was_enabled;
+	return b;
+}
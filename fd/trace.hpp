@@ -0,0 +1,95 @@
+#pragma once
+
+#include <global.hpp>
+#include <memory/allocation.hpp>
+#include <oslibc/error.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cloudos {
+
+enum class trace_event_type : uint8_t {
+	syscall = 1, // arg is the syscall number
+	context_switch, // instant, pid/tid are of the thread switched to
+	pagefault, // arg is the faulting address
+	reverse_request, // arg is the reverse_request_t operation
+	irq, // arg is the IRQ number
+};
+
+enum class trace_phase : uint8_t {
+	begin = 'B',
+	end = 'E',
+	instant = 'i',
+};
+
+/** A single trace event as it is stored in the ring and exported. pid is
+ * the first four bytes of the process UUID, tid the thread ID within it.
+ */
+struct trace_event {
+	uint64_t tsc;
+	uint32_t pid;
+	uint32_t tid;
+	uint32_t arg;
+	trace_event_type type;
+	trace_phase phase;
+	uint16_t reserved;
+};
+static_assert(sizeof(trace_event) == 24, "trace_event must be packed");
+
+/** The header in front of the events in kernel/trace. The TSC and monotonic
+ * clock values at start and end allow the decoder to convert TSC values to
+ * time.
+ */
+struct trace_header {
+	static constexpr uint32_t MAGIC = 0x43525443; // "CTRC"
+	static constexpr uint32_t VERSION = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t event_size;
+	uint32_t num_events;
+	uint64_t lost_events;
+	uint64_t start_tsc;
+	uint64_t start_ns;
+	uint64_t end_tsc;
+	uint64_t end_ns;
+};
+
+/** The tracer records events from static tracepoints in the kernel into a
+ * ring buffer, overwriting the oldest events when it is full. When tracing
+ * is disabled, a tracepoint costs a load and a not-taken branch.
+ */
+struct tracer {
+	static constexpr size_t DEFAULT_NUM_EVENTS = 16384;
+
+	bool enabled = false;
+
+	/** (Re)start tracing into an empty ring of the given size. */
+	cloudabi_errno_t start(size_t num_events = DEFAULT_NUM_EVENTS);
+	void stop();
+
+	void record(trace_event_type type, trace_phase phase, uint32_t arg);
+
+	/** Returns a newly allocated copy of the trace, consisting of a
+	 * trace_header followed by the events, oldest first. The caller
+	 * owns the returned allocation.
+	 */
+	Blk snapshot(size_t *length);
+
+private:
+	Blk ring = {};
+	size_t num_events = 0;
+	uint64_t next_pos = 0;
+	uint64_t start_tsc = 0;
+	uint64_t start_ns = 0;
+};
+
+/** A static tracepoint. */
+inline void trace(trace_event_type type, trace_phase phase, uint32_t arg = 0) {
+	tracer *t = global_state_->tracer;
+	if(__builtin_expect(t != nullptr && t->enabled, 0)) {
+		t->record(type, phase, arg);
+	}
+}
+
+}
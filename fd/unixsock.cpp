@@ -34,18 +34,25 @@ unixsock::~unixsock()
 	if(o) {
 		o->error = ECONNRESET;
 	}
-	remove_all(&recv_messages, [&](unixsock_message_list *) {
-		return true;
-	}, [&](unixsock_message_list *item) {
-		remove_all(&item->data->fd_list, [&](linked_list<fd_mapping_t> *) {
-			return true;
-		});
-		deallocate(item->data->buf);
-		deallocate(item->data);
-		deallocate(item);
-	});
-
-	assert(recv_messages == nullptr);
+	while(recv_messages) {
+		auto *message = recv_messages;
+		recv_messages = message->next;
+		clear(&message->fd_list);
+		size_t size = sizeof(unixsock_message) + message->size;
+		message->~unixsock_message();
+		deallocate({message, size});
+	}
+	recv_messages_tail = nullptr;
+	while(recv_fds) {
+		auto *attachment = recv_fds;
+		recv_fds = attachment->next;
+		clear(&attachment->fd_list);
+		deallocate(attachment);
+	}
+	recv_fds_tail = nullptr;
+	if(ring.ptr) {
+		deallocate(ring);
+	}
 }
 
 size_t unixsock::bytes_readable() const
@@ -55,7 +62,7 @@ size_t unixsock::bytes_readable() const
 
 bool unixsock::is_readable()
 {
-	if(recv_messages != nullptr) {
+	if(recv_messages != nullptr || num_recv_bytes > 0 || recv_fds != nullptr) {
 		return true;
 	}
 	return is_shutdown();
@@ -78,6 +85,17 @@ bool unixsock::is_writeable()
 	return other->num_recv_bytes != MAX_SIZE_BUFFERS;
 }
 
+size_t unixsock::write_space()
+{
+	if(status != sockstatus_t::CONNECTED) {
+		// writing will fail with a proper error
+		return SIZE_MAX;
+	}
+	auto other = othersock.lock();
+	assert(other);
+	return MAX_SIZE_BUFFERS - other->num_recv_bytes;
+}
+
 thread_condition_data *unixsock::allocate_current_condition_data() {
 	auto *cd = allocate<thread_condition_data_fd_readwrite>();
 	cd->nbytes = bytes_readable();
@@ -111,48 +129,6 @@ void unixsock::socketpair(shared_ptr<unixsock> other)
 	other->othersock = weak_from_this();
 }
 
-size_t unixsock::read(void *dest, size_t count)
-{
-	cloudabi_iovec_t iovec[1];
-	iovec[0].buf = dest;
-	iovec[0].buf_len = count;
-
-	cloudabi_recv_in_t recv_in[1];
-	recv_in[0].ri_data = &iovec[0];
-	recv_in[0].ri_data_len = 1;
-	recv_in[0].ri_fds = nullptr;
-	recv_in[0].ri_fds_len = 0;
-	recv_in[0].ri_flags = 0;
-
-	cloudabi_recv_out_t recv_out[1];
-	recv_out[0].ro_datalen = 0;
-	recv_out[0].ro_fdslen = 0;
-
-	sock_recv(recv_in, recv_out);
-	assert(recv_out[0].ro_fdslen == 0);
-	return recv_out[0].ro_datalen;
-}
-
-size_t unixsock::write(const char *str, size_t count)
-{
-	cloudabi_ciovec_t iovec[1];
-	iovec[0].buf = str;
-	iovec[0].buf_len = count;
-
-	cloudabi_send_in_t send_in[1];
-	send_in[0].si_data = &iovec[0];
-	send_in[0].si_data_len = 1;
-	send_in[0].si_fds = nullptr;
-	send_in[0].si_fds_len = 0;
-	send_in[0].si_flags = 0;
-
-	cloudabi_send_out_t send_out[1];
-	send_out[0].so_datalen = 0;
-
-	sock_send(send_in, send_out);
-	return send_out[0].so_datalen;
-}
-
 void unixsock::sock_shutdown(cloudabi_sdflags_t how)
 {
 	if(status != sockstatus_t::CONNECTED) {
@@ -174,6 +150,106 @@ void unixsock::sock_shutdown(cloudabi_sdflags_t how)
 	error = 0;
 }
 
+bool unixsock::reserve_ring(size_t size)
+{
+	size_t needed = num_recv_bytes + size;
+	assert(needed <= MAX_SIZE_BUFFERS);
+	if(ring.size >= needed) {
+		return true;
+	}
+
+	size_t new_size = ring.size == 0 ? MIN_RING_SIZE : ring.size;
+	while(new_size < needed) {
+		new_size *= 2;
+	}
+	if(new_size > MAX_SIZE_BUFFERS) {
+		new_size = MAX_SIZE_BUFFERS;
+	}
+	Blk new_ring = allocate(new_size);
+	if(new_ring.ptr == nullptr) {
+		return false;
+	}
+	// linearize the existing contents at the start of the new ring
+	if(num_recv_bytes > 0) {
+		copy_from_ring(0, reinterpret_cast<char*>(new_ring.ptr), num_recv_bytes);
+	}
+	if(ring.ptr) {
+		deallocate(ring);
+	}
+	ring = new_ring;
+	ring_head = 0;
+	return true;
+}
+
+void unixsock::copy_to_ring(const char *src, size_t size)
+{
+	assert(num_recv_bytes + size <= ring.size);
+	if(size == 0) {
+		return;
+	}
+	char *buf = reinterpret_cast<char*>(ring.ptr);
+	size_t tail = (ring_head + num_recv_bytes) % ring.size;
+	size_t first = ring.size - tail < size ? ring.size - tail : size;
+	memcpy(buf + tail, src, first);
+	memcpy(buf, src + first, size - first);
+	num_recv_bytes += size;
+}
+
+void unixsock::copy_from_ring(size_t offset, char *dst, size_t size)
+{
+	assert(offset + size <= num_recv_bytes);
+	if(size == 0) {
+		return;
+	}
+	const char *buf = reinterpret_cast<const char*>(ring.ptr);
+	size_t start = (ring_head + offset) % ring.size;
+	size_t first = ring.size - start < size ? ring.size - start : size;
+	memcpy(dst, buf + start, first);
+	memcpy(dst + first, buf, size - first);
+}
+
+cloudabi_errno_t unixsock::collect_fds(const cloudabi_send_in_t *in, linked_list<fd_mapping_t> **fd_list)
+{
+	auto process = get_scheduler()->get_running_thread()->get_process();
+	for(size_t i = 0; i < in->si_fds_len; ++i) {
+		cloudabi_fd_t fdnum = in->si_fds[i];
+		fd_mapping_t *fd_mapping;
+		auto res = process->get_fd(&fd_mapping, fdnum, 0);
+		if(res != 0) {
+			clear(fd_list);
+			return res;
+		}
+		fd_mapping_t fd_mapping_copy = *fd_mapping;
+		auto *fd_item = allocate<linked_list<fd_mapping_t>>(fd_mapping_copy);
+		append(fd_list, fd_item);
+	}
+	return 0;
+}
+
+void unixsock::receive_fds(linked_list<fd_mapping_t> **fd_list, const cloudabi_recv_in_t *in, size_t &fds_set, cloudabi_roflags_t &ro_flags, bool peek)
+{
+	auto process = get_scheduler()->get_running_thread()->get_process();
+	auto *fd_item = *fd_list;
+	while(fd_item) {
+		if(fds_set < in->ri_fds_len) {
+			fd_mapping_t &fd_map = fd_item->data;
+			in->ri_fds[fds_set] = process->add_fd(fd_map.fd, fd_map.rights_base, fd_map.rights_inheriting);
+			fds_set++;
+		} else if(in->ri_fds_len > 0) {
+			// if userland did not ask for FDs at all, we shouldn't set FDS_TRUNCATED
+			ro_flags |= CLOUDABI_SOCK_RECV_FDS_TRUNCATED;
+		}
+		auto d = fd_item;
+		fd_item = fd_item->next;
+		if(!peek) {
+			deallocate(d);
+		}
+	}
+	if(!peek) {
+		*fd_list = nullptr;
+	}
+}
+
 void unixsock::sock_recv(const cloudabi_recv_in_t* in, cloudabi_recv_out_t *out)
 {
 	out->ro_flags = 0;
@@ -200,17 +276,16 @@ void unixsock::sock_recv(const cloudabi_recv_in_t* in, cloudabi_recv_out_t *out)
 
 	while(true) {
 		// see if condition is already satisfied
-		if(waitall) {
-			// count number of bytes present
-			size_t bytes_present = 0;
-			for(auto *message = recv_messages; message; message = message->next) {
-				bytes_present += message->data->buf.size - message->data->stream_data_recv;
+		if(type == CLOUDABI_FILETYPE_SOCKET_DGRAM) {
+			if(recv_messages != nullptr) {
+				break;
 			}
-			if(bytes_present >= wanted_data) {
+		} else if(waitall) {
+			if(num_recv_bytes >= wanted_data) {
 				break;
 			}
 		} else {
-			if(recv_messages != nullptr) {
+			if(num_recv_bytes > 0 || recv_fds != nullptr) {
 				break;
 			}
 		}
@@ -235,154 +310,106 @@ void unixsock::sock_recv(const cloudabi_recv_in_t* in, cloudabi_recv_out_t *out)
 		recv_messages_cv.wait();
 		other = othersock.lock();
 	}
-	assert(recv_messages);
 
 	if(type == CLOUDABI_FILETYPE_SOCKET_DGRAM) {
-		// Datagram receiving: take next message; fill current buffers
-		// with only it
-		auto item = recv_messages;
-		auto message = item->data;
-		if(!peek) {
-			recv_messages = item->next;
-			deallocate(item);
-		}
+		recv_dgram(in, out, peek);
+	} else {
+		recv_stream(in, out, peek);
+	}
+}
 
-		size_t bytes_copied = veccpy(in->ri_data, in->ri_data_len, message->buf, 0);
-		out->ro_flags = bytes_copied < message->buf.size ? CLOUDABI_SOCK_RECV_DATA_TRUNCATED : 0;
-
-		auto *fd_item = message->fd_list;
-		size_t fds_set = 0;
-		auto process = get_scheduler()->get_running_thread()->get_process();
-		while(fd_item) {
-			if(fds_set < in->ri_fds_len) {
-				fd_mapping_t &fd_map = fd_item->data;
-				in->ri_fds[fds_set] = process->add_fd(fd_map.fd, fd_map.rights_base, fd_map.rights_inheriting);
-				fds_set++;
-			} else if(in->ri_fds_len > 0) {
-				// if userland did not ask for FDs at all, we shouldn't set FDS_TRUNCATED
-				out->ro_flags |= CLOUDABI_SOCK_RECV_FDS_TRUNCATED;
-			}
-			auto d = fd_item;
-			fd_item = fd_item->next;
-			if(!peek) {
-				deallocate(d);
-			}
+void unixsock::recv_dgram(const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, bool peek)
+{
+	// Datagram receiving: take next message; fill current buffers
+	// with only it
+	auto *message = recv_messages;
+	assert(message);
+	if(!peek) {
+		recv_messages = message->next;
+		if(recv_messages == nullptr) {
+			recv_messages_tail = nullptr;
 		}
+	}
 
-		num_recv_bytes -= bytes_copied;
-		out->ro_datalen = bytes_copied;
-		out->ro_fdslen = fds_set;
-		error = 0;
+	size_t bytes_copied = veccpy(in->ri_data, in->ri_data_len, message->data(), message->size, 0);
+	out->ro_flags = bytes_copied < message->size ? CLOUDABI_SOCK_RECV_DATA_TRUNCATED : 0;
 
+	size_t fds_set = 0;
+	receive_fds(&message->fd_list, in, fds_set, out->ro_flags, peek);
+
+	out->ro_datalen = bytes_copied;
+	out->ro_fdslen = fds_set;
+	error = 0;
+
+	if(!peek) {
+		// the whole datagram is consumed, even if it was truncated
+		num_recv_bytes -= message->size;
+		size_t size = sizeof(unixsock_message) + message->size;
+		message->~unixsock_message();
+		deallocate({message, size});
+		send_signaler.condition_broadcast();
+	}
+}
+
+void unixsock::recv_stream(const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, bool peek)
+{
+	// Stream receiving: copy from the ring into the current buffers until
+	// they are full. File descriptors attached to the data at the read
+	// position are received along with it, but file descriptors attached
+	// to later data act as read boundaries, i.e. the read stops before
+	// that data.
+	out->ro_flags = 0;
+	size_t fds_set = 0;
+
+	auto *attachment = recv_fds;
+	while(attachment && attachment->offset <= stream_offset) {
+		receive_fds(&attachment->fd_list, in, fds_set, out->ro_flags, peek);
+		auto *next = attachment->next;
 		if(!peek) {
-			deallocate(message->buf);
-			deallocate(message);
-			send_signaler.condition_broadcast();
-		}
-	} else if(type == CLOUDABI_FILETYPE_SOCKET_STREAM) {
-		// Stream receiving: while the current buffers aren't full,
-		// fill them with parts of the next message, taking them off
-		// the list when they are fully consumed.
-		// However, if a new buffer contains file descriptors, these
-		// act as read boundaries, i.e. the read stops before the data.
-
-		auto *recv_message = recv_messages;
-		size_t total_written = 0;
-		size_t messages_consumed = 0;
-		bool next_message_read = false;
-		bool fd_boundary_encountered = false;
-		size_t stream_data_recv = recv_message->data->stream_data_recv;
-		for(size_t i = 0; i < in->ri_data_len && recv_message && !fd_boundary_encountered; ++i) {
-			auto &iovec = in->ri_data[i];
-			size_t written = 0;
-			while(written < iovec.buf_len && recv_message && !fd_boundary_encountered) {
-				auto *body = recv_message->data;
-				assert(body->buf.size >= stream_data_recv);
-				size_t message_remaining = body->buf.size - stream_data_recv;
-				if(message_remaining > 0) {
-					size_t iovec_remaining = iovec.buf_len - written;
-					size_t copy = iovec_remaining < message_remaining ? iovec_remaining : message_remaining;
-					memcpy(reinterpret_cast<char*>(iovec.buf) + written,
-						reinterpret_cast<char*>(body->buf.ptr) + stream_data_recv, copy);
-					stream_data_recv += copy;
-					if(!peek) {
-						body->stream_data_recv = stream_data_recv;
-					}
-					written += copy;
-					message_remaining -= copy;
-					assert(copy > 0);
-					next_message_read = true;
-				}
-				if(message_remaining == 0) {
-					// no data left in this buffer
-					recv_message = recv_message->next;
-					if(recv_message) {
-						stream_data_recv = recv_message->data->stream_data_recv;
-					}
-					++messages_consumed;
-					next_message_read = false;
-
-					// move on to the next buffer only if it has no file descriptors
-					// attached to it; these act as a read boundary
-					fd_boundary_encountered = recv_message && recv_message->data->fd_list != nullptr;
-				}
+			recv_fds = next;
+			if(recv_fds == nullptr) {
+				recv_fds_tail = nullptr;
 			}
-			total_written += written;
+			deallocate(attachment);
 		}
+		attachment = next;
+	}
 
-		recv_message = recv_messages;
-		out->ro_flags = 0;
-
-		size_t fd_messages = messages_consumed + (next_message_read ? 1 : 0);
-		size_t fds_set = 0;
-		auto process = get_scheduler()->get_running_thread()->get_process();
-		for(; fd_messages > 0; --fd_messages) {
-			assert(recv_message);
-
-			// FDs from this message were consumed in the stream; take or destroy them
-			auto *fd_item = recv_messages->data->fd_list;
-			while(fd_item) {
-				if(fds_set < in->ri_fds_len) {
-					fd_mapping_t &fd_map = fd_item->data;
-					in->ri_fds[fds_set] = process->add_fd(fd_map.fd, fd_map.rights_base, fd_map.rights_inheriting);
-					fds_set++;
-				} else if(in->ri_fds_len > 0) {
-					// if userland did not ask for FDs at all, we shouldn't set FDS_TRUNCATED
-					out->ro_flags |= CLOUDABI_SOCK_RECV_FDS_TRUNCATED;
-				}
-				auto d = fd_item;
-				fd_item = fd_item->next;
-				if(!peek) {
-					deallocate(d);
-				}
-			}
-			if(!peek) {
-				recv_messages->data->fd_list = nullptr;
-			}
-
-			recv_message = recv_message->next;
+	size_t readable = num_recv_bytes;
+	if(attachment) {
+		uint64_t boundary = attachment->offset - stream_offset;
+		if(boundary < readable) {
+			readable = boundary;
 		}
+	}
 
-		if(!peek) {
-			for(; messages_consumed > 0; --messages_consumed) {
-				assert(recv_messages);
-
-				auto *d = recv_messages;
-				recv_messages = recv_messages->next;
-				deallocate(d->data->buf);
-				deallocate(d->data);
-				deallocate(d);
-			}
+	size_t total_written = 0;
+	for(size_t i = 0; i < in->ri_data_len && total_written < readable; ++i) {
+		auto &iovec = in->ri_data[i];
+		size_t copy = readable - total_written;
+		if(iovec.buf_len < copy) {
+			copy = iovec.buf_len;
 		}
+		copy_from_ring(total_written, reinterpret_cast<char*>(iovec.buf), copy);
+		total_written += copy;
+	}
 
+	if(!peek) {
 		num_recv_bytes -= total_written;
-		out->ro_datalen = total_written;
-		out->ro_fdslen = fds_set;
-		error = 0;
-		if(!peek && total_written > 0) {
-			send_signaler.condition_broadcast();
+		stream_offset += total_written;
+		if(num_recv_bytes == 0) {
+			ring_head = 0;
+		} else {
+			ring_head = (ring_head + total_written) % ring.size;
 		}
 	}
+
+	out->ro_datalen = total_written;
+	out->ro_fdslen = fds_set;
+	error = 0;
+	if(!peek && total_written > 0) {
+		send_signaler.condition_broadcast();
+	}
 }
 
 void unixsock::sock_send(const cloudabi_send_in_t* in, cloudabi_send_out_t *out)
@@ -421,34 +448,91 @@ void unixsock::sock_send(const cloudabi_send_in_t* in, cloudabi_send_out_t *out)
 		total_message_size = MAX_SIZE_BUFFERS - other->num_recv_bytes;
 	}
 
-	auto *message = allocate<unixsock_message>();
-	message->buf = allocate(total_message_size);
-	size_t bytes_copied = veccpy(message->buf, in->si_data, in->si_data_len, 0);
-	assert(bytes_copied == total_message_size);
+	linked_list<fd_mapping_t> *fd_list = nullptr;
+	error = collect_fds(in, &fd_list);
+	if(error != 0) {
+		return;
+	}
 
-	auto process = get_scheduler()->get_running_thread()->get_process();
-	for(size_t i = 0; i < in->si_fds_len; ++i) {
-		cloudabi_fd_t fdnum = in->si_fds[i];
-		fd_mapping_t *fd_mapping;
-		error = process->get_fd(&fd_mapping, fdnum, 0);
-		if(error != 0) {
-			deallocate(message->buf);
-			deallocate(message);
-			return;
-		}
-		fd_mapping_t fd_mapping_copy = *fd_mapping;
-		auto *fd_item = allocate<linked_list<fd_mapping_t>>(fd_mapping_copy);
-		append(&message->fd_list, fd_item);
+	if(type == CLOUDABI_FILETYPE_SOCKET_DGRAM) {
+		send_dgram(in, out, other, total_message_size, fd_list);
+	} else {
+		send_stream(in, out, other, total_message_size, fd_list);
+	}
+	if(error != 0) {
+		return;
 	}
 
-	auto *message_item = allocate<unixsock_message_list>(message);
-	append(&other->recv_messages, message_item);
-	other->num_recv_bytes += total_message_size;
-	assert(other->num_recv_bytes <= MAX_SIZE_BUFFERS);
 	other->recv_signaler.condition_broadcast([&other]() { return other->allocate_current_condition_data(); });
 	other->recv_messages_cv.notify();
 	other->have_bytes_received();
-	out->so_datalen = total_message_size;
+}
+
+void unixsock::send_dgram(const cloudabi_send_in_t *in, cloudabi_send_out_t *out, shared_ptr<unixsock> &other, size_t size, linked_list<fd_mapping_t> *fd_list)
+{
+	Blk b = allocate(sizeof(unixsock_message) + size);
+	if(b.ptr == nullptr) {
+		clear(&fd_list);
+		error = ENOMEM;
+		return;
+	}
+	auto *message = new (b.ptr) unixsock_message();
+	message->size = size;
+	message->fd_list = fd_list;
+	size_t bytes_copied = veccpy(message->data(), size, in->si_data, in->si_data_len, 0);
+	assert(bytes_copied == size);
+
+	if(other->recv_messages_tail) {
+		other->recv_messages_tail->next = message;
+	} else {
+		other->recv_messages = message;
+	}
+	other->recv_messages_tail = message;
+	other->num_recv_bytes += size;
+	assert(other->num_recv_bytes <= MAX_SIZE_BUFFERS);
+	out->so_datalen = size;
+	error = 0;
+}
+
+void unixsock::send_stream(const cloudabi_send_in_t *in, cloudabi_send_out_t *out, shared_ptr<unixsock> &other, size_t size, linked_list<fd_mapping_t> *fd_list)
+{
+	if(size == 0 && fd_list == nullptr) {
+		// nothing to send; don't wake up the receiver, as it would
+		// read zero bytes and see an EOF
+		out->so_datalen = 0;
+		error = 0;
+		return;
+	}
+
+	if(!other->reserve_ring(size)) {
+		clear(&fd_list);
+		error = ENOMEM;
+		return;
+	}
+
+	if(fd_list) {
+		auto *attachment = allocate<unixsock_fd_attachment>();
+		attachment->offset = other->stream_offset + other->num_recv_bytes;
+		attachment->fd_list = fd_list;
+		if(other->recv_fds_tail) {
+			other->recv_fds_tail->next = attachment;
+		} else {
+			other->recv_fds = attachment;
+		}
+		other->recv_fds_tail = attachment;
+	}
+
+	// copy straight from the sender's buffers into the receiving ring
+	size_t copied = 0;
+	for(size_t i = 0; i < in->si_data_len && copied < size; ++i) {
+		const cloudabi_ciovec_t &data = in->si_data[i];
+		size_t copy = size - copied < data.buf_len ? size - copied : data.buf_len;
+		other->copy_to_ring(reinterpret_cast<const char*>(data.buf), copy);
+		copied += copy;
+	}
+	assert(copied == size);
+	assert(other->num_recv_bytes <= MAX_SIZE_BUFFERS);
+	out->so_datalen = size;
 	error = 0;
 }
 
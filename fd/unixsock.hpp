@@ -6,18 +6,38 @@
 
 namespace cloudos {
 
-struct unixsock_message;
-typedef linked_list<unixsock_message*> unixsock_message_list;
-
+/** A datagram queued on a unixsock. The payload follows the header in the
+ * same allocation, so sending a datagram costs a single allocation.
+ */
 struct unixsock_message {
-	Blk buf;
-	size_t stream_data_recv = 0;
+	unixsock_message *next = nullptr;
+	size_t size = 0;
 	// fd_mapping_t contains a shared_ptr<fd_t>. With shared_ptr, fd's
 	// survive in-flight (i.e. they are not destructed when a close()
 	// happens between send() and recv()).
 	linked_list<fd_mapping_t> *fd_list = nullptr;
+
+	inline char *data() { return reinterpret_cast<char*>(this + 1); }
+	inline const char *data() const { return reinterpret_cast<const char*>(this + 1); }
+};
+
+/** File descriptors sent along with stream data. They are received by the
+ * recv() that reads the byte at stream offset `offset`; a recv() never
+ * reads past the start of data that has file descriptors attached.
+ */
+struct unixsock_fd_attachment {
+	unixsock_fd_attachment *next = nullptr;
+	uint64_t offset = 0;
+	linked_list<fd_mapping_t> *fd_list = nullptr;
 };
 
+/** A unix socket, one side of a socketpair.
+ *
+ * Stream sockets receive data into a ring buffer that grows up to
+ * MAX_SIZE_BUFFERS; the sender copies directly from its iovecs into the ring
+ * of the receiving side, and the receiver copies directly into its own
+ * iovecs. Datagram sockets keep a queue of messages with a tail pointer.
+ */
 struct unixsock : public sock_t, public enable_shared_from_this<unixsock> {
 	unixsock(cloudabi_filetype_t sockettype, cloudabi_fdflags_t flags, const char *n);
 	~unixsock() override;
@@ -26,14 +46,12 @@ struct unixsock : public sock_t, public enable_shared_from_this<unixsock> {
 	bool is_readable();
 	bool is_shutdown();
 	bool is_writeable();
+	size_t write_space() override;
 	cloudabi_errno_t get_read_signaler(thread_condition_signaler **s) override;
 	cloudabi_errno_t get_write_signaler(thread_condition_signaler **s) override;
 
 	void socketpair(shared_ptr<unixsock> other);
 
-	size_t read(void *dest, size_t count) override;
-	size_t write(const char *str, size_t count) override;
-
 	void sock_shutdown(cloudabi_sdflags_t how) override;
 	void sock_recv(const cloudabi_recv_in_t* in, cloudabi_recv_out_t *out) override;
 	void sock_send(const cloudabi_send_in_t* in, cloudabi_send_out_t *out) override;
@@ -42,19 +60,45 @@ struct unixsock : public sock_t, public enable_shared_from_this<unixsock> {
 
 protected:
 	// This function is called by another unixsock when bytes were just added to
-	// this sock's recv_messages / num_recv_bytes. Because it's virtual, this allows
-	// creating unixsocks with additional behaviour when bytes are received, such as
-	// the reverse_fd.
+	// this sock's receive buffers. Because it's virtual, this allows creating
+	// unixsocks with additional behaviour when bytes are received, such as the
+	// reverse_fd.
 	virtual void have_bytes_received();
 
 private:
 	weak_ptr<unixsock> othersock;
 
 	static constexpr size_t MAX_SIZE_BUFFERS = 1024 * 1024;
+	static constexpr size_t MIN_RING_SIZE = 4096;
 	static constexpr size_t MAX_FD_PER_MESSAGE = 20;
 
+	cloudabi_errno_t collect_fds(const cloudabi_send_in_t *in, linked_list<fd_mapping_t> **fd_list);
+	void receive_fds(linked_list<fd_mapping_t> **fd_list, const cloudabi_recv_in_t *in, size_t &fds_set, cloudabi_roflags_t &ro_flags, bool peek);
+
+	void recv_dgram(const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, bool peek);
+	void recv_stream(const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, bool peek);
+	void send_dgram(const cloudabi_send_in_t *in, cloudabi_send_out_t *out, shared_ptr<unixsock> &other, size_t size, linked_list<fd_mapping_t> *fd_list);
+	void send_stream(const cloudabi_send_in_t *in, cloudabi_send_out_t *out, shared_ptr<unixsock> &other, size_t size, linked_list<fd_mapping_t> *fd_list);
+
+	bool reserve_ring(size_t size);
+	void copy_to_ring(const char *src, size_t size);
+	void copy_from_ring(size_t offset, char *dst, size_t size);
+
 	size_t num_recv_bytes = 0;
-	unixsock_message_list *recv_messages = nullptr;
+
+	// datagram sockets
+	unixsock_message *recv_messages = nullptr;
+	unixsock_message *recv_messages_tail = nullptr;
+
+	// stream sockets
+	Blk ring;
+	// index of the first unread byte in the ring
+	size_t ring_head = 0;
+	// stream offset of the first unread byte
+	uint64_t stream_offset = 0;
+	unixsock_fd_attachment *recv_fds = nullptr;
+	unixsock_fd_attachment *recv_fds_tail = nullptr;
+
 	cv_t recv_messages_cv;
 	thread_condition_signaler recv_signaler;
 	thread_condition_signaler send_signaler;
@@ -1,10 +1,76 @@
 #include <fd/vfs.hpp>
 #include <fd/fd.hpp>
+#include <fd/dentry_cache.hpp>
 #include <oslibc/list.hpp>
 
 using namespace cloudos;
 
-typedef linked_list<shared_ptr<fd_t>> directory_list;
+/// A directory entered during traversal. If inode is 0, fd is the directory
+/// itself. Otherwise, the directory wasn't opened, to save the requests to
+/// open and close it; fd is an opened directory on the same device that can
+/// look up names in it using lookup_inode().
+struct entered_directory {
+	entered_directory(shared_ptr<fd_t> f, cloudabi_inode_t i) : fd(f), inode(i) {}
+
+	shared_ptr<fd_t> fd;
+	cloudabi_inode_t inode;
+};
+
+typedef linked_list<entered_directory> directory_list;
+
+static bool is_dot_or_dotdot(const char *file, size_t filelen) {
+	return (filelen == 1 && file[0] == '.') || (filelen == 2 && file[0] == '.' && file[1] == '.');
+}
+
+/// Open the directory if it was entered without opening it.
+static cloudabi_errno_t open_entered(entered_directory &dir, cloudabi_fdstat_t *fds)
+{
+	if(dir.inode == 0) {
+		return 0;
+	}
+	auto directory = dir.fd->inode_open(dir.fd->device, dir.inode, fds);
+	if(dir.fd->error != 0) {
+		return dir.fd->error;
+	}
+	assert(directory);
+	dir.fd = directory;
+	dir.inode = 0;
+	return 0;
+}
+
+/// Perform lookup() on the directory, using the dentry cache if the directory
+/// takes part in it. Creating lookups are never answered from the cache, and
+/// must be done on an opened directory. Like lookup(), the result is in
+/// dir.fd->error; ENOSYS means the directory must be opened first.
+static void cached_lookup(entered_directory const &dir, const char *file, size_t filelen, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat)
+{
+	auto &directory = dir.fd;
+	cloudabi_inode_t dir_inode = dir.inode;
+	if(dir_inode == 0 && (oflags & CLOUDABI_O_CREAT) == 0 && !is_dot_or_dotdot(file, filelen)) {
+		dir_inode = directory->dentry_cache_inode();
+	}
+	if(dir_inode == 0) {
+		directory->lookup(file, filelen, oflags, filestat);
+		return;
+	}
+
+	auto *cache = get_dentry_cache();
+	cloudabi_errno_t lookup_errno;
+	if(cache->lookup(directory->device, dir_inode, file, filelen, &lookup_errno, filestat)) {
+		directory->error = lookup_errno;
+		return;
+	}
+
+	if(dir.inode != 0) {
+		directory->lookup_inode(dir.inode, file, filelen, filestat);
+		if(directory->error == ENOSYS) {
+			return;
+		}
+	} else {
+		directory->lookup(file, filelen, oflags, filestat);
+	}
+	cache->insert(directory->device, dir_inode, file, filelen, directory->error, filestat);
+}
 
 cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, size_t pathlen, cloudabi_lookupflags_t lookupflags, cloudabi_oflags_t oflags, cloudabi_fdstat_t *fds, traverse_result *res)
 {
@@ -23,11 +89,11 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 
 	Blk alloc_path;
 
-	directory_list *entered = allocate<directory_list>(rootdir); // Traversed directories in reverse order
+	directory_list *entered = allocate<directory_list>(entered_directory(rootdir, 0)); // Traversed directories in reverse order
 	const int max_symlinks_followed = 30;
 	int symlinks_followed = 0;
 	while(1) {
-		shared_ptr<fd_t> this_directory = entered->data;
+		shared_ptr<fd_t> this_directory = entered->data.fd;
 		assert(this_directory);
 
 		if (this_directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
@@ -76,7 +142,14 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 
 		assert(component_len <= pathlen);
 		if (splitter == pathlen) {
-			// filename component
+			// filename component; the caller gets the directory it's in,
+			// so it must be opened
+			rootdir->error = open_entered(entered->data, fds);
+			if (rootdir->error != 0) {
+				goto error;
+			}
+			this_directory = entered->data.fd;
+
 			if (component_len == 2 && strncmp(path, "..", component_len) == 0) {
 				if (entered->next == nullptr) {
 					// allow "foo/..", but not "foo/../.."
@@ -85,7 +158,7 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 				}
 			}
 
-			this_directory->lookup(path, component_len, oflags, &res->entry);
+			cached_lookup(entered->data, path, component_len, oflags, &res->entry);
 			res->lookup_errno = this_directory->error;
 
 			if (component_len < pathlen && res->lookup_errno == 0) {
@@ -157,7 +230,16 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 			continue;
 		}
 
-		this_directory->lookup(path, component_len, 0, &res->entry);
+		cached_lookup(entered->data, path, component_len, 0, &res->entry);
+		if (this_directory->error == ENOSYS && entered->data.inode != 0) {
+			// can't look up names in a directory that isn't opened
+			rootdir->error = open_entered(entered->data, fds);
+			if (rootdir->error != 0) {
+				goto error;
+			}
+			this_directory = entered->data.fd;
+			cached_lookup(entered->data, path, component_len, 0, &res->entry);
+		}
 		res->lookup_errno = this_directory->error;
 		if (this_directory->error != 0) {
 			rootdir->error = this_directory->error;
@@ -173,6 +255,12 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 				rootdir->error = ENAMETOOLONG;
 				goto error;
 			}
+			// the link is read from the directory it's in
+			rootdir->error = open_entered(entered->data, fds);
+			if (rootdir->error != 0) {
+				goto error;
+			}
+			this_directory = entered->data.fd;
 			// follow symlinks: path becomes <symlink>/<rest of path>
 			Blk new_alloc = allocate(res->entry.st_size + pathlen - splitter);
 			auto *newpath = reinterpret_cast<char*>(new_alloc.ptr);
@@ -199,6 +287,11 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 		}
 		if (splitter + 1 == pathlen) {
 			// 'foo/' or 'foo///', this is the final path component
+			rootdir->error = open_entered(entered->data, fds);
+			if (rootdir->error != 0) {
+				goto error;
+			}
+			this_directory = entered->data.fd;
 			res->filename = allocate(component_len + 1);
 			auto *name = reinterpret_cast<char*>(res->filename.ptr);
 			strncpy(name, path, component_len);
@@ -206,13 +299,18 @@ cloudabi_errno_t cloudos::traverse(shared_ptr<fd_t> rootdir, const char *path, s
 			res->directory = this_directory;
 			goto success;
 		}
-		// enter this directory
-		auto new_directory = this_directory->inode_open(res->entry.st_dev, res->entry.st_ino, fds);
-		if (this_directory->error != 0 || !new_directory) {
-			rootdir->error = this_directory->error;
-			goto error;
+		// enter this directory, without opening it if names in it can be
+		// looked up through this one
+		entered_directory new_directory(this_directory, res->entry.st_ino);
+		if (!this_directory->can_lookup_inode() || res->entry.st_dev != this_directory->device) {
+			new_directory.fd = this_directory->inode_open(res->entry.st_dev, res->entry.st_ino, fds);
+			new_directory.inode = 0;
+			if (this_directory->error != 0 || !new_directory.fd) {
+				rootdir->error = this_directory->error;
+				goto error;
+			}
 		}
-		directory_list *item = allocate<directory_list>(new_directory);
+		directory_list *item = allocate<directory_list>(move(new_directory));
 		prepend(&entered, item);
 		path += splitter + 1;
 		pathlen -= splitter + 1;
@@ -27,6 +27,10 @@ struct terminal_store;
 struct shmfs;
 struct blockdev_store;
 struct process_store;
+struct dentry_cache;
+struct kernel_log;
+struct tracer;
+struct profiler;
 
 extern global_state *global_state_;
 
@@ -52,6 +56,10 @@ struct global_state {
 	cloudos::shmfs *shmfs;
 	cloudos::blockdev_store *blockdev_store;
 	cloudos::process_store *process_store;
+	cloudos::dentry_cache *dentry_cache;
+	cloudos::kernel_log *log;
+	cloudos::tracer *tracer;
+	cloudos::profiler *profiler;
 };
 
 __attribute__((noreturn)) inline void kernel_panic(const char *message) {
@@ -60,7 +68,9 @@ __attribute__((noreturn)) inline void kernel_panic(const char *message) {
 	abort();
 #else
 	if(global_state_ && global_state_->vga) {
-		*(global_state_->vga) << "!!! KERNEL PANIC - HALTING !!!\n" << message;
+		// write everything out synchronously, interrupts won't come
+		global_state_->vga->set_deferred(false);
+		*(global_state_->vga) << log_error << "!!! KERNEL PANIC - HALTING !!!\n" << log_error << message << "\n";
 	}
 	asm volatile("cli; halted: hlt; jmp halted;");
 	while(1) {}
@@ -89,6 +99,10 @@ GET_GLOBAL(terminal_store, terminal_store, terminal_store);
 GET_GLOBAL(shmfs, shmfs, shmfs);
 GET_GLOBAL(blockdev_store, blockdev_store, blockdev_store);
 GET_GLOBAL(process_store, process_store, process_store);
+GET_GLOBAL(dentry_cache, dentry_cache, dentry_cache);
+GET_GLOBAL(kernel_log, kernel_log, log);
+GET_GLOBAL(tracer, tracer, tracer);
+GET_GLOBAL(profiler, profiler, profiler);
 
 inline vga_stream &get_vga_stream() {
 	assert(global_state_ && global_state_->vga);
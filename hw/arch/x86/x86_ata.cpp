@@ -66,7 +66,7 @@ static void wait_until_ready(int port) {
 			return;
 		}
 		if(attempt == 1000) {
-			get_vga_stream() << "Still waiting for RDY. Initially: [";
+			get_vga_stream() << log_warning << "Still waiting for RDY. Initially: [";
 			print_device_status(initial_value);
 			get_vga_stream() << "] Now: [";
 			print_device_status(value);
@@ -92,7 +92,7 @@ static void wait_until_drq(int port) {
 			return;
 		}
 		if(attempt == 1000) {
-			get_vga_stream() << "Still waiting for DRQ. Initially: [";
+			get_vga_stream() << log_warning << "Still waiting for DRQ. Initially: [";
 			print_device_status(initial_value);
 			get_vga_stream() << "] Now: [";
 			print_device_status(value);
@@ -168,7 +168,7 @@ bool x86_ata::identify_bus_device(int port, bool master, uint16_t *data)
 	}
 
 	if((data[83] & 0x400) == 0) {
-		get_vga_stream() << "Note: An ATA device was detected, but ignored because it does not support LBA48 addressing.\n";
+		get_vga_stream() << log_warning << "Note: An ATA device was detected, but ignored because it does not support LBA48 addressing.\n";
 	}
 
 	// return true only if LBA48 is supported, the only method implemented in this driver.
@@ -223,7 +223,7 @@ static void convert_scancode_to_sequence(uint8_t scancode, uint8_t *modifiers, u
 		return;
 	}
 
-	get_vga_stream() << "Unknown keypress: scancode 0x" << hex << scancode << ", modifiers 0x" << hex << *modifiers << "\n";
+	get_vga_stream() << log_debug << "Unknown keypress: scancode 0x" << hex << scancode << ", modifiers 0x" << hex << *modifiers << "\n";
 	*size = 0;
 }
 
@@ -1,10 +1,17 @@
 #include "x86_pit.hpp"
 #include <oslibc/assert.hpp>
 #include <global.hpp>
+#include <hw/cpu_io.hpp>
+#include <hw/interrupt.hpp>
+#include <hw/kernel_log.hpp>
 #include <fd/scheduler.hpp>
+#include <fd/profiler.hpp>
 
 using namespace cloudos;
 
+static const uint32_t PIT_FREQUENCY = 1193182;
+static const uint32_t PIT_DEFAULT_DIVISOR = 65536;
+
 x86_pit::x86_pit(device *parent) : device(parent), irq_handler() {
 }
 
@@ -12,21 +19,96 @@ const char *x86_pit::description() {
 	return "x86 timer";
 }
 
+/**
+ * Measure the TSC frequency by counting TSC ticks while PIT channel 2 counts
+ * down for 10 ms. Channel 2 is gated through port 0x61, so it can be used
+ * without interrupts.
+ */
+static uint64_t calibrate_tsc() {
+	const uint16_t PIT_FREQUENCY_DIV_100 = PIT_FREQUENCY / 100;
+	// enable the gate, disable the speaker
+	uint8_t gate = (inb(0x61) & ~0x02) | 0x01;
+	outb(0x61, gate);
+	// channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+	outb(0x43, 0xb0);
+	outb(0x42, PIT_FREQUENCY_DIV_100 & 0xff);
+	outb(0x42, PIT_FREQUENCY_DIV_100 >> 8);
+	// restart the count by toggling the gate
+	outb(0x61, gate & ~0x01);
+	outb(0x61, gate);
+
+	uint64_t start = rdtsc();
+	while((inb(0x61) & 0x20) == 0) {
+		// wait for the output of channel 2 to go high
+	}
+	return (rdtsc() - start) * 100;
+}
+
 cloudabi_errno_t x86_pit::init() {
+	uint64_t tsc_frequency = calibrate_tsc();
+	get_clock_store()->set_tsc_frequency(tsc_frequency);
+	get_vga_stream() << "TSC runs at " << (tsc_frequency / 1000000) << " MHz\n";
+
 	register_irq(0);
 	return 0;
 }
 
+void x86_pit::set_divisor(uint32_t divisor) {
+	// channel 0, lobyte/hibyte, mode 3 (square wave); 0 means 65536
+	outb(0x43, 0x36);
+	outb(0x40, divisor & 0xff);
+	outb(0x40, (divisor >> 8) & 0xff);
+}
+
 void x86_pit::handle_irq(uint8_t irq) {
 	assert(irq == 0);
 	(void)irq;
 
+	// This interrupt ends a period at the rate the PIT was running at
+	// until now, so the clock advances by that period, even if the rate
+	// changes below. Fast periods are computed from their index in the
+	// tick, so that they add up to exactly one tick.
+	auto *prof = get_profiler();
+	bool full_tick = true;
+	if(fast_rate) {
+		prof->sample(get_interrupt_handler()->get_interrupted_state());
+		auto tick_ns = clock.get_resolution();
+		auto multiplier = profiler::SAMPLE_RATE_MULTIPLIER;
+		clock.advance(tick_ns * (subtick + 1) / multiplier - tick_ns * subtick / multiplier);
+		if(++subtick == multiplier) {
+			subtick = 0;
+		} else {
+			full_tick = false;
+		}
+	} else {
+		clock.advance(clock.get_resolution());
+	}
+
+	if(prof->enabled != fast_rate) {
+		fast_rate = prof->enabled;
+		if(fast_rate) {
+			// a slow period just ended, so this starts a new tick
+			assert(subtick == 0);
+			set_divisor(PIT_DEFAULT_DIVISOR / profiler::SAMPLE_RATE_MULTIPLIER);
+			prof->set_rate(PIT_FREQUENCY * profiler::SAMPLE_RATE_MULTIPLIER / PIT_DEFAULT_DIVISOR);
+		} else {
+			// the fast periods of a partial tick are already on the
+			// clock; the next interrupt ends a full slow period
+			set_divisor(PIT_DEFAULT_DIVISOR);
+			subtick = 0;
+		}
+	}
+	if(!full_tick) {
+		return;
+	}
+
+	get_kernel_log()->refill();
+	get_vga_stream().flush();
 	get_root_device()->timer_event_recursive();
-	clock.tick();
 	if(!get_scheduler()->is_waiting_for_ready_task()) {
 		// this timer event occurred while already waiting for something
 		// to do, so just return immediately to prevent stack overflow
-		get_scheduler()->thread_yield();
+		get_interrupt_handler()->yield_after_irq();
 	}
 }
 
@@ -46,8 +128,8 @@ cloudabi_timestamp_t x86_pit_clock::get_time(cloudabi_timestamp_t /*precision*/)
 	return time;
 }
 
-void x86_pit_clock::tick() {
-	time += get_resolution();
+void x86_pit_clock::advance(cloudabi_timestamp_t elapsed) {
+	time += elapsed;
 
 	while(signalers) {
 		assert(signalers->next == nullptr || signalers->next->data->timeout >= signalers->data->timeout);
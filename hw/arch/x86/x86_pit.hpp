@@ -26,7 +26,9 @@ struct x86_pit_clock : public clock {
 	thread_condition_signaler *get_signaler(cloudabi_timestamp_t timeout,
 		cloudabi_timestamp_t precision) override;
 
-	void tick();
+	/** Advance the clock by the given number of nanoseconds, waking up
+	 * the threads whose timeout passed. */
+	void advance(cloudabi_timestamp_t elapsed);
 
 private:
 	cloudabi_timestamp_t time = 0;
@@ -34,7 +36,10 @@ private:
 };
 
 /**
- * This device represents a standard x86 PIT. It handles IRQ 0.
+ * This device represents a standard x86 PIT. It handles IRQ 0. While the
+ * profiler is enabled, the PIT runs profiler::SAMPLE_RATE_MULTIPLIER times
+ * faster; every interrupt is a sample and advances the clock by the period
+ * that ended, but only every so many runs the regular tick.
  */
 struct x86_pit : public device, public irq_handler {
 	x86_pit(device *parent);
@@ -45,7 +50,11 @@ struct x86_pit : public device, public irq_handler {
 	void handle_irq(uint8_t irq) override;
 
 private:
+	void set_divisor(uint32_t divisor);
+
 	x86_pit_clock clock;
+	bool fast_rate = false;
+	uint32_t subtick = 0;
 };
 
 }
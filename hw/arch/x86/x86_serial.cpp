@@ -2,6 +2,7 @@
 #include <oslibc/assert.hpp>
 #include <oslibc/string.h>
 #include <hw/cpu_io.hpp>
+#include <hw/kernel_log.hpp>
 #include <global.hpp>
 
 using namespace cloudos;
@@ -37,6 +38,9 @@ cloudabi_errno_t x86_serial::init() {
 
 	// send 'hello world' over COM1
 	transmit_string(1, "Serial driver started.\n");
+	if(global_state_ && global_state_->log) {
+		log_pos = get_kernel_log()->head();
+	}
 	get_vga_stream().set_serial(this);
 	return 0;
 }
@@ -68,7 +72,70 @@ void x86_serial::init_serial(uint8_t device) {
 	outb(base + 1, 0x0b); // enable IRQ for data/transmitter/status change
 }
 
+void x86_serial::drain(bool blocking) {
+	if(global_state_ == nullptr || global_state_->log == nullptr) {
+		return;
+	}
+	// the interrupt handler may try to drain while we are draining, in
+	// that case just let us continue; when blocking, we may be panicking
+	// and the other drain may never continue
+	if(__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE) && !blocking) {
+		return;
+	}
+
+	auto *log = get_kernel_log();
+	uint16_t base = device_to_port(1);
+	size_t fifo_space = 0;
+	kernel_log_record record;
+	while(log_pos < log->head()) {
+		if(!log->read(log_pos, &record)) {
+			if(log_pos < log->oldest()) {
+				// overwritten before we could send it
+				log_pos = log->oldest();
+				log_offset = 0;
+				continue;
+			}
+			// not completely written yet
+			break;
+		}
+
+		size_t length = record.length < kernel_log_record::TEXT_MAX ? record.length : kernel_log_record::TEXT_MAX;
+		size_t total = length + (record.continued ? 0 : 1);
+		while(log_offset < total) {
+			if(fifo_space == 0) {
+				// transmitter holding register empty means the whole
+				// FIFO is empty
+				if(inb(base + 5) & 0x20) {
+					fifo_space = FIFO_SIZE;
+				} else if(blocking) {
+					continue;
+				} else {
+					// we'll be called again from the IRQ
+					__atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+					return;
+				}
+			}
+			outb(base, log_offset < length ? record.text[log_offset] : '\n');
+			--fifo_space;
+			++log_offset;
+		}
+		++log_pos;
+		log_offset = 0;
+	}
+	__atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+}
+
 void x86_serial::handle_irq(uint8_t irq) {
 	assert(irq == 3 || irq == 4);
-	(void)irq;
+	if(irq == 4) {
+		// COM1; reading the interrupt identification register
+		// acknowledges a transmitter empty interrupt
+		inb(device_to_port(1) + 2);
+		drain(false);
+	}
+}
+
+void x86_serial::timer_event() {
+	// in case a record was appended while we were draining
+	drain(false);
 }
@@ -2,13 +2,16 @@
 
 #include <hw/device.hpp>
 #include <hw/interrupt.hpp>
+#include <stddef.h>
 #include <stdint.h>
 
 namespace cloudos {
 
 /**
  * This device represents a standard x86 serial controller. It handles IRQ 3
- * and 4.
+ * and 4. Kernel output is sent over COM1 from the kernel log: whenever the
+ * transmitter FIFO is empty, the next bytes of the log are written into it,
+ * so that logging never has to wait for the serial line.
  */
 struct x86_serial : public device, public irq_handler {
 	x86_serial(device *parent);
@@ -18,12 +21,24 @@ struct x86_serial : public device, public irq_handler {
 	cloudabi_errno_t init() override;
 
 	void handle_irq(uint8_t irq) override;
+	void timer_event() override;
 
 	void transmit(uint8_t device, const char *str, size_t len);
 	void transmit_string(uint8_t device, const char *str);
 
+	/** Send pending kernel log records over COM1. If blocking, wait until
+	 * all of them are sent; otherwise, only fill the transmitter FIFO.
+	 */
+	void drain(bool blocking);
+
 private:
+	static constexpr size_t FIFO_SIZE = 16;
+
 	void init_serial(uint8_t device);
+
+	uint64_t log_pos = 0;
+	size_t log_offset = 0;
+	bool draining = false;
 };
 
 }
@@ -4,6 +4,7 @@
 #include <global.hpp>
 #include <fd/scheduler.hpp>
 #include <fd/process_fd.hpp>
+#include <fd/trace.hpp>
 
 using namespace cloudos;
 
@@ -171,7 +172,7 @@ void interrupt_handler::handle_irq(uint8_t irq) {
 	if(handler != nullptr) {
 		handler->handle_irq(irq);
 	} else {
-		get_vga_stream() << "Unknown kernel IRQ " << irq << "\n";
+		get_vga_stream() << log_warning << "Unknown kernel IRQ " << irq << "\n";
 		kernel_panic("Got unknown hardware IRQ.");
 	}
 }
@@ -182,9 +183,10 @@ void interrupt_handler::handle(interrupt_state_t *regs) {
 #else
 	int int_no = regs->int_no;
 	int err_code = regs->err_code;
+	interrupted_state = regs;
 
 	if(regs->cs != 27 && regs->cs != 8) {
-		get_vga_stream() << "!!!! Interrupt occurred, but unexpected code segment value !!!!\n";
+		get_vga_stream() << log_error << "!!!! Interrupt occurred, but unexpected code segment value !!!!\n";
 		fatal_exception(int_no, err_code, regs);
 	}
 
@@ -195,7 +197,7 @@ void interrupt_handler::handle(interrupt_state_t *regs) {
 	}
 
 	if(!in_kernel && !running_thread) {
-		get_vga_stream() << "!!!! Interrupt occurred in userland, but without an active thread !!!!\n";
+		get_vga_stream() << log_error << "!!!! Interrupt occurred in userland, but without an active thread !!!!\n";
 		fatal_exception(int_no, err_code, regs);
 	}
 
@@ -232,7 +234,13 @@ void interrupt_handler::handle(interrupt_state_t *regs) {
 	}
 	// Hardware interrupts are handled normally
 	else {
+		trace(trace_event_type::irq, trace_phase::begin, int_no - 0x20);
 		handle_irq(int_no - 0x20);
+		trace(trace_event_type::irq, trace_phase::end, int_no - 0x20);
+		if(yield_requested) {
+			yield_requested = false;
+			get_scheduler()->thread_yield();
+		}
 	}
 
 	if(running_thread) {
@@ -35,8 +35,22 @@ struct interrupt_handler {
 	void handle(interrupt_state_t*);
 	void handle_irq(uint8_t irq);
 
+	/** The state at the moment the current interrupt occurred. */
+	inline interrupt_state_t *get_interrupted_state() {
+		return interrupted_state;
+	}
+
+	/** Called from an IRQ handler to switch to another thread once the
+	 * IRQ is handled completely.
+	 */
+	inline void yield_after_irq() {
+		yield_requested = true;
+	}
+
 private:
 	irq_handler *irq_handlers[0x10];
+	interrupt_state_t *interrupted_state = nullptr;
+	bool yield_requested = false;
 };
 
 }
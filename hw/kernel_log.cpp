@@ -0,0 +1,99 @@
+#include <hw/kernel_log.hpp>
+#include <hw/cpu_io.hpp>
+#include <oslibc/numeric.h>
+#include <oslibc/string.h>
+
+using namespace cloudos;
+
+const char *cloudos::kernel_log_level_name(kernel_log_level level) {
+	switch(level) {
+	case kernel_log_level::debug: return "debug";
+	case kernel_log_level::info: return "info";
+	case kernel_log_level::warning: return "warning";
+	case kernel_log_level::error: return "error";
+	}
+	return "unknown";
+}
+
+bool kernel_log::take_token() {
+	int32_t t = __atomic_load_n(&tokens, __ATOMIC_RELAXED);
+	do {
+		if(t <= 0) {
+			return false;
+		}
+	} while(!__atomic_compare_exchange_n(&tokens, &t, t - 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return true;
+}
+
+void kernel_log::refill() {
+	int32_t t = __atomic_load_n(&tokens, __ATOMIC_RELAXED);
+	int32_t n;
+	do {
+		n = t + RATE_REFILL > RATE_BURST ? RATE_BURST : t + RATE_REFILL;
+	} while(!__atomic_compare_exchange_n(&tokens, &t, n, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void kernel_log::append(kernel_log_level level, const char *text, size_t length, bool continued) {
+	// A line is kept or dropped as a whole, decided at its first record,
+	// so that rate limiting never cuts pieces out of the middle of lines
+	bool line_start = !in_line;
+	in_line = continued;
+	if(line_start) {
+		dropping_line = rate_limited && level < kernel_log_level::warning && !take_token();
+		if(dropping_line) {
+			__atomic_add_fetch(&suppressed_pending, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&stats.suppressed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	if(dropping_line) {
+		return;
+	}
+
+	// report suppressed lines only between lines, not in the middle of one
+	uint64_t suppressed = line_start ? __atomic_exchange_n(&suppressed_pending, 0, __ATOMIC_RELAXED) : 0;
+	if(suppressed > 0) {
+		char buf[kernel_log_record::TEXT_MAX];
+		char numbuf[24];
+		buf[0] = 0;
+		strlcat(buf, "kernel_log: ", sizeof(buf));
+		strlcat(buf, ui64toa_s(suppressed, numbuf, sizeof(numbuf), 10), sizeof(buf));
+		strlcat(buf, " messages suppressed", sizeof(buf));
+		write_record(kernel_log_level::warning, buf, strlen(buf), false);
+	}
+
+	write_record(level, text, length, continued);
+}
+
+void kernel_log::write_record(kernel_log_level level, const char *text, size_t length, bool continued) {
+	if(length > kernel_log_record::TEXT_MAX) {
+		length = kernel_log_record::TEXT_MAX;
+	}
+
+	uint64_t pos = __atomic_fetch_add(&next_pos, 1, __ATOMIC_ACQ_REL);
+	auto &s = slots[pos % NUM_RECORDS];
+	// invalidate the slot before overwriting it, so that readers don't
+	// mistake a half-written record for the old one
+	__atomic_store_n(&s.seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s.record.tsc = rdtsc();
+	s.record.level = level;
+	s.record.continued = continued;
+	s.record.length = length;
+	memcpy(s.record.text, text, length);
+
+	__atomic_store_n(&s.seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&stats.records, 1, __ATOMIC_RELAXED);
+}
+
+bool kernel_log::read(uint64_t pos, kernel_log_record *record) {
+	auto &s = slots[pos % NUM_RECORDS];
+	if(__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != pos + 1) {
+		return false;
+	}
+	memcpy(record, &s.record, sizeof(*record));
+	// if the writer started overwriting the slot while we were copying,
+	// the copy may be torn
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&s.seq, __ATOMIC_RELAXED) == pos + 1;
+}
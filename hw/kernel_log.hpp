@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cloudos {
+
+enum class kernel_log_level : uint8_t {
+	debug,
+	info,
+	warning,
+	error,
+};
+
+const char *kernel_log_level_name(kernel_log_level level);
+
+/** A piece of kernel output. If continued is set, the line does not end
+ * with this record but goes on in a later one, without a line break.
+ */
+struct kernel_log_record {
+	static constexpr size_t TEXT_MAX = 112;
+
+	uint64_t tsc;
+	kernel_log_level level;
+	bool continued;
+	uint16_t length;
+	char text[TEXT_MAX];
+};
+
+/** Statistics on the kernel log. */
+struct kernel_log_stats {
+	uint64_t records = 0;
+	uint64_t suppressed = 0;
+};
+
+/** The kernel log is a fixed-size ring of records that everything written
+ * to the vga_stream ends up in. Appending never blocks and never waits on
+ * a device: a writer reserves a record position with an atomic increment
+ * and publishes the record by storing its sequence number, so that it can
+ * safely be interrupted by another writer (e.g. an interrupt handler). The
+ * slow consumers (the VGA buffer and the serial port) each keep their own
+ * position in the ring and drain it later; when they fall behind by more
+ * than the size of the ring, they lose the oldest records.
+ *
+ * Once rate limiting is enabled, debug and info lines are limited to a
+ * burst of RATE_BURST lines, refilled by RATE_REFILL lines on every timer
+ * tick; a line is kept or dropped as a whole, with all of its records.
+ * Warnings and errors are never dropped.
+ */
+struct kernel_log {
+	static constexpr size_t NUM_RECORDS = 1024;
+	static constexpr int32_t RATE_BURST = 256;
+	static constexpr int32_t RATE_REFILL = 64;
+
+	constexpr kernel_log() {}
+
+	void append(kernel_log_level level, const char *text, size_t length, bool continued);
+
+	/** Copy the record at the given position into *record. Returns false if
+	 * the record was not completely written yet, or if it was overwritten.
+	 */
+	bool read(uint64_t pos, kernel_log_record *record);
+
+	/** The position the next record will be written at. */
+	inline uint64_t head() {
+		return __atomic_load_n(&next_pos, __ATOMIC_ACQUIRE);
+	}
+
+	/** The position of the oldest record that is still in the ring. */
+	inline uint64_t oldest() {
+		uint64_t h = head();
+		return h > NUM_RECORDS ? h - NUM_RECORDS : 0;
+	}
+
+	inline void set_rate_limited(bool r) {
+		rate_limited = r;
+	}
+
+	/** Called on every timer tick to refill the rate limit. */
+	void refill();
+
+	inline kernel_log_stats &get_stats() { return stats; }
+
+private:
+	struct slot {
+		// position + 1 of the record in this slot once it is completely
+		// written, 0 while it is being written
+		uint64_t seq;
+		kernel_log_record record;
+	};
+
+	bool take_token();
+	void write_record(kernel_log_level level, const char *text, size_t length, bool continued);
+
+	slot slots[NUM_RECORDS] = {};
+	uint64_t next_pos = 0;
+	int32_t tokens = RATE_BURST;
+	uint64_t suppressed_pending = 0;
+	bool rate_limited = false;
+	// set while the last record appended didn't end its line
+	bool in_line = false;
+	// whether the records of the current line are dropped
+	bool dropping_line = false;
+	kernel_log_stats stats;
+};
+
+}
@@ -99,7 +99,7 @@ size_t multiboot_info::memory_map(memory_map_entry **first) const {
 
 multiboot_module *multiboot_info::module_base_address() const {
 	if((bi->flags & FLAG_MODULE) == 0 || bi->mods_count == 0) {
-		get_vga_stream() << "No module base address\n";
+		get_vga_stream() << log_error << "No module base address\n";
 		return nullptr;
 	}
 
@@ -189,30 +189,30 @@ cloudabi_errno_t virtio_net_device::eth_init()
 
 	uint64_t sup_features = read32(device_features);
 	sup_features |= uint64_t(read32(device_features + 1)) << 32;
-	get_vga_stream() << "Device features: 0x" << hex << sup_features << dec << "\n";
+	get_vga_stream() << log_debug << "Device features: 0x" << hex << sup_features << dec << "\n";
 
 	if((sup_features & VIRTIO_NET_F_MAC) == 0) {
 		// TODO: if the VIRTIO_NET_F_MAC feature is not in
 		// device_features, we must randomly generate our own MAC
-		get_vga_stream() << "MAC setting not supported. Skipping device.\n";
+		get_vga_stream() << log_warning << "MAC setting not supported. Skipping device.\n";
 		write8(device_status, 128); /* driver failed */
 		return ENOTSUP;
 	}
 
 	if((sup_features & VIRTIO_NET_F_STATUS) == 0) {
-		get_vga_stream() << "Device status bit not supported. Skipping device.\n";
+		get_vga_stream() << log_warning << "Device status bit not supported. Skipping device.\n";
 		write8(device_status, 128); /* driver failed */
 		return ENOTSUP;
 	}
 
 	if((sup_features & VIRTIO_NET_F_MRG_RXBUF) == 0) {
-		get_vga_stream() << "Merging received buffers not supported. Skipping device.\n";
+		get_vga_stream() << log_warning << "Merging received buffers not supported. Skipping device.\n";
 		write8(device_status, 128); /* driver failed */
 		return ENOTSUP;
 	}
 
 	if((sup_features & VIRTIO_F_NOTIFY_ON_EMPTY) == 0) {
-		get_vga_stream() << "Notify on empty not supported. Skipping device.\n";
+		get_vga_stream() << log_warning << "Notify on empty not supported. Skipping device.\n";
 		write8(device_status, 128); /* driver failed */
 		return ENOTSUP;
 	}
@@ -224,7 +224,7 @@ cloudabi_errno_t virtio_net_device::eth_init()
 			| VIRTIO_F_NOTIFY_ON_EMPTY);
 	write32(driver_features, drv_features & 0xffffffff);
 	write32(driver_features + 1, drv_features >> 32);
-	get_vga_stream() << "Driver features: 0x" << hex << read32(driver_features) << dec << "\n";
+	get_vga_stream() << log_debug << "Driver features: 0x" << hex << read32(driver_features) << dec << "\n";
 
 	write8(device_status, 11); /* features OK */
 
@@ -245,7 +245,7 @@ cloudabi_errno_t virtio_net_device::eth_init()
 
 		uint64_t virtq_addr_phys = reinterpret_cast<uint64_t>(q->get_virtq_addr_phys());
 		if((virtq_addr_phys % PAGE_SIZE) != 0) {
-			get_vga_stream() << "Failed to allocate descriptor table aligned to a page\n";
+			get_vga_stream() << log_error << "Failed to allocate descriptor table aligned to a page\n";
 			return ENOMEM;
 		}
 		write32(queue_address, virtq_addr_phys >> 12);
@@ -297,7 +297,7 @@ void virtio_net_device::handle_irq(uint8_t) {
 
 	auto res = check_new_packets();
 	if(res != 0) {
-		get_vga_stream() << "check_new_packets failed: " << res << "\n";
+		get_vga_stream() << log_error << "check_new_packets failed: " << res << "\n";
 	}
 }
 
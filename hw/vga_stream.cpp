@@ -1,22 +1,94 @@
 #include <hw/arch/x86/x86_serial.hpp>
 #include <hw/vga_stream.hpp>
 #include <oslibc/numeric.h>
+#include <oslibc/string.h>
 #include <oslibc/utility.hpp>
 
 using cloudos::vga_stream;
 
 vga_stream::vga_stream(vga_buffer &v)
 : base(10)
+, level(kernel_log_level::info)
 , vga_(v)
 {}
 
 void vga_stream::write(const char *s) {
-	// TODO hack: everything written to the vga_stream is also
-	// written to the serial device, if any
+	if(log == nullptr) {
+		if(serial) {
+			serial->transmit_string(1, s);
+		}
+		return vga_.write(s);
+	}
+
+	// every piece of text goes into the log right away, so that there is no
+	// partial line that an interrupt handler writing in between could mix
+	// its own output into
+	while(*s) {
+		size_t length = 0;
+		while(s[length] != 0 && s[length] != '\n' && length < kernel_log_record::TEXT_MAX) {
+			++length;
+		}
+		bool line_end = s[length] == '\n';
+		log->append(level, s, length, !line_end);
+		s += line_end ? length + 1 : length;
+		if(line_end) {
+			level = kernel_log_level::info;
+		}
+	}
+
+	if(!deferred) {
+		flush();
+	} else if(serial) {
+		serial->drain(false);
+	}
+}
+
+void vga_stream::set_deferred(bool d) {
+	deferred = d;
+	if(!deferred && log) {
+		flushing = false;
+		flush();
+	}
+}
+
+void vga_stream::flush() {
+	if(log == nullptr) {
+		return;
+	}
+	// an interrupt handler may flush while we are flushing, let it be
+	if(__atomic_exchange_n(&flushing, true, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	uint64_t head = log->head();
+	if(vga_pos < log->oldest()) {
+		vga_pos = log->oldest();
+	}
+	kernel_log_record record;
+	char buf[kernel_log_record::TEXT_MAX + 2];
+	for(; vga_pos < head; ++vga_pos) {
+		if(!log->read(vga_pos, &record)) {
+			if(vga_pos < log->oldest()) {
+				// overwritten while we were behind
+				continue;
+			}
+			// not completely written yet
+			break;
+		}
+		size_t length = record.length < kernel_log_record::TEXT_MAX ? record.length : kernel_log_record::TEXT_MAX;
+		memcpy(buf, record.text, length);
+		if(!record.continued) {
+			buf[length++] = '\n';
+		}
+		buf[length] = 0;
+		vga_.write(buf);
+	}
+
+	__atomic_store_n(&flushing, false, __ATOMIC_RELEASE);
+
 	if(serial) {
-		serial->transmit_string(1, s);
+		serial->drain(!deferred);
 	}
-	return vga_.write(s);
 }
 
 // modifiers
@@ -30,6 +102,19 @@ void cloudos::hex(vga_stream &s) {
 	s.base = 16;
 }
 
+void cloudos::log_debug(vga_stream &s) {
+	s.level = kernel_log_level::debug;
+}
+void cloudos::log_info(vga_stream &s) {
+	s.level = kernel_log_level::info;
+}
+void cloudos::log_warning(vga_stream &s) {
+	s.level = kernel_log_level::warning;
+}
+void cloudos::log_error(vga_stream &s) {
+	s.level = kernel_log_level::error;
+}
+
 vga_stream &cloudos::operator<<(vga_stream &s, cloudos::modifier m)
 {
 	m(s);
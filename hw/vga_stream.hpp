@@ -1,6 +1,7 @@
 #pragma once
 
 #include <hw/vga.hpp>
+#include <hw/kernel_log.hpp>
 #include <oslibc/error.h>
 #include <oslibc/utility.hpp>
 
@@ -8,22 +9,53 @@ namespace cloudos {
 
 struct x86_serial;
 
+/**
+ * The vga_stream is where the kernel writes its output. Without a kernel log,
+ * everything is written to the VGA buffer immediately. With a kernel log,
+ * every write is appended to the log with the current level, as records that
+ * are continued until the end of the line; the VGA buffer and serial port
+ * are then written from the log. Output of an interrupt handler may end up
+ * in the middle of a line that was interrupted, but never inside a record. In
+ * deferred mode, writing to the stream never touches the devices: the VGA
+ * buffer is flushed on the timer tick and the serial port is drained from
+ * its interrupt handler.
+ */
 struct vga_stream {
 	vga_stream(vga_buffer &v);
 
 	int base;
+	kernel_log_level level;
 
 	void write(const char*);
 	inline void set_serial(x86_serial *s) {
 		serial = s;
 	}
 
+	inline void set_log(kernel_log *l) {
+		log = l;
+		vga_pos = l ? l->head() : 0;
+	}
+
+	/** Switching deferred mode off synchronously writes all pending
+	 * output, e.g. before a panic.
+	 */
+	void set_deferred(bool d);
+
+	/** Write all complete lines in the kernel log that were not written
+	 * to the VGA buffer yet, and drain the serial port if not deferred.
+	 */
+	void flush();
+
 	inline vga_buffer &get_vga_buffer() {
 		return vga_;
 	}
 
 private:
 	x86_serial *serial = nullptr;
+	kernel_log *log = nullptr;
+	bool deferred = false;
+	bool flushing = false;
+	uint64_t vga_pos = 0;
 	vga_buffer &vga_;
 };
 
@@ -32,6 +64,11 @@ typedef void (*modifier)(vga_stream &);
 void bin(vga_stream&);
 void dec(vga_stream&);
 void hex(vga_stream&);
+// the level of the current line
+void log_debug(vga_stream&);
+void log_info(vga_stream&);
+void log_warning(vga_stream&);
+void log_error(vga_stream&);
 vga_stream &operator<<(vga_stream &, modifier);
 
 vga_stream &operator<<(vga_stream &, signed char);
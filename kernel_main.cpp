@@ -1,5 +1,6 @@
 #include "hw/vga.hpp"
 #include "hw/vga_stream.hpp"
+#include "hw/kernel_log.hpp"
 #include "hw/multiboot.hpp"
 #include "hw/segments.hpp"
 #include "hw/interrupt_table.hpp"
@@ -29,11 +30,15 @@
 #include "global.hpp"
 #include "rng/rng.hpp"
 #include <time/clock_store.hpp>
+#include <time/cputime_clock.hpp>
 #include <fd/unixsock.hpp>
 #include <term/terminal_store.hpp>
 #include <term/console_terminal.hpp>
 #include <blockdev/blockdev_store.hpp>
 #include <proc/process_store.hpp>
+#include <fd/dentry_cache.hpp>
+#include <fd/trace.hpp>
+#include <fd/profiler.hpp>
 
 using namespace cloudos;
 
@@ -48,6 +53,10 @@ void kernel_main(uint32_t multiboot_magic, void *bi_ptr, void *end_of_kernel) {
 	vga_buffer buf;
 	vga_stream stream(buf);
 	global.vga = &stream;
+	// too large for the stack, and the allocator isn't there yet
+	static kernel_log log;
+	global.log = &log;
+	stream.set_log(&log);
 	stream << "CloudOS v" cloudos_VERSION " -- starting up\n";
 	char cpu_name[13];
 	get_cpu_name(cpu_name);
@@ -193,6 +202,10 @@ void kernel_main(uint32_t multiboot_magic, void *bi_ptr, void *end_of_kernel) {
 	shmfs shared_memory_filesystem;
 	global.shmfs = &shared_memory_filesystem;
 
+	global.dentry_cache = allocate<dentry_cache>();
+	global.tracer = allocate<tracer>();
+	global.profiler = allocate<profiler>();
+
 	{
 		auto bootfs_fd = bootfs::get_root_fd();
 		if(!bootfs_fd) {
@@ -216,6 +229,8 @@ void kernel_main(uint32_t multiboot_magic, void *bi_ptr, void *end_of_kernel) {
 	global.process_store->register_process(init);
 
 	global.clock_store = allocate<clock_store>();
+	get_clock_store()->register_clock(CLOUDABI_CLOCK_PROCESS_CPUTIME_ID, allocate<process_cputime_clock>());
+	get_clock_store()->register_clock(CLOUDABI_CLOCK_THREAD_CPUTIME_ID, allocate<thread_cputime_clock>());
 	global.driver_store = allocate<driver_store>();
 	global.blockdev_store = allocate<blockdev_store>();
 
@@ -244,6 +259,9 @@ void kernel_main(uint32_t multiboot_magic, void *bi_ptr, void *end_of_kernel) {
 	dump_interfaces(stream, global.interface_store);
 
 	stream << "Waiting for interrupts...\n";
+	// from now on, output is written to the devices from interrupts
+	log.set_rate_limited(true);
+	stream.set_deferred(true);
 	int_handler.enable_interrupts();
 
 	// yield to init kernel thread
@@ -90,7 +90,7 @@ size_t cloudos::track_detail::dump_allocations(tracked_allocation *track, bool t
 		// If tracking is still enabled, very recent allocations that
 		// will still be deallocated are very likely to be mentioned in
 		// this report
-		get_vga_stream() << "Warning: tracking is still enabled\n";
+		get_vga_stream() << log_warning << "Warning: tracking is still enabled\n";
 	} else {
 		get_vga_stream() << "Stopped tracking at: " << stop << " (" << stop_since << " ms ago)\n";
 		get_vga_stream() << "Tracking period: " << (stop - start) << " ms\n";
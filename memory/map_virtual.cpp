@@ -125,13 +125,13 @@ Blk map_virtual::allocate_contiguous_phys(size_t size) {
 	size_t num_pages = num_pages_for_size(size);
 	size_t bit;
 	if(!vmem_bitmap.get_contiguous_free(num_pages, bit)) {
-		get_vga_stream() << "allocate_contiguous_phys() called, but there is no virtual address space left\n";
+		get_vga_stream() << log_error << "allocate_contiguous_phys() called, but there is no virtual address space left\n";
 		return {};
 	}
 
 	Blk phys_alloc = pa->allocate_contiguous_phys(num_pages);
 	if(phys_alloc.ptr == nullptr) {
-		get_vga_stream() << "allocate_contiguous_phys() called, but no physical contiguous block could be found\n";
+		get_vga_stream() << log_error << "allocate_contiguous_phys() called, but no physical contiguous block could be found\n";
 		return {};
 	}
 
@@ -164,7 +164,7 @@ Blk map_virtual::allocate(size_t size) {
 	size_t num_pages = num_pages_for_size(size);
 	size_t bit;
 	if(!vmem_bitmap.get_contiguous_free(num_pages, bit)) {
-		get_vga_stream() << "allocate() called, but there is no virtual address space left\n";
+		get_vga_stream() << log_error << "allocate() called, but there is no virtual address space left\n";
 		return {};
 	}
 
@@ -181,7 +181,7 @@ Blk map_virtual::allocate(size_t size) {
 
 		Blk b = pa->allocate_phys();
 		if(b.ptr == nullptr) {
-			get_vga_stream() << "allocate() called, but there are no pages left\n";
+			get_vga_stream() << log_error << "allocate() called, but there are no pages left\n";
 			// TODO: free earlier acquired pages
 			return {};
 		}
@@ -221,7 +221,7 @@ Blk map_virtual::map_pages_only(void *physaddr, size_t bytes) {
 	size_t num_pages = bytes / PAGE_SIZE;
 	size_t bit;
 	if(!vmem_bitmap.get_contiguous_free(num_pages, bit)) {
-		get_vga_stream() << "map_pages_only() called, but there is no virtual address space left\n";
+		get_vga_stream() << log_error << "map_pages_only() called, but there is no virtual address space left\n";
 		return {};
 	}
 
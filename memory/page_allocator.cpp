@@ -62,7 +62,7 @@ page_allocator::page_allocator(void *h, memory_map_entry *mmap, size_t mmap_size
 
 Blk page_allocator::allocate_phys() {
 	if(empty(free_pages)) {
-		get_vga_stream() << __PRETTY_FUNCTION__ << " - there are no pages left\n";
+		get_vga_stream() << log_error << __PRETTY_FUNCTION__ << " - there are no pages left\n";
 		return {};
 	}
 
@@ -88,7 +88,7 @@ Blk page_allocator::allocate_contiguous_phys(size_t num) {
 
 	while(num_found < num) {
 		if(last->next == nullptr) {
-			get_vga_stream() << __PRETTY_FUNCTION__ << " - there are no pages left\n";
+			get_vga_stream() << log_error << __PRETTY_FUNCTION__ << " - there are no pages left\n";
 			return {};
 		}
 
@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+#
+# Symbolizes a kernel profile, as read from procfs kernel/profile, against
+# the kernel and userland ELF binaries. The output is in the "folded" format
+# of flamegraph.pl (https://github.com/brendangregg/FlameGraph):
+#
+#   process;[kernel];function count
+#   process;function count
+#
+# The profile is flat: the kernel samples only the interrupted instruction
+# pointer and doesn't walk the stack, so every sample is attributed to the
+# function it was in, not to its callers. A flame graph of it therefore has
+# no call stacks, only one level of functions per process.
+#
+# Usage: symbolize_profile.py profile.bin --kernel build/cloudkernel \
+#          --binary networkd=build/userland/networkd/networkd \
+#          --binary extfs=build/userland/extfs/extfs > profile.folded
+#        flamegraph.pl profile.folded > profile.svg
+#
+# A --binary is used for every process whose name (the path of the binary it
+# executed) ends in the given name. Userland binaries are loaded at their
+# link addresses, so no relocation is needed.
+
+import argparse
+import bisect
+import collections
+import struct
+import subprocess
+import sys
+
+HEADER = struct.Struct("<IIIIIIII")
+PROCESS = struct.Struct("<I64s")
+SAMPLE = struct.Struct("<IIB3x")
+MAGIC = 0x46525043
+VERSION = 1
+
+class SymbolTable:
+  def __init__(self, nm, path):
+    self.addresses = []
+    self.names = []
+    output = subprocess.run([nm, "--numeric-sort", "--demangle", "--defined-only", path],
+      check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+    for line in output.splitlines():
+      parts = line.split(" ", 2)
+      if len(parts) != 3 or parts[1] not in "tTwW":
+        continue
+      self.addresses.append(int(parts[0], 16))
+      self.names.append(parts[2])
+
+  def lookup(self, address):
+    i = bisect.bisect_right(self.addresses, address) - 1
+    if i < 0:
+      return "0x%08x" % address
+    return self.names[i]
+
+def main():
+  parser = argparse.ArgumentParser(description="Symbolize a kernel profile into folded stacks")
+  parser.add_argument("profile", help="binary profile read from procfs kernel/profile")
+  parser.add_argument("--kernel", help="the cloudkernel ELF binary")
+  parser.add_argument("--binary", action="append", default=[], metavar="NAME=PATH",
+    help="userland ELF binary for processes whose name ends in NAME")
+  parser.add_argument("--nm", default="nm", help="nm to use (default: nm)")
+  args = parser.parse_args()
+
+  with open(args.profile, "rb") as f:
+    data = f.read()
+
+  if len(data) < HEADER.size:
+    sys.exit("profile is too short")
+  (magic, version, sample_size, num_samples, lost, rate_hz, num_processes,
+    _) = HEADER.unpack_from(data)
+  if magic != MAGIC or version != VERSION or sample_size != SAMPLE.size:
+    sys.exit("not a kernel profile, or an unsupported version")
+  offset = HEADER.size
+  if len(data) < offset + num_processes * PROCESS.size + num_samples * SAMPLE.size:
+    sys.exit("profile is truncated")
+
+  process_names = {}
+  for i in range(num_processes):
+    pid, name = PROCESS.unpack_from(data, offset)
+    process_names[pid] = name.split(b"\0", 1)[0].decode("utf-8", "replace")
+    offset += PROCESS.size
+
+  kernel = SymbolTable(args.nm, args.kernel) if args.kernel else None
+  binaries = []
+  for b in args.binary:
+    name, _, path = b.partition("=")
+    if not path:
+      sys.exit("--binary must be NAME=PATH")
+    binaries.append((name, SymbolTable(args.nm, path)))
+
+  def binary_for(process):
+    for name, table in binaries:
+      if process.endswith(name):
+        return table
+    return None
+
+  stacks = collections.Counter()
+  for i in range(num_samples):
+    eip, pid, user = SAMPLE.unpack_from(data, offset)
+    offset += SAMPLE.size
+    process = process_names.get(pid, "idle" if pid == 0 else "pid-%08x" % pid)
+    if user:
+      table = binary_for(process)
+      function = table.lookup(eip) if table else "0x%08x" % eip
+      stacks["%s;%s" % (process, function)] += 1
+    else:
+      function = kernel.lookup(eip) if kernel else "0x%08x" % eip
+      stacks["%s;[kernel];%s" % (process, function)] += 1
+
+  for stack, count in stacks.most_common():
+    print("%s %d" % (stack.replace(" ", "_"), count))
+
+  print("%d samples at %d Hz, %d lost" % (num_samples, rate_hz, lost), file=sys.stderr)
+
+if __name__ == "__main__":
+  main()
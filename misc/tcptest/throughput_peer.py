@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+# The host side of the tcptest throughput test. tcptest connects to it from
+# inside qemu, where the host is reachable at 10.0.2.2 with the default user
+# networking, and sends one command line per connection:
+#
+#   send <bytes>  tcptest sends that many bytes; they are checked and
+#                 answered with "ok" or "bad"
+#   recv <bytes>  that many bytes are sent to tcptest, then the connection
+#                 is closed
+#
+# Byte i of the data is i % 251, so reordered or lost data is detected.
+#
+# Usage: throughput_peer.py [--port 5001]
+
+import argparse
+import socketserver
+import sys
+import time
+
+PATTERN_PERIOD = 251
+CHUNK_SIZE = 64 * 1024
+
+def pattern(offset, length):
+  return bytes((offset + i) % PATTERN_PERIOD for i in range(length))
+
+class PeerHandler(socketserver.StreamRequestHandler):
+  def handle(self):
+    command = self.rfile.readline().decode("ascii", "replace").split()
+    if len(command) != 2 or command[0] not in ("send", "recv") or not command[1].isdigit():
+      print("invalid command from %s: %r" % (self.client_address[0], command), file=sys.stderr)
+      return
+    length = int(command[1])
+    start = time.monotonic()
+    if command[0] == "send":
+      correct = self.receive(length)
+      self.wfile.write(b"ok\n" if correct else b"bad\n")
+    else:
+      self.send(length)
+    elapsed = time.monotonic() - start
+    print("%s %d bytes: %.3f s, %d KiB/s" % (command[0], length, elapsed,
+      length / 1024 / elapsed if elapsed > 0 else 0))
+
+  def receive(self, length):
+    # the pattern repeats, so compare against one period-aligned buffer
+    expected = pattern(0, CHUNK_SIZE + PATTERN_PERIOD)
+    offset = 0
+    correct = True
+    while offset < length:
+      data = self.rfile.read1(min(CHUNK_SIZE, length - offset))
+      if not data:
+        print("connection closed after %d of %d bytes" % (offset, length), file=sys.stderr)
+        return False
+      start = offset % PATTERN_PERIOD
+      if data != expected[start:start + len(data)]:
+        correct = False
+      offset += len(data)
+    if not correct:
+      print("received incorrect data", file=sys.stderr)
+    return correct
+
+  def send(self, length):
+    chunk = pattern(0, CHUNK_SIZE + PATTERN_PERIOD)
+    offset = 0
+    while offset < length:
+      size = min(CHUNK_SIZE, length - offset)
+      start = offset % PATTERN_PERIOD
+      self.wfile.write(chunk[start:start + size])
+      offset += size
+    self.wfile.flush()
+
+class PeerServer(socketserver.ThreadingTCPServer):
+  allow_reuse_address = True
+  daemon_threads = True
+
+def main():
+  parser = argparse.ArgumentParser(description="Host side of the tcptest throughput test")
+  parser.add_argument("--port", type=int, default=5001)
+  args = parser.parse_args()
+  with PeerServer(("", args.port), PeerHandler) as server:
+    print("listening on port %d" % args.port)
+    server.serve_forever()
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+#
+# Converts a kernel trace, as read from procfs kernel/trace, into the Chrome
+# trace event JSON format, which can be loaded in chrome://tracing or
+# https://ui.perfetto.dev.
+#
+# Usage: decode_trace.py trace.bin > trace.json
+#
+# The names of syscalls and reverse operations are read from the kernel
+# sources, so the trace should be decoded against the sources of the kernel
+# that recorded it (see --source).
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct("<IIIIQQQQQ")
+EVENT = struct.Struct("<QIIIBBH")
+MAGIC = 0x43525443
+VERSION = 1
+
+SOURCE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+
+def read_source(source, path):
+  with open(os.path.join(source, path)) as f:
+    return f.read()
+
+def syscall_names(source):
+  # the entries of syscall_table, in the order of their numbers
+  text = read_source(source, "proc/syscall_table.cpp")
+  table = text[text.index("syscall_table["):]
+  table = table[:table.index("};")]
+  return re.findall(r'\{"(\w+)",', table)
+
+def reverse_op_names(source):
+  # the values of reverse_request_t::operation, which are all implicit
+  # except the first
+  text = read_source(source, "fd/reverse_proto.hpp")
+  body = text[text.index("enum class operation {"):]
+  body = body[body.index("{") + 1:body.index("}")]
+  body = re.sub(r"//.*", "", body)
+  return [item.split("=")[0].strip() for item in body.split(",") if item.strip()]
+
+def lookup(names, index, prefix):
+  if index < len(names):
+    return names[index]
+  return "%s%d" % (prefix, index)
+
+def event_name(names, type, arg):
+  if type == 1:
+    return "syscall", lookup(names["syscalls"], arg, "syscall_")
+  if type == 2:
+    return "sched", "context_switch"
+  if type == 3:
+    return "mm", "pagefault"
+  if type == 4:
+    return "reverse", lookup(names["reverse_ops"], arg, "op_")
+  if type == 5:
+    return "irq", "irq%d" % arg
+  return "unknown", "event%d" % type
+
+def main():
+  parser = argparse.ArgumentParser(description="Convert a kernel trace to Chrome trace JSON")
+  parser.add_argument("trace", help="binary trace read from procfs kernel/trace")
+  parser.add_argument("--tsc-mhz", type=float,
+    help="TSC frequency; by default, it is derived from the monotonic clock")
+  parser.add_argument("--source", default=SOURCE_DIR,
+    help="kernel source tree to read syscall and reverse operation names from")
+  args = parser.parse_args()
+
+  names = {
+    "syscalls": syscall_names(args.source),
+    "reverse_ops": reverse_op_names(args.source),
+  }
+
+  with open(args.trace, "rb") as f:
+    data = f.read()
+
+  if len(data) < HEADER.size:
+    sys.exit("trace is too short")
+  (magic, version, event_size, num_events, lost, start_tsc, start_ns,
+    end_tsc, end_ns) = HEADER.unpack_from(data)
+  if magic != MAGIC or version != VERSION or event_size != EVENT.size:
+    sys.exit("not a kernel trace, or an unsupported version")
+  if len(data) < HEADER.size + num_events * event_size:
+    sys.exit("trace is truncated")
+
+  if args.tsc_mhz:
+    tsc_per_us = args.tsc_mhz
+  elif end_ns > start_ns and end_tsc > start_tsc:
+    tsc_per_us = (end_tsc - start_tsc) / ((end_ns - start_ns) / 1000.)
+  else:
+    sys.exit("trace too short to derive the TSC frequency, pass --tsc-mhz")
+
+  events = []
+  for i in range(num_events):
+    tsc, pid, tid, arg, type, phase, _ = EVENT.unpack_from(data, HEADER.size + i * event_size)
+    cat, name = event_name(names, type, arg)
+    event = {
+      "name": name,
+      "cat": cat,
+      "ph": chr(phase),
+      "ts": (tsc - start_tsc) / tsc_per_us,
+      "pid": pid,
+      "tid": tid,
+    }
+    if phase == ord('i'):
+      event["s"] = "t"
+    if type == 3:
+      event["args"] = {"address": "0x%08x" % arg}
+    events.append(event)
+
+  json.dump({
+    "traceEvents": events,
+    "displayTimeUnit": "ns",
+    "otherData": {"lost_events": lost, "tsc_mhz": tsc_per_us},
+  }, sys.stdout)
+  sys.stdout.write("\n")
+  if lost:
+    print("warning: %d older events were overwritten" % lost, file=sys.stderr)
+
+if __name__ == "__main__":
+  main()
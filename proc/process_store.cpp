@@ -5,35 +5,178 @@
 using namespace cloudos;
 
 process_store::process_store()
-: processes_(nullptr)
-{}
+{
+	Blk b = allocate(INITIAL_BUCKETS * sizeof(process_entry*));
+	if(b.ptr == nullptr) {
+		kernel_panic("Failed to allocate process store");
+	}
+	buckets = reinterpret_cast<process_entry**>(b.ptr);
+	num_buckets = INITIAL_BUCKETS;
+	for(size_t i = 0; i < num_buckets; ++i) {
+		buckets[i] = nullptr;
+	}
+}
+
+process_store::~process_store()
+{
+	for(size_t i = 0; i < num_buckets; ++i) {
+		while(buckets[i]) {
+			auto *e = buckets[i];
+			buckets[i] = e->next;
+			deallocate(e);
+		}
+	}
+	deallocate({buckets, num_buckets * sizeof(process_entry*)});
+}
+
+size_t process_store::hash(uint8_t const *pid)
+{
+	// pids are random UUIDs, so their first bytes are a good hash
+	uint32_t h;
+	memcpy(&h, pid, sizeof(h));
+	return h;
+}
+
+process_entry **process_store::bucket_for(uint8_t const *pid)
+{
+	return &buckets[hash(pid) & (num_buckets - 1)];
+}
+
+void process_store::insert(process_entry *entry)
+{
+	auto **bucket = bucket_for(entry->pid);
+	entry->next = *bucket;
+	*bucket = entry;
+}
+
+void process_store::reap_bucket(size_t i)
+{
+	process_entry **link = &buckets[i];
+	while(*link) {
+		auto *e = *link;
+		if(e->weak.expired()) {
+			*link = e->next;
+			deallocate(e);
+			num_entries--;
+		} else {
+			link = &e->next;
+		}
+	}
+}
+
+void process_store::reap_some()
+{
+	for(size_t i = 0; i < REAP_BUCKETS_PER_OPERATION; ++i) {
+		reap_bucket(reap_cursor);
+		reap_cursor = (reap_cursor + 1) & (num_buckets - 1);
+	}
+}
+
+void process_store::grow()
+{
+	size_t new_num_buckets = num_buckets * 2;
+	Blk b = allocate(new_num_buckets * sizeof(process_entry*));
+	if(b.ptr == nullptr) {
+		// keep using the current table, it just gets slower
+		return;
+	}
+	auto **old_buckets = buckets;
+	size_t old_num_buckets = num_buckets;
+	buckets = reinterpret_cast<process_entry**>(b.ptr);
+	num_buckets = new_num_buckets;
+	for(size_t i = 0; i < num_buckets; ++i) {
+		buckets[i] = nullptr;
+	}
+	for(size_t i = 0; i < old_num_buckets; ++i) {
+		while(old_buckets[i]) {
+			auto *e = old_buckets[i];
+			old_buckets[i] = e->next;
+			if(e->weak.expired()) {
+				deallocate(e);
+				num_entries--;
+			} else {
+				insert(e);
+			}
+		}
+	}
+	deallocate({old_buckets, old_num_buckets * sizeof(process_entry*)});
+	reap_cursor = 0;
+}
 
 void process_store::register_process(shared_ptr<process_fd> f) {
+	uint8_t pid[16];
+	f->get_pid(pid, sizeof(pid));
+
 #ifndef NDEBUG
-	for (weak_ptr<process_fd> weak : processes_) {
-		shared_ptr<process_fd> fd = weak.lock();
-		if (fd && fd == f) {
+	for(process_entry *e = *bucket_for(pid); e; e = e->next) {
+		if(!e->weak.expired() && e->process == f.get()) {
 			kernel_panic("process registering to process store is already registered");
 		}
 	}
 #endif
 
-	process_weaklist *new_entry = allocate<process_weaklist>(f);
-	append(&processes_, new_entry);
+	reap_some();
+	if(num_entries >= num_buckets * 2) {
+		grow();
+	}
+
+	auto *entry = allocate<process_entry>();
+	memcpy(entry->pid, pid, sizeof(pid));
+	entry->process = f.get();
+	entry->weak = f;
+	insert(entry);
+	num_entries++;
+}
+
+void process_store::pid_changed(process_fd *f, uint8_t const *old_pid) {
+	process_entry **link = bucket_for(old_pid);
+	while(*link) {
+		auto *e = *link;
+		if(!e->weak.expired() && e->process == f) {
+			*link = e->next;
+			f->get_pid(e->pid, sizeof(e->pid));
+			insert(e);
+			return;
+		}
+		link = &e->next;
+	}
+	// not registered (yet)
 }
 
 shared_ptr<process_fd> process_store::find_process(uint8_t const *pid) {
-	uint8_t p[16];
-	// TODO: O(n) -> O(log n)
-	for(weak_ptr<process_fd> weakfd : processes_) {
-		shared_ptr<process_fd> fd = weakfd.lock();
-		if (!fd) {
-			// TODO: process already exited, should take entry out of processes_
+	reap_some();
+	process_entry **link = bucket_for(pid);
+	while(*link) {
+		auto *e = *link;
+		auto fd = e->weak.lock();
+		if(!fd) {
+			// process already exited, take the entry out
+			*link = e->next;
+			deallocate(e);
+			num_entries--;
 			continue;
 		}
-		if (memcmp(p, pid, sizeof(p)) == 0) {
+		if(memcmp(e->pid, pid, sizeof(e->pid)) == 0) {
 			return fd;
 		}
+		link = &e->next;
+	}
+	return nullptr;
+}
+
+shared_ptr<process_fd> process_store::find_process_by_prefix(uint64_t prefix, uint64_t mask) {
+	assert((mask & 0xffffffff) == 0xffffffff);
+	uint8_t pid[16] = {0};
+	memcpy(pid, &prefix, sizeof(prefix));
+	for(process_entry *e = *bucket_for(pid); e; e = e->next) {
+		uint64_t e_prefix;
+		memcpy(&e_prefix, e->pid, sizeof(e_prefix));
+		if(((e_prefix ^ prefix) & mask) == 0) {
+			auto fd = e->weak.lock();
+			if(fd) {
+				return fd;
+			}
+		}
 	}
 	return nullptr;
 }
@@ -8,22 +8,77 @@ namespace cloudos {
 
 struct process_fd;
 
-typedef linked_list<weak_ptr<process_fd>> process_weaklist;
+/** An entry in the process_store hash table. The process pointer is only
+ * used for comparisons, and only while the weak_ptr is not expired.
+ */
+struct process_entry {
+	uint8_t pid[16];
+	process_fd *process;
+	weak_ptr<process_fd> weak;
+	process_entry *next;
+};
 
+/** The process store keeps track of all processes by their pid. Processes are
+ * kept in a hash table of weak references keyed by pid; entries of processes
+ * that no longer exist are removed when they are encountered during a
+ * lookup, and incrementally by sweeping a few buckets on every operation, so
+ * that no operation has to go over all processes.
+ *
+ * A process that is forked but didn't exec() yet has an all-zero pid. Its
+ * entry moves when it gets its own pid, through pid_changed().
+ */
 struct process_store {
 	process_store();
+	~process_store();
 
 	void register_process(shared_ptr<process_fd> f);
 
-	inline process_weaklist *get_processes() {
-		return processes_;
-	}
+	/** The given process got a new pid; old_pid is its previous pid. */
+	void pid_changed(process_fd *f, uint8_t const *old_pid);
 
 	// 16 bytes are read from the pid ptr
 	shared_ptr<process_fd> find_process(uint8_t const *pid);
 
+	/** Find a process by the first 8 bytes of its pid, in host order, of
+	 * which only the bits in mask are compared. If more than one process
+	 * matches, returns one of them. The mask must include the lowest 32
+	 * bits, which are used to find the bucket.
+	 */
+	shared_ptr<process_fd> find_process_by_prefix(uint64_t prefix, uint64_t mask = UINT64_MAX);
+
+	/** Call f(shared_ptr<process_fd>) for every existing process. */
+	template <typename Functor>
+	void iterate_processes(Functor f) {
+		for(size_t i = 0; i < num_buckets; ++i) {
+			for(process_entry *e = buckets[i]; e; e = e->next) {
+				auto process = e->weak.lock();
+				if(process) {
+					f(process);
+				}
+			}
+		}
+	}
+
+	/** The number of entries, including ones not reaped yet. */
+	inline size_t size() {
+		return num_entries;
+	}
+
 private:
-	process_weaklist *processes_;
+	static constexpr size_t INITIAL_BUCKETS = 64;
+	static constexpr size_t REAP_BUCKETS_PER_OPERATION = 2;
+
+	static size_t hash(uint8_t const *pid);
+	process_entry **bucket_for(uint8_t const *pid);
+	void insert(process_entry *entry);
+	void reap_bucket(size_t i);
+	void reap_some();
+	void grow();
+
+	process_entry **buckets = nullptr;
+	size_t num_buckets = 0;
+	size_t num_entries = 0;
+	size_t reap_cursor = 0;
 };
 
 };
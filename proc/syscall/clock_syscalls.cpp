@@ -5,13 +5,13 @@
 using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_clock_time_get(syscall_context &c) {
-	auto args = arguments_t<cloudabi_clockid_t, cloudabi_timestamp_t, cloudabi_timestamp_t*>(c);
+	auto args = syscall_clock_time_get_args(c);
 	auto clockid = args.first();
 	auto precision = args.second();
 
 	auto clock = get_clock_store()->get_clock(clockid);
 	if(!clock) {
-		get_vga_stream() << "Unknown clock ID " << clockid << "\n";
+		get_vga_stream() << log_debug << "Unknown clock ID " << clockid << "\n";
 		return EINVAL;
 	}
 
@@ -20,12 +20,12 @@ cloudabi_errno_t cloudos::syscall_clock_time_get(syscall_context &c) {
 }
 
 cloudabi_errno_t cloudos::syscall_clock_res_get(syscall_context &c) {
-	auto args = arguments_t<cloudabi_clockid_t, cloudabi_timestamp_t*>(c);
+	auto args = syscall_clock_res_get_args(c);
 	auto clockid = args.first();
 
 	auto clock = get_clock_store()->get_clock(clockid);
 	if(!clock) {
-		get_vga_stream() << "Unknown clock ID " << clockid << "\n";
+		get_vga_stream() << log_debug << "Unknown clock ID " << clockid << "\n";
 		return EINVAL;
 	}
 
@@ -5,12 +5,12 @@
 using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_condvar_signal(syscall_context &c) {
-	auto args = arguments_t<_Atomic(cloudabi_condvar_t)*, cloudabi_scope_t, cloudabi_nthreads_t>(c);
+	auto args = syscall_condvar_signal_args(c);
 	auto condvar = args.first();
 	auto scope = args.second();
 	auto nwaiters = args.third();
 	if(scope != CLOUDABI_SCOPE_PRIVATE) {
-		get_vga_stream() << "condvar_signal(): non-private condition variables are not supported yet\n";
+		get_vga_stream() << log_warning << "condvar_signal(): non-private condition variables are not supported yet\n";
 		return ENOSYS;
 	}
 
@@ -19,11 +19,11 @@ cloudabi_errno_t cloudos::syscall_condvar_signal(syscall_context &c) {
 }
 
 cloudabi_errno_t cloudos::syscall_lock_unlock(syscall_context &c) {
-	auto args = arguments_t<_Atomic(cloudabi_lock_t)*, cloudabi_scope_t>(c);
+	auto args = syscall_lock_unlock_args(c);
 	auto lock = args.first();
 	auto scope = args.second();
 	if(scope != CLOUDABI_SCOPE_PRIVATE) {
-		get_vga_stream() << "lock_unlock(): non-private locks are not supported yet\n";
+		get_vga_stream() << log_warning << "lock_unlock(): non-private locks are not supported yet\n";
 		return ENOSYS;
 	}
 
@@ -2,6 +2,7 @@
 #include <fd/process_fd.hpp>
 #include <fd/unixsock.hpp>
 #include <fd/shmfs.hpp>
+#include <fd/ring_fd.hpp>
 #include <global.hpp>
 
 using namespace cloudos;
@@ -11,14 +12,14 @@ static const cloudabi_rights_t all_rights = 0x0815ffff7ff;
 
 cloudabi_errno_t cloudos::syscall_fd_close(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t>(c);
+	auto args = syscall_fd_close_args(c);
 	auto fdnum = args.first();
 	return c.process()->close_fd(fdnum);
 }
 
 cloudabi_errno_t cloudos::syscall_fd_create1(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_filetype_t, cloudabi_fd_t*>(c);
+	auto args = syscall_fd_create1_args(c);
 	auto type = args.first();
 
 	if(type == CLOUDABI_FILETYPE_SHARED_MEMORY) {
@@ -33,6 +34,15 @@ cloudabi_errno_t cloudos::syscall_fd_create1(syscall_context &c)
 		auto fd = c.process()->add_fd(shm, sock_rights, 0);
 		c.result = fd;
 		return 0;
+	} else if(type == ring_proto::filetype_ring) {
+		auto ring = make_shared<ring_fd>("ring_fd");
+		auto ring_rights = 0
+			| CLOUDABI_RIGHT_FD_READ
+			| CLOUDABI_RIGHT_FD_WRITE
+			| CLOUDABI_RIGHT_POLL_FD_READWRITE;
+		auto fd = c.process()->add_fd(ring, ring_rights, 0);
+		c.result = fd;
+		return 0;
 	} else {
 		return EINVAL;
 	}
@@ -40,7 +50,7 @@ cloudabi_errno_t cloudos::syscall_fd_create1(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_create2(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_filetype_t, cloudabi_fd_t*, cloudabi_fd_t*>(c);
+	auto args = syscall_fd_create2_args(c);
 	auto type = args.first();
 
 	if(type == CLOUDABI_FILETYPE_SOCKET_DGRAM
@@ -71,7 +81,7 @@ cloudabi_errno_t cloudos::syscall_fd_create2(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_datasync(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t>(c);
+	auto args = syscall_fd_datasync_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FD_DATASYNC);
@@ -85,7 +95,7 @@ cloudabi_errno_t cloudos::syscall_fd_datasync(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_dup(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_fd_t*>(c);
+	auto args = syscall_fd_dup_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, 0);
@@ -99,7 +109,7 @@ cloudabi_errno_t cloudos::syscall_fd_dup(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_pread(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_iovec_t *, size_t, size_t, size_t *>(c);
+	auto args = syscall_fd_pread_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FD_READ | CLOUDABI_RIGHT_FD_SEEK);
@@ -116,28 +126,17 @@ cloudabi_errno_t cloudos::syscall_fd_pread(syscall_context &c)
 		return 0;
 	}
 
-	// TODO: pass iov, iovcnt to read() instead of calling read() multiple
-	// times
-	size_t r;
-	size_t i = 0;
-	size_t read = 0;
-	do {
-		auto buf = iov[i].buf;
-		auto len = iov[i].buf_len;
-		r = mapping->fd->pread(buf, len, offset + read);
-		if(mapping->fd->error) {
-			return mapping->fd->error;
-		}
-		read += r;
-		i++;
-	} while(r > 0 && i < iovcnt);
+	auto read = mapping->fd->preadv(iov, iovcnt, offset);
+	if(mapping->fd->error && read == 0) {
+		return mapping->fd->error;
+	}
 	c.result = read;
 	return 0;
 }
 
 cloudabi_errno_t cloudos::syscall_fd_pwrite(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_ciovec_t*, size_t, size_t, size_t*>(c);
+	auto args = syscall_fd_pwrite_args(c);
 	auto fdnum = args.first();
 	auto iov = args.second();
 	auto iovcnt = args.third();
@@ -149,24 +148,17 @@ cloudabi_errno_t cloudos::syscall_fd_pwrite(syscall_context &c)
 		return res;
 	}
 
-	// TODO: pass iov, iovcnt to pwrite() instead of calling pwrite() multiple
-	// times
-	c.result = 0;
-	for(size_t i = 0; i < iovcnt; ++i) {
-		auto buf = iov[i].buf;
-		auto len = iov[i].buf_len;
-		mapping->fd->pwrite(reinterpret_cast<const char*>(buf), len, offset + c.result);
-		c.result += len;
-		if(mapping->fd->error) {
-			return mapping->fd->error;
-		}
+	auto written = mapping->fd->pwritev(iov, iovcnt, offset);
+	if(mapping->fd->error && written == 0) {
+		return mapping->fd->error;
 	}
+	c.result = written;
 	return 0;
 }
 
 cloudabi_errno_t cloudos::syscall_fd_read(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_iovec_t *, size_t, size_t *>(c);
+	auto args = syscall_fd_read_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FD_READ);
@@ -182,28 +174,17 @@ cloudabi_errno_t cloudos::syscall_fd_read(syscall_context &c)
 		return 0;
 	}
 
-	// TODO: pass iov, iovcnt to read() instead of calling read() multiple
-	// times
-	size_t r;
-	size_t i = 0;
-	size_t read = 0;
-	do {
-		auto buf = iov[i].buf;
-		auto len = iov[i].buf_len;
-		r = mapping->fd->read(buf, len);
-		if(mapping->fd->error) {
-			return mapping->fd->error;
-		}
-		read += r;
-		i++;
-	} while(r > 0 && i < iovcnt);
+	auto read = mapping->fd->readv(iov, iovcnt);
+	if(mapping->fd->error && read == 0) {
+		return mapping->fd->error;
+	}
 	c.result = read;
 	return 0;
 }
 
 cloudabi_errno_t cloudos::syscall_fd_replace(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_fd_t>(c);
+	auto args = syscall_fd_replace_args(c);
 	auto fromnum = args.first();
 	auto tonum = args.second();
 
@@ -222,7 +203,7 @@ cloudabi_errno_t cloudos::syscall_fd_replace(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_seek(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_filedelta_t, cloudabi_whence_t, cloudabi_filesize_t*>(c);
+	auto args = syscall_fd_seek_args(c);
 	auto fdnum = args.first();
 	auto offset = args.second();
 	auto whence = args.third();
@@ -247,7 +228,7 @@ cloudabi_errno_t cloudos::syscall_fd_seek(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_stat_get(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_fdstat_t*>(c);
+	auto args = syscall_fd_stat_get_args(c);
 	auto fdnum = args.first();
 	auto stat = args.second();
 
@@ -266,7 +247,7 @@ cloudabi_errno_t cloudos::syscall_fd_stat_get(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_stat_put(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_fdstat_t*, cloudabi_fdsflags_t>(c);
+	auto args = syscall_fd_stat_put_args(c);
 	auto fdnum = args.first();
 	auto stat = args.second();
 	auto flags = args.third();
@@ -299,7 +280,7 @@ cloudabi_errno_t cloudos::syscall_fd_stat_put(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_sync(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t>(c);
+	auto args = syscall_fd_sync_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FD_SYNC);
@@ -313,7 +294,7 @@ cloudabi_errno_t cloudos::syscall_fd_sync(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_fd_write(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_ciovec_t*, size_t, size_t*>(c);
+	auto args = syscall_fd_write_args(c);
 	auto fdnum = args.first();
 	auto iov = args.second();
 	auto iovcnt = args.third();
@@ -324,17 +305,10 @@ cloudabi_errno_t cloudos::syscall_fd_write(syscall_context &c)
 		return res;
 	}
 
-	// TODO: pass iov, iovcnt to write() instead of calling write() multiple
-	// times
-	c.result = 0;
-	for(size_t i = 0; i < iovcnt; ++i) {
-		auto buf = iov[i].buf;
-		auto len = iov[i].buf_len;
-		mapping->fd->write(reinterpret_cast<const char*>(buf), len);
-		c.result += len;
-		if(mapping->fd->error) {
-			return mapping->fd->error;
-		}
+	auto written = mapping->fd->writev(iov, iovcnt);
+	if(mapping->fd->error && written == 0) {
+		return mapping->fd->error;
 	}
+	c.result = written;
 	return 0;
 }
@@ -7,7 +7,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_file_advise(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_filesize_t, cloudabi_filesize_t, cloudabi_advice_t>(c);
+	auto args = syscall_file_advise_args(c);
 	auto fdnum = args.first();
 	auto advice = args.fourth();
 
@@ -27,7 +27,7 @@ cloudabi_errno_t cloudos::syscall_file_advise(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_allocate(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_filesize_t, cloudabi_filesize_t>(c);
+	auto args = syscall_file_allocate_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FILE_ALLOCATE);
@@ -44,14 +44,14 @@ cloudabi_errno_t cloudos::syscall_file_allocate(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_create(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const char*, size_t, cloudabi_filetype_t>(c);
+	auto args = syscall_file_create_args(c);
 	auto type = args.fourth();
 
 	cloudabi_rights_t right_needed = 0;
 	if(type == CLOUDABI_FILETYPE_DIRECTORY) {
 		right_needed = CLOUDABI_RIGHT_FILE_CREATE_DIRECTORY;
 	} else {
-		get_vga_stream() << "Unknown file type to create, failing\n";
+		get_vga_stream() << log_warning << "Unknown file type to create, failing\n";
 		return EINVAL;
 	}
 
@@ -70,7 +70,7 @@ cloudabi_errno_t cloudos::syscall_file_create(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_link(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_fd_t, const char*, size_t>(c);
+	auto args = syscall_file_link_args(c);
 	auto fd1 = args.first().fd;
 	fd_mapping_t *mapping1;
 	auto res = c.process()->get_fd(&mapping1, fd1, CLOUDABI_RIGHT_FILE_LINK_SOURCE);
@@ -96,7 +96,7 @@ cloudabi_errno_t cloudos::syscall_file_link(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_open(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_oflags_t, const cloudabi_fdstat_t*, cloudabi_fd_t*>(c);
+	auto args = syscall_file_open_args(c);
 	auto dirfd = args.first();
 	int fdnum = dirfd.fd;
 	fd_mapping_t *mapping;
@@ -109,7 +109,7 @@ cloudabi_errno_t cloudos::syscall_file_open(syscall_context &c)
 	cloudabi_fdstat_t fds = *args.fifth();
 	if((mapping->rights_inheriting & fds.fs_rights_base) != fds.fs_rights_base
 	|| (mapping->rights_inheriting & fds.fs_rights_inheriting) != fds.fs_rights_inheriting) {
-		get_vga_stream() << "userspace wants too many permissions\n";
+		get_vga_stream() << log_debug << "userspace wants too many permissions\n";
 		return ENOTCAPABLE;
 	}
 
@@ -130,7 +130,7 @@ cloudabi_errno_t cloudos::syscall_file_open(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_readdir(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, char*, size_t, cloudabi_dircookie_t, size_t*>(c);
+	auto args = syscall_file_readdir_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FILE_READDIR);
@@ -147,7 +147,7 @@ cloudabi_errno_t cloudos::syscall_file_readdir(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_readlink(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const char*, size_t, char*, size_t, size_t*>(c);
+	auto args = syscall_file_readlink_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FILE_READLINK);
@@ -169,12 +169,12 @@ cloudabi_errno_t cloudos::syscall_file_readlink(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_rename(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const char*, size_t, cloudabi_fd_t, const char*, size_t>(c);
+	auto args = syscall_file_rename_args(c);
 	auto fd1 = args.first();
 	fd_mapping_t *mapping1;
 	auto res = c.process()->get_fd(&mapping1, fd1, CLOUDABI_RIGHT_FILE_RENAME_SOURCE);
 	if(res != 0) {
-		get_vga_stream() << "rename source failed\n";
+		get_vga_stream() << log_debug << "rename source failed\n";
 		return res;
 	}
 
@@ -182,7 +182,7 @@ cloudabi_errno_t cloudos::syscall_file_rename(syscall_context &c)
 	fd_mapping_t *mapping2;
 	res = c.process()->get_fd(&mapping2, fd2, CLOUDABI_RIGHT_FILE_RENAME_TARGET);
 	if(res != 0) {
-		get_vga_stream() << "rename target failed\n";
+		get_vga_stream() << log_debug << "rename target failed\n";
 		return res;
 	}
 
@@ -197,7 +197,7 @@ cloudabi_errno_t cloudos::syscall_file_rename(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_stat_fget(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_filestat_t*>(c);
+	auto args = syscall_file_stat_fget_args(c);
 	auto fdnum = args.first();
 	auto statbuf = args.second();
 
@@ -216,7 +216,7 @@ cloudabi_errno_t cloudos::syscall_file_stat_fget(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_stat_fput(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_filestat_t*, cloudabi_fsflags_t>(c);
+	auto args = syscall_file_stat_fput_args(c);
 	auto fdnum = args.first();
 	auto statbuf = args.second();
 	auto flags = args.third();
@@ -252,7 +252,7 @@ cloudabi_errno_t cloudos::syscall_file_stat_fput(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_stat_get(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_filestat_t*>(c);
+	auto args = syscall_file_stat_get_args(c);
 	auto dirfd = args.first();
 	auto path = args.second();
 	auto pathlen = args.third();
@@ -271,7 +271,7 @@ cloudabi_errno_t cloudos::syscall_file_stat_get(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_stat_put(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_lookup_t, const char*, size_t, const cloudabi_filestat_t*, cloudabi_fsflags_t>(c);
+	auto args = syscall_file_stat_put_args(c);
 	auto dirfd = args.first();
 	auto path = args.second();
 	auto pathlen = args.third();
@@ -310,7 +310,7 @@ cloudabi_errno_t cloudos::syscall_file_stat_put(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_symlink(syscall_context &c)
 {
-	auto args = arguments_t<const char*, size_t, cloudabi_fd_t, const char*, size_t>(c);
+	auto args = syscall_file_symlink_args(c);
 	auto fdnum = args.third();
 
 	fd_mapping_t *mapping;
@@ -329,7 +329,7 @@ cloudabi_errno_t cloudos::syscall_file_symlink(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_file_unlink(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, char*, size_t, cloudabi_ulflags_t>(c);
+	auto args = syscall_file_unlink_args(c);
 	auto fdnum = args.first();
 	fd_mapping_t *mapping;
 	auto res = c.process()->get_fd(&mapping, fdnum, CLOUDABI_RIGHT_FILE_UNLINK);
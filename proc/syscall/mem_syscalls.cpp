@@ -6,7 +6,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_mem_advise(syscall_context &c)
 {
-	auto args = arguments_t<void*, size_t, cloudabi_advice_t>(c);
+	auto args = syscall_mem_advise_args(c);
 	auto address = args.first();
 	auto len = args.second();
 	auto advice = args.third();
@@ -28,7 +28,7 @@ cloudabi_errno_t cloudos::syscall_mem_advise(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_mem_map(syscall_context &c)
 {
-	auto args = arguments_t<void*, size_t, cloudabi_mprot_t, cloudabi_mflags_t, cloudabi_fd_t, cloudabi_filesize_t, void**>(c);
+	auto args = syscall_mem_map_args(c);
 	auto address_requested = args.first();
 	auto len = args.second();
 	auto prot = args.third();
@@ -77,12 +77,12 @@ cloudabi_errno_t cloudos::syscall_mem_map(syscall_context &c)
 		// do the placement as well
 		address_requested = c.process()->find_free_virtual_range(len_to_pages(len));
 		if(address_requested == nullptr) {
-			get_vga_stream() << "Failed to find virtual memory for mapping.\n";
+			get_vga_stream() << log_warning << "Failed to find virtual memory for mapping.\n";
 			return ENOMEM;
 		}
 	}
 	if((reinterpret_cast<uint32_t>(address_requested) % process_fd::PAGE_SIZE) != 0) {
-		get_vga_stream() << "Address requested isn't page aligned\n";
+		get_vga_stream() << log_debug << "Address requested isn't page aligned\n";
 		return EINVAL;
 	}
 
@@ -117,7 +117,7 @@ cloudabi_errno_t cloudos::syscall_mem_map(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_mem_protect(syscall_context &c)
 {
-	auto args = arguments_t<void*, size_t, cloudabi_mprot_t>(c);
+	auto args = syscall_mem_protect_args(c);
 	auto addr = args.first();
 	auto len = args.second();
 	auto prot = args.third();
@@ -137,7 +137,7 @@ cloudabi_errno_t cloudos::syscall_mem_protect(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_mem_sync(syscall_context &c)
 {
-	auto args = arguments_t<void*, size_t, cloudabi_msflags_t>(c);
+	auto args = syscall_mem_sync_args(c);
 	auto addr = args.first();
 	auto len = args.second();
 	auto flags = args.third();
@@ -162,7 +162,7 @@ cloudabi_errno_t cloudos::syscall_mem_sync(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_mem_unmap(syscall_context &c)
 {
-	auto args = arguments_t<void*, size_t>(c);
+	auto args = syscall_mem_unmap_args(c);
 	auto addr = args.first();
 	auto len = args.second();
 
@@ -12,7 +12,7 @@ static bool return_true(void*, thread_condition*, thread_condition_data**) {
 
 cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 {
-	auto args = arguments_t<const cloudabi_subscription_t*, cloudabi_event_t*, size_t, size_t*>(c);
+	auto args = syscall_poll_args(c);
 	auto in = args.first();
 	auto out = args.second();
 	size_t nsubscriptions = args.third();
@@ -88,7 +88,7 @@ cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 			auto *condvar = i.condvar.condvar;
 			auto *lock = i.condvar.lock;
 			if(i.condvar.condvar_scope != CLOUDABI_SCOPE_PRIVATE || i.condvar.lock_scope != CLOUDABI_SCOPE_PRIVATE) {
-				get_vga_stream() << "poll(): non-private locks or condvars are not supported yet\n";
+				get_vga_stream() << log_warning << "poll(): non-private locks or condvars are not supported yet\n";
 				signaler = &null_signaler;
 				userdata->error = ENOSYS;
 			} else {
@@ -109,7 +109,7 @@ cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 		case CLOUDABI_EVENTTYPE_LOCK_WRLOCK: {
 			auto *lock = i.lock.lock;
 			if(i.lock.lock_scope != CLOUDABI_SCOPE_PRIVATE) {
-				get_vga_stream() << "poll(): non-private locks are not supported yet\n";
+				get_vga_stream() << log_warning << "poll(): non-private locks are not supported yet\n";
 				signaler = &null_signaler;
 				userdata->error = ENOSYS;
 			} else {
@@ -127,7 +127,7 @@ cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 		case CLOUDABI_EVENTTYPE_CLOCK: {
 			auto clock = get_clock_store()->get_clock(i.clock.clock_id);
 			if(clock == nullptr) {
-				get_vga_stream() << "Unknown clock ID " << i.clock.clock_id << "\n";
+				get_vga_stream() << log_debug << "Unknown clock ID " << i.clock.clock_id << "\n";
 				userdata->error = ENOSYS;
 				signaler = &null_signaler;
 				break;
@@ -142,6 +142,11 @@ cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 				signaler = &null_signaler;
 			} else {
 				signaler = clock->get_signaler(timeout, i.clock.precision);
+				if(signaler == nullptr) {
+					// this clock can't be waited on
+					userdata->error = ENOTSUP;
+					signaler = &null_signaler;
+				}
 			}
 			break;
 		}
@@ -256,13 +261,13 @@ cloudabi_errno_t cloudos::syscall_poll(syscall_context &c)
 			auto *lock = i->type == CLOUDABI_EVENTTYPE_CONDVAR ? i->condvar.lock : i->lock.lock;
 			if(i->type != CLOUDABI_EVENTTYPE_LOCK_RDLOCK) {
 				if((*lock & CLOUDABI_LOCK_WRLOCKED) == 0 || (*lock & 0x3fffffff) != c.thread->get_thread_id()) {
-					get_vga_stream() << "Warning: Thought I had a writelock, but it's not writelocked or thread ID isn't mine\n";
+					get_vga_stream() << log_error << "Warning: Thought I had a writelock, but it's not writelocked or thread ID isn't mine\n";
 				}
 			} else {
 				if((*lock & CLOUDABI_LOCK_WRLOCKED) == CLOUDABI_LOCK_WRLOCKED) {
-					get_vga_stream() << "Warning: Thought I had a readlock, but lock is writelocked.\n";
+					get_vga_stream() << log_error << "Warning: Thought I had a readlock, but lock is writelocked.\n";
 				} else if((*lock & 0x3fffffff) == 0) {
-					get_vga_stream() << "Warning: Thought I had a readlock, but readcount is 0.\n";
+					get_vga_stream() << log_error << "Warning: Thought I had a readlock, but readcount is 0.\n";
 				}
 			}
 		}
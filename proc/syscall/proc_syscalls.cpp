@@ -8,7 +8,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_proc_exec(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const void*, size_t, const cloudabi_fd_t*, size_t>(c);
+	auto args = syscall_proc_exec_args(c);
 	auto fd = args.first();
 	auto fds = args.fourth();
 	auto fdslen = args.fifth();
@@ -40,7 +40,7 @@ cloudabi_errno_t cloudos::syscall_proc_exec(syscall_context &c)
 	auto datalen = args.third();
 	res = c.process()->exec(mapping->fd, fdslen, new_fds, data, datalen);
 	if(res != 0) {
-		get_vga_stream() << "exec() failed because of " << res << "\n";
+		get_vga_stream() << log_warning << "exec() failed because of " << res << "\n";
 		return res;
 	}
 
@@ -51,7 +51,7 @@ cloudabi_errno_t cloudos::syscall_proc_exec(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_proc_exit(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_exitcode_t>(c);
+	auto args = syscall_proc_exit_args(c);
 
 	assert(!c.process()->is_terminated());
 	c.process()->exit(args.first());
@@ -83,7 +83,7 @@ cloudabi_errno_t cloudos::syscall_proc_fork(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_proc_raise(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_signal_t>(c);
+	auto args = syscall_proc_raise_args(c);
 
 	assert(!c.process()->is_terminated());
 	c.process()->signal(args.first());
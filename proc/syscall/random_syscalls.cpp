@@ -6,7 +6,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_random_get(syscall_context &c)
 {
-	auto args = arguments_t<char*, size_t>(c);
+	auto args = syscall_random_get_args(c);
 	auto buf = args.first();
 	auto nbyte = args.second();
 	get_random()->get(buf, nbyte);
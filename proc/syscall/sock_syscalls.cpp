@@ -6,7 +6,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_sock_recv(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_recv_in_t*, cloudabi_recv_out_t*>(c);
+	auto args = syscall_sock_recv_args(c);
 	auto fdnum = args.first();
 	auto recv_in = args.second();
 	auto recv_out = args.third();
@@ -23,7 +23,7 @@ cloudabi_errno_t cloudos::syscall_sock_recv(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_sock_send(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, const cloudabi_send_in_t*, cloudabi_send_out_t*>(c);
+	auto args = syscall_sock_send_args(c);
 	auto fdnum = args.first();
 	auto send_in = args.second();
 	auto send_out = args.third();
@@ -40,7 +40,7 @@ cloudabi_errno_t cloudos::syscall_sock_send(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_sock_shutdown(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_fd_t, cloudabi_sdflags_t>(c);
+	auto args = syscall_sock_shutdown_args(c);
 	auto fdnum = args.first();
 	auto sdflags = args.second();
 
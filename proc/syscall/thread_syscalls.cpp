@@ -7,7 +7,7 @@ using namespace cloudos;
 
 cloudabi_errno_t cloudos::syscall_thread_create(syscall_context &c)
 {
-	auto args = arguments_t<cloudabi_threadattr_t*, cloudabi_tid_t*>(c);
+	auto args = syscall_thread_create_args(c);
 	auto attr = args.first();
 	shared_ptr<thread> thr = c.process()->add_thread(attr->stack, attr->stack_len, attr->argument, reinterpret_cast<void*>(attr->entry_point));
 	c.result = thr->get_thread_id();
@@ -16,11 +16,11 @@ cloudabi_errno_t cloudos::syscall_thread_create(syscall_context &c)
 
 cloudabi_errno_t cloudos::syscall_thread_exit(syscall_context &c)
 {
-	auto args = arguments_t<_Atomic(cloudabi_lock_t)*, cloudabi_scope_t>(c);
+	auto args = syscall_thread_exit_args(c);
 	auto lock = args.first();
 	auto scope = args.second();
 	if(scope != CLOUDABI_SCOPE_PRIVATE) {
-		get_vga_stream() << "thread_exit(): non-private locks are not supported yet\n";
+		get_vga_stream() << log_warning << "thread_exit(): non-private locks are not supported yet\n";
 		return ENOSYS;
 	}
 	c.thread->thread_exit();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <oslibc/assert.hpp>
 #include <fd/thread.hpp>
@@ -35,10 +36,36 @@ private:
 
 struct no_argument_tag {};
 
+/** How an argument of type T is passed in the argument frame on the userland
+ * stack: whether it is present, and how many bytes it takes. This must
+ * correspond to arguments_t::fill_member().
+ */
+template <typename T>
+struct argument_traits {
+	static constexpr size_t count = 1;
+	static constexpr size_t frame_size = sizeof(T) <= sizeof(uint32_t) ? sizeof(uint32_t) : sizeof(T);
+};
+
+template <>
+struct argument_traits<no_argument_tag> {
+	static constexpr size_t count = 0;
+	static constexpr size_t frame_size = 0;
+};
+
 template <typename first_t, typename second_t = no_argument_tag, typename third_t = no_argument_tag,
           typename fourth_t = no_argument_tag, typename fifth_t = no_argument_tag,
           typename sixth_t = no_argument_tag, typename seventh_t = no_argument_tag>
 struct arguments_t {
+	// the number of arguments, and the bytes they take on the stack
+	static constexpr size_t num_arguments = argument_traits<first_t>::count
+		+ argument_traits<second_t>::count + argument_traits<third_t>::count
+		+ argument_traits<fourth_t>::count + argument_traits<fifth_t>::count
+		+ argument_traits<sixth_t>::count + argument_traits<seventh_t>::count;
+	static constexpr size_t frame_size = argument_traits<first_t>::frame_size
+		+ argument_traits<second_t>::frame_size + argument_traits<third_t>::frame_size
+		+ argument_traits<fourth_t>::frame_size + argument_traits<fifth_t>::frame_size
+		+ argument_traits<sixth_t>::frame_size + argument_traits<seventh_t>::frame_size;
+
 	arguments_t(syscall_context &c) {
 		uint8_t offset = 4;
 #define FM(n)   fill_member(c, offset, & n##_, reinterpret_cast<n##_t*>(0))
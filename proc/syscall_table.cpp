@@ -0,0 +1,102 @@
+#include <fd/trace.hpp>
+#include <hw/cpu_io.hpp>
+#include <oslibc/assert.hpp>
+#include <proc/syscalls.hpp>
+
+using namespace cloudos;
+
+#define SYSCALL(name) {#name, syscall_##name, \
+	syscall_##name##_args::num_arguments, syscall_##name##_args::frame_size}
+
+const syscall_entry cloudos::syscall_table[NUM_SYSCALLS] = {
+	SYSCALL(clock_res_get),
+	SYSCALL(clock_time_get),
+	SYSCALL(condvar_signal),
+	SYSCALL(fd_close),
+	SYSCALL(fd_create1),
+	SYSCALL(fd_create2),
+	SYSCALL(fd_datasync),
+	SYSCALL(fd_dup),
+	SYSCALL(fd_pread),
+	SYSCALL(fd_pwrite),
+	SYSCALL(fd_read),
+	SYSCALL(fd_replace),
+	SYSCALL(fd_seek),
+	SYSCALL(fd_stat_get),
+	SYSCALL(fd_stat_put),
+	SYSCALL(fd_sync),
+	SYSCALL(fd_write),
+	SYSCALL(file_advise),
+	SYSCALL(file_allocate),
+	SYSCALL(file_create),
+	SYSCALL(file_link),
+	SYSCALL(file_open),
+	SYSCALL(file_readdir),
+	SYSCALL(file_readlink),
+	SYSCALL(file_rename),
+	SYSCALL(file_stat_fget),
+	SYSCALL(file_stat_fput),
+	SYSCALL(file_stat_get),
+	SYSCALL(file_stat_put),
+	SYSCALL(file_symlink),
+	SYSCALL(file_unlink),
+	SYSCALL(lock_unlock),
+	SYSCALL(mem_advise),
+	SYSCALL(mem_map),
+	SYSCALL(mem_protect),
+	SYSCALL(mem_sync),
+	SYSCALL(mem_unmap),
+	SYSCALL(poll),
+	SYSCALL(proc_exec),
+	SYSCALL(proc_exit),
+	SYSCALL(proc_fork),
+	SYSCALL(proc_raise),
+	SYSCALL(random_get),
+	SYSCALL(sock_recv),
+	SYSCALL(sock_send),
+	SYSCALL(sock_shutdown),
+	SYSCALL(thread_create),
+	SYSCALL(thread_exit),
+	SYSCALL(thread_yield),
+};
+
+#undef SYSCALL
+
+static syscall_stats stats[NUM_SYSCALLS];
+
+syscall_stats *cloudos::get_syscall_stats() {
+	return stats;
+}
+
+void cloudos::account_syscall(size_t num, cloudabi_errno_t error, uint64_t cycles) {
+	auto &s = stats[num];
+	s.calls++;
+	if(error) {
+		s.errors++;
+	}
+	s.cycles += cycles;
+	size_t bucket = cycles == 0 ? 0 : 63 - __builtin_clzll(cycles);
+	if(bucket >= syscall_stats::NUM_BUCKETS) {
+		bucket = syscall_stats::NUM_BUCKETS - 1;
+	}
+	s.latency[bucket]++;
+}
+
+size_t cloudos::syscall_number(syscall_handler handler) {
+	for(size_t i = 0; i < NUM_SYSCALLS; ++i) {
+		if(syscall_table[i].handler == handler) {
+			return i;
+		}
+	}
+	assert(!"Handler is not in the syscall table");
+	return NUM_SYSCALLS;
+}
+
+cloudabi_errno_t cloudos::call_syscall(size_t num, syscall_context &c) {
+	trace(trace_event_type::syscall, trace_phase::begin, num);
+	uint64_t start = rdtsc();
+	cloudabi_errno_t error = syscall_table[num].handler(c);
+	account_syscall(num, error, rdtsc() - start);
+	trace(trace_event_type::syscall, trace_phase::end, num);
+	return error;
+}
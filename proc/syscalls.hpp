@@ -1,6 +1,8 @@
 #pragma once
 #include <proc/syscall_context.hpp>
 #include <cloudabi/headers/cloudabi_types.h>
+#include <stddef.h>
+#include <stdint.h>
 
 namespace cloudos {
 
@@ -54,4 +56,100 @@ cloudabi_errno_t syscall_thread_create(syscall_context &c);
 cloudabi_errno_t syscall_thread_exit(syscall_context &c);
 cloudabi_errno_t syscall_thread_yield(syscall_context &c);
 
+/** The arguments of each syscall, as its handler unpacks them from the
+ * userland stack.
+ */
+typedef arguments_t<cloudabi_clockid_t, cloudabi_timestamp_t*> syscall_clock_res_get_args;
+typedef arguments_t<cloudabi_clockid_t, cloudabi_timestamp_t, cloudabi_timestamp_t*> syscall_clock_time_get_args;
+typedef arguments_t<_Atomic(cloudabi_condvar_t)*, cloudabi_scope_t, cloudabi_nthreads_t> syscall_condvar_signal_args;
+typedef arguments_t<cloudabi_fd_t> syscall_fd_close_args;
+typedef arguments_t<cloudabi_filetype_t, cloudabi_fd_t*> syscall_fd_create1_args;
+typedef arguments_t<cloudabi_filetype_t, cloudabi_fd_t*, cloudabi_fd_t*> syscall_fd_create2_args;
+typedef arguments_t<cloudabi_fd_t> syscall_fd_datasync_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_fd_t*> syscall_fd_dup_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_iovec_t*, size_t, size_t, size_t*> syscall_fd_pread_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_ciovec_t*, size_t, size_t, size_t*> syscall_fd_pwrite_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_iovec_t*, size_t, size_t*> syscall_fd_read_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_fd_t> syscall_fd_replace_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_filedelta_t, cloudabi_whence_t, cloudabi_filesize_t*> syscall_fd_seek_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_fdstat_t*> syscall_fd_stat_get_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_fdstat_t*, cloudabi_fdsflags_t> syscall_fd_stat_put_args;
+typedef arguments_t<cloudabi_fd_t> syscall_fd_sync_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_ciovec_t*, size_t, size_t*> syscall_fd_write_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_filesize_t, cloudabi_filesize_t, cloudabi_advice_t> syscall_file_advise_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_filesize_t, cloudabi_filesize_t> syscall_file_allocate_args;
+typedef arguments_t<cloudabi_fd_t, const char*, size_t, cloudabi_filetype_t> syscall_file_create_args;
+typedef arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_fd_t, const char*, size_t> syscall_file_link_args;
+typedef arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_oflags_t, const cloudabi_fdstat_t*, cloudabi_fd_t*> syscall_file_open_args;
+typedef arguments_t<cloudabi_fd_t, char*, size_t, cloudabi_dircookie_t, size_t*> syscall_file_readdir_args;
+typedef arguments_t<cloudabi_fd_t, const char*, size_t, char*, size_t, size_t*> syscall_file_readlink_args;
+typedef arguments_t<cloudabi_fd_t, const char*, size_t, cloudabi_fd_t, const char*, size_t> syscall_file_rename_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_filestat_t*> syscall_file_stat_fget_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_filestat_t*, cloudabi_fsflags_t> syscall_file_stat_fput_args;
+typedef arguments_t<cloudabi_lookup_t, const char*, size_t, cloudabi_filestat_t*> syscall_file_stat_get_args;
+typedef arguments_t<cloudabi_lookup_t, const char*, size_t, const cloudabi_filestat_t*, cloudabi_fsflags_t> syscall_file_stat_put_args;
+typedef arguments_t<const char*, size_t, cloudabi_fd_t, const char*, size_t> syscall_file_symlink_args;
+typedef arguments_t<cloudabi_fd_t, char*, size_t, cloudabi_ulflags_t> syscall_file_unlink_args;
+typedef arguments_t<_Atomic(cloudabi_lock_t)*, cloudabi_scope_t> syscall_lock_unlock_args;
+typedef arguments_t<void*, size_t, cloudabi_advice_t> syscall_mem_advise_args;
+typedef arguments_t<void*, size_t, cloudabi_mprot_t, cloudabi_mflags_t, cloudabi_fd_t, cloudabi_filesize_t, void**> syscall_mem_map_args;
+typedef arguments_t<void*, size_t, cloudabi_mprot_t> syscall_mem_protect_args;
+typedef arguments_t<void*, size_t, cloudabi_msflags_t> syscall_mem_sync_args;
+typedef arguments_t<void*, size_t> syscall_mem_unmap_args;
+typedef arguments_t<const cloudabi_subscription_t*, cloudabi_event_t*, size_t, size_t*> syscall_poll_args;
+typedef arguments_t<cloudabi_fd_t, const void*, size_t, const cloudabi_fd_t*, size_t> syscall_proc_exec_args;
+typedef arguments_t<cloudabi_exitcode_t> syscall_proc_exit_args;
+typedef arguments_t<no_argument_tag> syscall_proc_fork_args;
+typedef arguments_t<cloudabi_signal_t> syscall_proc_raise_args;
+typedef arguments_t<char*, size_t> syscall_random_get_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_recv_in_t*, cloudabi_recv_out_t*> syscall_sock_recv_args;
+typedef arguments_t<cloudabi_fd_t, const cloudabi_send_in_t*, cloudabi_send_out_t*> syscall_sock_send_args;
+typedef arguments_t<cloudabi_fd_t, cloudabi_sdflags_t> syscall_sock_shutdown_args;
+typedef arguments_t<cloudabi_threadattr_t*, cloudabi_tid_t*> syscall_thread_create_args;
+typedef arguments_t<_Atomic(cloudabi_lock_t)*, cloudabi_scope_t> syscall_thread_exit_args;
+typedef arguments_t<no_argument_tag> syscall_thread_yield_args;
+
+typedef cloudabi_errno_t (*syscall_handler)(syscall_context &c);
+
+/** An entry in the syscall table, indexed by syscall number. The argument
+ * metadata comes from the syscall's arguments_t type: the number of
+ * arguments and the size of their frame on the userland stack, excluding
+ * the return address.
+ */
+struct syscall_entry {
+	const char *name;
+	syscall_handler handler;
+	uint8_t num_arguments;
+	uint8_t frame_size;
+};
+
+/** Statistics of a single syscall. latency[i] counts the calls that took
+ * between 2^i and 2^(i+1) TSC cycles; the last bucket also counts all
+ * longer calls. Calls that block are counted including the time blocked.
+ */
+struct syscall_stats {
+	static constexpr size_t NUM_BUCKETS = 40;
+
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t cycles;
+	uint64_t latency[NUM_BUCKETS];
+};
+
+static constexpr size_t NUM_SYSCALLS = 49;
+extern const syscall_entry syscall_table[NUM_SYSCALLS];
+
+/** Returns the statistics of all syscalls, indexed by syscall number. */
+syscall_stats *get_syscall_stats();
+void account_syscall(size_t num, cloudabi_errno_t error, uint64_t cycles);
+
+/** Returns the number of the syscall with the given handler. */
+size_t syscall_number(syscall_handler handler);
+
+/** Calls the handler of syscall num, which must be smaller than
+ * NUM_SYSCALLS, within syscall tracepoints, and accounts it in the syscall
+ * statistics.
+ */
+cloudabi_errno_t call_syscall(size_t num, syscall_context &c);
+
 }
@@ -10,6 +10,19 @@ void clock_store::register_clock(cloudabi_clockid_t type, clock *obj) {
 	clocks[type] = obj;
 }
 
+void clock_store::set_tsc_frequency(uint64_t hz) {
+	tsc_frequency = hz;
+}
+
+cloudabi_timestamp_t clock_store::tsc_to_ns(uint64_t tsc) {
+	if(tsc_frequency == 0) {
+		// not calibrated
+		return 0;
+	}
+	// split up to prevent overflowing tsc * 1e9
+	return (tsc / tsc_frequency) * 1000000000 + (tsc % tsc_frequency) * 1000000000 / tsc_frequency;
+}
+
 clock *clock_store::get_clock(cloudabi_clockid_t type) {
 	if(type >= NUM_CLOCKS) {
 		return nullptr;
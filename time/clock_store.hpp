@@ -24,6 +24,8 @@ struct clock {
 	 * the behaviour of this function is undefined. If the time passes
 	 * after you got the signaler, it may be destroyed, so use the pointer
 	 * immediately to add thread conditions and do not store it.
+	 *
+	 * Clocks that can't be waited on return NULL.
 	 */
 	virtual thread_condition_signaler *get_signaler(
 		cloudabi_timestamp_t timeout, cloudabi_timestamp_t precision) = 0;
@@ -33,9 +35,16 @@ struct clock_store {
 	void register_clock(cloudabi_clockid_t type, clock *obj);
 	clock *get_clock(cloudabi_clockid_t type);
 
+	/** Set the calibrated frequency of the TSC, in Hz. */
+	void set_tsc_frequency(uint64_t hz);
+	inline uint64_t get_tsc_frequency() { return tsc_frequency; }
+	/** Convert a number of TSC ticks to nanoseconds. */
+	cloudabi_timestamp_t tsc_to_ns(uint64_t tsc);
+
 private:
 	static constexpr auto NUM_CLOCKS = CLOUDABI_CLOCK_THREAD_CPUTIME_ID + 1;
 	clock *clocks[NUM_CLOCKS];
+	uint64_t tsc_frequency = 0;
 };
 
 }
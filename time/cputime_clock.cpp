@@ -0,0 +1,39 @@
+#include <time/cputime_clock.hpp>
+#include <fd/process_fd.hpp>
+#include <fd/scheduler.hpp>
+#include <global.hpp>
+
+using namespace cloudos;
+
+static cloudabi_timestamp_t tsc_resolution() {
+	auto res = get_clock_store()->tsc_to_ns(1);
+	return res == 0 ? 1 : res;
+}
+
+cloudabi_timestamp_t process_cputime_clock::get_resolution() {
+	return tsc_resolution();
+}
+
+cloudabi_timestamp_t process_cputime_clock::get_time(cloudabi_timestamp_t /*precision*/) {
+	auto thr = get_scheduler()->get_running_thread();
+	assert(thr);
+	return get_clock_store()->tsc_to_ns(get_scheduler()->get_process_cpu_tsc(thr->get_process()));
+}
+
+thread_condition_signaler *process_cputime_clock::get_signaler(cloudabi_timestamp_t, cloudabi_timestamp_t) {
+	return nullptr;
+}
+
+cloudabi_timestamp_t thread_cputime_clock::get_resolution() {
+	return tsc_resolution();
+}
+
+cloudabi_timestamp_t thread_cputime_clock::get_time(cloudabi_timestamp_t /*precision*/) {
+	auto thr = get_scheduler()->get_running_thread();
+	assert(thr);
+	return get_clock_store()->tsc_to_ns(get_scheduler()->get_thread_cpu_tsc(thr.get()));
+}
+
+thread_condition_signaler *thread_cputime_clock::get_signaler(cloudabi_timestamp_t, cloudabi_timestamp_t) {
+	return nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <time/clock_store.hpp>
+
+namespace cloudos {
+
+/** The CPU time used by the calling process, as accounted by the scheduler
+ * using the TSC. These clocks can't be waited on.
+ */
+struct process_cputime_clock : public clock {
+	cloudabi_timestamp_t get_resolution() override;
+	cloudabi_timestamp_t get_time(cloudabi_timestamp_t precision) override;
+	thread_condition_signaler *get_signaler(cloudabi_timestamp_t timeout,
+		cloudabi_timestamp_t precision) override;
+};
+
+/** The CPU time used by the calling thread. */
+struct thread_cputime_clock : public clock {
+	cloudabi_timestamp_t get_resolution() override;
+	cloudabi_timestamp_t get_time(cloudabi_timestamp_t precision) override;
+	thread_condition_signaler *get_signaler(cloudabi_timestamp_t timeout,
+		cloudabi_timestamp_t precision) override;
+};
+
+}
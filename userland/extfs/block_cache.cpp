@@ -0,0 +1,125 @@
+#include "block_cache.hpp"
+#include <cosix/reverse.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace cosix;
+
+block_cache::block_cache(int b, size_t s, size_t c)
+: blockdev(b)
+, block_size(s)
+, capacity(std::max(c, MIN_CAPACITY))
+{
+	index.reserve(capacity);
+}
+
+uint8_t *block_cache::get(uint64_t block) {
+	auto it = index.find(block);
+	if(it != index.end()) {
+		stats.hits++;
+		lru.splice(lru.begin(), lru, it->second);
+		return it->second->data.get();
+	}
+
+	stats.misses++;
+	auto &entry = make_room(block);
+	ssize_t res = ::pread(blockdev, entry.data.get(), block_size, off_t(block) * block_size);
+	if(res < 0 || size_t(res) != block_size) {
+		cloudabi_errno_t error = res < 0 ? errno : EIO;
+		lru.pop_front();
+		throw cloudabi_system_error(error);
+	}
+	index[block] = lru.begin();
+	return entry.data.get();
+}
+
+uint8_t *block_cache::get_zeroed(uint64_t block) {
+	auto it = index.find(block);
+	cached_block *entry;
+	if(it != index.end()) {
+		lru.splice(lru.begin(), lru, it->second);
+		entry = &*it->second;
+	} else {
+		entry = &make_room(block);
+		index[block] = lru.begin();
+	}
+	memset(entry->data.get(), 0, block_size);
+	if(!entry->dirty) {
+		entry->dirty = true;
+		num_dirty++;
+	}
+	return entry->data.get();
+}
+
+void block_cache::mark_dirty(uint64_t block) {
+	auto it = index.find(block);
+	assert(it != index.end());
+	if(!it->second->dirty) {
+		it->second->dirty = true;
+		num_dirty++;
+	}
+}
+
+void block_cache::forget(uint64_t block) {
+	auto it = index.find(block);
+	if(it != index.end()) {
+		if(it->second->dirty) {
+			num_dirty--;
+		}
+		lru.erase(it->second);
+		index.erase(it);
+	}
+}
+
+void block_cache::flush() {
+	std::vector<cached_block*> dirty;
+	for(auto &b : lru) {
+		if(b.dirty) {
+			dirty.push_back(&b);
+		}
+	}
+	std::sort(dirty.begin(), dirty.end(), [](cached_block *a, cached_block *b) {
+		return a->block < b->block;
+	});
+	for(auto *b : dirty) {
+		write_back(*b);
+	}
+}
+
+block_cache::cached_block &block_cache::make_room(uint64_t block) {
+	if(lru.size() < capacity) {
+		lru.push_front(cached_block{block, false, std::unique_ptr<uint8_t[]>(new uint8_t[block_size])});
+		return lru.front();
+	}
+
+	// reuse the buffer of the least recently used block
+	auto &victim = lru.back();
+	if(victim.dirty) {
+		write_back(victim);
+	}
+	stats.evictions++;
+	index.erase(victim.block);
+	lru.splice(lru.begin(), lru, std::prev(lru.end()));
+	auto &entry = lru.front();
+	entry.block = block;
+	entry.dirty = false;
+	return entry;
+}
+
+void block_cache::write_back(cached_block &b) {
+	assert(b.dirty);
+	ssize_t res = ::pwrite(blockdev, b.data.get(), block_size, off_t(b.block) * block_size);
+	if(res < 0) {
+		throw cloudabi_system_error(errno);
+	} else if(size_t(res) != block_size) {
+		throw cloudabi_system_error(EIO);
+	}
+	b.dirty = false;
+	num_dirty--;
+	stats.writebacks++;
+}
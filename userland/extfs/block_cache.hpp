@@ -0,0 +1,76 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+/** An LRU cache of filesystem blocks on a block device. Blocks that are
+ * changed through the cache must be marked dirty; they are written back when
+ * they are evicted or when the cache is flushed.
+ *
+ * Pointers returned by get() and get_zeroed() stay valid until the next call
+ * into the cache, since that call may evict the block.
+ */
+struct block_cache {
+	static constexpr size_t DEFAULT_CAPACITY = 1024;
+	static constexpr size_t MIN_CAPACITY = 16;
+
+	struct statistics {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t writebacks = 0;
+	};
+
+	block_cache(int blockdev, size_t block_size, size_t capacity = DEFAULT_CAPACITY);
+
+	/** Returns the contents of the given block, reading it from the device
+	 * if it isn't cached. Throws cloudabi_system_error if the read failed.
+	 */
+	uint8_t *get(uint64_t block);
+
+	/** Returns a zeroed, dirty buffer for the given block without reading
+	 * it from the device, for blocks that are about to be filled in
+	 * completely, such as newly allocated indirect blocks.
+	 */
+	uint8_t *get_zeroed(uint64_t block);
+
+	void mark_dirty(uint64_t block);
+
+	/** Drops the block from the cache without writing it back, because it
+	 * was deallocated or is about to be overwritten on the device directly.
+	 */
+	void forget(uint64_t block);
+
+	/** Writes back all dirty blocks, in order of block number. */
+	void flush();
+
+	size_t size() const { return lru.size(); }
+	size_t dirty_blocks() const { return num_dirty; }
+	size_t get_capacity() const { return capacity; }
+	statistics const &get_statistics() const { return stats; }
+
+private:
+	struct cached_block {
+		uint64_t block;
+		bool dirty;
+		std::unique_ptr<uint8_t[]> data;
+	};
+
+	// Puts an entry for the block at the front of the LRU list, evicting
+	// the least recently used block if the cache is full. The entry isn't
+	// in the index yet.
+	cached_block &make_room(uint64_t block);
+	void write_back(cached_block &b);
+
+	int blockdev;
+	size_t block_size;
+	size_t capacity;
+	// most recently used first
+	std::list<cached_block> lru;
+	std::unordered_map<uint64_t, std::list<cached_block>::iterator> index;
+	statistics stats;
+	size_t num_dirty = 0;
+};
@@ -0,0 +1,153 @@
+#include "dir_hash.hpp"
+
+#include <string.h>
+
+// These follow the hash functions of the Linux ext4 driver, as the on-disk
+// index depends on their exact results.
+
+static uint32_t rol32(uint32_t word, unsigned int shift) {
+	return (word << shift) | (word >> (32 - shift));
+}
+
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	for(int n = 0; n < 16; ++n) {
+		sum += 0x9e3779b9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+static uint32_t md4_f(uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); }
+static uint32_t md4_g(uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); }
+static uint32_t md4_h(uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; }
+
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+	const uint32_t k2 = 013240474631;
+	const uint32_t k3 = 015666365641;
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = rol32(a, s))
+	ROUND(md4_f, a, b, c, d, in[0], 3);
+	ROUND(md4_f, d, a, b, c, in[1], 7);
+	ROUND(md4_f, c, d, a, b, in[2], 11);
+	ROUND(md4_f, b, c, d, a, in[3], 19);
+	ROUND(md4_f, a, b, c, d, in[4], 3);
+	ROUND(md4_f, d, a, b, c, in[5], 7);
+	ROUND(md4_f, c, d, a, b, in[6], 11);
+	ROUND(md4_f, b, c, d, a, in[7], 19);
+
+	ROUND(md4_g, a, b, c, d, in[1] + k2, 3);
+	ROUND(md4_g, d, a, b, c, in[3] + k2, 5);
+	ROUND(md4_g, c, d, a, b, in[5] + k2, 9);
+	ROUND(md4_g, b, c, d, a, in[7] + k2, 13);
+	ROUND(md4_g, a, b, c, d, in[0] + k2, 3);
+	ROUND(md4_g, d, a, b, c, in[2] + k2, 5);
+	ROUND(md4_g, c, d, a, b, in[4] + k2, 9);
+	ROUND(md4_g, b, c, d, a, in[6] + k2, 13);
+
+	ROUND(md4_h, a, b, c, d, in[3] + k3, 3);
+	ROUND(md4_h, d, a, b, c, in[7] + k3, 9);
+	ROUND(md4_h, c, d, a, b, in[2] + k3, 11);
+	ROUND(md4_h, b, c, d, a, in[6] + k3, 15);
+	ROUND(md4_h, a, b, c, d, in[1] + k3, 3);
+	ROUND(md4_h, d, a, b, c, in[5] + k3, 9);
+	ROUND(md4_h, c, d, a, b, in[0] + k3, 11);
+	ROUND(md4_h, b, c, d, a, in[4] + k3, 15);
+#undef ROUND
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+static uint32_t char_value(const char *name, size_t i, bool is_unsigned) {
+	if(is_unsigned) {
+		return static_cast<unsigned char>(name[i]);
+	}
+	return static_cast<uint32_t>(static_cast<int32_t>(static_cast<signed char>(name[i])));
+}
+
+static uint32_t legacy_hash(const char *name, size_t len, bool is_unsigned) {
+	uint32_t hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	for(size_t i = 0; i < len; ++i) {
+		uint32_t hash = hash1 + (hash0 ^ (char_value(name, i, is_unsigned) * 7152373));
+		if(hash & 0x80000000) {
+			hash -= 0x7fffffff;
+		}
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+// Fills num words with the name, padded with its length
+static void str_to_hashbuf(const char *msg, size_t len, uint32_t *buf, int num, bool is_unsigned) {
+	uint32_t pad = uint32_t(len) | (uint32_t(len) << 8);
+	pad |= pad << 16;
+
+	uint32_t val = pad;
+	if(len > size_t(num) * 4) {
+		len = num * 4;
+	}
+	for(size_t i = 0; i < len; ++i) {
+		val = char_value(msg, i, is_unsigned) + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if(--num >= 0) {
+		*buf++ = val;
+	}
+	while(--num >= 0) {
+		*buf++ = pad;
+	}
+}
+
+uint32_t ext2_dir_hash(const char *name, size_t len, uint8_t version, const uint32_t seed[4]) {
+	uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	if(seed[0] != 0 || seed[1] != 0 || seed[2] != 0 || seed[3] != 0) {
+		memcpy(buf, seed, sizeof(buf));
+	}
+
+	bool is_unsigned = version >= EXT2_HASH_LEGACY_UNSIGNED;
+	uint32_t in[8];
+	uint32_t hash;
+	switch(version) {
+	case EXT2_HASH_HALF_MD4:
+	case EXT2_HASH_HALF_MD4_UNSIGNED:
+		for(size_t i = 0; i < len; i += 32) {
+			str_to_hashbuf(name + i, len - i, in, 8, is_unsigned);
+			half_md4_transform(buf, in);
+		}
+		hash = buf[1];
+		break;
+	case EXT2_HASH_TEA:
+	case EXT2_HASH_TEA_UNSIGNED:
+		for(size_t i = 0; i < len; i += 16) {
+			str_to_hashbuf(name + i, len - i, in, 4, is_unsigned);
+			tea_transform(buf, in);
+		}
+		hash = buf[0];
+		break;
+	case EXT2_HASH_LEGACY:
+	case EXT2_HASH_LEGACY_UNSIGNED:
+	default:
+		hash = legacy_hash(name, len, is_unsigned);
+		break;
+	}
+
+	hash &= ~uint32_t(1);
+	// the highest hash value marks the end of the index in readdir cookies
+	if(hash == (0x7fffffffu << 1)) {
+		hash = (0x7fffffffu - 1) << 1;
+	}
+	return hash;
+}
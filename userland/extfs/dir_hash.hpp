@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Hash functions of the ext3/ext4 hashed directory index (htree). The root
+ * of an index stores one of the first three; the unsigned variants are used
+ * instead if the superblock says the index was built with unsigned chars.
+ */
+enum ext2_dir_hash_version : uint8_t {
+	EXT2_HASH_LEGACY = 0,
+	EXT2_HASH_HALF_MD4 = 1,
+	EXT2_HASH_TEA = 2,
+	EXT2_HASH_LEGACY_UNSIGNED = 3,
+	EXT2_HASH_HALF_MD4_UNSIGNED = 4,
+	EXT2_HASH_TEA_UNSIGNED = 5,
+};
+
+/** Returns the hash of a directory entry name, as used to order the index.
+ * The lowest bit is always clear, as the index uses it to mark hash
+ * collisions between leaves. A seed of all zeroes means the default seed.
+ */
+uint32_t ext2_dir_hash(const char *name, size_t len, uint8_t version, const uint32_t seed[4]);
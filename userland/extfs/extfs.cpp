@@ -1,12 +1,19 @@
 #include "extfs.hpp"
-#include <cloudabi_syscalls.h>
+#include "dir_hash.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <errno.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <shared_mutex>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <time.h>
+#include <unordered_map>
 
 using namespace cosix;
 
@@ -55,7 +62,13 @@ struct ext2_superblock {
 	uint32_t journal_inode;
 	uint32_t journal_device;
 	uint32_t orphan_inode_head;
-	char unused2[788];
+	uint32_t hash_seed[4];
+	uint8_t default_hash_version;
+	char unused2[95];
+	uint16_t min_extra_isize;
+	uint16_t want_extra_isize;
+	uint32_t flags;
+	char unused3[668];
 } __attribute__((packed));
 
 struct ext2_block_group_descriptor {
@@ -100,9 +113,137 @@ struct ext2_direntry {
 	char name[0];
 } __attribute__((packed));
 
+// Hashed directory index (htree): the first block of an indexed directory
+// holds the root of the index after the "." and ".." entries; index nodes
+// below it and the leaves holding the entries are later blocks of the
+// directory. Index blocks look like empty directory blocks to code that
+// doesn't know about the index.
+struct ext2_dx_root_info {
+	uint32_t reserved_zero;
+	uint8_t hash_version;
+	uint8_t info_length;
+	uint8_t indirect_levels;
+	uint8_t unused_flags;
+} __attribute__((packed));
+
+struct ext2_dx_entry {
+	uint32_t hash;
+	// logical block in the directory
+	uint32_t block;
+} __attribute__((packed));
+
+// Takes the place of the hash of the first entry of an index node
+struct ext2_dx_countlimit {
+	uint16_t limit;
+	uint16_t count;
+} __attribute__((packed));
+
+#define EXT2_FEATURE_COMPAT_DIR_INDEX 0x20
+// Directory entries hold the type of the file in the second byte of the
+// name length; names are never longer than EXT2_NAME_LEN anyway
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x2
+#define EXT2_NAME_LEN 255
+#define EXT2_INDEX_FL 0x1000
+#define EXT2_FLAGS_UNSIGNED_HASH 0x2
+#define EXT2_DX_ROOT_INFO_OFFSET 24
+#define EXT2_DX_NODE_ENTRIES_OFFSET 8
+
+// An index node on the way from the root to a leaf
+struct ext2_dx_frame {
+	// logical block of the node in the directory
+	uint32_t block;
+	// offset of the index entries in the block
+	size_t entries;
+	// the entry that was followed
+	size_t at;
+};
+
+struct ext2_dx_path {
+	uint8_t hash_version;
+	uint32_t hash;
+	std::vector<ext2_dx_frame> frames;
+	// logical block of the leaf
+	uint32_t leaf;
+};
+
+// A directory entry while it's moved between blocks
+struct ext2_dir_record {
+	uint32_t hash;
+	cloudabi_inode_t inode;
+	std::string name;
+	uint8_t file_type;
+};
+
+struct ext2_dir_name {
+	cloudabi_inode_t inode;
+	// logical block of the directory holding the entry
+	uint32_t block;
+};
+
+// Extent tree (ext4): inodes with EXT4_EXTENTS_FL map runs of logical
+// blocks onto runs of physical blocks. The root node takes the place of the
+// block pointers in the inode; every node starts with a header, followed by
+// index entries pointing to the nodes below it, or by extents in a leaf.
+struct ext4_extent_header {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	// 0 for a leaf
+	uint16_t depth;
+	uint32_t generation;
+} __attribute__((packed));
+
+struct ext4_extent {
+	// first logical block
+	uint32_t block;
+	// above EXT4_EXT_INIT_MAX_LEN, the extent is unwritten
+	uint16_t len;
+	uint16_t start_hi;
+	uint32_t start_lo;
+} __attribute__((packed));
+
+struct ext4_extent_idx {
+	// first logical block below this entry
+	uint32_t block;
+	uint32_t leaf_lo;
+	uint16_t leaf_hi;
+	uint16_t unused;
+} __attribute__((packed));
+
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x40
+// The bitmaps and inode tables of a group may live in another group; they
+// are only found through the group descriptors here, so that's fine
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x200
+#define EXTFS_SUPPORTED_INCOMPAT (EXT2_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_EXTENTS \
+	| EXT4_FEATURE_INCOMPAT_FLEX_BG)
+
+// Read-only compatible features that don't change anything this
+// implementation writes: backup superblocks in fewer groups, file sizes
+// above 2 GiB (always kept in size2 here), block counts of huge files, link
+// counts of directories with many subdirectories, and the extra inode space
+// beyond sizeof(ext2_inode), which is left alone.
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x1
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x2
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE 0x8
+#define EXT4_FEATURE_RO_COMPAT_DIR_NLINK 0x20
+#define EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE 0x40
+#define EXTFS_SUPPORTED_RO_COMPAT (EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE \
+	| EXT4_FEATURE_RO_COMPAT_HUGE_FILE | EXT4_FEATURE_RO_COMPAT_DIR_NLINK | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE)
+// The size of the fields after ext2_inode in a larger inode (i_extra_isize
+// and on) that new inodes get, unless the superblock asks for another size
+#define EXT4_DEFAULT_EXTRA_ISIZE 32
+#define EXT4_EXTENTS_FL 0x80000
+#define EXT4_EXT_MAGIC 0xf30a
+#define EXT4_EXT_MAX_DEPTH 5
+// An unwritten extent has allocated blocks that read as zeroes; its length
+// is stored with this added to it.
+#define EXT4_EXT_INIT_MAX_LEN 32768
+
 static_assert(sizeof(ext2_superblock) == 1024, "Size of ext2 superblock");
 static_assert(sizeof(ext2_block_group_descriptor) == 32, "Size of ext2 block group descriptor");
 static_assert(sizeof(ext2_inode) == 128, "Size of ext2 inode");
+static_assert(sizeof(ext4_extent_header) == 12, "Size of ext4 extent header");
+static_assert(sizeof(ext4_extent) == sizeof(ext4_extent_idx), "Size of ext4 extent tree entries");
 
 /* TODO: don't hardcode this size */
 #define SECTOR_SIZE 512
@@ -115,33 +256,229 @@ static void check_ssize(ssize_t res, size_t expect) {
 	}
 }
 
+// Turns the block pointers of a new inode into the root of an empty extent
+// tree
+static void init_extent_root(ext2_inode &inode) {
+	auto *header = reinterpret_cast<ext4_extent_header*>(inode.blockptr);
+	header->magic = EXT4_EXT_MAGIC;
+	header->entries = 0;
+	header->max = (offsetof(ext2_inode, generation) - offsetof(ext2_inode, blockptr)
+		- sizeof(ext4_extent_header)) / sizeof(ext4_extent);
+	header->depth = 0;
+	header->generation = 0;
+	inode.flags |= EXT4_EXTENTS_FL;
+}
+
+static size_t direntry_namelen(const ext2_direntry *entry) {
+	// the second byte is 0 or, with the filetype feature, the file type
+	return entry->namelen1;
+}
+
+// The space an entry with a name of the given length takes, aligned to 4 bytes
+static size_t direntry_size(size_t namelen) {
+	return (sizeof(ext2_direntry) + namelen + 3) & ~size_t(3);
+}
+
+template <typename F>
+static void for_each_direntry(const uint8_t *block, size_t block_size, F f) {
+	size_t offset = 0;
+	while(offset + sizeof(ext2_direntry) <= block_size) {
+		auto *entry = reinterpret_cast<const ext2_direntry*>(block + offset);
+		assert(entry->size_of_entry >= sizeof(ext2_direntry));
+		f(entry);
+		offset += entry->size_of_entry;
+	}
+}
+
+// Returns the inode of the entry with the given name in a directory block,
+// or 0 if it isn't in this block
+static cloudabi_inode_t find_in_block(const uint8_t *block, size_t block_size, std::string const &name) {
+	cloudabi_inode_t inode = 0;
+	for_each_direntry(block, block_size, [&](const ext2_direntry *entry) {
+		if(inode == 0 && entry->inode != 0 && direntry_namelen(entry) == name.size()
+		&& memcmp(entry->name, name.data(), name.size()) == 0) {
+			inode = entry->inode;
+		}
+	});
+	return inode;
+}
+
+// Adds an entry to a directory block, if it has room for it
+static bool insert_into_block(uint8_t *block, size_t block_size, std::string const &filename, cloudabi_inode_t new_inode, uint8_t file_type) {
+	size_t entry_size_needed = sizeof(ext2_direntry) + filename.size();
+	assert(entry_size_needed <= block_size);
+
+	char *dircontents = reinterpret_cast<char*>(block);
+	char *ci = dircontents;
+	ext2_direntry *entry = nullptr;
+	for(; ci < dircontents + block_size; ci += entry->size_of_entry) {
+		entry = reinterpret_cast<ext2_direntry*>(ci);
+
+		// Align to 4 bytes
+		size_t actual_size = direntry_size(direntry_namelen(entry));
+
+		if(entry->inode == 0 && entry->size_of_entry >= entry_size_needed) {
+			// cannibalize this entry
+		} else if(entry->size_of_entry - actual_size >= entry_size_needed) {
+			// create an extra entry here
+			size_t new_entry_size = entry->size_of_entry - actual_size;
+
+			entry->size_of_entry = actual_size;
+			ci += entry->size_of_entry;
+			entry = reinterpret_cast<ext2_direntry*>(ci);
+			entry->size_of_entry = new_entry_size;
+		} else {
+			// doesn't fit here
+			continue;
+		}
+
+		assert(entry->size_of_entry >= entry_size_needed);
+
+		// reuse this entry
+		entry->inode = new_inode;
+		entry->namelen1 = filename.size();
+		entry->type_or_namelen2 = file_type;
+		memcpy(entry->name, filename.c_str(), filename.size());
+		return true;
+	}
+
+	// File entries must span to the end of the block. If this isn't true, the filesystem
+	// is corrupt.
+	assert(ci == dircontents + block_size);
+	return false;
+}
+
+// Removes the entry with the given name from a directory block, if it is in it
+static bool remove_from_block(uint8_t *block, size_t block_size, std::string const &filename) {
+	char *dircontents = reinterpret_cast<char*>(block);
+	char *ci = dircontents;
+	ext2_direntry *entry = nullptr;
+	ext2_direntry *prev_entry = nullptr;
+	for(; ci < dircontents + block_size; ci += entry->size_of_entry) {
+		entry = reinterpret_cast<ext2_direntry*>(ci);
+
+		size_t namelen = direntry_namelen(entry);
+		if(entry->inode != 0 && namelen == filename.size() && memcmp(entry->name, filename.c_str(), namelen) == 0) {
+			if(ci == dircontents && entry->size_of_entry == block_size) {
+				// we're removing the last entry in this block
+				// TODO: should deallocate this block. Instead, for now, we mark the entry
+				// invalid by setting inode to 0.
+				entry->inode = 0;
+				entry->namelen1 = 0;
+				entry->type_or_namelen2 = 0;
+			} else if(ci == dircontents) {
+				// we're removing the first entry, but there is an entry after this;
+				// move it over this one
+				assert(entry->size_of_entry < block_size - sizeof(ext2_direntry));
+				ext2_direntry *next_entry = reinterpret_cast<ext2_direntry*>(ci + entry->size_of_entry);
+				size_t new_size = entry->size_of_entry + next_entry->size_of_entry;
+				size_t new_namelen = direntry_namelen(next_entry);
+				assert(new_size >= sizeof(ext2_direntry) + new_namelen);
+				assert(new_namelen <= next_entry->size_of_entry - sizeof(ext2_direntry));
+				*entry = *next_entry;
+				entry->size_of_entry = new_size;
+				// if this entry used to be very short, then the new length of entry->name
+				// may overlap with next_entry->name, so use memmove instead of memcpy here
+				memmove(entry->name, next_entry->name, new_namelen);
+			} else {
+				assert(prev_entry != nullptr);
+				prev_entry->size_of_entry += entry->size_of_entry;
+			}
+			return true;
+		}
+		prev_entry = entry;
+	}
+
+	// File entries must span to the end of the block. If this isn't true, the filesystem
+	// is corrupt.
+	assert(ci == dircontents + block_size);
+	return false;
+}
+
+// Lays out the records as the entries of a directory block, the last one
+// spanning to the end of the block
+static void write_records(uint8_t *block, size_t block_size, const ext2_dir_record *begin, const ext2_dir_record *end) {
+	size_t offset = 0;
+	ext2_direntry *entry = reinterpret_cast<ext2_direntry*>(block);
+	entry->inode = 0;
+	entry->size_of_entry = 0;
+	entry->namelen1 = 0;
+	entry->type_or_namelen2 = 0;
+	for(auto *record = begin; record != end; ++record) {
+		entry = reinterpret_cast<ext2_direntry*>(block + offset);
+		entry->inode = record->inode;
+		entry->size_of_entry = direntry_size(record->name.size());
+		entry->namelen1 = record->name.size();
+		entry->type_or_namelen2 = record->file_type;
+		memcpy(entry->name, record->name.data(), record->name.size());
+		offset += entry->size_of_entry;
+	}
+	assert(offset <= block_size);
+	entry->size_of_entry += block_size - offset;
+}
+
+// Sorts the records by hash and returns where to split them over two blocks
+// so both take about the same space. split_hash is set to the lowest hash in
+// the second block, with the collision bit set if the first block ends with
+// the same hash.
+static size_t split_records(std::vector<ext2_dir_record> &records, uint32_t &split_hash) {
+	assert(records.size() >= 2);
+	std::sort(records.begin(), records.end(), [](ext2_dir_record const &a, ext2_dir_record const &b) {
+		return a.hash < b.hash;
+	});
+
+	size_t total = 0;
+	for(auto &record : records) {
+		total += direntry_size(record.name.size());
+	}
+	size_t split = 0;
+	size_t size = 0;
+	while(split + 1 < records.size() && (split == 0 || size * 2 < total)) {
+		size += direntry_size(records[split].name.size());
+		++split;
+	}
+
+	split_hash = records[split].hash;
+	if(records[split - 1].hash == split_hash) {
+		split_hash |= 1;
+	}
+	return split;
+}
+
 struct ext2_block_iterator {
-	ext2_block_iterator(int b, int s, ext2_inode &i)
-	: blockdev(b)
+	// Start at logical block 'first' of the inode; the indirect blocks or
+	// extent tree nodes before it aren't read, so seeking is as cheap as
+	// dereferencing.
+	ext2_block_iterator(block_cache &c, int s, ext2_inode &i, int first = 0)
+	: cache(&c)
 	, block_size(s)
 	, pointers_per_block(s / 4)
 	, inode(&i)
-	, it(-1)
+	, extents(i.flags & EXT4_EXTENTS_FL)
+	, it(first)
 	{
 		assert(block_size % 4 == 0);
+		assert(first >= 0);
 
 		// Don't use the block iterator on a symbolic link
 		auto type = inode->type_and_permissions & 0xf000;
 		assert(type != 0xa000);
 
-		// Find first block
-		++(*this);
+		if(block_at(it) == 0) {
+			would_be_next_it = it;
+			it = INT_MAX;
+		}
 	}
 
 	ext2_block_iterator()
-	: blockdev(-1)
+	: cache(nullptr)
 	, it(INT_MAX)
 	{
 	}
 
 	bool operator==(ext2_block_iterator const &o) {
 		if(it != INT_MAX && it == o.it) {
-			assert(blockdev == o.blockdev);
+			assert(cache == o.cache);
 			assert(inode == o.inode);
 		}
 		return it == o.it;
@@ -152,178 +489,579 @@ struct ext2_block_iterator {
 	}
 
 	uint32_t operator*() {
-		if(it < 12) {
-			assert(inode->blockptr[it] != 0);
-			return inode->blockptr[it];
-		} else if(it < 12 + pointers_per_block) {
-			assert(inode->singly_blockptr != 0);
+		assert(it != INT_MAX);
+		uint32_t block = block_at(it);
+		assert(block != 0);
+		return block;
+	}
+
+	void operator++() {
+		assert(it >= 0);
+		assert(it != INT_MAX);
+		// Once a block pointer is 0, the end of the file has been reached
+		// and it is mandatory for all block pointers after it to also be
+		// 0, so we can stop looking then.
+		++it;
+		if(block_at(it) == 0) {
+			would_be_next_it = it;
+			it = INT_MAX;
+		}
+	}
 
-			int deref_it = it - 12;
-			assert(deref_it < pointers_per_block);
+	// Maps the block after the last one onto a newly allocated block. In
+	// an extent-mapped inode, the block can be allocated unwritten: it
+	// reads as zeroes until it's marked written.
+	void assign_new_block(std::function<int(void)> allocate_block, bool unwritten = false) {
+		assert(it == INT_MAX);
+		assert(would_be_next_it != INT_MAX);
+		assert(extents || !unwritten);
 
-			uint32_t refblock[pointers_per_block];
-			auto res = ::pread(blockdev, refblock, block_size, block_size * inode->singly_blockptr);
-			check_ssize(res, block_size);
-			assert(refblock[it - 12] != 0);
-			return refblock[it - 12];
-		} else if(it < 12 + pointers_per_block + pointers_per_block * pointers_per_block) {
-			assert(inode->doubly_blockptr != 0);
-
-			int deref_it1 = (it - 12 - pointers_per_block) / pointers_per_block;
-			int deref_it2 = (it - 12 - pointers_per_block) % pointers_per_block;
-			assert(deref_it1 < pointers_per_block);
-			assert(deref_it2 < pointers_per_block);
-
-			uint32_t refblock[pointers_per_block];
-			auto res = ::pread(blockdev, refblock, block_size, block_size * inode->doubly_blockptr);
-			check_ssize(res, block_size);
-			assert(refblock[deref_it1] != 0);
+		it = would_be_next_it;
+		would_be_next_it = INT_MAX;
 
-			res = ::pread(blockdev, refblock, block_size, block_size * refblock[deref_it1]);
-			check_ssize(res, block_size);
-			assert(refblock[deref_it2] != 0);
-			return refblock[deref_it2];
-		} else if(it < 12 + pointers_per_block + pointers_per_block * pointers_per_block + pointers_per_block * pointers_per_block * pointers_per_block) {
-			// TODO: read triply_blockptr, find index in there
-			assert(false);
+		// TODO: what if we have already put an inode in a block group descriptor table,
+		// but then it turns out there's not enough blocks for this inode? Can we get
+		// blocks from _another_ block group into this one for an inode? Or is the size
+		// of all files within a block group limited to the amount of blocks within
+		// that group?
+
+		if(extents) {
+			assign_extent_block(allocate_block, unwritten);
 		} else {
-			assert(!"operator* on an invalid block");
+			assign_indirect_block(allocate_block);
 		}
-		abort();
+
+		assert(block_size % SECTOR_SIZE == 0);
+		inode->sectorcount += block_size / SECTOR_SIZE;
 	}
 
-	void operator++() {
-		assert(it >= -1);
+	// Returns how many blocks, from the current one on and at most max,
+	// follow each other on disk as far as the extent holding the current
+	// block tells, and whether they are unwritten. Indirect blocks only
+	// tell this block by block, so without extents this returns 1.
+	size_t extent_length(size_t max, bool &unwritten) {
+		assert(it != INT_MAX);
+		unwritten = false;
+		if(!extents) {
+			return 1;
+		}
+		uint32_t block = block_at(it);
+		assert(block != 0);
+		unwritten = cached_unwritten;
+		return std::min<size_t>(max, cached_count - (it - cached_first));
+	}
+
+	// Marks count blocks from the current one on as written; they must
+	// lie in a single unwritten extent. The extent is split, so the blocks
+	// around them stay unwritten. Written blocks that continue the extent
+	// before them are added to it, so a file written sequentially after
+	// allocating it ends up with one written extent, not one per write.
+	void mark_written(uint32_t count, std::function<int(void)> allocate_block) {
+		assert(extents);
 		assert(it != INT_MAX);
-		auto it_before = it;
-		(void)it_before;
-		// Iterate through block pointers, finding the next one that is set.
-		// Once one is 0, the end of the file has been reached and it
-		// is mandatory for all block pointers after it to also be 0, so we
-		// can stop looking then.
-		if(it < 11) {
-			if(!inode->blockptr[++it]) {
-				would_be_next_it = it;
-				it = INT_MAX;
+		assert(count > 0);
+		uint32_t n = it;
+		cached_count = 0;
+
+		// the extent is split in at most three; make room for that first,
+		// so that running out of space leaves the extent as it was
+		extent_path path;
+		find_extent(n, path);
+		make_room_in_leaf(path, n, 2, false, allocate_block);
+
+		extent_frame const &leaf = path.frames[path.depth];
+		assert(leaf.index >= 0);
+		auto *header = extent_node(leaf.block);
+		auto *entries = extent_entries<ext4_extent>(header);
+		ext4_extent extent = entries[leaf.index];
+		assert(extent.len > EXT4_EXT_INIT_MAX_LEN);
+		uint32_t len = extent.len - EXT4_EXT_INIT_MAX_LEN;
+		assert(n >= extent.block && n + count <= extent.block + len);
+		uint32_t before = n - extent.block;
+		uint32_t after = extent.block + len - (n + count);
+
+		ext4_extent pieces[3];
+		int num_pieces = 0;
+		if(before > 0) {
+			pieces[num_pieces++] = make_extent(extent.block, before, extent.start_lo, true);
+		}
+		auto *prev = leaf.index > 0 ? &entries[leaf.index - 1] : nullptr;
+		// an unwritten extent before it has a length above the maximum
+		if(before == 0 && prev != nullptr && prev->len + count <= EXT4_EXT_INIT_MAX_LEN
+		&& prev->block + prev->len == n && prev->start_hi == 0 && prev->start_lo + prev->len == extent.start_lo) {
+			prev->len += count;
+		} else {
+			pieces[num_pieces++] = make_extent(n, count, extent.start_lo + before, false);
+		}
+		if(after > 0) {
+			pieces[num_pieces++] = make_extent(n + count, after, extent.start_lo + before + count, true);
+		}
+
+		// The first piece starts where the extent did, unless it was
+		// added to the extent before it; so the index entries above
+		// this leaf stay right
+		int pos = leaf.index;
+		memmove(&entries[pos + num_pieces], &entries[pos + 1], (header->entries - pos - 1) * sizeof(ext4_extent));
+		memcpy(&entries[pos], pieces, num_pieces * sizeof(ext4_extent));
+		header->entries = header->entries - 1 + num_pieces;
+		mark_node_dirty(leaf.block);
+	}
+
+	// Calls f for every block of the inode, including the indirect blocks
+	// or extent tree nodes mapping them, also past holes in the file. f
+	// may use the cache.
+	void for_each_block(std::function<void(uint32_t)> const &f) {
+		if(extents) {
+			for_each_extent_block(0, -1, f);
+			return;
+		}
+		for(int i = 0; i < 12; ++i) {
+			if(inode->blockptr[i]) {
+				f(inode->blockptr[i]);
 			}
-		} else if(it < 11 + pointers_per_block) {
-			if(!inode->singly_blockptr) {
-				assert(it == 11);
-				would_be_next_it = it + 1;
-				it = INT_MAX;
-			} else {
-				++it;
-				int deref_it = it - 12;
-				assert(deref_it < pointers_per_block);
+		}
+		for_each_indirect_block(inode->singly_blockptr, 1, f);
+		for_each_indirect_block(inode->doubly_blockptr, 2, f);
+		for_each_indirect_block(inode->triply_blockptr, 3, f);
+	}
 
-				uint32_t refblock[pointers_per_block];
-				auto res = ::pread(blockdev, refblock, block_size, block_size * inode->singly_blockptr);
-				check_ssize(res, block_size);
-				if(!refblock[deref_it]) {
-					would_be_next_it = it;
-					it = INT_MAX;
+private:
+	// A node on the way from the root of the extent tree to a leaf
+	struct extent_frame {
+		// 0 for the root in the inode
+		uint32_t block;
+		// the index entry that was followed; in the leaf, the last extent
+		// starting at or before the block looked up, or -1 if there is none
+		int index;
+	};
+
+	struct extent_path {
+		extent_frame frames[EXT4_EXT_MAX_DEPTH + 1];
+		// frames[depth] is the leaf
+		int depth;
+	};
+
+	// Returns the physical block holding logical block n of the inode, or
+	// 0 if it isn't allocated.
+	uint32_t block_at(int n) {
+		return extents ? extent_block_at(n) : indirect_block_at(n);
+	}
+
+	// The direct, singly, doubly and triply indirect block pointers of the
+	// inode, in that order
+	uint32_t *inode_pointers() {
+		return reinterpret_cast<uint32_t*>(reinterpret_cast<char*>(inode) + offsetof(ext2_inode, blockptr));
+	}
+
+	// Finds the block pointer in the inode through which logical block n
+	// is reached, and the index into the indirect block at every level
+	// below it. Returns the number of levels, 0 for a direct block
+	// pointer, or -1 if the block is past the triply indirect blocks.
+	int indirect_path(int n, uint32_t *&root, int indices[3]) {
+		if(n < 12) {
+			root = inode_pointers() + n;
+			return 0;
+		}
+		n -= 12;
+		int64_t span = pointers_per_block;
+		for(int levels = 1; levels <= 3; ++levels) {
+			if(n < span) {
+				root = inode_pointers() + 11 + levels;
+				for(int level = levels - 1; level >= 0; --level) {
+					indices[level] = n % pointers_per_block;
+					n /= pointers_per_block;
 				}
+				return levels;
 			}
-		} else if(it < 11 + pointers_per_block + pointers_per_block * pointers_per_block) {
-			if(!inode->doubly_blockptr) {
-				assert(it == 11 + pointers_per_block);
-				would_be_next_it = it + 1;
-				it = INT_MAX;
+			n -= span;
+			span *= pointers_per_block;
+		}
+		return -1;
+	}
+
+	// The indices into the indirect blocks are computed directly, so this
+	// reads one block per level of indirection.
+	uint32_t indirect_block_at(int n) {
+		uint32_t *root;
+		int indices[3];
+		int levels = indirect_path(n, root, indices);
+		if(levels < 0) {
+			return 0;
+		}
+		uint32_t block = *root;
+		for(int level = 0; level < levels && block != 0; ++level) {
+			block = reinterpret_cast<uint32_t*>(cache->get(block))[indices[level]];
+		}
+		return block;
+	}
+
+	void assign_indirect_block(std::function<int(void)> &allocate_block) {
+		uint32_t *root;
+		int indices[3];
+		int levels = indirect_path(it, root, indices);
+		if(levels < 0) {
+			throw cloudabi_system_error(EFBIG);
+		}
+		if(levels == 0) {
+			assert(*root == 0);
+			*root = allocate_block();
+			return;
+		}
+
+		// Missing indirect blocks are allocated on the way down, so they
+		// precede the data block on the disk
+		if(*root == 0) {
+			*root = new_indirect_block(allocate_block);
+		}
+		uint32_t indirect = *root;
+		for(int level = 0; level < levels; ++level) {
+			uint32_t next = reinterpret_cast<uint32_t*>(cache->get(indirect))[indices[level]];
+			if(level == levels - 1) {
+				assert(next == 0);
+				next = allocate_block();
+			} else if(next == 0) {
+				next = new_indirect_block(allocate_block);
 			} else {
-				++it;
-				int deref_it1 = (it - 12 - pointers_per_block) / pointers_per_block;
-				int deref_it2 = (it - 12 - pointers_per_block) % pointers_per_block;
-				assert(deref_it1 < pointers_per_block);
-				assert(deref_it2 < pointers_per_block);
+				indirect = next;
+				continue;
+			}
+			// allocate_block() uses the cache as well, so only take the
+			// indirect block from it once the allocations are done
+			reinterpret_cast<uint32_t*>(cache->get(indirect))[indices[level]] = next;
+			cache->mark_dirty(indirect);
+			indirect = next;
+		}
+	}
 
-				uint32_t refblock[pointers_per_block];
-				auto res = ::pread(blockdev, refblock, block_size, block_size * inode->doubly_blockptr);
-				check_ssize(res, block_size);
-				if(!refblock[deref_it1]) {
-					would_be_next_it = it;
-					it = INT_MAX;
-				} else {
-					res = ::pread(blockdev, refblock, block_size, block_size * refblock[deref_it1]);
-					check_ssize(res, block_size);
-					if(!refblock[deref_it2]) {
-						would_be_next_it = it;
-						it = INT_MAX;
-					}
-				}
+	uint32_t new_indirect_block(std::function<int(void)> &allocate_block) {
+		uint32_t block = allocate_block();
+		inode->sectorcount += block_size / SECTOR_SIZE;
+		// stays in the cache as a dirty block, so the pointer needn't
+		// outlive the allocations after it
+		cache->get_zeroed(block);
+		return block;
+	}
+
+	void for_each_indirect_block(uint32_t block, int levels, std::function<void(uint32_t)> const &f) {
+		if(block == 0) {
+			return;
+		}
+		// f may evict the indirect block, so copy the pointers out first
+		auto *pointers = reinterpret_cast<uint32_t*>(cache->get(block));
+		std::vector<uint32_t> copy(pointers, pointers + pointers_per_block);
+		for(uint32_t pointer : copy) {
+			if(pointer == 0) {
+				continue;
+			}
+			if(levels > 1) {
+				for_each_indirect_block(pointer, levels - 1, f);
+			} else {
+				f(pointer);
 			}
-		} else if(it < 11 + pointers_per_block + pointers_per_block * pointers_per_block + pointers_per_block * pointers_per_block * pointers_per_block) {
-			// TODO: increase through triply blockptr
-			assert(false);
-		} else {
-			// End of blocks reached
-			// TODO: end of all possible blocks reached, how to react?
-			assert(false);
 		}
-		assert(it > it_before);
+		f(block);
+	}
+
+	// Returns a node of the extent tree, after checking its header. If a
+	// depth is given, the node must be at that depth.
+	ext4_extent_header *extent_node(uint32_t block, int depth = -1) {
+		auto *header = block == 0
+			? reinterpret_cast<ext4_extent_header*>(inode_pointers())
+			: reinterpret_cast<ext4_extent_header*>(cache->get(block));
+		if(header->magic != EXT4_EXT_MAGIC || header->entries > header->max
+		|| header->depth > EXT4_EXT_MAX_DEPTH || (depth >= 0 && header->depth != depth)) {
+			throw cloudabi_system_error(EIO);
+		}
+		return header;
 	}
 
-	void assign_new_block(std::function<int(void)> allocate_block) {
-		assert(it == INT_MAX);
-		assert(would_be_next_it != INT_MAX);
+	template <typename T>
+	static T *extent_entries(ext4_extent_header *header) {
+		return reinterpret_cast<T*>(header + 1);
+	}
 
-		it = would_be_next_it;
-		would_be_next_it = INT_MAX;
+	// The root lives in the inode, which the caller writes back
+	void mark_node_dirty(uint32_t block) {
+		if(block != 0) {
+			cache->mark_dirty(block);
+		}
+	}
 
-		assert(block_size % SECTOR_SIZE == 0);
-		inode->sectorcount += block_size / SECTOR_SIZE;
+	// Walks from the root of the extent tree to the leaf that holds, or
+	// would hold, logical block n.
+	void find_extent(uint32_t n, extent_path &path) {
+		uint32_t block = 0;
+		int depth = -1;
+		for(int level = 0;; ++level) {
+			auto *header = extent_node(block, depth);
+			if(level == 0) {
+				path.depth = header->depth;
+			}
+			// the last entry starting at or before n; index entries and
+			// extents both start with their first logical block
+			auto *entries = extent_entries<ext4_extent_idx>(header);
+			int lo = 0;
+			int hi = header->entries;
+			while(lo < hi) {
+				int mid = (lo + hi) / 2;
+				if(entries[mid].block <= n) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			int index = lo - 1;
+			if(header->depth == 0) {
+				path.frames[level] = {block, index};
+				return;
+			}
+			if(header->entries == 0) {
+				throw cloudabi_system_error(EIO);
+			}
+			// blocks before the first index entry go below it
+			index = std::max(index, 0);
+			path.frames[level] = {block, index};
+			if(entries[index].leaf_hi != 0) {
+				throw cloudabi_system_error(EIO);
+			}
+			block = entries[index].leaf_lo;
+			depth = header->depth - 1;
+		}
+	}
 
-		// TODO: what if we have already put an inode in a block group descriptor table,
-		// but then it turns out there's not enough blocks for this inode? Can we get
-		// blocks from _another_ block group into this one for an inode? Or is the size
-		// of all files within a block group limited to the amount of blocks within
-		// that group?
+	// Sequential access stays within one extent most of the time, so the
+	// last extent found is remembered and the tree is only walked when
+	// leaving it.
+	uint32_t extent_block_at(uint32_t n) {
+		if(cached_count != 0 && n - cached_first < cached_count) {
+			return cached_start + (n - cached_first);
+		}
+		extent_path path;
+		find_extent(n, path);
+		extent_frame const &leaf = path.frames[path.depth];
+		if(leaf.index < 0) {
+			return 0;
+		}
+		auto const &extent = extent_entries<ext4_extent>(extent_node(leaf.block))[leaf.index];
+		bool unwritten = extent.len > EXT4_EXT_INIT_MAX_LEN;
+		uint32_t len = unwritten ? extent.len - EXT4_EXT_INIT_MAX_LEN : extent.len;
+		if(n - extent.block >= len) {
+			return 0;
+		}
+		if(extent.start_hi != 0) {
+			throw cloudabi_system_error(EIO);
+		}
+		cached_first = extent.block;
+		cached_count = len;
+		cached_start = extent.start_lo;
+		cached_unwritten = unwritten;
+		return cached_start + (n - cached_first);
+	}
+
+	void assign_extent_block(std::function<int(void)> &allocate_block, bool unwritten) {
+		uint32_t n = it;
+		uint32_t physical = allocate_block();
+		cached_count = 0;
+
+		extent_path path;
+		find_extent(n, path);
+		{
+			// Grow the extent before the block, if the new block follows it
+			// on the disk as well
+			extent_frame const &leaf = path.frames[path.depth];
+			if(leaf.index >= 0) {
+				auto &extent = extent_entries<ext4_extent>(extent_node(leaf.block))[leaf.index];
+				bool extent_unwritten = extent.len > EXT4_EXT_INIT_MAX_LEN;
+				uint32_t len = extent_unwritten ? extent.len - EXT4_EXT_INIT_MAX_LEN : extent.len;
+				uint32_t max_len = unwritten ? EXT4_EXT_INIT_MAX_LEN - 1 : EXT4_EXT_INIT_MAX_LEN;
+				if(extent_unwritten == unwritten && len < max_len && extent.block + len == n
+				&& extent.start_hi == 0 && extent.start_lo + len == physical) {
+					extent.len += 1;
+					mark_node_dirty(leaf.block);
+					return;
+				}
+			}
+		}
 
-		if(it < 12) {
-			assert(inode->blockptr[it] == 0);
-			inode->blockptr[it] = allocate_block();
-		} else if(it == 12) {
-			assert(inode->singly_blockptr == 0);
-			inode->singly_blockptr = allocate_block();
+		// A new extent is needed
+		make_room_in_leaf(path, n, 1, true, allocate_block);
+
+		extent_frame const &leaf = path.frames[path.depth];
+		auto *header = extent_node(leaf.block);
+		assert(header->entries < header->max);
+		auto *entries = extent_entries<ext4_extent>(header);
+		int pos = leaf.index + 1;
+		memmove(&entries[pos + 1], &entries[pos], (header->entries - pos) * sizeof(ext4_extent));
+		entries[pos].block = n;
+		entries[pos].len = unwritten ? EXT4_EXT_INIT_MAX_LEN + 1 : 1;
+		entries[pos].start_hi = 0;
+		entries[pos].start_lo = physical;
+		header->entries += 1;
+		mark_node_dirty(leaf.block);
+	}
+
+	static ext4_extent make_extent(uint32_t block, uint32_t len, uint32_t start, bool unwritten) {
+		ext4_extent extent;
+		extent.block = block;
+		extent.len = unwritten ? EXT4_EXT_INIT_MAX_LEN + len : len;
+		extent.start_hi = 0;
+		extent.start_lo = start;
+		return extent;
+	}
+
+	// Makes room for the given number of entries in the leaf of the path,
+	// which holds, or would hold, logical block n. Full nodes at the
+	// bottom of the path are split from the highest one down, so the
+	// parent of every split node has room for the index entry of the new
+	// half. If may_append is set and block n goes at the very end of the
+	// tree, the full nodes are left as they are instead (see
+	// split_extent_node()).
+	void make_room_in_leaf(extent_path &path, uint32_t n, int needed, bool may_append, std::function<int(void)> &allocate_block) {
+		auto room = [&](int level) -> int {
+			auto *header = extent_node(path.frames[level].block);
+			return header->max - header->entries;
+		};
+		if(room(path.depth) >= needed) {
+			return;
+		}
+		int top = path.depth - 1;
+		while(top >= 0 && room(top) == 0) {
+			--top;
+		}
+		if(top < 0) {
+			grow_extent_tree(path, allocate_block);
+			top = 1;
+		}
+		bool appending = may_append;
+		for(int level = top + 1; level <= path.depth; ++level) {
+			if(path.frames[level].index + 1 != extent_node(path.frames[level].block)->entries) {
+				appending = false;
+			}
+		}
+		for(int level = top + 1; level <= path.depth; ++level) {
+			split_extent_node(path, level, n, appending, allocate_block);
+		}
+	}
 
-			uint32_t refblock[pointers_per_block];
-			refblock[0] = allocate_block();
+	uint32_t new_extent_node(std::function<int(void)> &allocate_block, uint16_t depth, const void *entries, uint16_t count) {
+		uint32_t block = allocate_block();
+		inode->sectorcount += block_size / SECTOR_SIZE;
+		auto *header = reinterpret_cast<ext4_extent_header*>(cache->get_zeroed(block));
+		header->magic = EXT4_EXT_MAGIC;
+		header->entries = count;
+		header->max = (block_size - sizeof(ext4_extent_header)) / sizeof(ext4_extent);
+		header->depth = depth;
+		if(count > 0) {
+			memcpy(header + 1, entries, count * sizeof(ext4_extent));
+		}
+		return block;
+	}
 
-			auto res = ::pwrite(blockdev, refblock, block_size, block_size * inode->singly_blockptr);
-			check_ssize(res, block_size);
-		} else if(it < 12 + pointers_per_block) {
-			assert(inode->singly_blockptr != 0);
-			uint32_t refblock[pointers_per_block];
-			auto res = ::pread(blockdev, refblock, block_size, block_size * inode->singly_blockptr);
-			check_ssize(res, block_size);
-			assert(refblock[it - 12] == 0);
-			refblock[it - 12] = allocate_block();
+	// Moves the entries of the full root into a new node below it, so the
+	// tree gets one level deeper and the root has room again.
+	void grow_extent_tree(extent_path &path, std::function<int(void)> &allocate_block) {
+		auto *root = extent_node(0);
+		if(root->depth >= EXT4_EXT_MAX_DEPTH) {
+			throw cloudabi_system_error(EFBIG);
+		}
+		// the root is in the inode, so it stays valid during the allocation
+		uint32_t child = new_extent_node(allocate_block, root->depth, root + 1, root->entries);
+		uint32_t first = extent_entries<ext4_extent_idx>(root)[0].block;
+		root->depth += 1;
+		root->entries = 1;
+		auto &index = extent_entries<ext4_extent_idx>(root)[0];
+		index.block = first;
+		index.leaf_lo = child;
+		index.leaf_hi = 0;
+		index.unused = 0;
+
+		for(int level = path.depth; level >= 0; --level) {
+			path.frames[level + 1] = path.frames[level];
+		}
+		path.depth += 1;
+		path.frames[0] = {0, 0};
+		path.frames[1].block = child;
+	}
+
+	// Splits the full node at the given level of the path, adding an
+	// index entry for the new node to the parent, and moves the path to
+	// the half where the new extent goes. When the new extent goes at the
+	// very end of the tree, the full node is left as it is and the new one
+	// starts out empty, so files written sequentially get full nodes.
+	void split_extent_node(extent_path &path, int level, uint32_t n, bool appending, std::function<int(void)> &allocate_block) {
+		assert(level > 0);
+		extent_frame &frame = path.frames[level];
+		auto *header = extent_node(frame.block);
+		int entries = header->entries;
+		int split = appending ? entries : entries / 2;
+		uint16_t depth = header->depth;
+		uint32_t key = appending ? n : extent_entries<ext4_extent_idx>(header)[split].block;
+		// the node may be evicted by the allocation, so copy the entries
+		// that move first
+		auto *moved_begin = reinterpret_cast<uint8_t*>(extent_entries<ext4_extent>(header) + split);
+		auto *moved_end = reinterpret_cast<uint8_t*>(extent_entries<ext4_extent>(header) + entries);
+		std::vector<uint8_t> moved(moved_begin, moved_end);
+		uint32_t sibling = new_extent_node(allocate_block, depth, moved.data(), entries - split);
+		extent_node(frame.block)->entries = split;
+		mark_node_dirty(frame.block);
+
+		extent_frame &parent = path.frames[level - 1];
+		auto *parent_header = extent_node(parent.block);
+		assert(parent_header->entries < parent_header->max);
+		auto *indices = extent_entries<ext4_extent_idx>(parent_header);
+		int pos = parent.index + 1;
+		memmove(&indices[pos + 1], &indices[pos], (parent_header->entries - pos) * sizeof(ext4_extent_idx));
+		indices[pos].block = key;
+		indices[pos].leaf_lo = sibling;
+		indices[pos].leaf_hi = 0;
+		indices[pos].unused = 0;
+		parent_header->entries += 1;
+		mark_node_dirty(parent.block);
+
+		if(appending) {
+			parent.index = pos;
+			frame = {sibling, -1};
+		} else if(frame.index >= split) {
+			parent.index = pos;
+			frame = {sibling, frame.index - split};
+		}
+	}
 
-			res = ::pwrite(blockdev, refblock, block_size, block_size * inode->singly_blockptr);
-			check_ssize(res, block_size);
-		} else if(it == 12 + pointers_per_block) {
-			// TODO: create doubly indirect blockptr (need a second block)
-			assert(false);
-		} else if(it < 12 + pointers_per_block + pointers_per_block * pointers_per_block) {
-			// TODO: append to doubly indirect blockptr
-			assert(false);
-		} else if(it == 12 + pointers_per_block + pointers_per_block * pointers_per_block) {
-			// TODO: create triply indirect blockptr (need a second and third block)
-			assert(false);
-		} else if(it < 12 + pointers_per_block + pointers_per_block * pointers_per_block + pointers_per_block * pointers_per_block * pointers_per_block) {
-			// TODO: append to triply indirect blockptr (may need an extra second block)
-			assert(false);
-		} else {
-			// should be unreachable
-			assert(false);
+	void for_each_extent_block(uint32_t block, int depth, std::function<void(uint32_t)> const &f) {
+		auto *header = extent_node(block, depth);
+		depth = header->depth;
+		// f may evict the node, so copy the entries out first
+		std::vector<ext4_extent> entries(extent_entries<ext4_extent>(header), extent_entries<ext4_extent>(header) + header->entries);
+		for(auto const &entry : entries) {
+			if(depth > 0) {
+				auto const &index = reinterpret_cast<ext4_extent_idx const&>(entry);
+				if(index.leaf_hi != 0) {
+					throw cloudabi_system_error(EIO);
+				}
+				for_each_extent_block(index.leaf_lo, depth - 1, f);
+			} else {
+				uint32_t len = entry.len > EXT4_EXT_INIT_MAX_LEN ? entry.len - EXT4_EXT_INIT_MAX_LEN : entry.len;
+				if(entry.start_hi != 0) {
+					throw cloudabi_system_error(EIO);
+				}
+				for(uint32_t i = 0; i < len; ++i) {
+					f(entry.start_lo + i);
+				}
+			}
+		}
+		if(block != 0) {
+			f(block);
 		}
 	}
 
-private:
-	int blockdev;
+	block_cache *cache;
 	int block_size;
 	int pointers_per_block;
 	ext2_inode *inode;
-	// -1 is initializing;
+	// whether the inode maps its blocks through an extent tree instead of
+	// indirect blocks
+	bool extents = false;
+	// Without extents:
 	// 0 to 11 are direct inode blockptrs;
 	// 12 to 12+ppb are singly indirect inode blockptrs;
 	// 12+ppb to 12+ppb+ppb^2 are doubly indirect inode blockptrs;
@@ -331,7 +1069,11 @@ private:
 	// INT_MAX is end
 	int it;
 	int would_be_next_it = INT_MAX;
-	// TODO: add a cache here/in the FS implementation for indirection blocks so we don't have to re-read them all the time
+	// the extent last found by extent_block_at(); none if cached_count is 0
+	uint32_t cached_first = 0;
+	uint32_t cached_count = 0;
+	uint32_t cached_start = 0;
+	bool cached_unwritten = false;
 };
 
 struct extfs_file_entry : public cosix::file_entry {
@@ -341,13 +1083,37 @@ struct extfs_file_entry : public cosix::file_entry {
 	}
 
 	~extfs_file_entry() {
+		std::lock_guard<std::recursive_mutex> lock(e->metadata_mtx);
+		e->release_preallocation(*this);
 		if(inode_data.nlink == 0) {
 			e->deallocate_inode(inode, type, inode_data);
 		}
 	}
 
 	extfs *e;
+	// Held shared while the contents of the file are read, and exclusively
+	// while they're written or the file is resized
+	std::shared_mutex rwlock;
 	ext2_inode inode_data;
+	// Where the next block of this file should preferably be allocated
+	size_t allocation_goal = 0;
+	// Blocks reserved for this file in the in-memory bitmaps, but not
+	// allocated on disk yet, so that appends get contiguous blocks
+	size_t prealloc_start = 0;
+	size_t prealloc_count = 0;
+	// Physical block numbers of the logical blocks of this file, filled in
+	// lazily by extfs::map_block(); 0 if not looked up yet. Blocks are only
+	// ever added to a file while it's in use, so entries never go stale.
+	// The map is kept in chunks of BLOCK_MAP_CHUNK blocks, indexed by
+	// logical block / BLOCK_MAP_CHUNK, so that a lookup far into a large or
+	// sparse file only allocates the chunk around it.
+	static const size_t BLOCK_MAP_CHUNK = 1024;
+	std::unordered_map<size_t, std::unique_ptr<uint32_t[]>> block_map;
+	// For directories without an htree index: their entries by name,
+	// loaded by the first lookup and kept up to date from then on
+	std::unique_ptr<std::unordered_map<std::string, ext2_dir_name>> names;
+	// Logical block of the directory to try first when adding an entry
+	size_t insert_hint = 0;
 };
 
 // This function takes an object that spans multiple sectors that is already on
@@ -390,10 +1156,41 @@ static void pwrite_partial(int fd, const void *object, const void *changed_ptr,
 		length, object_offset_on_disk);
 }
 
-extfs::extfs(int b, cloudabi_device_t d)
+// Describes which part of a run of contiguous blocks a pread or pwrite
+// touches: possibly a partial first block, whole blocks in the middle that
+// can be transferred to or from the caller's buffer directly, and possibly
+// a partial last block. Offsets are relative to the caller's buffer.
+struct run_layout {
+	run_layout(size_t run, size_t in_block, size_t remaining, size_t block_size) {
+		size_t run_end = std::min(run * block_size, in_block + remaining);
+		length = run_end - in_block;
+		partial_head = in_block != 0 || run_end < block_size;
+		partial_tail = run > 1 && run_end % block_size != 0;
+		head_length = std::min(block_size, run_end) - in_block;
+		size_t first_middle = partial_head ? 1 : 0;
+		size_t end_middle = partial_tail ? run - 1 : run;
+		middle_blocks = end_middle > first_middle ? end_middle - first_middle : 0;
+		middle_offset = partial_head ? block_size - in_block : 0;
+		tail_offset = end_middle * block_size - in_block;
+		tail_length = run_end % block_size;
+	}
+
+	size_t length;
+	bool partial_head;
+	bool partial_tail;
+	size_t head_length;
+	size_t middle_blocks;
+	size_t middle_offset;
+	size_t tail_offset;
+	size_t tail_length;
+};
+
+extfs::extfs(int b, cloudabi_device_t d, int r, size_t cache_blocks, atime_update a)
 : cosix::reverse_handler()
 , device(d)
 , blockdev(b)
+, reversefd(r)
+, atime(a)
 {
 	superblock = reinterpret_cast<ext2_superblock*>(malloc(sizeof(ext2_superblock)));
 	superblock_offset = 1024;
@@ -418,11 +1215,11 @@ extfs::extfs(int b, cloudabi_device_t d)
 			0, sizeof(ext2_superblock) - offsetof(ext2_superblock, this_block_group));
 	}
 
-	if(superblock->required_features_present != 0) {
+	if(superblock->required_features_present & ~EXTFS_SUPPORTED_INCOMPAT) {
 		throw std::runtime_error("required features are not supported");
 	}
 
-	if(superblock->rw_required_features_present != 0) {
+	if(superblock->rw_required_features_present & ~EXTFS_SUPPORTED_RO_COMPAT) {
 		throw std::runtime_error("required r/w features are not supported");
 	}
 
@@ -434,6 +1231,14 @@ extfs::extfs(int b, cloudabi_device_t d)
 	block_size = 1024 << superblock->block_size_shifted;
 	first_block = block_size == 1024 ? 1 : 0;
 
+	// only the first sizeof(ext2_inode) bytes of larger inodes are used
+	if(superblock->inode_size < sizeof(ext2_inode) || superblock->inode_size > block_size
+	|| (superblock->inode_size & (superblock->inode_size - 1)) != 0) {
+		throw std::runtime_error("inode size is not supported");
+	}
+	cache.reset(new block_cache(blockdev, block_size, cache_blocks));
+	block_bitmaps.resize(number_of_block_groups);
+
 	int block_after_superblock = block_size == 1024 ? 2 : 1;
 	size_t readsz = sizeof(ext2_block_group_descriptor) * number_of_block_groups;
 	if(readsz % SECTOR_SIZE) {
@@ -454,6 +1259,15 @@ extfs::extfs(int b, cloudabi_device_t d)
 
 extfs::~extfs()
 {
+	// drop the file entries first, as they may free blocks and inodes
+	pseudo_fds.clear();
+	open_inodes.clear();
+
+	try {
+		write_back();
+	} catch(cloudabi_system_error &e) {
+		fprintf(stderr, "[extfs] failed to write back metadata: %s\n", strerror(e.error));
+	}
 	free(block_group_desc);
 	free(superblock);
 }
@@ -474,11 +1288,12 @@ static void file_entry_to_filestat(file_entry_ptr const &entry, cloudabi_filesta
 
 file_entry extfs::lookup(pseudofd_t pseudo, const char *file, size_t len, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr directory = get_file_entry_from_pseudo(pseudo);
 
+	// like on other systems, looking up names doesn't count as reading the
+	// directory, so its access time doesn't change
 	std::string filename(file, len);
-	directory->inode_data.atime = time(nullptr);
-	write_inode(directory->inode, directory->inode_data);
 	file_entry entry;
 	try {
 		file_entry_ptr entry_ptr = get_file_entry_from_inode(directory->inode);
@@ -490,22 +1305,11 @@ file_entry extfs::lookup(pseudofd_t pseudo, const char *file, size_t len, clouda
 				throw cloudabi_system_error(ENOTDIR);
 			}
 
-			bool entry_found = false;
-			cloudabi_dirent_t dirent;
-			readdir(entry_ptr, false, [&](cloudabi_dirent_t d, std::string n, file_entry_ptr) -> bool {
-				assert(!entry_found);
-				if(n == filename) {
-					entry_found = true;
-					dirent = d;
-					return false;
-				}
-				return true;
-			});
-
-			if(!entry_found) {
+			cloudabi_inode_t inode = find_entry(entry_ptr, filename);
+			if(inode == 0) {
 				throw cloudabi_system_error(ENOENT);
 			} else {
-				entry = *get_file_entry_from_inode(dirent.d_ino);
+				entry = *get_file_entry_from_inode(inode);
 			}
 		}
 
@@ -527,8 +1331,30 @@ file_entry extfs::lookup(pseudofd_t pseudo, const char *file, size_t len, clouda
 	return entry;
 }
 
+file_entry extfs::lookup_inode(pseudofd_t pseudo, cloudabi_inode_t directory_inode, const char *file, size_t len, cloudabi_filestat_t *filestat)
+{
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	// the directory doesn't need to be opened, but the pseudo FD must be
+	get_pseudo_fd(pseudo);
+
+	file_entry_ptr directory = get_file_entry_from_inode(directory_inode);
+	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
+		throw cloudabi_system_error(ENOTDIR);
+	}
+	cloudabi_inode_t inode = find_entry(directory, std::string(file, len));
+	if(inode == 0) {
+		throw cloudabi_system_error(ENOENT);
+	}
+	file_entry_ptr entry = get_file_entry_from_inode(inode);
+	if (filestat) {
+		file_entry_to_filestat(entry, filestat);
+	}
+	return *entry;
+}
+
 std::pair<pseudofd_t, cloudabi_filetype_t> extfs::open(cloudabi_inode_t inode)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr entry = get_file_entry_from_inode(inode);
 
 	if(entry->type == CLOUDABI_FILETYPE_SYMBOLIC_LINK) {
@@ -538,18 +1364,16 @@ std::pair<pseudofd_t, cloudabi_filetype_t> extfs::open(cloudabi_inode_t inode)
 		throw cloudabi_system_error(EINVAL);
 	}
 
-	auto &idata = entry->inode_data;
-	idata.atime = time(nullptr);
-	write_inode(entry->inode, idata);
-
 	pseudo_fd_ptr pseudo(new pseudo_fd_entry);
 	pseudo->file = entry;
 	pseudofd_t fd = reinterpret_cast<pseudofd_t>(pseudo.get());
+	std::lock_guard<std::mutex> entries_lock(entries_mtx);
 	pseudo_fds[fd] = pseudo;
 	return std::make_pair(fd, entry->type);
 }
 
 void extfs::link(pseudofd_t pseudo1, const char *file1, size_t file1len, cloudabi_lookupflags_t lookupflags, pseudofd_t pseudo2, const char *file2, size_t file2len) {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	auto entry1 = lookup(pseudo1, file1, file1len, 0, NULL);
 	if(entry1.type == CLOUDABI_FILETYPE_DIRECTORY) {
 		throw cloudabi_system_error(EPERM);
@@ -559,35 +1383,31 @@ void extfs::link(pseudofd_t pseudo1, const char *file1, size_t file1len, cloudab
 	std::string filename2(file2, file2len);
 	assert(dir2->type == CLOUDABI_FILETYPE_DIRECTORY);
 
-	bool entry_found = false;
-	readdir(dir2, false, [&](cloudabi_dirent_t, std::string n, file_entry_ptr) -> bool {
-		assert(!entry_found);
-		if(n == filename2) {
-			entry_found = true;
-			return false;
-		}
-		return true;
-	});
-	if(entry_found) {
+	if(find_entry(dir2, filename2) != 0) {
 		throw cloudabi_system_error(EEXIST);
 	}
+	invalidate_other_dentries(dir2, pseudo2);
 
 	auto entry1_ptr = get_file_entry_from_inode(entry1.inode);
 	entry1_ptr->inode_data.nlink += 1;
 	entry1_ptr->inode_data.mtime = time(nullptr);
 	write_inode(entry1_ptr->inode, entry1_ptr->inode_data);
 
-	add_entry_into_directory(dir2, filename2, entry1_ptr->inode);
+	add_entry_into_directory(dir2, filename2, entry1_ptr->inode, entry1_ptr->type);
 	dir2->inode_data.ctime = dir2->inode_data.mtime = time(nullptr);
 	write_inode(dir2->inode, dir2->inode_data);
 }
 
 void extfs::allocate(pseudofd_t pseudo, off_t offset, off_t length) {
-	file_entry_ptr entry = get_file_entry_from_pseudo(pseudo);
+	pseudo_fd_ptr pseudo_fd = get_pseudo_fd(pseudo);
+	file_entry_ptr entry = pseudo_fd->file;
 	if(entry->type != CLOUDABI_FILETYPE_REGULAR_FILE) {
 		throw cloudabi_system_error(EINVAL);
 	}
 
+	std::unique_lock<std::shared_mutex> file_lock(entry->rwlock);
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+
 	size_t minsize = offset + length;
 
 	size_t size = entry->inode_data.size1;
@@ -596,13 +1416,16 @@ void extfs::allocate(pseudofd_t pseudo, off_t offset, off_t length) {
 	}
 
 	if(size < minsize) {
+		pseudo_fd->written = true;
 		allocate(entry, minsize);
 		entry->inode_data.ctime = entry->inode_data.mtime = time(nullptr);
 		write_inode(entry->inode, entry->inode_data);
+		invalidate_other_pseudos(entry, pseudo);
 	}
 }
 
 size_t extfs::readlink(pseudofd_t pseudo, const char *file, size_t filelen, char *buf, size_t buflen) {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	auto entrynum = lookup(pseudo, file, filelen, 0, nullptr);
 
 	file_entry_ptr entry = get_file_entry_from_inode(entrynum.inode);
@@ -621,6 +1444,7 @@ size_t extfs::readlink(pseudofd_t pseudo, const char *file, size_t filelen, char
 
 void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseudofd_t pseudo2, const char *file2, size_t file2len)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr dir1 = get_file_entry_from_pseudo(pseudo1);
 	file_entry_ptr dir2 = get_file_entry_from_pseudo(pseudo2);
 
@@ -639,22 +1463,22 @@ void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseud
 	// source file exists?
 	file_entry entry = lookup(pseudo1, file1, file1len, 0, NULL);
 
+	// sent under metadata_mtx, so lookups answered after this see the
+	// renamed entries
+	invalidate_other_dentries(dir1, pseudo1);
+	invalidate_other_dentries(dir2, pseudo2);
+
 	// destination doesn't exist? -> rename file
 	file_entry_ptr newentry;
-	readdir(dir2, false, [&](cloudabi_dirent_t d, std::string n, file_entry_ptr) -> bool {
-		assert(!newentry);
-		if(n == filename2) {
-			newentry = get_file_entry_from_inode(d.d_ino);
-			return false;
-		}
-		return true;
-	});
+	cloudabi_inode_t existing = find_entry(dir2, filename2);
+	if(existing != 0) {
+		newentry = get_file_entry_from_inode(existing);
+	}
 	if(!newentry) {
 		file_entry_ptr entryp = get_file_entry_from_inode(entry.inode);
 		assert(entry.type == entryp->type);
 		if(entry.type == CLOUDABI_FILETYPE_DIRECTORY && dir1->inode != dir2->inode) {
-			remove_entry_from_directory(entryp, "..");
-			add_entry_into_directory(entryp, "..", dir2->inode);
+			set_parent_directory(entryp, dir2->inode);
 			// TODO this needs to be in the block group, not the inode
 			/*
 			dir1->inode_data.num_directories -= 1;
@@ -664,7 +1488,7 @@ void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseud
 			dir2->inode_data.nlink += 2;
 		}
 		remove_entry_from_directory(dir1, filename1);
-		add_entry_into_directory(dir2, filename2, entry.inode);
+		add_entry_into_directory(dir2, filename2, entry.inode, entry.type);
 		auto t = time(nullptr);
 		dir1->inode_data.ctime = dir1->inode_data.mtime = t;
 		dir2->inode_data.ctime = dir2->inode_data.mtime = t;
@@ -695,7 +1519,7 @@ void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseud
 		dir1->inode_data.nlink -= 1;
 		// TODO: in the block group, decrease number of directories by 1
 
-		add_entry_into_directory(dir2, filename2, entry.inode);
+		add_entry_into_directory(dir2, filename2, entry.inode, entry.type);
 
 		file_entry_ptr entryp = get_file_entry_from_inode(entry.inode);
 		auto t = time(nullptr);
@@ -714,7 +1538,7 @@ void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseud
 
 	remove_entry_from_directory(dir1, filename1);
 	remove_entry_from_directory(dir2, filename2);
-	add_entry_into_directory(dir2, filename2, entry.inode);
+	add_entry_into_directory(dir2, filename2, entry.inode, entry.type);
 
 	file_entry_ptr entryp = get_file_entry_from_inode(entry.inode);
 	auto t = time(nullptr);
@@ -727,6 +1551,7 @@ void extfs::rename(pseudofd_t pseudo1, const char *file1, size_t file1len, pseud
 }
 
 void extfs::symlink(pseudofd_t pseudo, const char *file1, size_t file1len, const char *file2, size_t file2len) {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	auto inode = create(pseudo, file2, file2len, CLOUDABI_FILETYPE_SYMBOLIC_LINK);
 	file_entry_ptr entry = get_file_entry_from_inode(inode);
 
@@ -749,6 +1574,7 @@ void extfs::symlink(pseudofd_t pseudo, const char *file1, size_t file1len, const
 
 void extfs::unlink(pseudofd_t pseudo, const char *file, size_t len, cloudabi_ulflags_t unlinkflags)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr directory = get_file_entry_from_pseudo(pseudo);
 	std::string filename(file, len);
 
@@ -770,6 +1596,7 @@ void extfs::unlink(pseudofd_t pseudo, const char *file, size_t len, cloudabi_ulf
 		}
 	}
 
+	invalidate_other_dentries(directory, pseudo);
 	remove_entry_from_directory(directory, filename);
 	directory->inode_data.ctime = directory->inode_data.mtime = time(nullptr);
 
@@ -791,27 +1618,20 @@ void extfs::unlink(pseudofd_t pseudo, const char *file, size_t len, cloudabi_ulf
 
 cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len, cloudabi_filetype_t type)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr directory = get_file_entry_from_pseudo(pseudo);
 
 	std::string filename(file, len);
 	assert(directory->type == CLOUDABI_FILETYPE_DIRECTORY);
 
-	bool entry_found = false;
-	readdir(directory, false, [&](cloudabi_dirent_t, std::string n, file_entry_ptr) -> bool {
-		assert(!entry_found);
-		if(n == filename) {
-			entry_found = true;
-			return false;
-		}
-		return true;
-	});
-	if(entry_found) {
+	if(find_entry(directory, filename) != 0) {
 		throw cloudabi_system_error(EEXIST);
 	}
 
 	if(superblock->num_unallocated_inodes == 0) {
 		throw cloudabi_system_error(ENOSPC);
 	}
+	invalidate_other_dentries(directory, pseudo);
 
 	ext2_inode inode_data;
 	memset(&inode_data, 0, sizeof(ext2_inode));
@@ -832,6 +1652,11 @@ cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len,
 	}
 
 	inode_data.nlink = type == CLOUDABI_FILETYPE_DIRECTORY ? 2 : 1;
+	// Symbolic links keep their target in the block pointers instead
+	if((superblock->required_features_present & EXT4_FEATURE_INCOMPAT_EXTENTS)
+	&& (type == CLOUDABI_FILETYPE_REGULAR_FILE || type == CLOUDABI_FILETYPE_DIRECTORY)) {
+		init_extent_root(inode_data);
+	}
 	inode_data.atime = inode_data.mtime = inode_data.ctime = time(nullptr);
 	// TODO: generation?
 
@@ -850,9 +1675,7 @@ cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len,
 		assert(blockgroup < number_of_block_groups);
 		auto &descriptor = block_group_desc[blockgroup];
 
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		uint8_t *bitmap = cache->get(descriptor.inode_usage_bitmap_addr);
 
 		// find an unused inode in this bitmap
 		for(size_t i = 0; i < size_t(block_size); ++i) {
@@ -890,21 +1713,20 @@ cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len,
 	auto &descriptor = block_group_desc[blockgroup];
 	size_t index = (new_inode - 1) % superblock->inodes_per_group;
 
-	// Write inode data into the inode table of this block group
+	// Write inode data into the inode table of this block group; the
+	// space after it may hold the fields of a freed inode
 	write_inode(new_inode, inode_data);
+	init_extra_inode_space(new_inode);
 
 	// Set this bit in the bitmask
 	{
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		uint8_t *bitmap = cache->get(descriptor.inode_usage_bitmap_addr);
 
 		size_t byte = index / 8;
 		uint8_t bit = 1 << (index % 8);
 		assert((bitmap[byte] & bit) == 0);
 		bitmap[byte] |= bit;
-		res = ::pwrite(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		cache->mark_dirty(descriptor.inode_usage_bitmap_addr);
 	}
 
 	assert(descriptor.num_unallocated_inodes > 0);
@@ -914,21 +1736,16 @@ cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len,
 		descriptor.num_directories += 1;
 	}
 	superblock->num_unallocated_inodes -= 1;
-
-	// Write updated block group descriptor
-	pwrite_partial(blockdev, block_group_desc, &descriptor, sizeof(descriptor), block_group_desc_offset);
-
-	// Write updated superblock
-	pwrite_partial(blockdev, superblock, int(0), sizeof(ext2_superblock), superblock_offset);
+	mark_counters_dirty(blockgroup);
 
 	// Add an entry into the directory
-	add_entry_into_directory(directory, filename, new_inode);
+	add_entry_into_directory(directory, filename, new_inode, type);
 
 	if(type == CLOUDABI_FILETYPE_DIRECTORY) {
 		auto new_directory = get_file_entry_from_inode(new_inode);
 		assert(new_directory->type == CLOUDABI_FILETYPE_DIRECTORY);
-		add_entry_into_directory(new_directory, ".", new_inode);
-		add_entry_into_directory(new_directory, "..", directory->inode);
+		add_entry_into_directory(new_directory, ".", new_inode, CLOUDABI_FILETYPE_DIRECTORY);
+		add_entry_into_directory(new_directory, "..", directory->inode, CLOUDABI_FILETYPE_DIRECTORY);
 
 		directory->inode_data.nlink += 1;
 	}
@@ -941,11 +1758,22 @@ cloudabi_inode_t extfs::create(pseudofd_t pseudo, const char *file, size_t len,
 
 void extfs::close(pseudofd_t pseudo)
 {
-	auto it = pseudo_fds.find(pseudo);
-	if(it != pseudo_fds.end()) {
+	pseudo_fd_ptr pseudo_fd;
+	{
+		std::lock_guard<std::mutex> lock(entries_mtx);
+		auto it = pseudo_fds.find(pseudo);
+		if(it == pseudo_fds.end()) {
+			throw cloudabi_system_error(EBADF);
+		}
+		pseudo_fd = std::move(it->second);
 		pseudo_fds.erase(it);
-	} else {
-		throw cloudabi_system_error(EBADF);
+	}
+	bool written = pseudo_fd->written;
+	// this may drop the last reference to an unlinked file, freeing it,
+	// which takes the metadata lock, so entries_mtx mustn't be held
+	pseudo_fd.reset();
+	if(written) {
+		write_back();
 	}
 }
 
@@ -966,40 +1794,62 @@ size_t extfs::pread(file_entry_ptr entry, off_t offset, char *dest, size_t reque
 		requested = size - offset;
 	}
 
-	ext2_block_iterator it(blockdev, block_size, entry->inode_data);
-
-	size_t block_skip = offset / block_size;
-	offset %= block_size;
-
-	// Skip blocks we don't need to pread
-	for(; block_skip > 0; ++it, --block_skip) {
-		assert(it != ext2_block_iterator());
-	}
+	size_t block = offset / block_size;
+	size_t in_block = offset % block_size;
 
 	size_t read = 0;
-	// Read block-by-block, since they may not be in the same location on the disk
-	// TODO: could optimize this by checking if the disk data is contiguous
-	for(; it != ext2_block_iterator() && read < requested; ++it) {
-		auto datablock = *it;
+	// Read every run of blocks that is contiguous on the disk with a single
+	// request. Whole blocks are read straight into dest; only a partial
+	// first or last block goes through a bounce buffer. Only finding the
+	// run needs the metadata lock; the caller holds the file lock.
+	while(read < requested) {
 		size_t remaining = requested - read;
+		uint32_t first;
+		bool unwritten;
+		size_t run;
+		{
+			std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+			run = contiguous_run(entry, block, (in_block + remaining + block_size - 1) / block_size, first, unwritten);
+		}
+		if(run == 0) {
+			break;
+		}
 
-		if(offset == 0 && remaining > size_t(block_size)) {
-			// Copy directly into dest
-			ssize_t res = ::pread(blockdev, dest + read, block_size, block_size * datablock);
-			check_ssize(res, block_size);
-			read += block_size;
-		} else {
-			// Partial block copy
-			char contents[block_size];
-			ssize_t res = ::pread(blockdev, contents, block_size, block_size * datablock);
-			check_ssize(res, block_size);
+		run_layout layout(run, in_block, remaining, block_size);
+		if(unwritten) {
+			memset(dest + read, 0, layout.length);
+			read += layout.length;
+			block += run;
+			in_block = 0;
+			continue;
+		}
+
+		char head[block_size];
+		char tail[block_size];
+		struct iovec iov[3];
+		int iovcnt = 0;
+		if(layout.partial_head) {
+			iov[iovcnt++] = {head, block_size};
+		}
+		if(layout.middle_blocks > 0) {
+			iov[iovcnt++] = {dest + read + layout.middle_offset, layout.middle_blocks * block_size};
+		}
+		if(layout.partial_tail) {
+			iov[iovcnt++] = {tail, block_size};
+		}
+
+		ssize_t res = ::preadv(blockdev, iov, iovcnt, off_t(first) * block_size);
+		check_ssize(res, run * block_size);
 
-			size_t to_copy = std::min(remaining, block_size - size_t(offset));
-			memcpy(dest + read, &contents[offset], to_copy);
-			read += to_copy;
-			assert(offset < block_size);
-			offset = 0;
+		if(layout.partial_head) {
+			memcpy(dest + read, head + in_block, layout.head_length);
+		}
+		if(layout.partial_tail) {
+			memcpy(dest + read + layout.tail_offset, tail, layout.tail_length);
 		}
+		read += layout.length;
+		block += run;
+		in_block = 0;
 	}
 	assert(read <= requested);
 	return read;
@@ -1014,8 +1864,11 @@ size_t extfs::pread(pseudofd_t pseudo, off_t offset, char *dest, size_t requeste
 		throw cloudabi_system_error(EBADF);
 	}
 
-	entry->inode_data.atime = time(nullptr);
-	write_inode(entry->inode, entry->inode_data);
+	std::shared_lock<std::shared_mutex> file_lock(entry->rwlock);
+	{
+		std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+		update_atime(entry);
+	}
 
 	return pread(entry, offset, dest, requested);
 }
@@ -1030,75 +1883,117 @@ void extfs::pwrite(file_entry_ptr entry, off_t offset, const char *buf, size_t r
 	size_t data_end = offset + requested;
 	if(data_end > size) {
 		// Make sure we have enough blocks for the file to contain data_end
-		allocate(entry, data_end);
+		std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+		allocate(entry, data_end, offset, data_end);
 		entry->inode_data.ctime = entry->inode_data.mtime = time(nullptr);
 		write_inode(entry->inode, entry->inode_data);
 		size = data_end;
 	}
 
-	size_t block_skip = offset / block_size;
-	offset %= block_size;
-	ext2_block_iterator it(blockdev, block_size, entry->inode_data);
-	assert(it != ext2_block_iterator());
-
-	// Skip blocks we don't need to pwrite
-	for(; block_skip > 0; ++it, --block_skip) {
-		assert(it != ext2_block_iterator());
-	}
+	size_t block = offset / block_size;
+	size_t in_block = offset % block_size;
 
 	size_t wrote = 0;
-	// Write block-by-block, since they may not be in the same location on the disk
-	// TODO: could optimize this by checking if the disk data is contiguous
-	for(; it != ext2_block_iterator() && wrote < requested; ++it) {
-		auto datablock = *it;
+	// Write every run of blocks that is contiguous on the disk with a single
+	// request, like pread() does. A partial first or last block is read
+	// first, so the rest of it is preserved.
+	while(wrote < requested) {
 		size_t remaining = requested - wrote;
+		uint32_t first;
+		bool unwritten;
+		size_t run;
+		{
+			std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+			run = contiguous_run(entry, block, (in_block + remaining + block_size - 1) / block_size, first, unwritten);
+			if(run != 0 && unwritten) {
+				mark_extent_written(entry, block, run);
+				continue;
+			}
+		}
+		if(run == 0) {
+			break;
+		}
 
-		if(offset == 0 && remaining > size_t(block_size)) {
-			// Write directly from buf since we write a full block
-			ssize_t res = ::pwrite(blockdev, buf + wrote, block_size, block_size * datablock);
+		char head[block_size];
+		char tail[block_size];
+		struct iovec iov[3];
+		run_layout layout(run, in_block, remaining, block_size);
+		int iovcnt = 0;
+		if(layout.partial_head) {
+			ssize_t res = ::pread(blockdev, head, block_size, off_t(first) * block_size);
 			check_ssize(res, block_size);
-			wrote += block_size;
-		} else {
-			// Overwrite buffer partially
-			char contents[block_size];
-			ssize_t res = ::pread(blockdev, contents, block_size, block_size * datablock);
+			memcpy(head + in_block, buf + wrote, layout.head_length);
+			iov[iovcnt++] = {head, block_size};
+		}
+		if(layout.middle_blocks > 0) {
+			iov[iovcnt++] = {const_cast<char*>(buf) + wrote + layout.middle_offset, layout.middle_blocks * block_size};
+		}
+		if(layout.partial_tail) {
+			ssize_t res = ::pread(blockdev, tail, block_size, off_t(first + run - 1) * block_size);
 			check_ssize(res, block_size);
+			memcpy(tail, buf + wrote + layout.tail_offset, layout.tail_length);
+			iov[iovcnt++] = {tail, block_size};
+		}
 
-			size_t to_copy = std::min(remaining, block_size - size_t(offset));
-			memcpy(contents + offset, buf + wrote, to_copy);
+		ssize_t res = ::pwritev(blockdev, iov, iovcnt, off_t(first) * block_size);
+		check_ssize(res, run * block_size);
 
-			res = ::pwrite(blockdev, contents, block_size, block_size * datablock);
-			check_ssize(res, block_size);
-			wrote += to_copy;
-			offset = 0;
-		}
+		wrote += layout.length;
+		block += run;
+		in_block = 0;
 	}
 	assert(wrote == requested);
 }
 
 void extfs::pwrite(pseudofd_t pseudo, off_t offset, const char *buf, size_t length)
 {
-	auto entry = get_file_entry_from_pseudo(pseudo);
+	pseudo_fd_ptr pseudo_fd = get_pseudo_fd(pseudo);
+	auto entry = pseudo_fd->file;
 
 	if(entry->type != CLOUDABI_FILETYPE_REGULAR_FILE) {
 		// Don't perform writes on non-files through the extfs
 		throw cloudabi_system_error(EBADF);
 	}
 
-	entry->inode_data.ctime = time(nullptr);
-	write_inode(entry->inode, entry->inode_data);
+	std::unique_lock<std::shared_mutex> file_lock(entry->rwlock);
+	pseudo_fd->written = true;
+	{
+		std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+		entry->inode_data.ctime = time(nullptr);
+		write_inode(entry->inode, entry->inode_data);
+	}
 
-	return pwrite(entry, offset, buf, length);
+	pwrite(entry, offset, buf, length);
+	invalidate_other_pseudos(entry, pseudo);
 }
 
 void extfs::datasync(pseudofd_t)
 {
-	// there's nothing to sync
+	// file contents are written directly, but the metadata needed to
+	// find them back may still be in memory
+	write_back();
 }
 
 void extfs::sync(pseudofd_t)
 {
-	// there's nothing to sync
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	write_back();
+}
+
+bool extfs::has_dirty_metadata() const
+{
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	return superblock_dirty || dirty_groups_begin < dirty_groups_end || cache->dirty_blocks() > 0;
+}
+
+void extfs::write_back()
+{
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	// Bitmaps and inode tables are written before the counters that
+	// describe them. The block device writes synchronously, so once this
+	// returns, the metadata is durable.
+	cache->flush();
+	write_counters();
 }
 
 bool extfs::readdir(file_entry_ptr directory, bool get_type, std::function<bool(cloudabi_dirent_t, std::string name, file_entry_ptr)> per_entry)
@@ -1109,12 +2004,12 @@ bool extfs::readdir(file_entry_ptr directory, bool get_type, std::function<bool(
 
 	bool continue_reading = true;
 
-	ext2_block_iterator it(blockdev, block_size, directory->inode_data);
+	ext2_block_iterator it(*cache, block_size, directory->inode_data);
 	for(; it != ext2_block_iterator(); ++it) {
 		auto datablock = *it;
+		// per_entry may use the cache, so work on a copy of the block
 		char dircontents[block_size];
-		ssize_t res = ::pread(blockdev, dircontents, block_size, block_size * datablock);
-		check_ssize(res, sizeof(dircontents));
+		memcpy(dircontents, cache->get(datablock), block_size);
 
 		char *ci = dircontents;
 		auto entry = reinterpret_cast<ext2_direntry*>(ci);
@@ -1134,9 +2029,7 @@ bool extfs::readdir(file_entry_ptr directory, bool get_type, std::function<bool(
 			cloudabi_dirent_t dirent;
 			dirent.d_next = 0;
 			dirent.d_ino = entry->inode;
-			dirent.d_namlen = entry->namelen1;
-			// TODO: if "directories have type byte" feature is set, write this differently
-			dirent.d_namlen += (entry->type_or_namelen2 << 8);
+			dirent.d_namlen = direntry_namelen(entry);
 			dirent.d_type = 0;
 
 			assert(entry->size_of_entry >= sizeof(ext2_direntry) + dirent.d_namlen);
@@ -1172,13 +2065,13 @@ bool extfs::readdir(file_entry_ptr directory, bool get_type, std::function<bool(
  */
 size_t extfs::readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie)
 {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	auto directory = get_file_entry_from_pseudo(pseudo);
 	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
 		throw cloudabi_system_error(ENOTDIR);
 	}
 
-	directory->inode_data.atime = time(nullptr);
-	write_inode(directory->inode, directory->inode_data);
+	update_atime(directory);
 
 	cloudabi_dircookie_t skipped_entries = 0;
 	size_t copied = 0;
@@ -1196,7 +2089,7 @@ size_t extfs::readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_d
 			memcpy(buffer + copied, &dirent, to_copy);
 			copied += to_copy;
 			if(buflen > copied) {
-				to_copy = std::min(dirent.d_namlen, buflen - copied);
+				to_copy = std::min<size_t>(dirent.d_namlen, buflen - copied);
 				memcpy(buffer + copied, name.c_str(), to_copy);
 				copied += to_copy;
 			}
@@ -1219,7 +2112,69 @@ size_t extfs::readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_d
 	return copied;
 }
 
+/**
+ * Like readdir(), but writes a cloudabi_filestat_t for every entry after its
+ * dirent, and only writes whole records.
+ */
+size_t extfs::readdirplus(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie)
+{
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	auto directory = get_file_entry_from_pseudo(pseudo);
+	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
+		throw cloudabi_system_error(ENOTDIR);
+	}
+
+	update_atime(directory);
+
+	cloudabi_dircookie_t skipped_entries = 0;
+	size_t copied = 0;
+	bool buffer_full = false;
+
+	bool more_entries = readdir(directory, true, [&](cloudabi_dirent_t dirent, std::string name, file_entry_ptr entry) -> bool {
+		if(skipped_entries++ != cookie) {
+			return true;
+		}
+
+		size_t record_size = sizeof(cloudabi_dirent_t) + sizeof(cloudabi_filestat_t) + dirent.d_namlen;
+		if(buflen - copied < record_size) {
+			buffer_full = true;
+			return false;
+		}
+
+		cloudabi_filestat_t stat;
+		memset(&stat, 0, sizeof(stat));
+		if(entry) {
+			file_entry_to_filestat(entry, &stat);
+		}
+		// if the inode could not be read, st_ino stays 0 so the entry
+		// isn't cached
+
+		dirent.d_next = cookie + 1;
+		memcpy(buffer + copied, &dirent, sizeof(dirent));
+		copied += sizeof(dirent);
+		memcpy(buffer + copied, &stat, sizeof(stat));
+		copied += sizeof(stat);
+		memcpy(buffer + copied, name.c_str(), dirent.d_namlen);
+		copied += dirent.d_namlen;
+
+		cookie++;
+		return true;
+	});
+
+	if(buffer_full && copied == 0) {
+		// not even one record fits; returning nothing would look like
+		// the end of the directory
+		throw cloudabi_system_error(ENOBUFS);
+	}
+	if(!more_entries && !buffer_full) {
+		// We're at the end of the directory, make cookie 0 again
+		cookie = 0;
+	}
+	return copied;
+}
+
 void extfs::stat_fget(pseudofd_t pseudo, cloudabi_filestat_t *buf) {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	file_entry_ptr entry = get_file_entry_from_pseudo(pseudo);
 	file_entry_to_filestat(entry, buf);
 }
@@ -1245,7 +2200,7 @@ void extfs::update_file_entry_stat(file_entry_ptr entry, const cloudabi_filestat
 			entry->inode_data.size1 = new_size & 0xffffffff;
 			entry->inode_data.size2_or_dir_acl_blockptr = (new_size >> 32) & 0xffffffff;
 
-			ext2_block_iterator it(blockdev, block_size, entry->inode_data);
+			ext2_block_iterator it(*cache, block_size, entry->inode_data);
 			// Go to the first block that isn't entirely allocated anymore
 			for (; it != ext2_block_iterator() && new_size > block_size; ++it) {
 				new_size -= block_size;
@@ -1292,27 +2247,51 @@ void extfs::update_file_entry_stat(file_entry_ptr entry, const cloudabi_filestat
 }
 
 void extfs::stat_fput(pseudofd_t pseudo, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) {
-	file_entry_ptr entry = get_file_entry_from_pseudo(pseudo);
+	pseudo_fd_ptr pseudo_fd = get_pseudo_fd(pseudo);
+	file_entry_ptr entry = pseudo_fd->file;
+	// resizing the file waits for reads and writes of it
+	std::unique_lock<std::shared_mutex> file_lock(entry->rwlock);
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	pseudo_fd->written = true;
 	update_file_entry_stat(entry, buf, fsflags);
+	if(fsflags & CLOUDABI_FILESTAT_SIZE) {
+		invalidate_other_pseudos(entry, pseudo);
+	}
 }
 
 void extfs::stat_put(pseudofd_t pseudo, cloudabi_lookupflags_t lookupflags, const char *file, size_t filelen, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) {
-	auto entry = lookup(pseudo, file, filelen, 0, NULL);
-	auto entry_ptr = get_file_entry_from_inode(entry.inode);
+	file_entry_ptr entry_ptr;
+	{
+		std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+		auto entry = lookup(pseudo, file, filelen, 0, NULL);
+		entry_ptr = get_file_entry_from_inode(entry.inode);
+	}
 
+	// the file lock must be taken before the metadata lock
+	std::unique_lock<std::shared_mutex> file_lock(entry_ptr->rwlock);
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	update_file_entry_stat(entry_ptr, buf, fsflags);
+	if(fsflags & CLOUDABI_FILESTAT_SIZE) {
+		invalidate_other_pseudos(entry_ptr, 0);
+	}
 }
 
 file_entry_ptr extfs::get_file_entry_from_inode(cloudabi_inode_t inode)
 {
 	assert(inode > 0 /* invalid inode value */);
-	auto it = open_inodes.find(inode);
-	if(it != open_inodes.end()) {
-		auto weakptr = it->second;
-		auto sharedptr = weakptr.lock();
-		if(sharedptr) {
-			// already open, return it!
-			return sharedptr;
+	// the inode is read through the cache; holding the metadata lock also
+	// keeps others from opening the same inode in the meantime
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
+	{
+		std::lock_guard<std::mutex> entries_lock(entries_mtx);
+		auto it = open_inodes.find(inode);
+		if(it != open_inodes.end()) {
+			auto weakptr = it->second;
+			auto sharedptr = weakptr.lock();
+			if(sharedptr) {
+				// already open, return it!
+				return sharedptr;
+			}
 		}
 	}
 
@@ -1324,9 +2303,7 @@ file_entry_ptr extfs::get_file_entry_from_inode(cloudabi_inode_t inode)
 
 	// Check in the bitmap table whether this inode exists
 	{
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		uint8_t *bitmap = cache->get(descriptor.inode_usage_bitmap_addr);
 
 		size_t byte = index / 8;
 		uint8_t bit = 1 << (index % 8);
@@ -1335,22 +2312,13 @@ file_entry_ptr extfs::get_file_entry_from_inode(cloudabi_inode_t inode)
 		}
 	}
 
-	// TODO: we should not use sizeof(ext2_inode) but instead superblock->inode_size; for now
-	// we assume the two are the same
-	assert(sizeof(ext2_inode) == superblock->inode_size);
-
-	// read a block of inode data
-	size_t inodes_per_block = block_size / sizeof(ext2_inode);
-	size_t inode_block = index / inodes_per_block;
-	size_t index_in_block = index % inodes_per_block;
-
-	ext2_inode block_inodes[(block_size / sizeof(ext2_inode)) + 1];
-	ssize_t res = ::pread(blockdev, block_inodes, block_size, block_size * (descriptor.inode_table_addr + inode_block));
-	check_ssize(res, block_size);
-
-	assert(index_in_block < (sizeof(block_inodes) / sizeof(ext2_inode)));
-	auto &inode_data = block_inodes[index_in_block];
+	size_t offset_in_block;
+	uint32_t inode_block = inode_location(inode, offset_in_block);
+	ext2_inode inode_data;
+	memcpy(&inode_data, cache->get(inode_block) + offset_in_block, sizeof(ext2_inode));
 	file_entry_ptr entry = std::make_shared<extfs_file_entry>(this, inode, device, inode_data);
+	// without any better hint, put the blocks of a file in its inode's group
+	entry->allocation_goal = first_block + blockgroup * superblock->blocks_per_group;
 
 	auto type = entry->inode_data.type_and_permissions & 0xf000;
 	if(type == 0x2000) {
@@ -1372,21 +2340,29 @@ file_entry_ptr extfs::get_file_entry_from_inode(cloudabi_inode_t inode)
 	// extfs_file_entry objects may point at the same file entry; this
 	// allows a number of failure modes such as a double deallocation of
 	// the inode from the filesystem
+	std::lock_guard<std::mutex> entries_lock(entries_mtx);
 	open_inodes[inode] = entry;
 	return entry;
 }
 
 file_entry_ptr extfs::get_file_entry_from_pseudo(pseudofd_t pseudo)
 {
+	return get_pseudo_fd(pseudo)->file;
+}
+
+pseudo_fd_ptr extfs::get_pseudo_fd(pseudofd_t pseudo)
+{
+	std::lock_guard<std::mutex> lock(entries_mtx);
 	auto it = pseudo_fds.find(pseudo);
 	if(it != pseudo_fds.end()) {
-		return it->second->file;
+		return it->second;
 	} else {
 		throw cloudabi_system_error(EBADF);
 	}
 }
 
 bool extfs::is_readable(pseudofd_t pseudo, size_t &nbytes, bool &hangup) {
+	std::lock_guard<std::recursive_mutex> lock(metadata_mtx);
 	auto entry = get_file_entry_from_pseudo(pseudo);
 
 	if(entry->type != CLOUDABI_FILETYPE_REGULAR_FILE) {
@@ -1402,6 +2378,40 @@ bool extfs::is_readable(pseudofd_t pseudo, size_t &nbytes, bool &hangup) {
 	return true;
 }
 
+group_bitmap &extfs::get_block_bitmap(size_t group) {
+	assert(group < number_of_block_groups);
+	auto &bitmap = block_bitmaps[group];
+	if(!bitmap) {
+		size_t blocks_in_group = superblock->blocks_per_group;
+		if(group == number_of_block_groups - 1) {
+			blocks_in_group = std::min(blocks_in_group,
+				superblock->num_blocks - first_block - group * superblock->blocks_per_group);
+		}
+		bitmap.reset(new group_bitmap(cache->get(block_group_desc[group].block_usage_bitmap_addr), blocks_in_group));
+	}
+	return *bitmap;
+}
+
+void extfs::mark_counters_dirty(size_t group) {
+	dirty_groups_begin = std::min(dirty_groups_begin, group);
+	dirty_groups_end = std::max(dirty_groups_end, group + 1);
+	superblock_dirty = true;
+}
+
+void extfs::write_counters() {
+	if(dirty_groups_begin < dirty_groups_end) {
+		pwrite_partial(blockdev, block_group_desc, &block_group_desc[dirty_groups_begin],
+			(dirty_groups_end - dirty_groups_begin) * sizeof(ext2_block_group_descriptor),
+			block_group_desc_offset);
+		dirty_groups_begin = SIZE_MAX;
+		dirty_groups_end = 0;
+	}
+	if(superblock_dirty) {
+		pwrite_partial(blockdev, superblock, int(0), sizeof(ext2_superblock), superblock_offset);
+		superblock_dirty = false;
+	}
+}
+
 void extfs::deallocate_block(size_t b) {
 	size_t blockgroup = (b - first_block) / superblock->blocks_per_group;
 	size_t block = (b - first_block) % superblock->blocks_per_group;
@@ -1409,305 +2419,789 @@ void extfs::deallocate_block(size_t b) {
 	// Unset this bit in the bitmask
 	assert(blockgroup < number_of_block_groups);
 	auto &descriptor = block_group_desc[blockgroup];
+	if(block_bitmaps[blockgroup]) {
+		block_bitmaps[blockgroup]->clear(block);
+	}
 	{
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.block_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		uint8_t *bitmap = cache->get(descriptor.block_usage_bitmap_addr);
 
 		size_t byte = block / 8;
 		uint8_t bit = 1 << (block % 8);
 		assert((bitmap[byte] & bit) != 0);
 		bitmap[byte] &= ~bit;
-		res = ::pwrite(blockdev, bitmap, block_size, block_size * descriptor.block_usage_bitmap_addr);
-		check_ssize(res, block_size);
+		cache->mark_dirty(descriptor.block_usage_bitmap_addr);
 	}
 
+	// A cached copy of the block must not be written back once the block
+	// is reused
+	cache->forget(b);
+
 	assert(descriptor.num_unallocated_blocks < superblock->blocks_per_group);
 	assert(superblock->num_unallocated_blocks < superblock->num_blocks);
 	descriptor.num_unallocated_blocks += 1;
 	superblock->num_unallocated_blocks += 1;
-
-	// Write updated block group descriptor
-	pwrite_partial(blockdev, block_group_desc, &descriptor, sizeof(descriptor), block_group_desc_offset);
-
-	// Write updated superblock
-	pwrite_partial(blockdev, superblock, int(0), sizeof(ext2_superblock), superblock_offset);
+	mark_counters_dirty(blockgroup);
 }
 
-size_t extfs::allocate_block() {
-	// TODO: is it OK to take blocks from a different block group? I guess so, otherwise
-	// that would provide an arbitrary limit on files in a block group
-
-	// TODO: a search from the first block group may be slow, because quickly the first
-	// block groups will be filled up. Perhaps start with the block group the inode is
-	// in, but allow looping around to 0.
-
-	bool free_block_found = false;
-	size_t blockgroup = 0;
-	size_t block = 0;
-
+size_t extfs::reserve_blocks(size_t goal, size_t &count) {
+	assert(count > 0);
 	// if the next is untrue, the bitmap would span more than one block
 	assert(superblock->blocks_per_group <= uint64_t(8 * block_size));
 
-	for(blockgroup = 0; blockgroup < number_of_block_groups; ++blockgroup) {
-		auto &descriptor = block_group_desc[blockgroup];
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.block_usage_bitmap_addr);
-		check_ssize(res, block_size);
+	size_t blocks_per_group = superblock->blocks_per_group;
+	size_t goal_group = 0;
+	size_t goal_bit = 0;
+	if(goal >= first_block && goal < superblock->num_blocks) {
+		goal_group = (goal - first_block) / blocks_per_group;
+		goal_bit = (goal - first_block) % blocks_per_group;
+	}
+
+	// Start looking at the goal, and continue with the following groups,
+	// wrapping around to group 0. Within a group, prefer a free run that
+	// is long enough over the first free block, but don't search forever.
+	for(size_t i = 0; i < number_of_block_groups; ++i) {
+		size_t group = (goal_group + i) % number_of_block_groups;
+		if(block_group_desc[group].num_unallocated_blocks == 0) {
+			// don't bother reading the bitmap of a full group
+			continue;
+		}
+		auto &bitmap = get_block_bitmap(group);
+		if(bitmap.free_bits() == 0) {
+			continue;
+		}
 
-		// find an unused block in this bitmap
-		for(size_t i = 0; i < size_t(block_size); ++i) {
-			if(bitmap[i] == 0xff) {
-				continue;
+		size_t best_bit = group_bitmap::npos;
+		size_t best_run = 0;
+		size_t bit = bitmap.find_free(i == 0 ? goal_bit : 0);
+		for(int attempt = 0; attempt < 16 && bit != group_bitmap::npos; ++attempt) {
+			size_t run = bitmap.free_run(bit, count);
+			if(run > best_run) {
+				best_bit = bit;
+				best_run = run;
 			}
-			for(int j = 0; j < 8; ++j) {
-				if(~bitmap[i] & (1 << j)) {
-					// free block found
-					block = i * 8 + j + first_block /* offset of the first block group */;
-					free_block_found = true;
-					break;
-				}
+			if(run == count) {
+				break;
 			}
-			if(free_block_found) {
+			bit = bitmap.find_free(bit + run);
+			if(bit == best_bit) {
+				// wrapped around
 				break;
 			}
 		}
 
-		if(free_block_found) {
-			break;
-		}
+		assert(best_bit != group_bitmap::npos);
+		bitmap.set(best_bit, best_run);
+		count = best_run;
+		return first_block + group * blocks_per_group + best_bit;
 	}
 
-	if(!free_block_found) {
-		throw cloudabi_system_error(ENOSPC);
-	}
+	throw cloudabi_system_error(ENOSPC);
+}
 
-	// Set this bit in the bitmask
+void extfs::unreserve_blocks(size_t block, size_t count) {
+	size_t blockgroup = (block - first_block) / superblock->blocks_per_group;
+	get_block_bitmap(blockgroup).clear((block - first_block) % superblock->blocks_per_group, count);
+}
+
+void extfs::commit_block(size_t b) {
+	size_t blockgroup = (b - first_block) / superblock->blocks_per_group;
+	size_t block = (b - first_block) % superblock->blocks_per_group;
 	assert(blockgroup < number_of_block_groups);
+	assert(get_block_bitmap(blockgroup).test(block));
+
 	auto &descriptor = block_group_desc[blockgroup];
-	{
-		uint8_t bitmap[block_size];
-		ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.block_usage_bitmap_addr);
-		check_ssize(res, block_size);
+	uint8_t *bitmap = cache->get(descriptor.block_usage_bitmap_addr);
+	size_t byte = block / 8;
+	uint8_t bit = 1 << (block % 8);
+	assert((bitmap[byte] & bit) == 0);
+	bitmap[byte] |= bit;
+	cache->mark_dirty(descriptor.block_usage_bitmap_addr);
 
-		size_t byte = (block - 1) / 8;
-		uint8_t bit = 1 << ((block - 1) % 8);
-		assert((bitmap[byte] & bit) == 0);
-		bitmap[byte] |= bit;
-		res = ::pwrite(blockdev, bitmap, block_size, block_size * descriptor.block_usage_bitmap_addr);
-		check_ssize(res, block_size);
-	}
+	// A stale cached copy of the block must not be written back over it
+	cache->forget(b);
 
 	assert(descriptor.num_unallocated_blocks > 0);
 	assert(superblock->num_unallocated_blocks > 0);
 	descriptor.num_unallocated_blocks -= 1;
 	superblock->num_unallocated_blocks -= 1;
+	mark_counters_dirty(blockgroup);
+}
 
-	// Overwrite block with zeroes
-	block += blockgroup * superblock->blocks_per_group;
-	char zeroes[block_size];
-	memset(zeroes, 0, block_size);
-	ssize_t res = ::pwrite(blockdev, zeroes, block_size, block_size * block);
-	check_ssize(res, block_size);
-
-	// Write updated block group descriptor
-	pwrite_partial(blockdev, block_group_desc, &descriptor, sizeof(descriptor), block_group_desc_offset);
+size_t extfs::allocate_block(size_t goal) {
+	size_t count = 1;
+	size_t block = reserve_blocks(goal, count);
+	commit_block(block);
+	return block;
+}
 
-	// Write updated superblock
-	pwrite_partial(blockdev, superblock, int(0), sizeof(ext2_superblock), superblock_offset);
+size_t extfs::allocate_file_block(extfs_file_entry &entry, size_t wanted) {
+	if(entry.prealloc_count == 0) {
+		// Regular files get a window of extra blocks, so that the next
+		// blocks of the file end up right after this one
+		size_t count = wanted;
+		if(entry.type == CLOUDABI_FILETYPE_REGULAR_FILE) {
+			count = std::min(std::max(wanted, PREALLOCATE_BLOCKS), MAX_RESERVATION);
+		}
+		entry.prealloc_start = reserve_blocks(entry.allocation_goal, count);
+		entry.prealloc_count = count;
+	}
 
+	size_t block = entry.prealloc_start++;
+	entry.prealloc_count--;
+	commit_block(block);
+	entry.allocation_goal = block + 1;
 	return block;
 }
 
-void extfs::write_inode(cloudabi_inode_t inode, ext2_inode &inode_data) {
+void extfs::release_preallocation(extfs_file_entry &entry) {
+	if(entry.prealloc_count > 0) {
+		unreserve_blocks(entry.prealloc_start, entry.prealloc_count);
+		entry.prealloc_count = 0;
+	}
+}
+
+void extfs::zero_blocks(std::vector<uint32_t> const &blocks) {
+	char zeroes[block_size];
+	memset(zeroes, 0, block_size);
+	const size_t max_iov = 16;
+	struct iovec iov[max_iov];
+	for(size_t i = 0; i < max_iov; ++i) {
+		iov[i] = {zeroes, block_size};
+	}
+
+	// one request per run of contiguous blocks
+	size_t i = 0;
+	while(i < blocks.size()) {
+		size_t run = 1;
+		while(run < max_iov && i + run < blocks.size() && blocks[i + run] == blocks[i] + run) {
+			++run;
+		}
+		ssize_t res = ::pwritev(blockdev, iov, run, off_t(blocks[i]) * block_size);
+		check_ssize(res, run * block_size);
+		i += run;
+	}
+}
+
+void extfs::update_atime(file_entry_ptr const &entry) {
+	if(atime == atime_update::never) {
+		return;
+	}
+	auto &idata = entry->inode_data;
+	uint32_t now = time(nullptr);
+	if(atime == atime_update::relative && idata.atime > idata.mtime
+	&& idata.atime > idata.ctime && now - idata.atime < 24 * 60 * 60) {
+		return;
+	}
+	if(idata.atime == now) {
+		// don't dirty the inode table for nothing
+		return;
+	}
+	idata.atime = now;
+	write_inode(entry->inode, idata);
+}
+
+uint32_t extfs::inode_location(cloudabi_inode_t inode, size_t &offset_in_block) {
 	size_t blockgroup = (inode - 1) / superblock->inodes_per_group;
 	assert(blockgroup < number_of_block_groups);
 	auto &descriptor = block_group_desc[blockgroup];
 	size_t index = (inode - 1) % superblock->inodes_per_group;
 
-	// TODO: we should not use sizeof(ext2_inode) but instead superblock->inode_size; for now
-	// we assume the two are the same
-	assert(sizeof(ext2_inode) == superblock->inode_size);
+	size_t inodes_per_block = block_size / superblock->inode_size;
+	offset_in_block = (index % inodes_per_block) * superblock->inode_size;
+	return descriptor.inode_table_addr + index / inodes_per_block;
+}
+
+void extfs::write_inode(cloudabi_inode_t inode, ext2_inode &inode_data) {
+	size_t offset_in_block;
+	uint32_t inode_block = inode_location(inode, offset_in_block);
+	memcpy(cache->get(inode_block) + offset_in_block, &inode_data, sizeof(ext2_inode));
+	cache->mark_dirty(inode_block);
+}
 
-	size_t inodes_per_block = block_size / sizeof(ext2_inode);
-	size_t inode_block = index / inodes_per_block;
-	size_t index_in_block = index % inodes_per_block;
+void extfs::init_extra_inode_space(cloudabi_inode_t inode) {
+	size_t extra_space = superblock->inode_size - sizeof(ext2_inode);
+	if(extra_space == 0) {
+		return;
+	}
+	size_t offset_in_block;
+	uint32_t inode_block = inode_location(inode, offset_in_block);
+	uint8_t *extra = cache->get(inode_block) + offset_in_block + sizeof(ext2_inode);
+	memset(extra, 0, extra_space);
+	// i_extra_isize, the size of the fields in use after ext2_inode; the
+	// fields themselves (high bits of the times, creation time) are zero
+	uint16_t extra_isize = superblock->want_extra_isize != 0
+		? superblock->want_extra_isize : EXT4_DEFAULT_EXTRA_ISIZE;
+	extra_isize = std::min<size_t>(extra_isize, extra_space);
+	memcpy(extra, &extra_isize, sizeof(extra_isize));
+	cache->mark_dirty(inode_block);
+}
 
-	ext2_inode block_inodes[(block_size / sizeof(ext2_inode)) + 1];
-	ssize_t res = ::pread(blockdev, block_inodes, block_size, block_size * (descriptor.inode_table_addr + inode_block));
-	check_ssize(res, block_size);
+cloudabi_inode_t extfs::find_entry(file_entry_ptr const &directory, std::string const &name) {
+	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
+		throw cloudabi_system_error(ENOTDIR);
+	}
 
-	assert(sizeof(block_inodes[0]) * (index_in_block + 1) <= sizeof(block_inodes));
-	block_inodes[index_in_block] = inode_data;
+	if(name == "." || name == "..") {
+		// these are always in the first block, also in indexed directories
+		uint32_t physical = map_block(directory, 0);
+		return physical == 0 ? 0 : find_in_block(cache->get(physical), block_size, name);
+	}
 
-	pwrite_partial(blockdev, block_inodes, block_inodes + index_in_block, sizeof(ext2_inode), block_size * (descriptor.inode_table_addr + inode_block));
+	if(is_indexed(directory)) {
+		cloudabi_inode_t inode;
+		if(dx_find_entry(directory, name, inode)) {
+			return inode;
+		}
+		// the index can't be used, fall back to the names in memory
+	}
+
+	load_directory_names(directory);
+	auto it = directory->names->find(name);
+	return it == directory->names->end() ? 0 : it->second.inode;
 }
 
-void extfs::add_entry_into_directory(file_entry_ptr directory, std::string filename, cloudabi_inode_t new_inode) {
-	assert(directory->type == CLOUDABI_FILETYPE_DIRECTORY);
+void extfs::load_directory_names(file_entry_ptr const &directory) {
+	if(directory->names) {
+		return;
+	}
 
-	size_t const max_filename_length = block_size - sizeof(ext2_direntry);
-	if(filename.size() > max_filename_length) {
-		filename.resize(max_filename_length);
+	std::unique_ptr<std::unordered_map<std::string, ext2_dir_name>> names(new std::unordered_map<std::string, ext2_dir_name>);
+	uint32_t logical = 0;
+	ext2_block_iterator it(*cache, block_size, directory->inode_data);
+	for(; it != ext2_block_iterator(); ++it, ++logical) {
+		for_each_direntry(cache->get(*it), block_size, [&](const ext2_direntry *entry) {
+			if(entry->inode != 0) {
+				std::string name(entry->name, direntry_namelen(entry));
+				(*names)[name] = ext2_dir_name{entry->inode, logical};
+			}
+		});
 	}
+	directory->names = std::move(names);
+}
 
-	size_t entry_size_needed = sizeof(ext2_direntry) + filename.size();
-	assert(entry_size_needed <= block_size);
+void extfs::read_dir_records(const uint8_t *block, uint8_t hash_version, std::vector<ext2_dir_record> &records) {
+	for_each_direntry(block, block_size, [&](const ext2_direntry *entry) {
+		if(entry->inode != 0) {
+			std::string name(entry->name, direntry_namelen(entry));
+			records.push_back(ext2_dir_record{dx_hash(name, hash_version), entry->inode, name, entry->type_or_namelen2});
+		}
+	});
+}
 
-	bool direntry_written = false;
-	ext2_block_iterator it(blockdev, block_size, directory->inode_data);
-	for(; it != ext2_block_iterator(); ++it) {
-		auto datablock = *it;
-		char dircontents[block_size];
-		ssize_t res = ::pread(blockdev, dircontents, block_size, block_size * datablock);
-		check_ssize(res, sizeof(dircontents));
+uint32_t extfs::add_directory_block(file_entry_ptr const &directory, uint32_t &physical) {
+	size_t logical = directory->inode_data.size1 / block_size;
+	ext2_block_iterator it(*cache, block_size, directory->inode_data, logical);
+	assert(it == ext2_block_iterator());
+	it.assign_new_block([&]() -> int {
+		return allocate_file_block(*directory, 1);
+	});
+	assert(it != ext2_block_iterator());
+	physical = *it;
 
-		char *ci = dircontents;
-		ext2_direntry *entry = nullptr;
-		for(; ci < dircontents + block_size; ci += entry->size_of_entry) {
-			entry = reinterpret_cast<ext2_direntry*>(ci);
-			// TODO: if "directories have type byte" feature is set, write this differently
+	directory->inode_data.size1 += block_size;
+	write_inode(directory->inode, directory->inode_data);
+	return logical;
+}
 
-			size_t actual_size = sizeof(ext2_direntry) + entry->namelen1;
-			actual_size += (entry->type_or_namelen2 << 8);
-			// Align to 4 bytes
-			if(actual_size % 4) {
-				actual_size += 4 - (actual_size % 4);
-			}
+bool extfs::is_indexed(file_entry_ptr const &directory) {
+	return (superblock->optional_features_present & EXT2_FEATURE_COMPAT_DIR_INDEX)
+		&& (directory->inode_data.flags & EXT2_INDEX_FL);
+}
+
+void extfs::clear_index(file_entry_ptr const &directory) {
+	// Adding entries without maintaining the index would make it wrong, so
+	// drop it, like ext2 drivers that don't know about the index do. The
+	// index blocks then read as empty directory blocks.
+	if(directory->inode_data.flags & EXT2_INDEX_FL) {
+		directory->inode_data.flags &= ~EXT2_INDEX_FL;
+		write_inode(directory->inode, directory->inode_data);
+	}
+}
+
+uint32_t extfs::dx_hash(std::string const &name, uint8_t hash_version) {
+	if(hash_version <= EXT2_HASH_TEA && (superblock->flags & EXT2_FLAGS_UNSIGNED_HASH)) {
+		hash_version += EXT2_HASH_LEGACY_UNSIGNED;
+	}
+	uint32_t seed[4];
+	memcpy(seed, superblock->hash_seed, sizeof(seed));
+	return ext2_dir_hash(name.data(), name.size(), hash_version, seed);
+}
+
+bool extfs::dx_probe(file_entry_ptr const &directory, std::string const &name, ext2_dx_path &path) {
+	path.frames.clear();
+
+	uint32_t physical = map_block(directory, 0);
+	if(physical == 0) {
+		return false;
+	}
+	auto *info = reinterpret_cast<ext2_dx_root_info*>(cache->get(physical) + EXT2_DX_ROOT_INFO_OFFSET);
+	if(info->reserved_zero != 0 || info->hash_version > EXT2_HASH_TEA
+	|| info->info_length < sizeof(ext2_dx_root_info) || info->indirect_levels > 1) {
+		// not an index we know, e.g. one with three levels
+		return false;
+	}
+	size_t levels = info->indirect_levels;
+	size_t entries_offset = EXT2_DX_ROOT_INFO_OFFSET + info->info_length;
+	path.hash_version = info->hash_version;
+	path.hash = dx_hash(name, path.hash_version);
+
+	uint32_t block = 0;
+	for(size_t level = 0; level <= levels; ++level) {
+		physical = map_block(directory, block);
+		if(physical == 0) {
+			return false;
+		}
+		uint8_t *node = cache->get(physical);
+		auto *countlimit = reinterpret_cast<ext2_dx_countlimit*>(node + entries_offset);
+		auto *entries = reinterpret_cast<ext2_dx_entry*>(node + entries_offset);
+		size_t count = countlimit->count;
+		if(count == 0 || count > countlimit->limit
+		|| entries_offset + countlimit->limit * sizeof(ext2_dx_entry) > block_size) {
+			return false;
+		}
 
-			if(entry->inode == 0 && entry->size_of_entry >= entry_size_needed) {
-				// cannibalize this entry
-				// TODO: does inode == 0 actually happen, or is the direntry just removed in that case?
-			} else if(entry->size_of_entry - actual_size >= entry_size_needed) {
-				// create an extra entry here
-				size_t new_entry_size = entry->size_of_entry - actual_size;
-
-				entry->size_of_entry = actual_size;
-				ci += entry->size_of_entry;
-				entry = reinterpret_cast<ext2_direntry*>(ci);
-				entry->size_of_entry = new_entry_size;
+		// Find the last entry with a hash not above ours; the first entry
+		// has no hash and covers everything below the second.
+		size_t low = 1;
+		size_t high = count;
+		while(low < high) {
+			size_t mid = (low + high) / 2;
+			if(entries[mid].hash > path.hash) {
+				high = mid;
 			} else {
-				// doesn't fit here
-				continue;
+				low = mid + 1;
 			}
+		}
+		path.frames.push_back(ext2_dx_frame{block, entries_offset, low - 1});
+		block = entries[low - 1].block;
+		entries_offset = EXT2_DX_NODE_ENTRIES_OFFSET;
+	}
+	path.leaf = block;
+	return true;
+}
 
-			assert(entry->size_of_entry >= entry_size_needed);
-			assert(entry->size_of_entry >= sizeof(ext2_direntry) + filename.size());
-
-			// reuse this entry
-			entry->inode = new_inode;
-			// TODO: if "directories have type byte" feature is set, write this differently
-			entry->namelen1 = filename.size() & 0xff;
-			entry->type_or_namelen2 = filename.size() >> 8;
-			memcpy(entry->name, filename.c_str(), filename.size());
-			direntry_written = true;
+bool extfs::dx_next_leaf(file_entry_ptr const &directory, ext2_dx_path &path) {
+	// find the lowest level that has a next entry
+	size_t level = path.frames.size();
+	uint32_t next_hash = 0;
+	while(true) {
+		if(level == 0) {
+			return false;
+		}
+		--level;
+		auto &frame = path.frames[level];
+		uint8_t *node = cache->get(map_block(directory, frame.block));
+		auto *countlimit = reinterpret_cast<ext2_dx_countlimit*>(node + frame.entries);
+		auto *entries = reinterpret_cast<ext2_dx_entry*>(node + frame.entries);
+		if(frame.at + 1 < countlimit->count) {
+			frame.at++;
+			next_hash = entries[frame.at].hash;
 			break;
 		}
+	}
 
-		// File entries must span to the end of the block. If this isn't true, the filesystem
-		// is corrupt.
-		assert(direntry_written || ci == dircontents + block_size);
+	// Names with the same hash only continue in the next leaf if the
+	// split between them is marked as a collision
+	if((next_hash & 1) == 0 && (next_hash & ~uint32_t(1)) != path.hash) {
+		return false;
+	}
 
-		if(direntry_written) {
-			res = ::pwrite(blockdev, dircontents, block_size, block_size * datablock);
-			check_ssize(res, sizeof(dircontents));
-			break;
+	// descend to the first leaf below the new entry
+	for(; level < path.frames.size(); ++level) {
+		auto &frame = path.frames[level];
+		uint8_t *node = cache->get(map_block(directory, frame.block));
+		uint32_t child = reinterpret_cast<ext2_dx_entry*>(node + frame.entries)[frame.at].block;
+		if(level + 1 < path.frames.size()) {
+			path.frames[level + 1].block = child;
+			path.frames[level + 1].at = 0;
+		} else {
+			path.leaf = child;
 		}
 	}
+	return true;
+}
 
-	if(!direntry_written) {
-		it.assign_new_block([&]() -> int {
-			return allocate_block();
-		});
-		assert(it != ext2_block_iterator());
-		ext2_block_iterator next = it;
-		++next;
-		assert(next == ext2_block_iterator());
+bool extfs::dx_find_entry(file_entry_ptr const &directory, std::string const &name, cloudabi_inode_t &inode) {
+	inode = 0;
+	ext2_dx_path path;
+	if(!dx_probe(directory, name, path)) {
+		return false;
+	}
+	do {
+		uint32_t physical = map_block(directory, path.leaf);
+		if(physical == 0) {
+			return false;
+		}
+		inode = find_in_block(cache->get(physical), block_size, name);
+	} while(inode == 0 && dx_next_leaf(directory, path));
+	return true;
+}
 
-		auto datablock = *it;
-		directory->inode_data.size1 += block_size;
-		write_inode(directory->inode, directory->inode_data);
+bool extfs::dx_remove_entry(file_entry_ptr const &directory, std::string const &name, bool &removed) {
+	removed = false;
+	ext2_dx_path path;
+	if(!dx_probe(directory, name, path)) {
+		return false;
+	}
+	do {
+		uint32_t physical = map_block(directory, path.leaf);
+		if(physical == 0) {
+			return false;
+		}
+		if(remove_from_block(cache->get(physical), block_size, name)) {
+			cache->mark_dirty(physical);
+			removed = true;
+		}
+	} while(!removed && dx_next_leaf(directory, path));
+	return true;
+}
 
-		char dircontents[block_size];
-		ext2_direntry *entry = reinterpret_cast<ext2_direntry*>(dircontents);
-		entry->inode = new_inode;
-		entry->size_of_entry = block_size;
-		entry->namelen1 = filename.size() & 0xff;
-		entry->type_or_namelen2 = filename.size() >> 8;
-		assert(entry->size_of_entry >= sizeof(ext2_direntry) + filename.size());
-		memcpy(entry->name, filename.c_str(), filename.size());
-		memset(entry->name + filename.size(), 0, sizeof(dircontents) - sizeof(ext2_direntry) - filename.size());
-		ssize_t res = ::pwrite(blockdev, dircontents, block_size, block_size * datablock);
-		check_ssize(res, sizeof(dircontents));
+void extfs::dx_insert_index_entry(file_entry_ptr const &directory, ext2_dx_frame const &frame, uint32_t hash, uint32_t block) {
+	uint32_t physical = map_block(directory, frame.block);
+	assert(physical != 0);
+	uint8_t *node = cache->get(physical);
+	auto *countlimit = reinterpret_cast<ext2_dx_countlimit*>(node + frame.entries);
+	auto *entries = reinterpret_cast<ext2_dx_entry*>(node + frame.entries);
+	size_t count = countlimit->count;
+	assert(count < countlimit->limit);
+	assert(frame.at < count);
+
+	memmove(&entries[frame.at + 2], &entries[frame.at + 1], (count - frame.at - 1) * sizeof(ext2_dx_entry));
+	entries[frame.at + 1].hash = hash;
+	entries[frame.at + 1].block = block;
+	countlimit->count = count + 1;
+	cache->mark_dirty(physical);
+}
+
+bool extfs::dx_make_room(file_entry_ptr const &directory, ext2_dx_path &path) {
+	size_t node_limit = (block_size - EXT2_DX_NODE_ENTRIES_OFFSET) / sizeof(ext2_dx_entry);
+	ext2_dx_frame lowest = path.frames.back();
+	uint32_t physical = map_block(directory, lowest.block);
+	uint8_t *node = cache->get(physical);
+	auto *countlimit = reinterpret_cast<ext2_dx_countlimit*>(node + lowest.entries);
+	size_t count = countlimit->count;
+	if(count < countlimit->limit) {
+		return true;
+	}
+	std::vector<ext2_dx_entry> entries(count);
+	memcpy(entries.data(), node + lowest.entries, count * sizeof(ext2_dx_entry));
+
+	if(path.frames.size() == 1) {
+		// The root is full; move its entries to a new node below it, which
+		// has room for more entries than the root
+		uint32_t new_physical;
+		uint32_t new_block = add_directory_block(directory, new_physical);
+		uint8_t *new_node = cache->get_zeroed(new_physical);
+		reinterpret_cast<ext2_direntry*>(new_node)->size_of_entry = block_size;
+		memcpy(new_node + EXT2_DX_NODE_ENTRIES_OFFSET, entries.data(), count * sizeof(ext2_dx_entry));
+		auto *new_countlimit = reinterpret_cast<ext2_dx_countlimit*>(new_node + EXT2_DX_NODE_ENTRIES_OFFSET);
+		new_countlimit->limit = node_limit;
+		new_countlimit->count = count;
+
+		node = cache->get(physical);
+		countlimit = reinterpret_cast<ext2_dx_countlimit*>(node + lowest.entries);
+		countlimit->count = 1;
+		reinterpret_cast<ext2_dx_entry*>(node + lowest.entries)[0].block = new_block;
+		reinterpret_cast<ext2_dx_root_info*>(node + EXT2_DX_ROOT_INFO_OFFSET)->indirect_levels = 1;
+		cache->mark_dirty(physical);
+
+		path.frames[0].at = 0;
+		path.frames.push_back(ext2_dx_frame{new_block, EXT2_DX_NODE_ENTRIES_OFFSET, lowest.at});
+		return true;
+	}
+
+	// A full node below the root: split it in two, which needs room for
+	// another entry in the root
+	assert(path.frames.size() == 2);
+	auto &root = path.frames[0];
+	auto *root_node = cache->get(map_block(directory, root.block));
+	auto *root_countlimit = reinterpret_cast<ext2_dx_countlimit*>(root_node + root.entries);
+	if(root_countlimit->count >= root_countlimit->limit) {
+		return false;
+	}
+
+	size_t half = count / 2;
+	uint32_t new_physical;
+	uint32_t new_block = add_directory_block(directory, new_physical);
+	uint8_t *new_node = cache->get_zeroed(new_physical);
+	reinterpret_cast<ext2_direntry*>(new_node)->size_of_entry = block_size;
+	memcpy(new_node + EXT2_DX_NODE_ENTRIES_OFFSET, &entries[half], (count - half) * sizeof(ext2_dx_entry));
+	auto *new_countlimit = reinterpret_cast<ext2_dx_countlimit*>(new_node + EXT2_DX_NODE_ENTRIES_OFFSET);
+	new_countlimit->limit = node_limit;
+	new_countlimit->count = count - half;
+
+	node = cache->get(physical);
+	reinterpret_cast<ext2_dx_countlimit*>(node + lowest.entries)->count = half;
+	cache->mark_dirty(physical);
+
+	dx_insert_index_entry(directory, root, entries[half].hash, new_block);
+	if(lowest.at >= half) {
+		root.at += 1;
+		path.frames[1].block = new_block;
+		path.frames[1].at = lowest.at - half;
 	}
+	return true;
 }
 
-void extfs::remove_entry_from_directory(file_entry_ptr directory, std::string filename) {
+void extfs::dx_split_leaf(file_entry_ptr const &directory, ext2_dx_path &path) {
+	uint32_t physical = map_block(directory, path.leaf);
+	std::vector<ext2_dir_record> records;
+	read_dir_records(cache->get(physical), path.hash_version, records);
+	uint32_t split_hash;
+	size_t split = split_records(records, split_hash);
+
+	uint32_t new_physical;
+	uint32_t new_block = add_directory_block(directory, new_physical);
+	write_records(cache->get_zeroed(new_physical), block_size, records.data() + split, records.data() + records.size());
+	write_records(cache->get(physical), block_size, records.data(), records.data() + split);
+	cache->mark_dirty(physical);
+
+	dx_insert_index_entry(directory, path.frames.back(), split_hash, new_block);
+}
+
+bool extfs::dx_add_entry(file_entry_ptr const &directory, std::string const &name, cloudabi_inode_t inode, uint8_t file_type) {
+	// the entries in memory would go stale, and aren't needed with an index
+	directory->names.reset();
+
+	// Normally, the entry fits after splitting the leaf once, but if the
+	// half of the leaf it belongs in is still full, split again
+	for(int attempt = 0; attempt < 3; ++attempt) {
+		ext2_dx_path path;
+		if(!dx_probe(directory, name, path)) {
+			return false;
+		}
+		uint32_t physical = map_block(directory, path.leaf);
+		if(physical == 0) {
+			return false;
+		}
+		if(insert_into_block(cache->get(physical), block_size, name, inode, file_type)) {
+			cache->mark_dirty(physical);
+			return true;
+		}
+		if(!dx_make_room(directory, path)) {
+			return false;
+		}
+		dx_split_leaf(directory, path);
+	}
+	return false;
+}
+
+bool extfs::make_indexed(file_entry_ptr const &directory) {
+	assert(!is_indexed(directory));
+	assert(directory->inode_data.size1 == block_size);
+
+	uint32_t root_physical = map_block(directory, 0);
+	assert(root_physical != 0);
+	uint8_t *root = cache->get(root_physical);
+
+	// the first block must start with "." and "..", which stay in it
+	auto *dot = reinterpret_cast<ext2_direntry*>(root);
+	if(dot->size_of_entry + sizeof(ext2_direntry) + 2 > block_size
+	|| direntry_namelen(dot) != 1 || dot->name[0] != '.') {
+		return false;
+	}
+	auto *dotdot = reinterpret_cast<ext2_direntry*>(root + dot->size_of_entry);
+	if(direntry_namelen(dotdot) != 2 || memcmp(dotdot->name, "..", 2) != 0) {
+		return false;
+	}
+	cloudabi_inode_t dot_inode = dot->inode;
+	cloudabi_inode_t dotdot_inode = dotdot->inode;
+
+	uint8_t hash_version = superblock->default_hash_version;
+	if(hash_version > EXT2_HASH_TEA) {
+		hash_version = EXT2_HASH_HALF_MD4;
+	}
+	std::vector<ext2_dir_record> records;
+	read_dir_records(root, hash_version, records);
+	records.erase(std::remove_if(records.begin(), records.end(), [](ext2_dir_record const &r) {
+		return r.name == "." || r.name == "..";
+	}), records.end());
+	if(records.size() < 2) {
+		return false;
+	}
+	uint32_t split_hash;
+	size_t split = split_records(records, split_hash);
+
+	// move the entries to two new leaves
+	uint32_t physical1, physical2;
+	uint32_t block1 = add_directory_block(directory, physical1);
+	uint32_t block2 = add_directory_block(directory, physical2);
+	write_records(cache->get_zeroed(physical1), block_size, records.data(), records.data() + split);
+	write_records(cache->get_zeroed(physical2), block_size, records.data() + split, records.data() + records.size());
+
+	// and turn the first block into the root of the index
+	root = cache->get(root_physical);
+	memset(root, 0, block_size);
+	dot = reinterpret_cast<ext2_direntry*>(root);
+	dot->inode = dot_inode;
+	dot->size_of_entry = 12;
+	dot->namelen1 = 1;
+	dot->type_or_namelen2 = direntry_type(CLOUDABI_FILETYPE_DIRECTORY);
+	dot->name[0] = '.';
+	dotdot = reinterpret_cast<ext2_direntry*>(root + 12);
+	dotdot->inode = dotdot_inode;
+	dotdot->size_of_entry = block_size - 12;
+	dotdot->namelen1 = 2;
+	dotdot->type_or_namelen2 = direntry_type(CLOUDABI_FILETYPE_DIRECTORY);
+	memcpy(dotdot->name, "..", 2);
+
+	auto *info = reinterpret_cast<ext2_dx_root_info*>(root + EXT2_DX_ROOT_INFO_OFFSET);
+	info->hash_version = hash_version;
+	info->info_length = sizeof(ext2_dx_root_info);
+	size_t entries_offset = EXT2_DX_ROOT_INFO_OFFSET + sizeof(ext2_dx_root_info);
+	auto *countlimit = reinterpret_cast<ext2_dx_countlimit*>(root + entries_offset);
+	countlimit->limit = (block_size - entries_offset) / sizeof(ext2_dx_entry);
+	countlimit->count = 2;
+	auto *entries = reinterpret_cast<ext2_dx_entry*>(root + entries_offset);
+	entries[0].block = block1;
+	entries[1].hash = split_hash;
+	entries[1].block = block2;
+	cache->mark_dirty(root_physical);
+
+	directory->inode_data.flags |= EXT2_INDEX_FL;
+	write_inode(directory->inode, directory->inode_data);
+	directory->names.reset();
+	return true;
+}
+
+uint8_t extfs::direntry_type(cloudabi_filetype_t type) {
+	if((superblock->required_features_present & EXT2_FEATURE_INCOMPAT_FILETYPE) == 0) {
+		return 0;
+	}
+	switch(type) {
+	case CLOUDABI_FILETYPE_REGULAR_FILE: return 1;
+	case CLOUDABI_FILETYPE_DIRECTORY: return 2;
+	case CLOUDABI_FILETYPE_CHARACTER_DEVICE: return 3;
+	case CLOUDABI_FILETYPE_BLOCK_DEVICE: return 4;
+	case CLOUDABI_FILETYPE_SYMBOLIC_LINK: return 7;
+	default: return 0;
+	}
+}
+
+void extfs::add_entry_into_directory(file_entry_ptr directory, std::string filename, cloudabi_inode_t new_inode, cloudabi_filetype_t type) {
 	assert(directory->type == CLOUDABI_FILETYPE_DIRECTORY);
 
-	bool entry_removed = false;
-	ext2_block_iterator it(blockdev, block_size, directory->inode_data);
-	for(; it != ext2_block_iterator(); ++it) {
-		auto datablock = *it;
-		char dircontents[block_size];
-		ssize_t res = ::pread(blockdev, dircontents, block_size, block_size * datablock);
-		check_ssize(res, sizeof(dircontents));
+	if(filename.size() > EXT2_NAME_LEN) {
+		filename.resize(EXT2_NAME_LEN);
+	}
+	uint8_t file_type = direntry_type(type);
 
-		char *ci = dircontents;
-		ext2_direntry *entry = nullptr;
-		ext2_direntry *prev_entry = nullptr;
-		for(; ci < dircontents + block_size; ci += entry->size_of_entry) {
-			entry = reinterpret_cast<ext2_direntry*>(ci);
-			// TODO: if "directories have type byte" feature is set, write this differently
-
-			size_t namelen = entry->namelen1 + (entry->type_or_namelen2 << 8);
-			if(namelen == filename.size() && memcmp(entry->name, filename.c_str(), namelen) == 0) {
-				if(ci == dircontents && entry->size_of_entry == block_size) {
-					// we're removing the last entry in this block
-					// TODO: should deallocate this block. Instead, for now, we mark the entry
-					// invalid by setting inode to 0.
-					entry->inode = 0;
-					entry->namelen1 = 0;
-					entry->type_or_namelen2 = 0;
-				} else if(ci == dircontents) {
-					// we're removing the first entry, but there is an entry after this;
-					// move it over this one
-					assert(entry->size_of_entry < block_size - sizeof(ext2_direntry));
-					ext2_direntry *next_entry = reinterpret_cast<ext2_direntry*>(ci + entry->size_of_entry);
-					size_t new_size = entry->size_of_entry + next_entry->size_of_entry;
-					size_t new_namelen = next_entry->namelen1 + (next_entry->type_or_namelen2 << 8);
-					assert(new_size >= sizeof(ext2_direntry) + new_namelen);
-					assert(new_namelen <= next_entry->size_of_entry - sizeof(ext2_direntry));
-					*entry = *next_entry;
-					entry->size_of_entry = new_size;
-					// if this entry used to be very short, then the new length of entry->name
-					// may overlap with next_entry->name, so use memmove instead of memcpy here
-					memmove(entry->name, next_entry->name, new_namelen);
-				} else {
-					assert(prev_entry != nullptr);
-					prev_entry->size_of_entry += entry->size_of_entry;
-				}
-				entry_removed = true;
-				break;
+	bool is_dot = filename == "." || filename == "..";
+	if(!is_dot && is_indexed(directory)) {
+		if(dx_add_entry(directory, filename, new_inode, file_type)) {
+			return;
+		}
+		// the index can't be used or is full, go on without it
+	}
+	clear_index(directory);
+
+	// Start at the block an entry was last added to; in a growing
+	// directory, that's the one that still has room
+	size_t num_blocks = directory->inode_data.size1 / block_size;
+	size_t start = directory->insert_hint < num_blocks ? directory->insert_hint : 0;
+	for(size_t i = 0; i < num_blocks; ++i) {
+		size_t logical = (start + i) % num_blocks;
+		uint32_t physical = map_block(directory, logical);
+		assert(physical != 0);
+		if(insert_into_block(cache->get(physical), block_size, filename, new_inode, file_type)) {
+			cache->mark_dirty(physical);
+			directory->insert_hint = logical;
+			if(directory->names) {
+				(*directory->names)[filename] = ext2_dir_name{new_inode, uint32_t(logical)};
 			}
-			prev_entry = entry;
+			return;
 		}
+	}
 
-		// File entries must span to the end of the block. If this isn't true, the filesystem
-		// is corrupt.
-		assert(entry_removed || ci == dircontents + block_size);
+	// Like Linux, start an index once the first block of a directory is full
+	if(!is_dot && num_blocks == 1 && (superblock->optional_features_present & EXT2_FEATURE_COMPAT_DIR_INDEX)
+	&& make_indexed(directory)) {
+		if(dx_add_entry(directory, filename, new_inode, file_type)) {
+			return;
+		}
+		clear_index(directory);
+	}
 
-		if(entry_removed) {
-			res = ::pwrite(blockdev, dircontents, block_size, block_size * datablock);
-			check_ssize(res, sizeof(dircontents));
-			break;
+	uint32_t physical;
+	uint32_t logical = add_directory_block(directory, physical);
+	ext2_dir_record record{0, new_inode, filename, file_type};
+	write_records(cache->get_zeroed(physical), block_size, &record, &record + 1);
+	directory->insert_hint = logical;
+	if(directory->names) {
+		(*directory->names)[filename] = ext2_dir_name{new_inode, logical};
+	}
+}
+
+void extfs::remove_entry_from_directory(file_entry_ptr directory, std::string filename) {
+	assert(directory->type == CLOUDABI_FILETYPE_DIRECTORY);
+
+	bool is_dot = filename == "." || filename == "..";
+	if(!is_dot && is_indexed(directory)) {
+		bool removed;
+		if(dx_remove_entry(directory, filename, removed)) {
+			if(!removed) {
+				fprintf(stderr, "[extfs] Remove_entry called for an entry that doesn't exist?\n");
+				throw cloudabi_system_error(ENOENT);
+			}
+			return;
 		}
 	}
+	if(is_dot) {
+		// these share the first block with the root of an index
+		clear_index(directory);
+	}
 
-	if(!entry_removed) {
-		fprintf(stderr, "[extfs] Remove_entry called for an entry that doesn't exist?\n");
-		throw cloudabi_system_error(ENOENT);
+	// with the names in memory, go straight to the block holding the entry
+	if(directory->names) {
+		auto it = directory->names->find(filename);
+		if(it != directory->names->end()) {
+			uint32_t physical = map_block(directory, it->second.block);
+			if(physical != 0 && remove_from_block(cache->get(physical), block_size, filename)) {
+				cache->mark_dirty(physical);
+				directory->names->erase(it);
+				return;
+			}
+		}
+	}
+
+	size_t num_blocks = directory->inode_data.size1 / block_size;
+	for(size_t logical = 0; logical < num_blocks; ++logical) {
+		uint32_t physical = map_block(directory, logical);
+		assert(physical != 0);
+		if(remove_from_block(cache->get(physical), block_size, filename)) {
+			cache->mark_dirty(physical);
+			if(directory->names) {
+				directory->names->erase(filename);
+			}
+			return;
+		}
 	}
+
+	fprintf(stderr, "[extfs] Remove_entry called for an entry that doesn't exist?\n");
+	throw cloudabi_system_error(ENOENT);
+}
+
+void extfs::set_parent_directory(file_entry_ptr const &directory, cloudabi_inode_t parent) {
+	// ".." is the second entry of the first block; change it in place, as
+	// the root of an index shares the block with it
+	uint32_t physical = map_block(directory, 0);
+	assert(physical != 0);
+	uint8_t *block = cache->get(physical);
+	auto *dot = reinterpret_cast<ext2_direntry*>(block);
+	if(dot->size_of_entry + sizeof(ext2_direntry) + 2 <= block_size) {
+		auto *dotdot = reinterpret_cast<ext2_direntry*>(block + dot->size_of_entry);
+		if(direntry_namelen(dotdot) == 2 && memcmp(dotdot->name, "..", 2) == 0) {
+			dotdot->inode = parent;
+			cache->mark_dirty(physical);
+			if(directory->names) {
+				(*directory->names)[".."].inode = parent;
+			}
+			return;
+		}
+	}
+
+	remove_entry_from_directory(directory, "..");
+	add_entry_into_directory(directory, "..", parent, CLOUDABI_FILETYPE_DIRECTORY);
 }
 
 bool extfs::directory_is_empty(file_entry_ptr directory)
@@ -1730,10 +3224,10 @@ void extfs::deallocate_inode(cloudabi_inode_t inode, cloudabi_filetype_t type, e
 
 	// first, deallocate all blocks
 	if(type != CLOUDABI_FILETYPE_SYMBOLIC_LINK) {
-		ext2_block_iterator it(blockdev, block_size, inode_data);
-		for(; it != ext2_block_iterator(); ++it) {
-			deallocate_block(*it);
-		}
+		ext2_block_iterator it(*cache, block_size, inode_data);
+		it.for_each_block([&](uint32_t block) {
+			deallocate_block(block);
+		});
 	}
 
 	memset(&inode_data, 0, sizeof(inode_data));
@@ -1746,47 +3240,65 @@ void extfs::deallocate_inode(cloudabi_inode_t inode, cloudabi_filetype_t type, e
 	auto &descriptor = block_group_desc[blockgroup];
 	size_t index = (inode - 1) % superblock->inodes_per_group;
 
-	uint8_t bitmap[block_size];
-	ssize_t res = ::pread(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-	check_ssize(res, block_size);
+	uint8_t *bitmap = cache->get(descriptor.inode_usage_bitmap_addr);
 
 	size_t byte = index / 8;
 	uint8_t bit = 1 << (index % 8);
 	assert((bitmap[byte] & bit) == bit);
 	bitmap[byte] &= ~bit;
-	res = ::pwrite(blockdev, bitmap, block_size, block_size * descriptor.inode_usage_bitmap_addr);
-	check_ssize(res, block_size);
+	cache->mark_dirty(descriptor.inode_usage_bitmap_addr);
 
 	descriptor.num_unallocated_inodes += 1;
 	if(type == CLOUDABI_FILETYPE_DIRECTORY) {
-		descriptor.num_directories += 1;
+		descriptor.num_directories -= 1;
 	}
 	superblock->num_unallocated_inodes += 1;
+	mark_counters_dirty(blockgroup);
+}
 
-	// Write updated block group descriptor
-	pwrite_partial(blockdev, block_group_desc, &descriptor, sizeof(descriptor), block_group_desc_offset);
+void extfs::allocate(file_entry_ptr entry, size_t size, size_t written_from, size_t written_to) {
+	size_t current_size = entry->inode_data.size1;
+	if(entry->type == CLOUDABI_FILETYPE_REGULAR_FILE) {
+		current_size += (uint64_t(entry->inode_data.size2_or_dir_acl_blockptr) & 0xffffffff) << 32;
+	}
 
-	// Write updated superblock
-	pwrite_partial(blockdev, superblock, int(0), sizeof(ext2_superblock), superblock_offset);
-}
+	// The blocks before the one containing the current end of the file
+	// exist, so don't walk through them
+	size_t block = std::min(current_size, size) / block_size;
+	size_t blocks_needed = (size + block_size - 1) / block_size;
+	if(block > 0 && entry->prealloc_count == 0) {
+		entry->allocation_goal = map_block(entry, block - 1) + 1;
+	}
 
-void extfs::allocate(file_entry_ptr entry, size_t size) {
-	ext2_block_iterator it(blockdev, block_size, entry->inode_data);
-	size_t has_size = 0;
-	while(has_size < size) {
-		if(it == ext2_block_iterator()) {
-			// this block doesn't exist, but we don't have enough place yet, so allocate it
-			it.assign_new_block([&]() -> int {
-				return allocate_block();
-			});
-			assert(it != ext2_block_iterator());
-			ext2_block_iterator next = it;
-			++next;
-			assert(next == ext2_block_iterator());
-		}
-		has_size += block_size;
+	ext2_block_iterator it(*cache, block_size, entry->inode_data, block);
+	for(; it != ext2_block_iterator() && block < blocks_needed; ++it, ++block) {
+		if(entry->prealloc_count == 0) {
+			entry->allocation_goal = *it + 1;
+		}
+	}
+
+	// New blocks must read as zeroes, unless the caller is about to
+	// overwrite them completely. In a file mapped by extents, blocks the
+	// caller doesn't write to are allocated unwritten instead of zeroed.
+	bool use_unwritten = entry->type == CLOUDABI_FILETYPE_REGULAR_FILE
+		&& (entry->inode_data.flags & EXT4_EXTENTS_FL);
+	std::vector<uint32_t> to_zero;
+	for(; block < blocks_needed; ++block) {
+		// this block doesn't exist, but we don't have enough place yet, so allocate it
+		assert(it == ext2_block_iterator());
+		bool unwritten = use_unwritten
+			&& (block * block_size >= written_to || (block + 1) * block_size <= written_from);
+		it.assign_new_block([&]() -> int {
+			return allocate_file_block(*entry, blocks_needed - block);
+		}, unwritten);
+		assert(it != ext2_block_iterator());
+		if(!unwritten && (block * block_size < written_from || (block + 1) * block_size > written_to)) {
+			to_zero.push_back(*it);
+		}
 		++it;
+		assert(it == ext2_block_iterator());
 	}
+	zero_blocks(to_zero);
 
 	// Update the inode struct
 	entry->inode_data.size1 = size & 0xffffffff;
@@ -1794,3 +3306,93 @@ void extfs::allocate(file_entry_ptr entry, size_t size) {
 		entry->inode_data.size2_or_dir_acl_blockptr = (uint64_t(size) >> 32) & 0xffffffff;
 	}
 }
+
+void extfs::print_cache_statistics() const {
+	auto const &stats = cache->get_statistics();
+	fprintf(stderr, "[extfs] block cache: %zu/%zu blocks, %llu hits, %llu misses, %llu evictions, %llu writebacks\n",
+		cache->size(), cache->get_capacity(),
+		static_cast<unsigned long long>(stats.hits), static_cast<unsigned long long>(stats.misses),
+		static_cast<unsigned long long>(stats.evictions), static_cast<unsigned long long>(stats.writebacks));
+}
+
+size_t extfs::contiguous_run(file_entry_ptr const &entry, size_t block, size_t max_blocks, uint32_t &first, bool &unwritten) {
+	unwritten = false;
+	if(entry->inode_data.flags & EXT4_EXTENTS_FL) {
+		// the extent holding the block tells how far the run goes
+		ext2_block_iterator it(*cache, block_size, entry->inode_data, block);
+		if(it == ext2_block_iterator()) {
+			return 0;
+		}
+		first = *it;
+		return it.extent_length(max_blocks, unwritten);
+	}
+
+	first = map_block(entry, block);
+	if(first == 0) {
+		return 0;
+	}
+	size_t run = 1;
+	while(run < max_blocks && map_block(entry, block + run) == first + run) {
+		++run;
+	}
+	return run;
+}
+
+void extfs::mark_extent_written(file_entry_ptr const &entry, size_t block, size_t count) {
+	ext2_block_iterator it(*cache, block_size, entry->inode_data, block);
+	assert(it != ext2_block_iterator());
+	// the blocks are contiguous on the disk
+	uint32_t first = *it;
+	it.mark_written(count, [&]() -> int {
+		return allocate_file_block(*entry, 1);
+	});
+	// the blocks in between are overwritten completely
+	std::vector<uint32_t> blocks{first};
+	if(count > 1) {
+		blocks.push_back(first + count - 1);
+	}
+	zero_blocks(blocks);
+	write_inode(entry->inode, entry->inode_data);
+}
+
+uint32_t extfs::map_block(file_entry_ptr const &entry, size_t block) {
+	size_t const chunk_size = extfs_file_entry::BLOCK_MAP_CHUNK;
+	auto &map = entry->block_map;
+	auto chunk = map.find(block / chunk_size);
+	if(chunk != map.end() && chunk->second[block % chunk_size] != 0) {
+		return chunk->second[block % chunk_size];
+	}
+
+	ext2_block_iterator it(*cache, block_size, entry->inode_data, block);
+	if(it == ext2_block_iterator()) {
+		return 0;
+	}
+	if(chunk == map.end()) {
+		std::unique_ptr<uint32_t[]> blocks(new uint32_t[chunk_size]());
+		chunk = map.emplace(block / chunk_size, std::move(blocks)).first;
+	}
+	uint32_t physical = *it;
+	chunk->second[block % chunk_size] = physical;
+	return physical;
+}
+
+void extfs::invalidate_other_pseudos(file_entry_ptr entry, pseudofd_t except) {
+	notify_other_pseudos(entry, except, cosix::pseudo_fd_invalidate_cache);
+}
+
+void extfs::invalidate_other_dentries(file_entry_ptr directory, pseudofd_t except) {
+	notify_other_pseudos(directory, except, cosix::pseudo_fd_invalidate_dentries);
+}
+
+void extfs::notify_other_pseudos(file_entry_ptr const &entry, pseudofd_t except, void (*notify)(int, pseudofd_t)) {
+	if(reversefd < 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(entries_mtx);
+	std::lock_guard<std::mutex> write_lock(reverse_write_mtx);
+	for(auto &p : pseudo_fds) {
+		if(p.first != except && p.second->file == entry) {
+			notify(reversefd, p.first);
+		}
+	}
+}
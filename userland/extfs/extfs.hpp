@@ -1,16 +1,23 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <string>
 #include <stdexcept>
 #include <cosix/reverse.hpp>
 #include <memory>
 #include <vector>
 #include <functional>
+#include "block_cache.hpp"
+#include "group_bitmap.hpp"
 
 struct ext2_superblock;
 struct ext2_block_group_descriptor;
 struct ext2_inode;
+struct ext2_dx_frame;
+struct ext2_dx_path;
+struct ext2_dir_record;
 
 struct extfs_file_entry;
 
@@ -18,20 +25,50 @@ typedef std::shared_ptr<extfs_file_entry> file_entry_ptr;
 
 struct pseudo_fd_entry {
 	file_entry_ptr file;
+	// whether the file was changed through this pseudo FD, so that
+	// closing it writes back the metadata
+	std::atomic<bool> written{false};
 };
 
 typedef std::shared_ptr<pseudo_fd_entry> pseudo_fd_ptr;
 
+/** When to update the access time of files and directories, like the
+ * strictatime, relatime and noatime mount options on Linux.
+ */
+enum class atime_update {
+	// on every access
+	strict,
+	// only if the access time is older than the modification or change
+	// time, or more than a day old
+	relative,
+	never,
+};
+
 /** An EXT2 filesystem implementation.
+ *
+ * Changed metadata (inodes, bitmaps, block group descriptors and the
+ * superblock) is kept in memory and written back on sync, on datasync, when
+ * a pseudo FD that was written to is closed, or when write_back() is called
+ * because the metadata has been dirty for WRITE_BACK_INTERVAL.
+ *
+ * Requests may be handled by several threads at once. All metadata,
+ * including the block cache and the in-memory inodes, is protected by one
+ * lock; the contents of files are read and written without it, under a
+ * reader/writer lock per inode. The per-inode lock is always taken before
+ * the metadata lock.
  */
 struct extfs : public cosix::reverse_handler {
-	extfs(int blockdev, cloudabi_device_t);
+	static constexpr cloudabi_timestamp_t WRITE_BACK_INTERVAL = 5'000'000'000;
+
+	extfs(int blockdev, cloudabi_device_t, int reversefd, size_t cache_blocks = block_cache::DEFAULT_CAPACITY,
+		atime_update atime = atime_update::relative);
 	~extfs() override;
 
 	typedef cosix::file_entry file_entry;
 	typedef cosix::pseudofd_t pseudofd_t;
 
 	file_entry lookup(pseudofd_t pseudo, const char *file, size_t len, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat) override;
+	file_entry lookup_inode(pseudofd_t pseudo, cloudabi_inode_t directory, const char *file, size_t len, cloudabi_filestat_t *filestat) override;
 	std::pair<pseudofd_t, cloudabi_filetype_t> open(cloudabi_inode_t inode) override;
 	void allocate(pseudofd_t pseudo, off_t offset, off_t length) override;
 	size_t readlink(pseudofd_t pseudo, const char *file, size_t filelen, char *buf, size_t buflen) override;
@@ -47,14 +84,30 @@ struct extfs : public cosix::reverse_handler {
 	void sync(pseudofd_t pseudo) override;
 
 	size_t readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie) override;
+	size_t readdirplus(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie) override;
 	void stat_fget(pseudofd_t pseudo, cloudabi_filestat_t *statbuf) override;
 	void stat_fput(pseudofd_t pseudo, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) override;
 	void stat_put(pseudofd_t pseudo, cloudabi_lookupflags_t lookupflags, const char *file, size_t filelen, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) override;
 	bool is_readable(pseudofd_t pseudo, size_t &nbytes, bool &hangup) override;
 
+	block_cache::statistics const &get_cache_statistics() const { return cache->get_statistics(); }
+	// Print the block cache statistics to stderr
+	void print_cache_statistics() const;
+
+	bool has_dirty_metadata() const;
+	// Writes all dirty metadata to the block device
+	void write_back();
+
+	/** Threads handling requests must write their responses under this
+	 * mutex, since extfs sends messages of its own on the reverse FD.
+	 */
+	std::mutex &get_reverse_write_mutex() { return reverse_write_mtx; }
+
 private:
 	const cloudabi_device_t device;
 	int blockdev;
+	int reversefd;
+	atime_update atime;
 	size_t block_size;
 	size_t number_of_block_groups;
 	size_t first_block;
@@ -62,6 +115,25 @@ private:
 	size_t superblock_offset;
 	ext2_block_group_descriptor *block_group_desc = nullptr;
 	size_t block_group_desc_offset;
+	// Bitmaps, inode tables, indirect blocks and directory blocks are
+	// accessed through this cache; file contents bypass it.
+	std::unique_ptr<block_cache> cache;
+	// In-memory copies of the block bitmaps, loaded on first use. Blocks
+	// are reserved here before they are allocated on disk, so reserved
+	// (preallocated) blocks can't be given out twice.
+	std::vector<std::unique_ptr<group_bitmap>> block_bitmaps;
+	// Changed block group descriptors and the superblock, written by
+	// write_back()
+	size_t dirty_groups_begin = SIZE_MAX;
+	size_t dirty_groups_end = 0;
+	bool superblock_dirty = false;
+	// Protects everything but the maps below and the contents of files.
+	// Recursive, since operations are built from other operations, and
+	// dropping the last reference to an unlinked file frees its inode.
+	mutable std::recursive_mutex metadata_mtx;
+	// Protects open_inodes and pseudo_fds; taken after metadata_mtx
+	std::mutex entries_mtx;
+	std::mutex reverse_write_mtx;
 	std::map<cloudabi_inode_t, std::weak_ptr<extfs_file_entry>> open_inodes;
 	std::map<pseudofd_t, pseudo_fd_ptr> pseudo_fds;
 
@@ -71,18 +143,107 @@ private:
 	bool readdir(file_entry_ptr directory, bool, std::function<bool(cloudabi_dirent_t, std::string, file_entry_ptr)> per_entry);
 	size_t pread(file_entry_ptr entry, off_t offset, char *dest, size_t requested);
 	void pwrite(file_entry_ptr entry, off_t offset, const char *buf, size_t requested);
-	size_t allocate_block();
+	// Number of blocks reserved for a regular file at once, so that it
+	// grows contiguously
+	static constexpr size_t PREALLOCATE_BLOCKS = 16;
+	static constexpr size_t MAX_RESERVATION = 2048;
+
+	group_bitmap &get_block_bitmap(size_t group);
+	// Reserves a run of at most count free blocks in the in-memory
+	// bitmaps, as close after the goal block as possible, and sets count
+	// to the length of the run. Throws ENOSPC if no block is free.
+	size_t reserve_blocks(size_t goal, size_t &count);
+	void unreserve_blocks(size_t block, size_t count);
+	// Marks a reserved block as allocated on disk
+	void commit_block(size_t block);
+	size_t allocate_block(size_t goal);
+	// Allocates a block for the file from its preallocation window,
+	// reserving a new window of at least wanted blocks if it is empty.
+	size_t allocate_file_block(extfs_file_entry &entry, size_t wanted);
+	void release_preallocation(extfs_file_entry &entry);
 	void deallocate_block(size_t);
+	void zero_blocks(std::vector<uint32_t> const &blocks);
+	void mark_counters_dirty(size_t group);
+	void write_counters();
+	// Returns the block of the inode table holding the inode, and where
+	// in it the inode starts. Inodes may be larger than ext2_inode; only
+	// its first sizeof(ext2_inode) bytes are read and written.
+	uint32_t inode_location(cloudabi_inode_t inode, size_t &offset_in_block);
 	void write_inode(cloudabi_inode_t inode, ext2_inode &inode_data);
-	void add_entry_into_directory(file_entry_ptr directory, std::string filename, cloudabi_inode_t new_inode);
+	// Clears the space after ext2_inode in a new inode
+	void init_extra_inode_space(cloudabi_inode_t inode);
+	// Sets the access time of the entry to now, if the atime_update
+	// policy asks for it
+	void update_atime(file_entry_ptr const &entry);
+	// Returns the inode of the entry with the given name in the directory,
+	// or 0 if there is none. Uses the htree index if the directory has
+	// one, and otherwise the names of the directory kept in memory.
+	cloudabi_inode_t find_entry(file_entry_ptr const &directory, std::string const &name);
+	void load_directory_names(file_entry_ptr const &directory);
+	// The file type stored in directory entries, or 0 without the filetype
+	// feature
+	uint8_t direntry_type(cloudabi_filetype_t type);
+	void add_entry_into_directory(file_entry_ptr directory, std::string filename, cloudabi_inode_t new_inode, cloudabi_filetype_t type);
 	void remove_entry_from_directory(file_entry_ptr directory, std::string filename);
+	void set_parent_directory(file_entry_ptr const &directory, cloudabi_inode_t parent);
+	// Appends a block to the directory and returns its logical block
+	// number; fill it in through cache->get_zeroed(physical).
+	uint32_t add_directory_block(file_entry_ptr const &directory, uint32_t &physical);
+	void read_dir_records(const uint8_t *block, uint8_t hash_version, std::vector<ext2_dir_record> &records);
+
+	// Hashed directory index (htree). These return false if the index of
+	// the directory can't be used, or has no room left.
+	bool is_indexed(file_entry_ptr const &directory);
+	void clear_index(file_entry_ptr const &directory);
+	uint32_t dx_hash(std::string const &name, uint8_t hash_version);
+	// Walks from the root of the index to the leaf that holds the name
+	bool dx_probe(file_entry_ptr const &directory, std::string const &name, ext2_dx_path &path);
+	// Moves the path to the next leaf, if that one may hold names with
+	// the same hash as well
+	bool dx_next_leaf(file_entry_ptr const &directory, ext2_dx_path &path);
+	bool dx_find_entry(file_entry_ptr const &directory, std::string const &name, cloudabi_inode_t &inode);
+	bool dx_add_entry(file_entry_ptr const &directory, std::string const &name, cloudabi_inode_t inode, uint8_t file_type);
+	bool dx_remove_entry(file_entry_ptr const &directory, std::string const &name, bool &removed);
+	void dx_insert_index_entry(file_entry_ptr const &directory, ext2_dx_frame const &frame, uint32_t hash, uint32_t block);
+	// Makes sure the lowest index node on the path has room for another
+	// entry, by adding a level to the index or splitting the node
+	bool dx_make_room(file_entry_ptr const &directory, ext2_dx_path &path);
+	void dx_split_leaf(file_entry_ptr const &directory, ext2_dx_path &path);
+	// Turns a directory with one full block into an indexed one
+	bool make_indexed(file_entry_ptr const &directory);
 	bool directory_is_empty(file_entry_ptr directory);
 	void deallocate_inode(cloudabi_inode_t inode, cloudabi_filetype_t type, ext2_inode &inode_data);
 	void update_file_entry_stat(file_entry_ptr entry, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags);
-	void allocate(file_entry_ptr entry, size_t size);
+	// Grows the file to the given size. New blocks are zeroed, except
+	// those that will be overwritten completely by a write to
+	// [written_from, written_to), and those outside it in a file mapped
+	// by extents, which are allocated unwritten.
+	void allocate(file_entry_ptr entry, size_t size, size_t written_from = 0, size_t written_to = 0);
+	// Returns the physical block holding the given logical block of the
+	// file, or 0 if the file has no such block.
+	uint32_t map_block(file_entry_ptr const &entry, size_t block);
+	// Returns how many blocks, up to max_blocks, starting at the given
+	// logical block are stored contiguously on the disk, and sets first to
+	// the physical block of the first one. Returns 0 if there is no such
+	// block. Sets unwritten if the blocks belong to an unwritten extent,
+	// so they must read as zeroes.
+	size_t contiguous_run(file_entry_ptr const &entry, size_t block, size_t max_blocks, uint32_t &first, bool &unwritten);
+	// Marks count blocks from the given logical block of the file written,
+	// before they're written to; they must lie in one unwritten extent.
+	// The first and last of them are zeroed, as they may be written
+	// partially.
+	void mark_extent_written(file_entry_ptr const &entry, size_t block, size_t count);
+	// Tell the kernel to drop cached pages of all pseudo FDs opened on this
+	// entry, except the one that caused the change.
+	void invalidate_other_pseudos(file_entry_ptr entry, pseudofd_t except);
+	// Tell the kernel to drop the cached lookups in this directory, for all
+	// pseudo FDs opened on it except the one that caused the change.
+	void invalidate_other_dentries(file_entry_ptr directory, pseudofd_t except);
+	void notify_other_pseudos(file_entry_ptr const &entry, pseudofd_t except, void (*notify)(int, pseudofd_t));
 
 	file_entry_ptr get_file_entry_from_inode(cloudabi_inode_t inode);
 	file_entry_ptr get_file_entry_from_pseudo(pseudofd_t pseudo);
+	pseudo_fd_ptr get_pseudo_fd(pseudofd_t pseudo);
 
 	friend struct extfs_file_entry;
 };
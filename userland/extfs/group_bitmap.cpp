@@ -0,0 +1,83 @@
+#include "group_bitmap.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+
+group_bitmap::group_bitmap(const uint8_t *on_disk, size_t b)
+: words((b + 31) / 32, 0)
+, bits(b)
+, num_free(0)
+{
+	// bit i of the on-disk bitmap is bit i % 8 of byte i / 8, which on a
+	// little-endian machine is bit i % 32 of 32-bit word i / 32
+	memcpy(words.data(), on_disk, (bits + 7) / 8);
+	if(bits % 32) {
+		words.back() |= ~uint32_t(0) << (bits % 32);
+	}
+	for(auto w : words) {
+		num_free += __builtin_popcount(~w);
+	}
+}
+
+void group_bitmap::set(size_t bit, size_t count) {
+	assert(bit + count <= bits);
+	for(size_t i = bit; i < bit + count; ++i) {
+		uint32_t mask = uint32_t(1) << (i % 32);
+		assert((words[i / 32] & mask) == 0);
+		words[i / 32] |= mask;
+	}
+	num_free -= count;
+}
+
+void group_bitmap::clear(size_t bit, size_t count) {
+	assert(bit + count <= bits);
+	for(size_t i = bit; i < bit + count; ++i) {
+		uint32_t mask = uint32_t(1) << (i % 32);
+		assert((words[i / 32] & mask) != 0);
+		words[i / 32] &= ~mask;
+	}
+	num_free += count;
+}
+
+size_t group_bitmap::find_free(size_t goal) const {
+	if(goal >= bits) {
+		goal = 0;
+	}
+	size_t bit = find_free_between(goal, bits);
+	if(bit == npos) {
+		bit = find_free_between(0, goal);
+	}
+	return bit;
+}
+
+size_t group_bitmap::find_free_between(size_t begin, size_t end) const {
+	size_t i = begin;
+	while(i < end) {
+		// treat the bits before i in its word as used
+		uint32_t w = words[i / 32] | ((uint32_t(1) << (i % 32)) - 1);
+		if(w != ~uint32_t(0)) {
+			size_t found = (i & ~size_t(31)) + __builtin_ctz(~w);
+			return found < end ? found : npos;
+		}
+		i = (i & ~size_t(31)) + 32;
+	}
+	return npos;
+}
+
+size_t group_bitmap::free_run(size_t bit, size_t max) const {
+	size_t run = 0;
+	size_t i = bit;
+	while(run < max && i < bits) {
+		uint32_t w = words[i / 32] >> (i % 32);
+		size_t left_in_word = 32 - (i % 32);
+		if(w == 0) {
+			run += left_in_word;
+			i += left_in_word;
+		} else {
+			run += __builtin_ctz(w);
+			break;
+		}
+	}
+	return std::min(run, max);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** An in-memory copy of the block usage bitmap of a block group. Besides the
+ * blocks that are in use on disk, it also has the bits set of blocks that
+ * are reserved for the preallocation window of a file, so they aren't handed
+ * out twice. Searches go a 32-bit word at a time.
+ */
+struct group_bitmap {
+	static constexpr size_t npos = SIZE_MAX;
+
+	/** Copies the bitmap of a group of the given number of blocks. Bits
+	 * past the end of the group are treated as in use.
+	 */
+	group_bitmap(const uint8_t *on_disk, size_t bits);
+
+	bool test(size_t bit) const {
+		return words[bit / 32] & (uint32_t(1) << (bit % 32));
+	}
+
+	void set(size_t bit, size_t count = 1);
+	void clear(size_t bit, size_t count = 1);
+
+	/** Returns the first free bit at or after goal, wrapping around to the
+	 * start of the group, or npos if no bit is free.
+	 */
+	size_t find_free(size_t goal) const;
+
+	/** Returns how many bits starting at the given one are free, up to max. */
+	size_t free_run(size_t bit, size_t max) const;
+
+	size_t free_bits() const { return num_free; }
+
+private:
+	size_t find_free_between(size_t begin, size_t end) const;
+
+	std::vector<uint32_t> words;
+	size_t bits;
+	size_t num_free;
+};
@@ -0,0 +1,283 @@
+#include "extfs.hpp"
+
+#include <cosix/bench.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+// Runs extfs on the host against an ext2 disk image file and measures the
+// latency of its operations. The workloads run in a new directory in the
+// root of the image, which is removed again at the end, so a fresh
+// genext2fs image can be used as-is:
+//
+//   genext2fs -N 10000 -b 95000 -z bench.img
+//   extfs_bench bench.img
+//
+// With -k, the directory and its files are kept instead, so that e2fsck can
+// check the directory index and extent trees extfs built:
+//
+//   mke2fs -t ext4 -O ^64bit,^metadata_csum bench.img 256M
+//   extfs_bench -k -n 20000 bench.img && e2fsck -fn bench.img
+//
+// The requests are made on the extfs reverse_handler directly, as if they
+// came in over the reverse FD.
+
+using namespace cosix;
+
+static const char *DIRNAME = "extfs_bench";
+static const char *LARGE_FILENAME = "large";
+
+static int num_files = 1000;
+static size_t size_mb = 64;
+static size_t chunk_size = 64 * 1024;
+static int num_random_reads = 10000;
+static size_t random_read_size = 4096;
+static int num_readdirs = 10;
+static size_t cache_blocks = block_cache::DEFAULT_CAPACITY;
+static bool keep_files = false;
+
+// Collects the latencies of all operations of one workload.
+struct workload {
+	workload(const char *n) : name(n), start(cosix::now_ns()) {}
+
+	template <typename F>
+	void measure(F f) {
+		uint64_t before = cosix::now_ns();
+		f();
+		latencies.push_back(cosix::now_ns() - before);
+	}
+
+	// bytes is the amount of data read or written, 0 if not applicable
+	void report(uint64_t bytes = 0) {
+		uint64_t total = cosix::now_ns() - start;
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&](unsigned p) -> unsigned long long {
+			if(latencies.empty()) {
+				return 0;
+			}
+			return latencies[std::min(latencies.size() - 1, latencies.size() * p / 100)];
+		};
+		printf("%-9s %7zu ops %10.3f ms  p50 %9llu ns  p90 %9llu ns  p99 %9llu ns  max %9llu ns",
+			name, latencies.size(), total / 1e6, percentile(50), percentile(90),
+			percentile(99), percentile(100));
+		if(bytes != 0 && total != 0) {
+			printf("  %8llu KiB/s", (unsigned long long)(bytes * 1000000000 / 1024 / total));
+		}
+		printf("\n");
+	}
+
+	const char *name;
+	uint64_t start;
+	std::vector<uint64_t> latencies;
+};
+
+// every chunk starts with its offset, so misplaced data is detected
+static void fill(std::vector<char> &buf, uint64_t offset) {
+	memset(buf.data(), offset / buf.size(), buf.size());
+	memcpy(buf.data(), &offset, std::min(sizeof(offset), buf.size()));
+}
+
+static std::string file_name(int i) {
+	return "file" + std::to_string(i);
+}
+
+static extfs::pseudofd_t open_file(extfs &fs, extfs::pseudofd_t dir, const std::string &name) {
+	auto entry = fs.lookup(dir, name.c_str(), name.size(), 0, nullptr);
+	return fs.open(entry.inode).first;
+}
+
+static void bench_create(extfs &fs, extfs::pseudofd_t dir) {
+	workload w("create");
+	for(int i = 0; i < num_files; ++i) {
+		std::string name = file_name(i);
+		w.measure([&]() {
+			auto inode = fs.create(dir, name.c_str(), name.size(), CLOUDABI_FILETYPE_REGULAR_FILE);
+			fs.close(fs.open(inode).first);
+		});
+	}
+	w.report();
+}
+
+static void bench_seqwrite(extfs &fs, extfs::pseudofd_t dir) {
+	size_t size = size_mb * 1024 * 1024;
+	std::vector<char> buf(chunk_size);
+	fs.create(dir, LARGE_FILENAME, strlen(LARGE_FILENAME), CLOUDABI_FILETYPE_REGULAR_FILE);
+	auto file = open_file(fs, dir, LARGE_FILENAME);
+	workload w("seqwrite");
+	for(size_t offset = 0; offset < size; offset += chunk_size) {
+		fill(buf, offset);
+		w.measure([&]() {
+			fs.pwrite(file, offset, buf.data(), chunk_size);
+		});
+	}
+	w.measure([&]() {
+		fs.close(file);
+	});
+	w.report(size);
+}
+
+static void bench_seqread(extfs &fs, extfs::pseudofd_t dir) {
+	size_t size = size_mb * 1024 * 1024;
+	std::vector<char> buf(chunk_size), expected(chunk_size);
+	auto file = open_file(fs, dir, LARGE_FILENAME);
+	workload w("seqread");
+	for(size_t offset = 0; offset < size; offset += chunk_size) {
+		size_t res;
+		w.measure([&]() {
+			res = fs.pread(file, offset, buf.data(), chunk_size);
+		});
+		fill(expected, offset);
+		if(res != chunk_size || buf != expected) {
+			fprintf(stderr, "extfs_bench: read back wrong data at offset %zu\n", offset);
+			exit(1);
+		}
+	}
+	fs.close(file);
+	w.report(size);
+}
+
+static void bench_randread(extfs &fs, extfs::pseudofd_t dir) {
+	size_t size = size_mb * 1024 * 1024;
+	std::vector<char> buf(random_read_size);
+	std::mt19937_64 rng(1);
+	auto file = open_file(fs, dir, LARGE_FILENAME);
+	workload w("randread");
+	for(int i = 0; i < num_random_reads; ++i) {
+		size_t offset = rng() % (size / random_read_size) * random_read_size;
+		w.measure([&]() {
+			fs.pread(file, offset, buf.data(), random_read_size);
+		});
+	}
+	fs.close(file);
+	w.report(uint64_t(num_random_reads) * random_read_size);
+}
+
+static void bench_readdir(extfs &fs, extfs::pseudofd_t dir) {
+	std::vector<char> buf(64 * 1024);
+	workload w("readdir");
+	for(int i = 0; i < num_readdirs; ++i) {
+		int entries = 0;
+		w.measure([&]() {
+			// read the directory like a client would: continue after
+			// the last complete entry until the buffer isn't filled
+			cloudabi_dircookie_t cookie = CLOUDABI_DIRCOOKIE_START;
+			size_t res;
+			do {
+				cloudabi_dircookie_t next = cookie;
+				res = fs.readdir(dir, buf.data(), buf.size(), next);
+				size_t pos = 0;
+				while(pos + sizeof(cloudabi_dirent_t) <= res) {
+					cloudabi_dirent_t dirent;
+					memcpy(&dirent, buf.data() + pos, sizeof(dirent));
+					if(pos + sizeof(dirent) + dirent.d_namlen > res) {
+						break;
+					}
+					pos += sizeof(dirent) + dirent.d_namlen;
+					cookie = dirent.d_next;
+					entries++;
+				}
+			} while(res == buf.size());
+		});
+		// the files, the large file, "." and ".."
+		if(entries != num_files + 3) {
+			fprintf(stderr, "extfs_bench: readdir returned %d entries, expected %d\n", entries, num_files + 3);
+			exit(1);
+		}
+	}
+	w.report();
+}
+
+static void bench_unlink(extfs &fs, extfs::pseudofd_t dir) {
+	workload w("unlink");
+	for(int i = 0; i < num_files; ++i) {
+		std::string name = file_name(i);
+		w.measure([&]() {
+			fs.unlink(dir, name.c_str(), name.size(), 0);
+		});
+	}
+	w.measure([&]() {
+		fs.unlink(dir, LARGE_FILENAME, strlen(LARGE_FILENAME), 0);
+	});
+	w.report();
+}
+
+static void usage() {
+	fprintf(stderr, "usage: extfs_bench [-n files] [-s file size in MiB] [-c chunk size]\n"
+		"                   [-r random reads] [-R random read size] [-d readdirs]\n"
+		"                   [-C cache blocks] [-k] image\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[]) {
+	int ch;
+	while((ch = getopt(argc, argv, "n:s:c:r:R:d:C:k")) != -1) {
+		switch(ch) {
+		case 'n': num_files = atoi(optarg); break;
+		case 's': size_mb = strtoul(optarg, nullptr, 10); break;
+		case 'c': chunk_size = strtoul(optarg, nullptr, 10); break;
+		case 'r': num_random_reads = atoi(optarg); break;
+		case 'R': random_read_size = strtoul(optarg, nullptr, 10); break;
+		case 'd': num_readdirs = atoi(optarg); break;
+		case 'C': cache_blocks = strtoul(optarg, nullptr, 10); break;
+		case 'k': keep_files = true; break;
+		default: usage();
+		}
+	}
+	if(optind != argc - 1 || num_files < 0 || size_mb == 0 || chunk_size == 0
+	|| random_read_size == 0 || random_read_size > size_mb * 1024 * 1024) {
+		usage();
+	}
+
+	const char *image = argv[optind];
+	int blockdev = open(image, O_RDWR);
+	if(blockdev < 0) {
+		fprintf(stderr, "extfs_bench: failed to open %s: %s\n", image, strerror(errno));
+		return 1;
+	}
+
+	try {
+		extfs fs(blockdev, 1, -1, cache_blocks);
+		auto root = extfs::pseudofd_t(0);
+		try {
+			fs.create(root, DIRNAME, strlen(DIRNAME), CLOUDABI_FILETYPE_DIRECTORY);
+		} catch(cloudabi_system_error &e) {
+			if(e.error == EEXIST) {
+				fprintf(stderr, "extfs_bench: %s already exists in %s, use a fresh image\n", DIRNAME, image);
+				return 1;
+			}
+			throw;
+		}
+		auto dir = open_file(fs, root, DIRNAME);
+
+		bench_create(fs, dir);
+		bench_seqwrite(fs, dir);
+		bench_seqread(fs, dir);
+		bench_randread(fs, dir);
+		bench_readdir(fs, dir);
+		if(!keep_files) {
+			bench_unlink(fs, dir);
+		}
+
+		fs.close(dir);
+		if(!keep_files) {
+			fs.unlink(root, DIRNAME, strlen(DIRNAME), CLOUDABI_UNLINK_REMOVEDIR);
+		}
+		fs.sync(root);
+		fs.print_cache_statistics();
+	} catch(cloudabi_system_error &e) {
+		fprintf(stderr, "extfs_bench: %s\n", e.what());
+		return 1;
+	}
+
+	close(blockdev);
+	return 0;
+}
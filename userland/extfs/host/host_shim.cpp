@@ -0,0 +1,14 @@
+#include <cosix/reverse.hpp>
+
+// On the host, extfs runs without a kernel: there is no reverse FD to send
+// notifications over and no cache in front of it to invalidate, so the
+// libpseudofd calls that talk to the kernel do nothing.
+
+void cosix::pseudo_fd_becomes_readable(int, pseudofd_t) {
+}
+
+void cosix::pseudo_fd_invalidate_cache(int, pseudofd_t) {
+}
+
+void cosix::pseudo_fd_invalidate_dentries(int, pseudofd_t) {
+}
@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <program.h>
+#include <cloudabi_syscalls.h>
 #include <argdata.h>
 #include <sched.h>
 #include <pthread.h>
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <time.h>
 #include <unistd.h>
+#include <vector>
 #include <errno.h>
 #include <string.h>
 #include <cassert>
@@ -16,6 +21,67 @@ int device = -1;
 int stdout = -1;
 int reversefd = -1;
 int blockdev = -1;
+int cache_blocks = block_cache::DEFAULT_CAPACITY;
+static const int DEFAULT_THREADS = 4;
+int threads = DEFAULT_THREADS;
+atime_update atime = atime_update::relative;
+
+// only one thread waits for and reads a request at a time
+static std::mutex read_mtx;
+static std::atomic<bool> running{true};
+
+static cloudabi_timestamp_t monotonic_now() {
+	cloudabi_timestamp_t ts = 0;
+	cloudabi_sys_clock_time_get(CLOUDABI_CLOCK_MONOTONIC, 0, &ts);
+	return ts;
+}
+
+// Handles requests until the reverse FD fails. Several of these run at the
+// same time; the request is read and its response written under a lock, but
+// it is handled without one, so a request that waits for the block device
+// doesn't hold up requests for other files. A request that fails only gets an
+// error response; it doesn't stop the thread.
+static void handle_requests(extfs *fs) {
+	while(true) {
+		cloudabi_errno_t res;
+		try {
+			res = cosix::handle_request(reversefd, fs, read_mtx, fs->get_reverse_write_mutex());
+		} catch(std::exception &e) {
+			dprintf(stdout, "[extfs] error handling request: %s\n", e.what());
+			continue;
+		}
+		if(res != 0) {
+			dprintf(stdout, "[extfs] error: handle_request failed: %s\n", strerror(res));
+			return;
+		}
+	}
+}
+
+// Metadata that is left dirty by a request is written back
+// WRITE_BACK_INTERVAL later, or earlier if a sync or close asks for it.
+static void write_back_dirty_metadata(extfs *fs) {
+	cloudabi_timestamp_t write_back_at = 0;
+	while(running) {
+		struct timespec ts = {1, 0};
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &ts);
+
+		if(!fs->has_dirty_metadata()) {
+			write_back_at = 0;
+			continue;
+		}
+		auto now = monotonic_now();
+		if(write_back_at == 0) {
+			write_back_at = now + extfs::WRITE_BACK_INTERVAL;
+		} else if(now >= write_back_at) {
+			try {
+				fs->write_back();
+			} catch(cosix::cloudabi_system_error &e) {
+				dprintf(stdout, "[extfs] failed to write back metadata: %s\n", strerror(e.error));
+			}
+			write_back_at = 0;
+		}
+	}
+}
 
 void program_main(const argdata_t *ad) {
 	argdata_map_iterator_t it;
@@ -37,6 +103,21 @@ void program_main(const argdata_t *ad) {
 			argdata_get_int(value, &device);
 		} else if(strcmp(keystr, "blockdev") == 0) {
 			argdata_get_fd(value, &blockdev);
+		} else if(strcmp(keystr, "cache_blocks") == 0) {
+			argdata_get_int(value, &cache_blocks);
+		} else if(strcmp(keystr, "threads") == 0) {
+			argdata_get_int(value, &threads);
+		} else if(strcmp(keystr, "atime") == 0) {
+			const char *str;
+			if(argdata_get_str_c(value, &str) == 0) {
+				if(strcmp(str, "strictatime") == 0) {
+					atime = atime_update::strict;
+				} else if(strcmp(str, "relatime") == 0) {
+					atime = atime_update::relative;
+				} else if(strcmp(str, "noatime") == 0) {
+					atime = atime_update::never;
+				}
+			}
 		}
 		argdata_map_next(&it);
 	}
@@ -51,16 +132,30 @@ void program_main(const argdata_t *ad) {
 		exit(1);
 	}
 
-	cosix::reverse_handler *fs = new extfs(blockdev, device);
+	if(cache_blocks <= 0) {
+		cache_blocks = block_cache::DEFAULT_CAPACITY;
+	}
+	if(threads <= 0) {
+		threads = DEFAULT_THREADS;
+	}
+
+	extfs *fs = new extfs(blockdev, device, reversefd, cache_blocks, atime);
 
 	dprintf(stdout, "[extfs] spawned -- awaiting requests on reverse FD %d\n", reversefd);
 
-	try {
-		cosix::handle_requests(reversefd, fs);
-	} catch(std::runtime_error &e) {
-		dprintf(stdout, "[extfs] error: %s\n", e.what());
+	std::thread write_back_thread(write_back_dirty_metadata, fs);
+	std::vector<std::thread> workers;
+	for(int i = 1; i < threads; ++i) {
+		workers.emplace_back(handle_requests, fs);
+	}
+	handle_requests(fs);
+	for(auto &t : workers) {
+		t.join();
 	}
+	running = false;
+	write_back_thread.join();
 
+	fs->print_cache_statistics();
 	delete fs;
 	close(reversefd);
 	close(blockdev);
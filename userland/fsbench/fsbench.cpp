@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <program.h>
+#include <argdata.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <cosix/bench.hpp>
+
+// Measures sequential write and read throughput of a large file in tmpdir,
+// for every given chunk size.
+
+int stdout = -1;
+int tmpdir = -1;
+int size_mb = 256;
+
+static const char *FILENAME = "fsbench";
+
+static void report(const char *name, size_t chunk, uint64_t bytes, uint64_t ns) {
+	uint64_t kb_per_s = ns == 0 ? 0 : bytes * 1000000000 / 1024 / ns;
+	dprintf(stdout, "fsbench: %-6s %7zu byte chunks: %10llu ns, %8llu KiB/s\n", name, chunk,
+		(unsigned long long)ns, (unsigned long long)kb_per_s);
+}
+
+// every chunk starts with its offset, so misplaced data is detected
+static void fill(std::vector<char> &buf, uint64_t offset) {
+	memset(buf.data(), offset / buf.size(), buf.size());
+	memcpy(buf.data(), &offset, std::min(sizeof(offset), buf.size()));
+}
+
+static void bench_chunk_size(size_t chunk) {
+	uint64_t total = uint64_t(size_mb) * 1024 * 1024;
+	total -= total % chunk;
+
+	int file = openat(tmpdir, FILENAME, O_RDWR | O_CREAT | O_TRUNC);
+	if(file < 0) {
+		dprintf(stdout, "fsbench: opening file failed: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	std::vector<char> buf(chunk);
+	std::vector<char> expect(chunk);
+
+	uint64_t start = cosix::now_ns();
+	for(uint64_t offset = 0; offset < total; offset += chunk) {
+		fill(buf, offset);
+		if(pwrite(file, buf.data(), chunk, offset) != ssize_t(chunk)) {
+			dprintf(stdout, "fsbench: pwrite at %llu failed: %s\n", (unsigned long long)offset, strerror(errno));
+			exit(1);
+		}
+	}
+	if(fsync(file) != 0) {
+		dprintf(stdout, "fsbench: fsync failed: %s\n", strerror(errno));
+		exit(1);
+	}
+	report("write", chunk, total, cosix::now_ns() - start);
+
+	start = cosix::now_ns();
+	for(uint64_t offset = 0; offset < total; offset += chunk) {
+		if(pread(file, buf.data(), chunk, offset) != ssize_t(chunk)) {
+			dprintf(stdout, "fsbench: pread at %llu failed: %s\n", (unsigned long long)offset, strerror(errno));
+			exit(1);
+		}
+		fill(expect, offset);
+		if(memcmp(buf.data(), expect.data(), chunk) != 0) {
+			dprintf(stdout, "fsbench: data read at %llu differs from what was written\n", (unsigned long long)offset);
+			exit(1);
+		}
+	}
+	report("read", chunk, total, cosix::now_ns() - start);
+
+	close(file);
+	unlinkat(tmpdir, FILENAME, 0);
+}
+
+void program_main(const argdata_t *ad) {
+	std::vector<size_t> chunks;
+
+	argdata_map_iterator_t it;
+	const argdata_t *key;
+	const argdata_t *value;
+	argdata_map_iterate(ad, &it);
+	while (argdata_map_get(&it, &key, &value)) {
+		const char *keystr;
+		if(argdata_get_str_c(key, &keystr) != 0) {
+			argdata_map_next(&it);
+			continue;
+		}
+
+		if(strcmp(keystr, "stdout") == 0) {
+			argdata_get_fd(value, &stdout);
+		} else if(strcmp(keystr, "tmpdir") == 0) {
+			argdata_get_fd(value, &tmpdir);
+		} else if(strcmp(keystr, "size_mb") == 0) {
+			argdata_get_int(value, &size_mb);
+		} else if(strcmp(keystr, "chunk") == 0) {
+			int chunk = 0;
+			argdata_get_int(value, &chunk);
+			if(chunk > 0) {
+				chunks.push_back(chunk);
+			}
+		}
+		argdata_map_next(&it);
+	}
+
+	if(tmpdir < 0 || size_mb <= 0) {
+		dprintf(stdout, "fsbench: no tmpdir given, or invalid size\n");
+		exit(1);
+	}
+	if(chunks.empty()) {
+		chunks = {4096, 65536, 1048576};
+	}
+
+	dprintf(stdout, "fsbench: sequential I/O on a %d MiB file\n", size_mb);
+	for(auto chunk : chunks) {
+		bench_chunk_size(chunk);
+	}
+
+	dprintf(stdout, "fsbench: done\n");
+	exit(0);
+}
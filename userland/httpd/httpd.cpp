@@ -5,6 +5,7 @@
 #include <sched.h>
 #include <pthread.h>
 #include <atomic>
+#include <stdexcept>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -22,6 +23,7 @@
 #include <arpa/inet.h>
 
 #include <cosix/networkd.hpp>
+#include <cosix/ring.hpp>
 #include <flower/protocol/server.ad.h>
 #include <flower/protocol/switchboard.ad.h>
 
@@ -35,6 +37,74 @@ using namespace arpc;
 using namespace flower::protocol::server;
 using namespace flower::protocol::switchboard;
 
+static void serve_hello(int client) {
+	char buf[512];
+	buf[0] = 0;
+	strlcat(buf, "HTTP/1.1 200 OK\r\n", sizeof(buf));
+	strlcat(buf, "Server: cosix/0.0\r\n", sizeof(buf));
+	strlcat(buf, "Content-Type: text/html; charset=UTF-8\r\n", sizeof(buf));
+	strlcat(buf, "Transfer-Encoding: chunked\r\n", sizeof(buf));
+	strlcat(buf, "Connection: close\r\n\r\n", sizeof(buf));
+	strlcat(buf, "40\r\n", sizeof(buf));
+	strlcat(buf, "<!DOCTYPE html><html><body><h1>Hello world!</h1></body></html>\r\n\r\n0\r\n\r\n", sizeof(buf));
+
+	write(client, buf, strlen(buf));
+}
+
+// Copy the file from offset on through our own buffer
+static void copy_file(int client, int file, off_t offset, off_t size) {
+	char buf[4096];
+	while(offset < size) {
+		ssize_t count = pread(file, buf, sizeof(buf), offset);
+		if(count <= 0) {
+			if(count < 0) {
+				dprintf(stdout, "httpd: read failed: %s\n", strerror(errno));
+			}
+			return;
+		}
+		for(ssize_t written = 0; written < count;) {
+			ssize_t res = write(client, buf + written, count - written);
+			if(res <= 0) {
+				dprintf(stdout, "httpd: write failed: %s\n", strerror(errno));
+				return;
+			}
+			written += res;
+		}
+		offset += count;
+	}
+}
+
+// Serve a file with the kernel moving its contents straight from the
+// filesystem to the socket, instead of through our buffers. If the ring
+// can't be used, serve the rest of it with plain reads and writes.
+static void serve_file(int client, int file, off_t size) {
+	char buf[512];
+	snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n"
+		"Server: cosix/0.0\r\n"
+		"Content-Type: text/html; charset=UTF-8\r\n"
+		"Content-Length: %lld\r\n"
+		"Connection: close\r\n\r\n", (long long)size);
+	write(client, buf, strlen(buf));
+
+	off_t offset = 0;
+	try {
+		cosix::ring ring;
+		while(offset < size) {
+			ssize_t moved = ring.splice(file, offset, client, size - offset);
+			if(moved <= 0) {
+				if(moved < 0) {
+					dprintf(stdout, "httpd: splice failed: %s\n", strerror(errno));
+				}
+				return;
+			}
+			offset += moved;
+		}
+	} catch(std::runtime_error &e) {
+		dprintf(stdout, "httpd: %s, falling back to read and write\n", e.what());
+		copy_file(client, file, offset, size);
+	}
+}
+
 class WebServer : public flower::protocol::server::Server::Service {
 public:
 	virtual ~WebServer() {}
@@ -42,17 +112,16 @@ public:
 	Status Connect(ServerContext*, const ConnectRequest *request, ConnectResponse*) override {
 		auto client = request->client();
 		std::thread thr([client]() {
-			char buf[512];
-			buf[0] = 0;
-			strlcat(buf, "HTTP/1.1 200 OK\r\n", sizeof(buf));
-			strlcat(buf, "Server: cosix/0.0\r\n", sizeof(buf));
-			strlcat(buf, "Content-Type: text/html; charset=UTF-8\r\n", sizeof(buf));
-			strlcat(buf, "Transfer-Encoding: chunked\r\n", sizeof(buf));
-			strlcat(buf, "Connection: close\r\n\r\n", sizeof(buf));
-			strlcat(buf, "40\r\n", sizeof(buf));
-			strlcat(buf, "<!DOCTYPE html><html><body><h1>Hello world!</h1></body></html>\r\n\r\n0\r\n\r\n", sizeof(buf));
-
-			write(client->get(), buf, strlen(buf));
+			int file = tmpdir >= 0 ? openat(tmpdir, "index.html", O_RDONLY) : -1;
+			struct stat sb;
+			if(file >= 0 && fstat(file, &sb) == 0) {
+				serve_file(client->get(), file, sb.st_size);
+			} else {
+				serve_hello(client->get());
+			}
+			if(file >= 0) {
+				close(file);
+			}
 
 			// Wait for the client to close the connection.
 			shutdown(client->get(), SHUT_WR);
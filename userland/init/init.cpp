@@ -46,6 +46,14 @@ struct cmdlinefs {
 
 cmdlinefs configfs_spec;
 int last_deviceid = 0;
+// number of blocks extfs keeps in its block cache, 0 for its default
+int extfs_cache_blocks = 0;
+// number of threads handling extfs requests, 0 for its default
+int extfs_threads = 0;
+// maximum size of the tmpfs in MiB, 0 for no limit
+int tmpfs_size_mb = 0;
+// when extfs updates access times: strictatime, relatime or noatime
+std::string extfs_atime = "relatime";
 int configfs = -1;
 int tmpfs = -1;
 
@@ -65,6 +73,14 @@ static cmdlinefs parse_cmdlinefs(std::string value) {
 static void parse_cmdline_key(std::string key, std::string value) {
 	if(key == "cosix.config") {
 		configfs_spec = parse_cmdlinefs(value);
+	} else if(key == "cosix.extfs_cache_blocks") {
+		extfs_cache_blocks = strtol(value.c_str(), nullptr, 10);
+	} else if(key == "cosix.extfs_threads") {
+		extfs_threads = strtol(value.c_str(), nullptr, 10);
+	} else if(key == "cosix.tmpfs_size_mb") {
+		tmpfs_size_mb = strtol(value.c_str(), nullptr, 10);
+	} else if(key == "cosix.extfs_atime") {
+		extfs_atime = value;
 	} else {
 		// ignore key, it's not for us
 	}
@@ -417,6 +433,10 @@ static int mount_filesystem(cmdlinefs spec) {
 		argdata_create_string("reversefd"),
 		argdata_create_string("deviceid"),
 		argdata_create_string("blockdev"),
+		argdata_create_string("cache_blocks"),
+		argdata_create_string("atime"),
+		argdata_create_string("threads"),
+		argdata_create_string("size_mb"),
 	};
 	auto *blockdev_ad = blockdev < 0 ? &argdata_null : argdata_create_fd(blockdev);
 	argdata_t const *values[] = {
@@ -424,6 +444,10 @@ static int mount_filesystem(cmdlinefs spec) {
 		argdata_create_fd(pseudopair.first),
 		argdata_create_int(spec.deviceid),
 		blockdev_ad,
+		argdata_create_int(extfs_cache_blocks),
+		argdata_create_string(extfs_atime.c_str()),
+		argdata_create_int(extfs_threads),
+		argdata_create_int(tmpfs_size_mb),
 	};
 	argdata_t *ad = argdata_create_map(keys, values, sizeof(keys) / sizeof(keys[0]));
 
@@ -0,0 +1,74 @@
+#include <cosix/bench.hpp>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct benchmark_sender {
+	int out;
+	const char *prefix;
+	int fd;
+	size_t message_size;
+	size_t total_size;
+};
+
+static void *benchmark_send_thread(void *s) {
+	auto *sender = reinterpret_cast<benchmark_sender*>(s);
+	char *buf = reinterpret_cast<char*>(malloc(sender->message_size));
+	memset(buf, 'x', sender->message_size);
+	size_t sent = 0;
+	while(sent < sender->total_size) {
+		ssize_t res = write(sender->fd, buf, sender->message_size);
+		if(res < 0 && errno == EAGAIN) {
+			// the receiving buffer is full, let the reader catch up
+			sched_yield();
+			continue;
+		} else if(res < 0) {
+			dprintf(sender->out, "%s tx failed: %s\n", sender->prefix, strerror(errno));
+			break;
+		}
+		sent += res;
+	}
+	free(buf);
+	close(sender->fd);
+	return nullptr;
+}
+
+void cosix::benchmark_throughput(int out, const char *prefix, int rfd, int wfd, size_t message_size, size_t total_size) {
+	benchmark_sender sender = {out, prefix, wfd, message_size, total_size};
+	char *buf = reinterpret_cast<char*>(malloc(message_size));
+
+	uint64_t start = now_ns();
+	pthread_t thread;
+	pthread_create(&thread, NULL, benchmark_send_thread, &sender);
+
+	size_t received = 0;
+	size_t reads = 0;
+	while(true) {
+		ssize_t count = read(rfd, buf, message_size);
+		if(count < 0) {
+			dprintf(out, "%s rx failed: %s\n", prefix, strerror(errno));
+			break;
+		} else if(count == 0) {
+			break;
+		}
+		received += count;
+		reads++;
+	}
+	pthread_join(thread, nullptr);
+	uint64_t elapsed_us = (now_ns() - start) / 1000;
+	close(rfd);
+	free(buf);
+
+	if(elapsed_us == 0) {
+		elapsed_us = 1;
+	}
+	dprintf(out, "%s %6zu byte messages: %zu bytes in %zu reads, %llu us, %llu KiB/s\n",
+		prefix, message_size, received, reads,
+		static_cast<unsigned long long>(elapsed_us),
+		static_cast<unsigned long long>(uint64_t(received) * 1000000 / 1024 / elapsed_us));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace cosix {
+
+/* The current monotonic time in nanoseconds. This function is inline so that
+ * benchmarks running on the host can use it without the rest of libcosix.
+ */
+inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* Sends total_size bytes in messages of message_size bytes from a thread
+ * writing to wfd, reads them from rfd until EOF and prints the throughput to
+ * out, each line starting with prefix. Closes both rfd and wfd.
+ */
+void benchmark_throughput(int out, const char *prefix, int rfd, int wfd, size_t message_size, size_t total_size);
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <cloudabi_types.h>
+#include <vector>
+#include "../../../fd/ring_proto.hpp"
+
+namespace cosix {
+
+using ring_proto::submission_t;
+using ring_proto::completion_t;
+
+/** A submission/completion ring. Operations are queued with the prepare_*
+ * functions, and executed by the kernel in order with a single call to
+ * submit(). Their results are then taken with reap(). Every operation
+ * carries a user_data value that is returned in its completion.
+ *
+ * Operations are executed synchronously during submit(), so an operation
+ * that blocks also blocks the ones queued after it.
+ */
+struct ring {
+	ring();
+	~ring();
+
+	ring(ring const&) = delete;
+	ring &operator=(ring const&) = delete;
+
+	inline int get_fd() { return fd; }
+
+	void prepare_nop(uint64_t user_data);
+	void prepare_read(int fd, void *buf, size_t nbyte, uint64_t user_data);
+	void prepare_write(int fd, const void *buf, size_t nbyte, uint64_t user_data);
+	void prepare_pread(int fd, void *buf, size_t nbyte, uint64_t offset, uint64_t user_data);
+	void prepare_pwrite(int fd, const void *buf, size_t nbyte, uint64_t offset, uint64_t user_data);
+	void prepare_sock_recv(int fd, const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, uint64_t user_data);
+	void prepare_sock_send(int fd, const cloudabi_send_in_t *in, cloudabi_send_out_t *out, uint64_t user_data);
+	/** Move nbyte bytes from in to out within the kernel. */
+	void prepare_splice(int in, int out, size_t nbyte, uint64_t user_data);
+	/** Like prepare_splice(), but read in at offset, like pread(). */
+	void prepare_splice_at(int in, uint64_t offset, int out, size_t nbyte, uint64_t user_data);
+	void prepare_poll(const cloudabi_subscription_t *in, cloudabi_event_t *out, size_t nsubscriptions, uint64_t user_data);
+
+	/** Make the last prepared operation cancel the ones after it in the
+	 * same submit() if it fails. */
+	void link_last();
+
+	/** The number of operations prepared, but not submitted yet. */
+	inline size_t pending() { return submissions.size(); }
+
+	/** Submit all prepared operations to the kernel. Returns the number
+	 * of operations submitted; if the completion ring is full, fewer
+	 * than pending() may be submitted, and the rest stays pending. */
+	size_t submit();
+
+	/** Take up to max completions from the ring, without blocking.
+	 * Returns the number of completions taken. */
+	size_t reap(completion_t *out, size_t max);
+
+	/** Submit all prepared operations and wait for all their
+	 * completions, appending them to out. */
+	void submit_and_reap(std::vector<completion_t> &out);
+
+	/** Move up to nbyte bytes from in to out within the kernel, reading
+	 * in at offset if it is nonnegative. Returns the number of bytes
+	 * moved, or -1 and sets errno. */
+	ssize_t splice(int in, off_t offset, int out, size_t nbyte);
+
+private:
+	submission_t &prepare(submission_t::operation op, int fd, uint64_t user_data);
+
+	int fd;
+	std::vector<submission_t> submissions;
+};
+
+}
@@ -0,0 +1,165 @@
+#include <cosix/ring.hpp>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <cloudabi_syscalls.h>
+#include <stdexcept>
+#include <string>
+
+using namespace cosix;
+
+ring::ring() {
+	cloudabi_fd_t ringfd;
+	cloudabi_errno_t res = cloudabi_sys_fd_create1(ring_proto::filetype_ring, &ringfd);
+	if(res != 0) {
+		throw std::runtime_error("Failed to create ring: " + std::string(strerror(res)));
+	}
+	fd = ringfd;
+}
+
+ring::~ring() {
+	close(fd);
+}
+
+submission_t &ring::prepare(submission_t::operation op, int target, uint64_t user_data) {
+	submissions.emplace_back();
+	auto &s = submissions.back();
+	s.op = op;
+	s.fd = target;
+	s.user_data = user_data;
+	return s;
+}
+
+void ring::prepare_nop(uint64_t user_data) {
+	prepare(submission_t::operation::nop, -1, user_data);
+}
+
+void ring::prepare_read(int target, void *buf, size_t nbyte, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::read, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(buf);
+	s.length = nbyte;
+}
+
+void ring::prepare_write(int target, const void *buf, size_t nbyte, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::write, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(buf);
+	s.length = nbyte;
+}
+
+void ring::prepare_pread(int target, void *buf, size_t nbyte, uint64_t offset, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::pread, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(buf);
+	s.length = nbyte;
+	s.offset = offset;
+}
+
+void ring::prepare_pwrite(int target, const void *buf, size_t nbyte, uint64_t offset, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::pwrite, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(buf);
+	s.length = nbyte;
+	s.offset = offset;
+}
+
+void ring::prepare_sock_recv(int target, const cloudabi_recv_in_t *in, cloudabi_recv_out_t *out, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::sock_recv, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(in);
+	s.addr2 = reinterpret_cast<uintptr_t>(out);
+}
+
+void ring::prepare_sock_send(int target, const cloudabi_send_in_t *in, cloudabi_send_out_t *out, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::sock_send, target, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(in);
+	s.addr2 = reinterpret_cast<uintptr_t>(out);
+}
+
+void ring::prepare_splice(int in, int out, size_t nbyte, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::splice, in, user_data);
+	s.fd2 = out;
+	s.length = nbyte;
+}
+
+void ring::prepare_splice_at(int in, uint64_t offset, int out, size_t nbyte, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::splice, in, user_data);
+	s.fd2 = out;
+	s.length = nbyte;
+	s.offset = offset;
+	s.flags |= ring_proto::splice_at_offset;
+}
+
+void ring::prepare_poll(const cloudabi_subscription_t *in, cloudabi_event_t *out, size_t nsubscriptions, uint64_t user_data) {
+	auto &s = prepare(submission_t::operation::poll, -1, user_data);
+	s.addr = reinterpret_cast<uintptr_t>(in);
+	s.addr2 = reinterpret_cast<uintptr_t>(out);
+	s.length = nsubscriptions;
+}
+
+void ring::link_last() {
+	if(submissions.empty()) {
+		throw std::logic_error("No operation to link");
+	}
+	submissions.back().flags |= ring_proto::link;
+}
+
+size_t ring::submit() {
+	if(submissions.empty()) {
+		return 0;
+	}
+	ssize_t res = write(fd, submissions.data(), submissions.size() * sizeof(submission_t));
+	if(res < 0) {
+		if(errno == EAGAIN) {
+			return 0;
+		}
+		throw std::runtime_error("Failed to submit to ring: " + std::string(strerror(errno)));
+	}
+	size_t submitted = res / sizeof(submission_t);
+	submissions.erase(submissions.begin(), submissions.begin() + submitted);
+	return submitted;
+}
+
+size_t ring::reap(completion_t *out, size_t max) {
+	ssize_t res = read(fd, out, max * sizeof(completion_t));
+	if(res < 0) {
+		if(errno == EAGAIN) {
+			return 0;
+		}
+		throw std::runtime_error("Failed to reap from ring: " + std::string(strerror(errno)));
+	}
+	return res / sizeof(completion_t);
+}
+
+void ring::submit_and_reap(std::vector<completion_t> &out) {
+	completion_t completions[ring_proto::max_completions];
+	while(!submissions.empty()) {
+		size_t submitted = submit();
+		// completions of this ring only come from our own submissions,
+		// so if none could be submitted, reaping makes room
+		size_t reaped = reap(completions, ring_proto::max_completions);
+		if(submitted == 0 && reaped == 0) {
+			throw std::runtime_error("Ring is full, but has no completions");
+		}
+		out.insert(out.end(), completions, completions + reaped);
+	}
+	size_t reaped;
+	while((reaped = reap(completions, ring_proto::max_completions)) > 0) {
+		out.insert(out.end(), completions, completions + reaped);
+	}
+}
+
+ssize_t ring::splice(int in, off_t offset, int out, size_t nbyte) {
+	if(offset >= 0) {
+		prepare_splice_at(in, offset, out, nbyte, 0);
+	} else {
+		prepare_splice(in, out, nbyte, 0);
+	}
+	std::vector<completion_t> completions;
+	submit_and_reap(completions);
+	if(completions.size() != 1) {
+		throw std::logic_error("Unexpected number of completions for splice");
+	}
+	if(completions[0].result < 0) {
+		errno = -completions[0].result;
+		return -1;
+	}
+	return completions[0].result;
+}
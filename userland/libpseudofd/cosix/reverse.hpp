@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include <stdexcept>
 #include <cloudabi_types.h>
 #include <stdio.h>
@@ -24,6 +25,11 @@ void write_response(int reversefd, reverse_response_t *response, char *buf);
 // 0 if a request was successfully handled, or an error otherwise.
 cloudabi_errno_t handle_request(int reversefd, reverse_handler *h, cloudabi_timestamp_t poll_timeout = 0);
 cloudabi_errno_t handle_request(int reversefd, reverse_handler *h, std::mutex&, cloudabi_timestamp_t poll_timeout = 0);
+// for several threads handling requests from the same reverse FD: one thread
+// at a time reads a request under read_mtx, responses are written under
+// write_mtx, and requests are handled concurrently in between. The handler
+// must take write_mtx as well for any gratituous messages it sends.
+cloudabi_errno_t handle_request(int reversefd, reverse_handler *h, std::mutex &read_mtx, std::mutex &write_mtx, cloudabi_timestamp_t poll_timeout = 0);
 void handle_requests(int reversefd, reverse_handler *h);
 
 // notify the kernel that the pseudo FD becomes readable
@@ -31,6 +37,16 @@ void handle_requests(int reversefd, reverse_handler *h);
 // It is safe to call while handling a request.
 void pseudo_fd_becomes_readable(int reversefd, pseudofd_t);
 
+// notify the kernel that the contents of the pseudo FD changed, so that it
+// drops the pages it cached for it. Like pseudo_fd_becomes_readable(), this
+// is not threadsafe, but safe to call while handling a request.
+void pseudo_fd_invalidate_cache(int reversefd, pseudofd_t);
+
+// notify the kernel that entries in the pseudo FD directory were created,
+// removed or changed other than through this pseudo FD, so that it drops the
+// lookups it cached for it. Not threadsafe, but safe while handling a request.
+void pseudo_fd_invalidate_dentries(int reversefd, pseudofd_t);
+
 // Pseudo-related calls to the kernel
 // returns (reverse, pseudo)
 std::pair<int, int> open_pseudo(int ifstorefd, cloudabi_filetype_t type);
@@ -62,6 +78,11 @@ struct reverse_handler {
 	virtual ~reverse_handler();
 
 	virtual file_entry lookup(pseudofd_t pseudo, const char *file, size_t len, cloudabi_oflags_t oflags, cloudabi_filestat_t *statbuf);
+	// Like lookup() without oflags, but looks the file up in the directory
+	// with the given inode, on the same filesystem as the pseudo FD. The
+	// default implementation throws ENOSYS, after which the kernel opens
+	// the directory and uses lookup() instead.
+	virtual file_entry lookup_inode(pseudofd_t pseudo, cloudabi_inode_t directory, const char *file, size_t len, cloudabi_filestat_t *statbuf);
 
 	virtual std::pair<pseudofd_t, cloudabi_filetype_t> open(cloudabi_inode_t inode);
 	virtual size_t readlink(pseudofd_t pseudo, const char *filename, size_t len, char *buf, size_t buflen);
@@ -78,6 +99,11 @@ struct reverse_handler {
 	virtual void datasync(pseudofd_t pseudo);
 	virtual void sync(pseudofd_t pseudo);
 	virtual size_t readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie);
+	// Like readdir(), but writes records of a cloudabi_dirent_t, followed by the
+	// cloudabi_filestat_t of the entry and its name. Only whole records are
+	// written. The default implementation throws ENOSYS, after which the
+	// kernel falls back to readdir().
+	virtual size_t readdirplus(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie);
 	virtual size_t sock_recv(pseudofd_t pseudo, char *dest, size_t requested);
 	virtual void sock_send(pseudofd_t pseudo, const char *buf, size_t length);
 	virtual void stat_fget(pseudofd_t pseudo, cloudabi_filestat_t *statbuf);
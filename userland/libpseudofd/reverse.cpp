@@ -1,10 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <program.h>
-#include <argdata.h>
-#include <sched.h>
-#include <pthread.h>
-#include <atomic>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -29,6 +24,10 @@ file_entry reverse_handler::lookup(pseudofd_t, const char*, size_t, cloudabi_ofl
 	throw cloudabi_system_error(EINVAL);
 }
 
+file_entry reverse_handler::lookup_inode(pseudofd_t, cloudabi_inode_t, const char*, size_t, cloudabi_filestat_t*) {
+	throw cloudabi_system_error(ENOSYS);
+}
+
 std::pair<pseudofd_t, cloudabi_filetype_t> reverse_handler::open(cloudabi_inode_t) {
 	throw cloudabi_system_error(EINVAL);
 }
@@ -89,6 +88,10 @@ size_t reverse_handler::readdir(pseudofd_t, char*, size_t, cloudabi_dircookie_t&
 	throw cloudabi_system_error(EINVAL);
 }
 
+size_t reverse_handler::readdirplus(pseudofd_t, char*, size_t, cloudabi_dircookie_t&) {
+	throw cloudabi_system_error(ENOSYS);
+}
+
 void reverse_handler::stat_fget(pseudofd_t, cloudabi_filestat_t*) {
 	throw cloudabi_system_error(EINVAL);
 }
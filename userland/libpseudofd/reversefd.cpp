@@ -16,6 +16,7 @@
 
 #include <string>
 #include <atomic>
+#include <new>
 
 using namespace cosix;
 
@@ -25,7 +26,9 @@ char *cosix::handle_request(reverse_request_t *request, char *buf, reverse_respo
 	response->flags = 0;
 	response->send_length = 0;
 	response->recv_length = 0;
+	response->tag = request->tag;
 	char *res = nullptr;
+	bool failed = false;
 
 	try {
 		switch(request->op) {
@@ -45,6 +48,14 @@ char *cosix::handle_request(reverse_request_t *request, char *buf, reverse_respo
 			response->result = file_entry.inode;
 			break;
 		}
+		case op::lookup_inode: {
+			response->send_length = sizeof(cloudabi_filestat_t);
+			res = reinterpret_cast<char*>(malloc(response->send_length));
+			auto statbuf = reinterpret_cast<cloudabi_filestat_t*>(res);
+			auto file_entry = h->lookup_inode(request->pseudofd, request->inode, buf, request->send_length, statbuf);
+			response->result = file_entry.inode;
+			break;
+		}
 		case op::open:
 			std::tie(response->result, response->flags) = h->open(request->inode);
 			break;
@@ -95,6 +106,13 @@ char *cosix::handle_request(reverse_request_t *request, char *buf, reverse_respo
 			response->result = cookie;
 			break;
 		}
+		case op::readdirplus: {
+			cloudabi_dircookie_t cookie = request->flags;
+			res = reinterpret_cast<char*>(malloc(request->recv_length));
+			response->send_length = h->readdirplus(request->pseudofd, res, request->recv_length, cookie);
+			response->result = cookie;
+			break;
+		}
 		case op::stat_fput: {
 			if(request->send_length != sizeof(cloudabi_filestat_t)) {
 				throw cloudabi_system_error(EIO);
@@ -198,6 +216,17 @@ char *cosix::handle_request(reverse_request_t *request, char *buf, reverse_respo
 		}
 	} catch(cloudabi_system_error &e) {
 		response->result = -e.error;
+		failed = true;
+	} catch(std::bad_alloc&) {
+		response->result = -ENOMEM;
+		failed = true;
+	} catch(std::exception &e) {
+		// a bug in the handler; fail this request, but keep serving others
+		fprintf(stderr, "[reverse] failed to handle request %d: %s\n", int(request->op), e.what());
+		response->result = -EIO;
+		failed = true;
+	}
+	if(failed) {
 		response->flags = 0;
 		response->send_length = 0;
 		response->recv_length = 0;
@@ -318,6 +347,38 @@ cloudabi_errno_t cosix::handle_request(int reversefd, reverse_handler *h, std::m
 	return res;
 }
 
+cloudabi_errno_t cosix::handle_request(int reversefd, reverse_handler *h, std::mutex &read_mtx, std::mutex &write_mtx, cloudabi_timestamp_t poll_timeout) {
+	reverse_request_t request;
+	reverse_response_t response;
+
+	char *buf = nullptr, *resbuf = nullptr;
+	cloudabi_errno_t res = 0;
+	try {
+		{
+			// only one thread waits for the next request at a time
+			std::lock_guard<std::mutex> lock(read_mtx);
+			if(poll_timeout != 0) {
+				res = wait_for_request(reversefd, poll_timeout);
+				if(res != 0) {
+					return res;
+				}
+			}
+			buf = read_request(reversefd, &request);
+		}
+		resbuf = handle_request(&request, buf, &response, h);
+		{
+			std::lock_guard<std::mutex> lock(write_mtx);
+			write_response(reversefd, &response, resbuf);
+		}
+	} catch(cloudabi_system_error &e) {
+		res = e.error;
+	}
+
+	free(buf);
+	free(resbuf);
+	return res;
+}
+
 cloudabi_errno_t cosix::handle_request(int reversefd, reverse_handler *h, cloudabi_timestamp_t poll_timeout) {
 	// always-unlocked mtx
 	std::mutex mtx;
@@ -337,12 +398,30 @@ void cosix::pseudo_fd_becomes_readable(int reversefd, pseudofd_t pseudo) {
 	reverse_response_t response;
 	response.gratituous = true;
 	response.result = pseudo;
-	response.flags = 1; /* pseudo became readable */
+	response.flags = reverse_proto::became_readable;
 	char *msg = reinterpret_cast<char*>(&response);
 	write(reversefd, msg, sizeof(response));
 	// TODO: response.recv_length = bytes that are readable now
 }
 
+void cosix::pseudo_fd_invalidate_cache(int reversefd, pseudofd_t pseudo) {
+	reverse_response_t response;
+	response.gratituous = true;
+	response.result = pseudo;
+	response.flags = reverse_proto::invalidate_cache;
+	char *msg = reinterpret_cast<char*>(&response);
+	write(reversefd, msg, sizeof(response));
+}
+
+void cosix::pseudo_fd_invalidate_dentries(int reversefd, pseudofd_t pseudo) {
+	reverse_response_t response;
+	response.gratituous = true;
+	response.result = pseudo;
+	response.flags = reverse_proto::invalidate_dentries;
+	char *msg = reinterpret_cast<char*>(&response);
+	write(reversefd, msg, sizeof(response));
+}
+
 std::pair<int, int> cosix::open_pseudo(int ifstore, cloudabi_filetype_t type) {
 	std::string message = "PSEUDOPAIR " + std::to_string(int(type));
 	write(ifstore, message.c_str(), message.size());
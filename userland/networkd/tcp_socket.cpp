@@ -3,13 +3,49 @@
 #include <arpa/inet.h>
 #include "ip.hpp"
 #include "arp.hpp"
+#include <algorithm>
 #include <cassert>
+#include <string.h>
 
 using namespace cosix;
 using namespace networkd;
 
 #define TCP_SEGMENT_ACK_TIMEOUT 5ull * 1000 * 1000 * 1000 /* 5 seconds */
 
+// TODO: instead of hardcoding MTU, request it from interface (also, don't
+// assume ethernet frame will be used eventually)
+#define TCP_MAX_MSS (1500 - sizeof(tcp_header) - sizeof(ip_header) - 18 /* eth frame + checksum */)
+
+#define TCP_OPTION_END 0
+#define TCP_OPTION_NOP 1
+#define TCP_OPTION_MSS 2
+#define TCP_OPTION_WINDOW_SCALE 3
+
+// the largest window scale allowed by RFC 7323
+#define TCP_MAX_WINDOW_SHIFT 14
+
+// The options sent along with a SYN: our MSS and, if window_scale is set,
+// our window scale. The result is padded to a multiple of 4 bytes.
+static std::string syn_options(bool window_scale) {
+	uint16_t mss = htons(TCP_MAX_MSS);
+	std::string options;
+	options += char(TCP_OPTION_MSS);
+	options += char(4);
+	options.append(reinterpret_cast<const char*>(&mss), sizeof(mss));
+	if(window_scale) {
+		options += char(TCP_OPTION_NOP);
+		options += char(TCP_OPTION_WINDOW_SCALE);
+		options += char(3);
+		options += char(TCP_WINDOW_SHIFT);
+	}
+	return options;
+}
+
+// wrap-around safe comparison of sequence numbers
+static bool seq_before_or_at(uint32_t a, uint32_t b) {
+	return int32_t(b - a) >= 0;
+}
+
 tcp_socket::tcp_socket(std::string l_ip, uint16_t l_p, std::string p_ip, uint16_t p_p, int r)
 : ip_socket(transport_proto::tcp, l_ip, l_p, p_ip, p_p, r)
 , status(sockstatus_t::CONNECTING)
@@ -33,7 +69,7 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 	assert(htons(hdr->source_port) == get_peer_port());
 
 	uint16_t header_size = hdr->data_off * 4;
-	if(header_size < sizeof(tcp_header)) {
+	if(header_size < sizeof(tcp_header) || header_size > tcp_length) {
 		// TCP header including options don't fit
 		return false;
 	}
@@ -42,9 +78,8 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 
 	std::lock_guard<std::mutex> lock(wc_mtx);
 
-	// TODO: handle out-of-order data
-	if(!hdr->flag_syn && htonl(hdr->seqnum) != send_ack_num) {
-		dprintf(0, "Dropped TCP data because sequence number is not as expected (%d vs %d)\n", htonl(hdr->seqnum), send_ack_num);
+	if(hdr->flag_syn) {
+		received_syn_options(hdr);
 	}
 
 	if(status == sockstatus_t::CONNECTING) {
@@ -58,6 +93,8 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 			}
 			// incoming connection approval!
 			send_ack_num = htonl(hdr->seqnum) + 1;
+			// the window in a SYN is never scaled
+			peer_window = ntohs(hdr->window);
 			received_acknum(htonl(hdr->acknum));
 			send_tcp_frame(false /* syn */, true /* ack */);
 			status = sockstatus_t::CONNECTED;
@@ -67,6 +104,7 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 			// two machines were connecting to each other simultaneously. Send
 			// SYN|ACK instead.
 			send_ack_num = htonl(hdr->seqnum) + 1;
+			peer_window = ntohs(hdr->window);
 			send_tcp_frame(true /* syn */, true /* ack */);
 			send_seq_num++;
 			status = sockstatus_t::CONNECTED;
@@ -97,18 +135,37 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 	|| status == sockstatus_t::SHUTDOWN);
 
 	// this is a connected socket, IPs and ports match, meant for us
+	uint32_t seqnum = htonl(hdr->seqnum);
 	if(hdr->flag_ack) {
 		received_acknum(htonl(hdr->acknum));
+		peer_window = size_t(ntohs(hdr->window)) << peer_window_shift;
+		// the ACK and the new window may allow more data to be sent, and
+		// make room in the send buffer for blocked senders
+		fill_send_window();
 		pump_segment_queue();
+		send_space_cv.notify_all();
 	}
 
 	if(payload_length > 0) {
-		// extra data
-		recv_buffer.append(std::string(frame + payload_offset, payload_length));
-		// TODO: handle overflow of sequence numbers
-		send_ack_num += payload_length;
-		send_tcp_frame(false /* syn */, true /* ack */);
-		becomes_readable();
+		if(seqnum != send_ack_num) {
+			// TODO: handle out-of-order data; for now, drop it and ACK what
+			// we have, so the peer retransmits from there
+			dprintf(0, "Dropped TCP data because sequence number is not as expected (%u vs %u)\n", seqnum, send_ack_num);
+			send_tcp_frame(false /* syn */, true /* ack */);
+			return true;
+		}
+		// only take what fits in the receive buffer; if the peer sends
+		// beyond our window, it will retransmit the rest
+		size_t accepted = std::min(payload_length, TCP_RECV_BUFFER_SIZE - recv_buffer.size());
+		recv_buffer.append(frame + payload_offset, accepted);
+		send_ack_num += accepted;
+		// a FIN is ACKed below, if all data before it was accepted
+		if(!hdr->flag_fin || accepted != payload_length) {
+			send_tcp_frame(false /* syn */, true /* ack */);
+		}
+		if(accepted > 0) {
+			becomes_readable();
+		}
 	}
 
 	if(hdr->flag_psh) {
@@ -123,7 +180,7 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 		return true;
 	}
 
-	if(hdr->flag_fin) {
+	if(hdr->flag_fin && seqnum + payload_length == send_ack_num) {
 		// other side is closing their part of the connection
 		if(status == sockstatus_t::CONNECTED) {
 			status = sockstatus_t::THEIRS_SHUTDOWN;
@@ -134,11 +191,55 @@ bool tcp_socket::handle_packet(std::shared_ptr<interface>, const char *frame, si
 		send_tcp_frame(false, true /* ack */);
 		becomes_readable();
 		return true;
+	} else if(hdr->flag_fin && seqnum + payload_length + 1 == send_ack_num) {
+		// retransmitted FIN, our ACK must have been lost
+		send_tcp_frame(false, true /* ack */);
 	}
 
 	return true;
 }
 
+void tcp_socket::received_syn_options(tcp_header const *hdr)
+{
+	const char *options = reinterpret_cast<const char*>(hdr) + sizeof(tcp_header);
+	size_t length = hdr->data_off * 4 - sizeof(tcp_header);
+	bool peer_window_scale = false;
+	uint8_t shift = 0;
+	for(size_t i = 0; i < length;) {
+		uint8_t kind = options[i];
+		if(kind == TCP_OPTION_END) {
+			break;
+		} else if(kind == TCP_OPTION_NOP) {
+			i++;
+			continue;
+		}
+		if(i + 2 > length) {
+			break;
+		}
+		uint8_t option_length = options[i + 1];
+		if(option_length < 2 || i + option_length > length) {
+			dprintf(0, "Ignoring malformed TCP options\n");
+			break;
+		}
+		if(kind == TCP_OPTION_MSS && option_length == 4) {
+			uint16_t mss;
+			memcpy(&mss, options + i + 2, sizeof(mss));
+			peer_mss = std::max<uint16_t>(ntohs(mss), 1);
+		} else if(kind == TCP_OPTION_WINDOW_SCALE && option_length == 3) {
+			peer_window_scale = true;
+			shift = std::min<uint8_t>(options[i + 2], TCP_MAX_WINDOW_SHIFT);
+		}
+		i += option_length;
+	}
+
+	// Windows are only scaled if both sides sent the option in their SYN.
+	// If we're the one answering with a SYN|ACK, we only send it if the
+	// peer did.
+	window_scaling = peer_window_scale;
+	peer_window_shift = window_scaling ? shift : 0;
+	window_shift = window_scaling ? TCP_WINDOW_SHIFT : 0;
+}
+
 void tcp_socket::pwrite(pseudofd_t p, off_t, const char *msg, size_t len)
 {
 	return sock_send(p, msg, len);
@@ -149,11 +250,34 @@ void tcp_socket::sock_send(pseudofd_t p, const char *msg, size_t len)
 	(void)p;
 	assert(p == 0);
 
-	if(status != sockstatus_t::CONNECTED && status != sockstatus_t::THEIRS_SHUTDOWN) {
-		throw cloudabi_system_error(EPIPE);
-	}
+	std::unique_lock<std::mutex> lock(wc_mtx);
+	while(true) {
+		if(status != sockstatus_t::CONNECTED && status != sockstatus_t::THEIRS_SHUTDOWN) {
+			throw cloudabi_system_error(EPIPE);
+		}
+
+		size_t space = TCP_SEND_BUFFER_SIZE - send_buffer.size();
+		size_t queued = std::min(space, len);
+		send_buffer.append(msg, queued);
+		msg += queued;
+		len -= queued;
+		fill_send_window();
+		if(len == 0) {
+			return;
+		}
 
-	send_tcp_frame(false /* syn */, true /* ack */, std::string(msg, len));
+		// Wait for the peer to ACK data, so it leaves the send buffer.
+		// This thread also handles the retransmission timeouts, so
+		// retransmit when they pass while waiting.
+		auto now = monotime();
+		if(next_ack_deadline <= now) {
+			pump_segment_queue();
+		} else if(next_ack_deadline == UINT64_MAX) {
+			send_space_cv.wait(lock);
+		} else {
+			send_space_cv.wait_for(lock, std::chrono::nanoseconds(next_ack_deadline - now));
+		}
+	}
 }
 
 cloudabi_errno_t tcp_socket::establish() {
@@ -173,10 +297,13 @@ void tcp_socket::send_tcp_frame(bool syn, bool ack, std::string data, bool fin,
 	// if we're establishing, closing or resetting, don't send any data
 	assert(! ((syn || fin || rst) && !data.empty()));
 
-	// TODO: instead of hardcoding MTU, request it from interface or use
-	// max MSS option from the sender (also, don't assume ethernet frame
-	// will be used eventually)
-	size_t max_mss = 1500 - sizeof(tcp_header) - sizeof(ip_header) - 18 /* eth frame + checksum */;
+	size_t max_mss = std::min<size_t>(TCP_MAX_MSS, peer_mss);
+
+	// a SYN|ACK only offers window scaling if the peer's SYN did
+	std::string options;
+	if(syn) {
+		options = syn_options(!ack || window_scaling);
+	}
 
 	do {
 		size_t segment_size = std::min(max_mss, data.size());
@@ -193,17 +320,23 @@ void tcp_socket::send_tcp_frame(bool syn, bool ack, std::string data, bool fin,
 		if(rst) tcp_hdr.flag_rst = 1;
 		// TODO: don't always set PSH on data, but when though?
 		if(segment_size > 0) tcp_hdr.flag_psh = 1;
-		// TODO: use a proper growing window
-		tcp_hdr.window = htons(128);
-		tcp_hdr.data_off = sizeof(tcp_hdr) / 4;
+		uint16_t window = receive_window(syn);
+		tcp_hdr.window = htons(window);
+		advertised_window_end = send_ack_num + (size_t(window) << (syn ? 0 : window_shift));
+		tcp_hdr.data_off = (sizeof(tcp_hdr) + options.size()) / 4;
 
-		compute_tcp_checksum(tcp_hdr, get_local_ip(), get_peer_ip(), data, segment_size);
+		if(options.empty()) {
+			compute_tcp_checksum(tcp_hdr, get_local_ip(), get_peer_ip(), data, segment_size);
+		} else {
+			// the options follow the header, and a SYN carries no data
+			compute_tcp_checksum(tcp_hdr, get_local_ip(), get_peer_ip(), options, options.size());
+		}
 
 		struct ip_header ip_hdr;
 		memset(&ip_hdr, 0, sizeof(ip_hdr));
 		ip_hdr.ihl = 5;
 		ip_hdr.version = 4;
-		ip_hdr.total_len = htons(sizeof(ip_hdr) + sizeof(tcp_hdr) + segment_size);
+		ip_hdr.total_len = htons(sizeof(ip_hdr) + sizeof(tcp_hdr) + options.size() + segment_size);
 		arc4random_buf(&ip_hdr.ident, sizeof(ip_hdr.ident));
 		ip_hdr.ttl = 0xff;
 		ip_hdr.proto = transport_proto::tcp;
@@ -213,9 +346,10 @@ void tcp_socket::send_tcp_frame(bool syn, bool ack, std::string data, bool fin,
 		compute_ip_checksum(ip_hdr);
 
 		tcp_outgoing_segment segment;
-		segment.segment.reserve(sizeof(ip_hdr) + sizeof(tcp_hdr) + segment_size);
+		segment.segment.reserve(sizeof(ip_hdr) + sizeof(tcp_hdr) + options.size() + segment_size);
 		segment.segment.append(reinterpret_cast<const char*>(&ip_hdr), sizeof(ip_hdr));
 		segment.segment.append(reinterpret_cast<const char*>(&tcp_hdr), sizeof(tcp_hdr));
+		segment.segment.append(options);
 		segment.segment.append(data.c_str(), segment_size);
 		segment.seqnum = ntohl(tcp_hdr.seqnum);
 		assert(segment_size < UINT16_MAX);
@@ -226,10 +360,6 @@ void tcp_socket::send_tcp_frame(bool syn, bool ack, std::string data, bool fin,
 		// because ACKs themselves aren't ACKed
 		bool reliable = !data.empty() || syn || fin;
 
-		// TODO: don't create segments if send_window_size would grow beyond
-		// the remote window size; instead, keep extra data in a buffer that is
-		// turned into segments as soon as the remote side ACKs data
-
 		if(reliable) {
 			outgoing_segments.emplace_back(std::move(segment));
 		} else {
@@ -256,25 +386,69 @@ void tcp_socket::send_tcp_frame(bool syn, bool ack, std::string data, bool fin,
 	pump_segment_queue();
 }
 
+// Returns the window to advertise: the free space in the receive buffer,
+// scaled unless it's for a SYN.
+uint16_t tcp_socket::receive_window(bool syn)
+{
+	size_t space = TCP_RECV_BUFFER_SIZE - recv_buffer.size();
+	if(!syn) {
+		space >>= window_shift;
+	}
+	return std::min<size_t>(space, UINT16_MAX);
+}
+
 void tcp_socket::received_acknum(uint32_t acknum)
 {
-	// TODO: handle overflow of sequence numbers
-	while(!outgoing_segments.empty() && (outgoing_segments.front().seqnum + outgoing_segments.front().segsize <= acknum)) {
+	while(!outgoing_segments.empty() && seq_before_or_at(outgoing_segments.front().seqnum + outgoing_segments.front().segsize, acknum)) {
 		// first segment is acked! take it out of the segment list
 		send_window_size -= outgoing_segments.front().segsize;
 		outgoing_segments.pop_front();
 	}
 }
 
+// Turns data from the send buffer into segments, as far as the peer's
+// window allows.
+void tcp_socket::fill_send_window()
+{
+	if(status != sockstatus_t::CONNECTED && status != sockstatus_t::THEIRS_SHUTDOWN) {
+		return;
+	}
+
+	size_t max_mss = std::min<size_t>(TCP_MAX_MSS, peer_mss);
+	size_t sent = 0;
+	while(sent < send_buffer.size()) {
+		size_t buffered = send_buffer.size() - sent;
+		size_t usable = peer_window > send_window_size ? peer_window - send_window_size : 0;
+		if(usable == 0) {
+			if(peer_window != 0 || !outgoing_segments.empty()) {
+				break;
+			}
+			// The peer's window is closed and we have nothing in flight that
+			// would get us its window update. Send one byte as a window probe;
+			// it is retransmitted like any segment until the window opens.
+			usable = 1;
+		}
+		size_t segment_size = std::min({max_mss, usable, buffered});
+		if(segment_size < max_mss && segment_size < buffered && !outgoing_segments.empty()) {
+			// silly window syndrome avoidance (RFC 1122): rather than
+			// sending a small segment because the window is almost full,
+			// wait for ACKs to open it further
+			break;
+		}
+		send_tcp_frame(false /* syn */, true /* ack */, send_buffer.substr(sent, segment_size));
+		sent += segment_size;
+	}
+	send_buffer.erase(0, sent);
+}
+
 void tcp_socket::pump_segment_queue()
 {
-	uint32_t last_seqnum = 0;
+	tcp_outgoing_segment const *previous = nullptr;
 	auto now = monotime();
 	cloudabi_errno_t res = 0;
 	for(auto &segment : outgoing_segments) {
-		// TODO: handle overflow
-		assert(segment.seqnum > last_seqnum);
-		last_seqnum = segment.seqnum;
+		assert(previous == nullptr || !seq_before_or_at(segment.seqnum, previous->seqnum));
+		previous = &segment;
 
 		if(segment.ack_deadline > now) {
 			continue;
@@ -333,7 +507,7 @@ size_t tcp_socket::sock_recv(pseudofd_t p, char *dest, size_t requested)
 		if(!recv_buffer.empty()) {
 			auto res = std::min(recv_buffer.size(), requested);
 			memcpy(dest, recv_buffer.c_str(), res);
-			recv_buffer = recv_buffer.substr(res);
+			consumed_recv_buffer(res);
 			return res;
 		}
 	}
@@ -351,10 +525,27 @@ size_t tcp_socket::sock_recv(pseudofd_t p, char *dest, size_t requested)
 
 	auto res = std::min(recv_buffer.size(), requested);
 	memcpy(dest, recv_buffer.c_str(), res);
-	recv_buffer = recv_buffer.substr(res);
+	consumed_recv_buffer(res);
 	return res;
 }
 
+// Removes data the application read from the receive buffer. If that opens
+// the window considerably beyond what we last advertised, tell the peer, as
+// it may be waiting for it. Smaller updates are left to the next ACK, so the
+// peer isn't invited to send small segments (RFC 1122 4.2.3.3).
+void tcp_socket::consumed_recv_buffer(size_t length)
+{
+	recv_buffer.erase(0, length);
+	if(status != sockstatus_t::CONNECTED && status != sockstatus_t::SHUTDOWN) {
+		return;
+	}
+	uint32_t window_end = send_ack_num + (size_t(receive_window(false)) << window_shift);
+	size_t threshold = std::min<size_t>(TCP_RECV_BUFFER_SIZE / 2, TCP_MAX_MSS);
+	if(int32_t(window_end - advertised_window_end) >= int32_t(threshold)) {
+		send_tcp_frame(false /* syn */, true /* ack */);
+	}
+}
+
 bool tcp_socket::is_readable(cosix::pseudofd_t p, size_t &nbytes, bool &hangup)
 {
 	(void)p;
@@ -383,6 +574,8 @@ void tcp_socket::becomes_readable()
 {
 	ip_socket::becomes_readable();
 	incoming_cv.notify_all();
+	// the status may have changed, so senders may have to stop waiting
+	send_space_cv.notify_all();
 }
 
 void tcp_socket::close(cosix::pseudofd_t p)
@@ -391,8 +584,9 @@ void tcp_socket::close(cosix::pseudofd_t p)
 	assert(p == 0);
 
 	std::unique_lock<std::mutex> lock(wc_mtx);
-	bool had_something_to_send_or_receive = !(recv_buffer.empty() && outgoing_segments.empty());
+	bool had_something_to_send_or_receive = !(recv_buffer.empty() && send_buffer.empty() && outgoing_segments.empty());
 	recv_buffer.clear();
+	send_buffer.clear();
 	outgoing_segments.clear();
 	if(status == sockstatus_t::RESET || status == sockstatus_t::CLOSED || status == sockstatus_t::SHUTDOWN) {
 		// all already done
@@ -1,11 +1,24 @@
 #pragma once
 #include "ip_socket.hpp"
+#include "tcp.hpp"
+#include <condition_variable>
 #include <queue>
 #include <thread>
 #include <map>
 
 namespace networkd {
 
+// the amount of received data that is buffered until the application reads
+// it, and so the largest window that is advertised to the peer
+#define TCP_RECV_BUFFER_SIZE (256 * 1024)
+// the amount of data that sends can buffer before they block
+#define TCP_SEND_BUFFER_SIZE (256 * 1024)
+// the window scale that is offered to the peer (RFC 7323); it is the
+// smallest that fits the whole receive buffer in a 16-bit window
+#define TCP_WINDOW_SHIFT 3
+// the MSS to assume if the peer doesn't send the MSS option
+#define TCP_DEFAULT_MSS 536
+
 struct tcp_incoming_connection {
 	std::string frame;
 	size_t ip_offset;
@@ -46,19 +59,31 @@ private:
 
 	// only call these functions if you already have the wc_mtx:
 	void send_tcp_frame(bool syn, bool ack, std::string data = std::string(), bool fin = false, bool rst = false);
+	void received_syn_options(tcp_header const *hdr);
 	void received_acknum(uint32_t acknum);
+	void fill_send_window();
 	void pump_segment_queue();
+	uint16_t receive_window(bool syn);
+	void consumed_recv_buffer(size_t length);
 
 	std::mutex wc_mtx;
 	std::condition_variable incoming_cv;
+	std::condition_variable send_space_cv;
 
 	// all guarded by wc_mtx:
 	sockstatus_t status;
 	uint32_t send_ack_num = 0; // the next sequence nr to ACK
-	std::string recv_buffer;
+	std::string recv_buffer; // at most TCP_RECV_BUFFER_SIZE bytes
+	uint32_t advertised_window_end = 0; // sequence nr after the last window we advertised
 	uint32_t send_seq_num = 0; // the next sequence nr to send
+	std::string send_buffer; // data not turned into segments yet, at most TCP_SEND_BUFFER_SIZE bytes
 	std::deque<tcp_outgoing_segment> outgoing_segments; // in order of sequence number
-	size_t send_window_size = 0;
+	size_t send_window_size = 0; // bytes in outgoing_segments that aren't ACKed yet
+	size_t peer_window = 0; // bytes the peer is willing to receive beyond its ACK
+	uint16_t peer_mss = TCP_DEFAULT_MSS;
+	bool window_scaling = false; // whether both sides agreed to scale windows
+	uint8_t peer_window_shift = 0;
+	uint8_t window_shift = 0;
 	cloudabi_timestamp_t next_ack_deadline = UINT64_MAX;
 };
 
@@ -9,6 +9,8 @@
 #include <errno.h>
 #include <string.h>
 
+#include <cosix/bench.hpp>
+
 int stdout;
 
 void *thread_handler(void *w) {
@@ -56,5 +58,17 @@ void program_main(const argdata_t *) {
 	}
 
 	pthread_join(thread, nullptr);
+
+	dprintf(stdout, "Running pipe throughput benchmarks\n");
+	const size_t message_sizes[] = {64, 4096, 65536};
+	for(size_t message_size : message_sizes) {
+		int bfds[2];
+		if(pipe(bfds) < 0) {
+			dprintf(stdout, "Failed to create pipes: %s\n", strerror(errno));
+			exit(0);
+		}
+		cosix::benchmark_throughput(stdout, "[PIPE]", bfds[0], bfds[1], message_size, 16 * 1024 * 1024);
+	}
+
 	pthread_exit(NULL);
 }
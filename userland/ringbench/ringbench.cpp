@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <program.h>
+#include <argdata.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+
+#include <cosix/bench.hpp>
+#include <cosix/ring.hpp>
+
+// Compares the time per operation of plain system calls against the same
+// operations submitted in batches through a ring.
+
+int stdout = -1;
+int tmpdir = -1;
+int iterations = 10000;
+int batch = 32;
+
+static const size_t MESSAGE_SIZE = 64;
+
+static void report(const char *name, uint64_t ns, size_t ops) {
+	dprintf(stdout, "ringbench: %-24s %8llu ns total, %6llu ns/op\n", name,
+		(unsigned long long)ns, (unsigned long long)(ns / ops));
+}
+
+static void check_completions(std::vector<cosix::completion_t> const &completions, int64_t expected) {
+	for(auto const &c : completions) {
+		if(c.result != expected) {
+			dprintf(stdout, "ringbench: operation %llu returned %lld, expected %lld\n",
+				(unsigned long long)c.user_data, (long long)c.result, (long long)expected);
+			exit(1);
+		}
+	}
+}
+
+// write a message into one end of a socketpair and read it from the other
+static void bench_socketpair(cosix::ring &ring) {
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		dprintf(stdout, "ringbench: socketpair failed: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	char out[MESSAGE_SIZE];
+	char in[MESSAGE_SIZE];
+	memset(out, 'x', sizeof(out));
+
+	uint64_t start = cosix::now_ns();
+	for(int i = 0; i < iterations; ++i) {
+		if(write(fds[0], out, sizeof(out)) != sizeof(out)
+		|| read(fds[1], in, sizeof(in)) != sizeof(in)) {
+			dprintf(stdout, "ringbench: write/read failed: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	report("socketpair syscalls", cosix::now_ns() - start, iterations * 2);
+
+	std::vector<cosix::completion_t> completions;
+	start = cosix::now_ns();
+	for(int i = 0; i < iterations; i += batch) {
+		for(int j = i; j < i + batch && j < iterations; ++j) {
+			ring.prepare_write(fds[0], out, sizeof(out), j);
+			ring.link_last();
+			ring.prepare_read(fds[1], in, sizeof(in), j);
+		}
+		completions.clear();
+		ring.submit_and_reap(completions);
+		check_completions(completions, MESSAGE_SIZE);
+	}
+	report("socketpair ring", cosix::now_ns() - start, iterations * 2);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+// pwrite and pread a file in tmpdir at increasing offsets
+static void bench_file(cosix::ring &ring) {
+	int file = openat(tmpdir, "ringbench", O_RDWR | O_CREAT | O_TRUNC);
+	if(file < 0) {
+		dprintf(stdout, "ringbench: opening file failed: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	char out[MESSAGE_SIZE];
+	char in[MESSAGE_SIZE];
+	memset(out, 'y', sizeof(out));
+	const int slots = 64;
+
+	uint64_t start = cosix::now_ns();
+	for(int i = 0; i < iterations; ++i) {
+		off_t offset = (i % slots) * MESSAGE_SIZE;
+		if(pwrite(file, out, sizeof(out), offset) != sizeof(out)
+		|| pread(file, in, sizeof(in), offset) != sizeof(in)) {
+			dprintf(stdout, "ringbench: pwrite/pread failed: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+	report("file syscalls", cosix::now_ns() - start, iterations * 2);
+
+	std::vector<cosix::completion_t> completions;
+	start = cosix::now_ns();
+	for(int i = 0; i < iterations; i += batch) {
+		for(int j = i; j < i + batch && j < iterations; ++j) {
+			uint64_t offset = (j % slots) * MESSAGE_SIZE;
+			ring.prepare_pwrite(file, out, sizeof(out), offset, j);
+			ring.prepare_pread(file, in, sizeof(in), offset, j);
+		}
+		completions.clear();
+		ring.submit_and_reap(completions);
+		check_completions(completions, MESSAGE_SIZE);
+	}
+	report("file ring", cosix::now_ns() - start, iterations * 2);
+
+	close(file);
+	unlinkat(tmpdir, "ringbench", 0);
+}
+
+// the fixed cost of entering the kernel
+static void bench_nop(cosix::ring &ring) {
+	uint64_t start = cosix::now_ns();
+	for(int i = 0; i < iterations; ++i) {
+		sched_yield();
+	}
+	report("thread_yield syscalls", cosix::now_ns() - start, iterations);
+
+	std::vector<cosix::completion_t> completions;
+	start = cosix::now_ns();
+	for(int i = 0; i < iterations; i += batch) {
+		for(int j = i; j < i + batch && j < iterations; ++j) {
+			ring.prepare_nop(j);
+		}
+		completions.clear();
+		ring.submit_and_reap(completions);
+		check_completions(completions, 0);
+	}
+	report("nop ring", cosix::now_ns() - start, iterations);
+}
+
+void program_main(const argdata_t *ad) {
+	argdata_map_iterator_t it;
+	const argdata_t *key;
+	const argdata_t *value;
+	argdata_map_iterate(ad, &it);
+	while (argdata_map_get(&it, &key, &value)) {
+		const char *keystr;
+		if(argdata_get_str_c(key, &keystr) != 0) {
+			argdata_map_next(&it);
+			continue;
+		}
+
+		if(strcmp(keystr, "stdout") == 0) {
+			argdata_get_fd(value, &stdout);
+		} else if(strcmp(keystr, "tmpdir") == 0) {
+			argdata_get_fd(value, &tmpdir);
+		} else if(strcmp(keystr, "iterations") == 0) {
+			argdata_get_int(value, &iterations);
+		} else if(strcmp(keystr, "batch") == 0) {
+			argdata_get_int(value, &batch);
+		}
+		argdata_map_next(&it);
+	}
+
+	// a batch of operation pairs must fit in the completion ring
+	if(iterations <= 0 || batch <= 0 || size_t(batch) * 2 > ring_proto::max_completions) {
+		dprintf(stdout, "ringbench: invalid iterations or batch size\n");
+		exit(1);
+	}
+
+	dprintf(stdout, "ringbench: %d iterations, batches of %d\n", iterations, batch);
+
+	cosix::ring ring;
+	bench_nop(ring);
+	bench_socketpair(ring);
+	if(tmpdir >= 0) {
+		bench_file(ring);
+	} else {
+		dprintf(stdout, "ringbench: no tmpdir given, skipping file benchmark\n");
+	}
+
+	dprintf(stdout, "ringbench: done\n");
+	exit(0);
+}
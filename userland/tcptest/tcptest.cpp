@@ -15,6 +15,10 @@
 #include <cloudabi_syscalls.h>
 #include <thread>
 #include <poll.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -22,6 +26,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <cosix/bench.hpp>
 #include <cosix/networkd.hpp>
 #include <flower/protocol/server.ad.h>
 #include <flower/protocol/switchboard.ad.h>
@@ -35,6 +40,98 @@ int tmpdir = -1;
 int networkd = -1;
 int switchboard = -1;
 
+// The throughput test runs against misc/tcptest/throughput_peer.py on the
+// host, which is reachable at this address with qemu's user networking.
+static const char *THROUGHPUT_PEER = "10.0.2.2:5001";
+static const size_t THROUGHPUT_BYTES = 16 * 1024 * 1024;
+static const size_t THROUGHPUT_CHUNK_SIZE = 64 * 1024;
+// byte i of the data is i % THROUGHPUT_PATTERN_PERIOD
+static const size_t THROUGHPUT_PATTERN_PERIOD = 251;
+
+static void fill_pattern(char *buf, size_t offset, size_t length) {
+	for(size_t i = 0; i < length; ++i) {
+		buf[i] = (offset + i) % THROUGHPUT_PATTERN_PERIOD;
+	}
+}
+
+static void report_throughput(const char *direction, uint64_t ns) {
+	dprintf(stdout, "TCP throughput %s %s: %zu bytes in %llu ms, %llu KiB/s\n",
+		direction, THROUGHPUT_PEER, THROUGHPUT_BYTES, (unsigned long long)(ns / 1000000),
+		(unsigned long long)(uint64_t(THROUGHPUT_BYTES) * 1000000000 / 1024 / std::max<uint64_t>(ns, 1)));
+}
+
+static void write_all(int fd, const char *buf, size_t length) {
+	while(length > 0) {
+		ssize_t res = write(fd, buf, length);
+		if(res <= 0) {
+			dprintf(stdout, "Failed to write data over TCP (%s)\n", strerror(errno));
+			exit(1);
+		}
+		buf += res;
+		length -= res;
+	}
+}
+
+// Sends THROUGHPUT_BYTES to the peer, and receives as many from it, measuring
+// the time each direction takes. It's skipped if the peer isn't running.
+static void throughput_test() {
+	int sock;
+	try {
+		sock = cosix::networkd::get_socket(networkd, SOCK_STREAM, THROUGHPUT_PEER, "");
+	} catch(std::runtime_error &e) {
+		dprintf(stdout, "Skipping TCP throughput test, no peer at %s: %s\n", THROUGHPUT_PEER, e.what());
+		return;
+	}
+
+	std::vector<char> buf(THROUGHPUT_CHUNK_SIZE);
+	std::string command = "send " + std::to_string(THROUGHPUT_BYTES) + "\n";
+	uint64_t start = cosix::now_ns();
+	write_all(sock, command.c_str(), command.size());
+	for(size_t offset = 0; offset < THROUGHPUT_BYTES; offset += buf.size()) {
+		fill_pattern(buf.data(), offset, buf.size());
+		write_all(sock, buf.data(), buf.size());
+	}
+	// the peer answers once it received everything
+	char answer[4];
+	size_t answer_length = 0;
+	while(answer_length < 3) {
+		ssize_t res = read(sock, answer + answer_length, 3 - answer_length);
+		if(res <= 0) {
+			dprintf(stdout, "Failed to receive throughput test answer (%s)\n", strerror(errno));
+			exit(1);
+		}
+		answer_length += res;
+	}
+	if(memcmp(answer, "ok\n", 3) != 0) {
+		dprintf(stdout, "Throughput test peer received incorrect data\n");
+		exit(1);
+	}
+	report_throughput("to", cosix::now_ns() - start);
+	close(sock);
+
+	sock = cosix::networkd::get_socket(networkd, SOCK_STREAM, THROUGHPUT_PEER, "");
+	command = "recv " + std::to_string(THROUGHPUT_BYTES) + "\n";
+	std::vector<char> expected(THROUGHPUT_CHUNK_SIZE);
+	start = cosix::now_ns();
+	write_all(sock, command.c_str(), command.size());
+	size_t offset = 0;
+	while(offset < THROUGHPUT_BYTES) {
+		ssize_t res = read(sock, buf.data(), buf.size());
+		if(res <= 0) {
+			dprintf(stdout, "Failed to receive throughput test data after %zu bytes (%s)\n", offset, strerror(errno));
+			exit(1);
+		}
+		fill_pattern(expected.data(), offset, res);
+		if(memcmp(buf.data(), expected.data(), res) != 0) {
+			dprintf(stdout, "Throughput test data received incorrectly at offset %zu\n", offset);
+			exit(1);
+		}
+		offset += res;
+	}
+	report_throughput("from", cosix::now_ns() - start);
+	close(sock);
+}
+
 class ConnectionExtractor : public flower::protocol::server::Server::Service {
 public:
 	virtual ~ConnectionExtractor() {}
@@ -262,6 +359,8 @@ void program_main(const argdata_t *ad) {
 		exit(1);
 	}
 
+	throughput_test();
+
 	dprintf(stdout, "All TCP traffic seems correct!\n");
 	exit(0);
 }
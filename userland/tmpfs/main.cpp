@@ -15,6 +15,8 @@
 int device = -1;
 int stdout = -1;
 int reversefd = -1;
+// maximum size of all files together, 0 for no limit
+int size_mb = 0;
 
 void program_main(const argdata_t *ad) {
 	argdata_map_iterator_t it;
@@ -34,6 +36,8 @@ void program_main(const argdata_t *ad) {
 			argdata_get_fd(value, &reversefd);
 		} else if(strcmp(keystr, "deviceid") == 0) {
 			argdata_get_int(value, &device);
+		} else if(strcmp(keystr, "size_mb") == 0) {
+			argdata_get_int(value, &size_mb);
 		}
 		argdata_map_next(&it);
 	}
@@ -43,7 +47,11 @@ void program_main(const argdata_t *ad) {
 	setvbuf(out, nullptr, _IONBF, BUFSIZ);
 	fswap(stderr, out);
 
-	cosix::reverse_handler *fs = new tmpfs(device);
+	if(size_mb < 0) {
+		size_mb = 0;
+	}
+
+	cosix::reverse_handler *fs = new tmpfs(device, reversefd, uint64_t(size_mb) * 1024 * 1024);
 
 	dprintf(stdout, "[tmpfs] spawned -- awaiting requests on reverse FD %d\n", reversefd);
 
@@ -0,0 +1,210 @@
+#include "page_store.hpp"
+#include <cosix/reverse.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+using namespace cosix;
+
+page_accounting::page_accounting(size_t l)
+: limit_pages(l)
+{}
+
+bool page_accounting::charge(size_t pages) {
+	if(limit_pages != 0 && (pages > limit_pages || used_pages > limit_pages - pages)) {
+		return false;
+	}
+	used_pages += pages;
+	return true;
+}
+
+void page_accounting::uncharge(size_t pages) {
+	used_pages -= pages;
+}
+
+page_store::page_store(page_accounting &a)
+: accounting(a)
+{}
+
+page_store::~page_store() {
+	if(root != nullptr) {
+		free_pages(root, height, 0, 0);
+		delete root;
+	}
+}
+
+size_t page_store::read(uint64_t offset, char *dest, size_t length) const {
+	if(offset >= file_size) {
+		return 0;
+	}
+	size_t copied = std::min<uint64_t>(length, file_size - offset);
+	for(size_t done = 0; done < copied;) {
+		uint64_t pos = offset + done;
+		size_t in_page = pos % PAGE_SIZE;
+		size_t count = std::min(PAGE_SIZE - in_page, copied - done);
+		const char *page = find_page(pos / PAGE_SIZE);
+		if(page == nullptr) {
+			// hole
+			memset(dest + done, 0, count);
+		} else {
+			memcpy(dest + done, page + in_page, count);
+		}
+		done += count;
+	}
+	return copied;
+}
+
+void page_store::write(uint64_t offset, const char *buf, size_t length) {
+	if(length == 0) {
+		return;
+	}
+	if(offset > uint64_t(INT64_MAX) - length) {
+		throw cloudabi_system_error(EFBIG);
+	}
+	reserve_pages(offset / PAGE_SIZE, (offset + length + PAGE_SIZE - 1) / PAGE_SIZE);
+	for(size_t done = 0; done < length;) {
+		uint64_t pos = offset + done;
+		size_t in_page = pos % PAGE_SIZE;
+		size_t count = std::min(PAGE_SIZE - in_page, length - done);
+		memcpy(get_page(pos / PAGE_SIZE) + in_page, buf + done, count);
+		done += count;
+	}
+	file_size = std::max(file_size, offset + length);
+}
+
+void page_store::allocate(uint64_t offset, uint64_t length) {
+	if(length == 0) {
+		return;
+	}
+	if(offset > uint64_t(INT64_MAX) - length) {
+		throw cloudabi_system_error(EFBIG);
+	}
+	uint64_t first = offset / PAGE_SIZE;
+	uint64_t end = (offset + length + PAGE_SIZE - 1) / PAGE_SIZE;
+	reserve_pages(first, end);
+	for(uint64_t index = first; index < end; ++index) {
+		get_page(index);
+	}
+	file_size = std::max(file_size, offset + length);
+}
+
+void page_store::resize(uint64_t size) {
+	if(size < file_size) {
+		uint64_t first_freed = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+		if(root != nullptr && free_pages(root, height, 0, first_freed)) {
+			delete root;
+			root = nullptr;
+			height = 0;
+		}
+		// zero the rest of the last page, so it reads as a hole if the
+		// file is extended again
+		if(size % PAGE_SIZE != 0) {
+			char *page = find_page(size / PAGE_SIZE);
+			if(page != nullptr) {
+				memset(page + size % PAGE_SIZE, 0, PAGE_SIZE - size % PAGE_SIZE);
+			}
+		}
+	}
+	file_size = size;
+}
+
+uint64_t page_store::capacity() const {
+	if(height == 0) {
+		return 0;
+	} else if(height * FANOUT_SHIFT >= 64) {
+		return UINT64_MAX;
+	}
+	return uint64_t(1) << (height * FANOUT_SHIFT);
+}
+
+char *page_store::find_page(uint64_t index) const {
+	if(index >= capacity()) {
+		return nullptr;
+	}
+	node *n = root;
+	for(unsigned h = height; h > 1; --h) {
+		n = static_cast<node*>(n->slots[(index >> ((h - 1) * FANOUT_SHIFT)) % FANOUT]);
+		if(n == nullptr) {
+			return nullptr;
+		}
+	}
+	return static_cast<char*>(n->slots[index % FANOUT]);
+}
+
+// Returns the page, allocating it and the nodes leading to it if necessary.
+// The page must have been reserved with reserve_pages().
+char *page_store::get_page(uint64_t index) {
+	while(index >= capacity()) {
+		// add a level above the root
+		node *n = new node;
+		if(root != nullptr) {
+			n->slots[0] = root;
+			n->used = 1;
+		}
+		root = n;
+		height++;
+	}
+
+	node *n = root;
+	for(unsigned h = height; h > 1; --h) {
+		void *&slot = n->slots[(index >> ((h - 1) * FANOUT_SHIFT)) % FANOUT];
+		if(slot == nullptr) {
+			slot = new node;
+			n->used++;
+		}
+		n = static_cast<node*>(slot);
+	}
+
+	void *&slot = n->slots[index % FANOUT];
+	if(slot == nullptr) {
+		slot = new char[PAGE_SIZE]();
+		n->used++;
+		num_pages++;
+	}
+	return static_cast<char*>(slot);
+}
+
+size_t page_store::missing_pages(uint64_t first, uint64_t end) const {
+	size_t missing = 0;
+	for(uint64_t index = first; index < end; ++index) {
+		if(find_page(index) == nullptr) {
+			missing++;
+		}
+	}
+	return missing;
+}
+
+// Charges the pages in [first, end) that aren't allocated yet, so that a
+// write either fails before changing anything or gets all of its pages.
+void page_store::reserve_pages(uint64_t first, uint64_t end) {
+	if(!accounting.charge(missing_pages(first, end))) {
+		throw cloudabi_system_error(ENOSPC);
+	}
+}
+
+bool page_store::free_pages(node *n, unsigned h, uint64_t base, uint64_t first) {
+	// number of pages under every slot of this node
+	uint64_t span = uint64_t(1) << ((h - 1) * FANOUT_SHIFT);
+	size_t freed = 0;
+	for(size_t i = 0; i < FANOUT; ++i) {
+		uint64_t slot_base = base + i * span;
+		if(n->slots[i] == nullptr || slot_base + span <= first) {
+			continue;
+		}
+		if(h == 1) {
+			delete[] static_cast<char*>(n->slots[i]);
+			freed++;
+		} else if(free_pages(static_cast<node*>(n->slots[i]), h - 1, slot_base, first)) {
+			delete static_cast<node*>(n->slots[i]);
+		} else {
+			continue;
+		}
+		n->slots[i] = nullptr;
+		n->used--;
+	}
+	num_pages -= freed;
+	accounting.uncharge(freed);
+	return n->used == 0;
+}
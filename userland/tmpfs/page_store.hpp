@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Counts the pages used by the files of one tmpfs, against an optional
+ * limit.
+ */
+struct page_accounting {
+	page_accounting(size_t limit_pages = 0);
+
+	/** Reserves the given number of pages. Returns false, reserving
+	 * nothing, if that would exceed the limit.
+	 */
+	bool charge(size_t pages);
+	void uncharge(size_t pages);
+
+	size_t used() const { return used_pages; }
+	// 0 if there is no limit
+	size_t limit() const { return limit_pages; }
+
+private:
+	size_t limit_pages;
+	size_t used_pages = 0;
+};
+
+/** The contents of a tmpfs file, stored sparsely in pages. The pages are
+ * kept in a radix tree that grows in height as the file grows, so finding a
+ * page takes a few steps regardless of the file size, and writing or
+ * appending only touches the pages written to. Pages that were never
+ * written to are holes, which read as zeroes and take no memory.
+ */
+struct page_store {
+	static constexpr size_t PAGE_SIZE = 4096;
+
+	page_store(page_accounting &accounting);
+	~page_store();
+
+	page_store(page_store const&) = delete;
+	page_store &operator=(page_store const&) = delete;
+
+	uint64_t size() const { return file_size; }
+	size_t allocated_pages() const { return num_pages; }
+
+	/** Copies up to length bytes at offset into dest and returns how many
+	 * were copied; fewer if the file ends before offset + length.
+	 */
+	size_t read(uint64_t offset, char *dest, size_t length) const;
+
+	/** Writes length bytes at offset, extending the file if necessary.
+	 * Throws cloudabi_system_error(ENOSPC), changing nothing, if the pages
+	 * it needs would exceed the limit of the accounting.
+	 */
+	void write(uint64_t offset, const char *buf, size_t length);
+
+	/** Allocates the pages in the range, so that writing to them can't
+	 * fail, and extends the file to cover it. Throws like write().
+	 */
+	void allocate(uint64_t offset, uint64_t length);
+
+	/** Sets the file size. Pages beyond the new size are freed; growing
+	 * the file leaves a hole.
+	 */
+	void resize(uint64_t size);
+
+private:
+	static constexpr unsigned FANOUT_SHIFT = 6;
+	static constexpr size_t FANOUT = size_t(1) << FANOUT_SHIFT;
+
+	struct node {
+		// at height 1, these are pages, otherwise they are child nodes
+		void *slots[FANOUT] = {};
+		size_t used = 0;
+	};
+
+	// number of pages the tree can hold at its current height
+	uint64_t capacity() const;
+	char *find_page(uint64_t index) const;
+	char *get_page(uint64_t index);
+	size_t missing_pages(uint64_t first, uint64_t end) const;
+	void reserve_pages(uint64_t first, uint64_t end);
+	// frees the pages from index first on; returns whether n is empty now
+	bool free_pages(node *n, unsigned height, uint64_t base, uint64_t first);
+
+	page_accounting &accounting;
+	node *root = nullptr;
+	unsigned height = 0;
+	uint64_t file_size = 0;
+	size_t num_pages = 0;
+};
@@ -1,6 +1,7 @@
 #include "tmpfs.hpp"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cassert>
 #include <cloudabi_syscalls.h>
 
@@ -14,21 +15,14 @@ static cloudabi_timestamp_t timestamp() {
 	return 0;
 }
 
-tmpfs::tmpfs(cloudabi_device_t d)
+tmpfs::tmpfs(cloudabi_device_t d, int r, uint64_t size_limit)
 : reverse_handler()
 , device(d)
+, reversefd(r)
+, accounting((size_limit + page_store::PAGE_SIZE - 1) / page_store::PAGE_SIZE)
 {
 	// make directory entry /
-	file_entry_ptr root(new tmpfs_file_entry);
-	cloudabi_inode_t root_inode = reinterpret_cast<cloudabi_inode_t>(root.get());
-
-	root->device = device;
-	root->inode = root_inode;
-	root->type = CLOUDABI_FILETYPE_DIRECTORY;
-	inodes[root_inode] = root;
-
-	root->access_time = root->content_time = root->metadata_time = timestamp();
-
+	file_entry_ptr root = new_file_entry(CLOUDABI_FILETYPE_DIRECTORY);
 	root->files["."] = root;
 	root->files[".."] = root;
 
@@ -37,13 +31,24 @@ tmpfs::tmpfs(cloudabi_device_t d)
 	pseudo_fds[0] = root_pseudo;
 }
 
+tmpfs::~tmpfs()
+{
+	// break the reference cycles through "." and "..", so all entries and
+	// their pages are freed while the accounting still exists
+	for(auto &inode : inodes) {
+		inode.second->files.clear();
+	}
+}
+
 static void file_entry_to_filestat(file_entry_ptr const &entry, cloudabi_filestat_t *buf) {
 	buf->st_dev = entry->device;
 	buf->st_ino = entry->inode;
 	buf->st_filetype = entry->type;
 	buf->st_nlink = entry->hardlinks;
-	if(entry->type == CLOUDABI_FILETYPE_REGULAR_FILE || entry->type == CLOUDABI_FILETYPE_SYMBOLIC_LINK) {
-		buf->st_size = entry->contents.size();
+	if(entry->type == CLOUDABI_FILETYPE_REGULAR_FILE) {
+		buf->st_size = entry->data.size();
+	} else if(entry->type == CLOUDABI_FILETYPE_SYMBOLIC_LINK) {
+		buf->st_size = entry->symlink_target.size();
 	} else {
 		buf->st_size = 0;
 	}
@@ -56,8 +61,9 @@ file_entry tmpfs::lookup(pseudofd_t pseudo, const char *file, size_t len, clouda
 {
 	file_entry_ptr directory = get_file_entry_from_pseudo(pseudo);
 
+	// like on other systems, looking up names doesn't count as reading the
+	// directory, so its access time doesn't change
 	std::string filename(file, len);
-	directory->access_time = timestamp();
 
 	file_entry entry;
 	try {
@@ -94,6 +100,25 @@ file_entry tmpfs::lookup(pseudofd_t pseudo, const char *file, size_t len, clouda
 	return entry;
 }
 
+file_entry tmpfs::lookup_inode(pseudofd_t pseudo, cloudabi_inode_t directory_inode, const char *file, size_t len, cloudabi_filestat_t *filestat)
+{
+	// the directory doesn't need to be opened, but the pseudo FD must be
+	get_file_entry_from_pseudo(pseudo);
+
+	file_entry_ptr directory = get_file_entry_from_inode(directory_inode);
+	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
+		throw cloudabi_system_error(ENOTDIR);
+	}
+	auto it = directory->files.find(std::string(file, len));
+	if(it == directory->files.end()) {
+		throw cloudabi_system_error(ENOENT);
+	}
+	if (filestat) {
+		file_entry_to_filestat(it->second, filestat);
+	}
+	return *it->second;
+}
+
 std::pair<pseudofd_t, cloudabi_filetype_t> tmpfs::open(cloudabi_inode_t inode)
 {
 	file_entry_ptr entry = get_file_entry_from_inode(inode);
@@ -105,8 +130,6 @@ std::pair<pseudofd_t, cloudabi_filetype_t> tmpfs::open(cloudabi_inode_t inode)
 		throw cloudabi_system_error(EINVAL);
 	}
 
-	entry->access_time = timestamp();
-
 	pseudo_fd_ptr pseudo(new pseudo_fd_entry);
 	pseudo->file = entry;
 	pseudofd_t fd = reinterpret_cast<pseudofd_t>(pseudo.get());
@@ -132,6 +155,7 @@ void tmpfs::link(pseudofd_t pseudo1, const char *path1, size_t path1len, cloudab
 	if(it2 != dir2->files.end()) {
 		throw cloudabi_system_error(EEXIST);
 	}
+	invalidate_other_dentries(dir2, pseudo2);
 
 	it1->second->hardlinks += 1;
 	auto ts = timestamp();
@@ -147,10 +171,15 @@ void tmpfs::allocate(pseudofd_t pseudo, off_t offset, off_t length) {
 		throw cloudabi_system_error(EINVAL);
 	}
 
-	size_t minsize = offset + length;
-	if(file->contents.size() < minsize) {
-		file->contents.resize(minsize);
+	if(offset < 0 || length <= 0) {
+		throw cloudabi_system_error(EINVAL);
+	}
+
+	uint64_t oldsize = file->data.size();
+	file->data.allocate(offset, length);
+	if(file->data.size() != oldsize) {
 		file->content_time = file->metadata_time = timestamp();
+		invalidate_other_pseudos(file, pseudo);
 	}
 }
 
@@ -166,9 +195,8 @@ size_t tmpfs::readlink(pseudofd_t pseudo, const char *path, size_t pathlen, char
 		throw cloudabi_system_error(EINVAL);
 	}
 
-	size_t copy = std::min(it->second->contents.size(), buflen);
-	memcpy(buf, it->second->contents.c_str(), copy);
-	it->second->access_time = timestamp();
+	size_t copy = std::min(it->second->symlink_target.size(), buflen);
+	memcpy(buf, it->second->symlink_target.c_str(), copy);
 	return copy;
 }
 
@@ -193,6 +221,8 @@ void tmpfs::rename(pseudofd_t pseudo1, const char *path1, size_t path1len, pseud
 	}
 
 	file_entry_ptr entry = it1->second;
+	invalidate_other_dentries(dir1, pseudo1);
+	invalidate_other_dentries(dir2, pseudo2);
 
 	// destination doesn't exist? -> rename file
 	auto it2 = dir2->files.find(filename2);
@@ -209,12 +239,18 @@ void tmpfs::rename(pseudofd_t pseudo1, const char *path1, size_t path1len, pseud
 		return;
 	}
 
+	file_entry_ptr replaced = it2->second;
+	if(replaced == entry) {
+		// both are links to the same file, nothing to do
+		return;
+	}
+
 	// destination is directory? -> must be empty, overwrite it
-	if(it2->second->type == CLOUDABI_FILETYPE_DIRECTORY) {
+	if(replaced->type == CLOUDABI_FILETYPE_DIRECTORY) {
 		if(entry->type != CLOUDABI_FILETYPE_DIRECTORY) {
 			throw cloudabi_system_error(EISDIR);
 		}
-		for(auto const &e : it2->second->files) {
+		for(auto const &e : replaced->files) {
 			if(e.first != "." && e.first != "..") {
 				throw cloudabi_system_error(ENOTEMPTY);
 			}
@@ -222,6 +258,7 @@ void tmpfs::rename(pseudofd_t pseudo1, const char *path1, size_t path1len, pseud
 		dir2->files[filename2] = entry;
 		entry->files[".."] = dir2;
 		dir1->files.erase(it1);
+		remove_link(replaced);
 		auto ts = timestamp();
 		dir1->content_time = dir1->metadata_time = ts;
 		dir2->content_time = dir2->metadata_time = ts;
@@ -236,6 +273,7 @@ void tmpfs::rename(pseudofd_t pseudo1, const char *path1, size_t path1len, pseud
 
 	dir2->files[filename2] = entry;
 	dir1->files.erase(it1);
+	remove_link(replaced);
 	auto ts = timestamp();
 	dir1->content_time = dir1->metadata_time = ts;
 	dir2->content_time = dir2->metadata_time = ts;
@@ -250,17 +288,10 @@ void tmpfs::symlink(pseudofd_t pseudo ,const char *path1, size_t path1len, const
 		throw cloudabi_system_error(EEXIST);
 	}
 
-	file_entry_ptr entry(new tmpfs_file_entry);
-	cloudabi_inode_t inode = reinterpret_cast<cloudabi_inode_t>(entry.get());
-	entry->device = device;
-	entry->inode = inode;
-	entry->type = CLOUDABI_FILETYPE_SYMBOLIC_LINK;
-	entry->contents = std::string(path1, path1len);
-
-	entry->access_time = entry->content_time = entry->metadata_time = timestamp();
-
-	inodes[inode] = entry;
+	file_entry_ptr entry = new_file_entry(CLOUDABI_FILETYPE_SYMBOLIC_LINK);
+	entry->symlink_target = std::string(path1, path1len);
 	directory->files[filename] = entry;
+	invalidate_other_dentries(directory, pseudo);
 
 	directory->content_time = directory->metadata_time = timestamp();
 }
@@ -294,14 +325,9 @@ void tmpfs::unlink(pseudofd_t pseudo, const char *path, size_t len, cloudabi_ulf
 	}
 
 	directory->files.erase(filename);
-	auto ts = timestamp();
-	directory->content_time = directory->metadata_time = ts;
-	entry->hardlinks -= 1;
-	entry->metadata_time = ts;
-	if(entry->hardlinks == 0) {
-		// TODO: erase inode if this was the last reference to it
-		// (possibly, using the deleter of the inode bound to this tmpfs*)
-	}
+	directory->content_time = directory->metadata_time = timestamp();
+	remove_link(entry);
+	invalidate_other_dentries(directory, pseudo);
 }
 
 cloudabi_inode_t tmpfs::create(pseudofd_t pseudo, const char *path, size_t len, cloudabi_filetype_t type)
@@ -315,24 +341,16 @@ cloudabi_inode_t tmpfs::create(pseudofd_t pseudo, const char *path, size_t len,
 		throw cloudabi_system_error(EEXIST);
 	}
 
-	file_entry_ptr entry(new tmpfs_file_entry);
-	cloudabi_inode_t inode = reinterpret_cast<cloudabi_inode_t>(entry.get());
-	entry->device = device;
-	entry->inode = inode;
-	entry->type = type;
-
+	file_entry_ptr entry = new_file_entry(type);
 	if(type == CLOUDABI_FILETYPE_DIRECTORY) {
 		entry->files["."] = entry;
 		entry->files[".."] = directory;
 	}
 
-	auto ts = timestamp();
-	entry->access_time = entry->content_time = entry->metadata_time = ts;
-
-	inodes[inode] = entry;
 	directory->files[filename] = entry;
-	directory->content_time = directory->metadata_time = ts;
-	return inode;
+	directory->content_time = directory->metadata_time = entry->metadata_time;
+	invalidate_other_dentries(directory, pseudo);
+	return entry->inode;
 }
 
 void tmpfs::close(pseudofd_t pseudo)
@@ -354,18 +372,12 @@ size_t tmpfs::pread(pseudofd_t pseudo, off_t offset, char *dest, size_t requeste
 		throw cloudabi_system_error(EBADF);
 	}
 
-	entry->access_time = timestamp();
-
-	if(offset > entry->contents.size()) {
-		// EOF
-		return 0;
+	if(offset < 0) {
+		throw cloudabi_system_error(EINVAL);
 	}
 
-	size_t remaining = entry->contents.size() - offset;
-	size_t returned = remaining < requested ? remaining : requested;
-	const char *data = entry->contents.c_str() + offset;
-	memcpy(dest, data, returned);
-	return returned;
+	entry->access_time = timestamp();
+	return entry->data.read(offset, dest, requested);
 }
 
 void tmpfs::pwrite(pseudofd_t pseudo, off_t offset, const char *buf, size_t length)
@@ -377,12 +389,13 @@ void tmpfs::pwrite(pseudofd_t pseudo, off_t offset, const char *buf, size_t leng
 		throw cloudabi_system_error(EBADF);
 	}
 
-	if(entry->contents.size() < offset + length) {
-		entry->contents.resize(offset + length, 0);
+	if(offset < 0) {
+		throw cloudabi_system_error(EINVAL);
 	}
 
-	entry->contents.replace(offset, length, std::string(buf, length));
+	entry->data.write(offset, buf, length);
 	entry->content_time = timestamp();
+	invalidate_other_pseudos(entry, pseudo);
 }
 
 void tmpfs::datasync(pseudofd_t)
@@ -437,6 +450,59 @@ size_t tmpfs::readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_d
 	return to_copy;
 }
 
+/**
+ * Like readdir(), but writes a cloudabi_filestat_t for every entry after its
+ * dirent, and as many whole records as fit in the buffer.
+ */
+size_t tmpfs::readdirplus(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie)
+{
+	auto directory = get_file_entry_from_pseudo(pseudo);
+	if(directory->type != CLOUDABI_FILETYPE_DIRECTORY) {
+		throw cloudabi_system_error(ENOTDIR);
+	}
+
+	// cookie is the index into the files map, like in readdir()
+	auto it = directory->files.begin();
+	directory->access_time = timestamp();
+	for(auto c = cookie; c-- > 0 && it != directory->files.end(); ++it);
+
+	size_t copied = 0;
+	for(; it != directory->files.end(); ++it) {
+		std::string const &filename = it->first;
+		file_entry_ptr entry = it->second;
+
+		size_t record_size = sizeof(cloudabi_dirent_t) + sizeof(cloudabi_filestat_t) + filename.length();
+		if(buflen - copied < record_size) {
+			if(copied == 0) {
+				// returning nothing would look like the end of the
+				// directory
+				throw cloudabi_system_error(ENOBUFS);
+			}
+			return copied;
+		}
+
+		cookie += 1;
+		cloudabi_dirent_t dirent;
+		dirent.d_next = cookie;
+		dirent.d_ino = entry->inode;
+		dirent.d_namlen = filename.length();
+		dirent.d_type = entry->type;
+
+		cloudabi_filestat_t stat;
+		file_entry_to_filestat(entry, &stat);
+
+		memcpy(buffer + copied, &dirent, sizeof(dirent));
+		copied += sizeof(dirent);
+		memcpy(buffer + copied, &stat, sizeof(stat));
+		copied += sizeof(stat);
+		memcpy(buffer + copied, filename.c_str(), filename.length());
+		copied += filename.length();
+	}
+
+	cookie = CLOUDABI_DIRCOOKIE_START;
+	return copied;
+}
+
 void tmpfs::stat_fget(pseudofd_t pseudo, cloudabi_filestat_t *buf) {
 	file_entry_ptr entry = get_file_entry_from_pseudo(pseudo);
 	file_entry_to_filestat(entry, buf);
@@ -451,7 +517,7 @@ static void update_file_entry_stat(file_entry_ptr entry, const cloudabi_filestat
 			throw cloudabi_system_error(EINVAL);
 		}
 
-		entry->contents.resize(buf->st_size);
+		entry->data.resize(buf->st_size);
 		entry->content_time = ts;
 	}
 
@@ -473,6 +539,9 @@ static void update_file_entry_stat(file_entry_ptr entry, const cloudabi_filestat
 void tmpfs::stat_fput(pseudofd_t pseudo, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) {
 	file_entry_ptr entry = get_file_entry_from_pseudo(pseudo);
 	update_file_entry_stat(entry, buf, fsflags);
+	if(fsflags & CLOUDABI_FILESTAT_SIZE) {
+		invalidate_other_pseudos(entry, pseudo);
+	}
 }
 
 void tmpfs::stat_put(pseudofd_t pseudo, cloudabi_lookupflags_t lookupflags, const char *path, size_t pathlen, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) {
@@ -484,6 +553,9 @@ void tmpfs::stat_put(pseudofd_t pseudo, cloudabi_lookupflags_t lookupflags, cons
 	}
 
 	update_file_entry_stat(it->second, buf, fsflags);
+	if(fsflags & CLOUDABI_FILESTAT_SIZE) {
+		invalidate_other_pseudos(it->second, 0);
+	}
 }
 
 file_entry_ptr tmpfs::get_file_entry_from_inode(cloudabi_inode_t inode)
@@ -506,14 +578,56 @@ file_entry_ptr tmpfs::get_file_entry_from_pseudo(pseudofd_t pseudo)
 	}
 }
 
+file_entry_ptr tmpfs::new_file_entry(cloudabi_filetype_t type)
+{
+	file_entry_ptr entry(new tmpfs_file_entry(accounting));
+	cloudabi_inode_t inode = reinterpret_cast<cloudabi_inode_t>(entry.get());
+	entry->device = device;
+	entry->inode = inode;
+	entry->type = type;
+	entry->access_time = entry->content_time = entry->metadata_time = timestamp();
+	inodes[inode] = entry;
+	return entry;
+}
+
+void tmpfs::remove_link(file_entry_ptr entry)
+{
+	entry->hardlinks -= 1;
+	entry->metadata_time = timestamp();
+	if(entry->hardlinks == 0) {
+		// break the reference cycles through "." and ".."
+		entry->files.clear();
+		inodes.erase(entry->inode);
+	}
+}
+
 bool tmpfs::is_readable(pseudofd_t pseudo, size_t &nbytes, bool &hangup) {
 	auto entry = get_file_entry_from_pseudo(pseudo);
 	if(entry->type == CLOUDABI_FILETYPE_REGULAR_FILE) {
 		// TODO: what is pos of pseudo, so we can see the remaining bytes in this file?
-		nbytes = entry->contents.size();
+		nbytes = entry->data.size();
 		hangup = false;
 		// regular file always returns true
 		return true;
 	}
 	throw cloudabi_system_error(EINVAL);
 }
+
+void tmpfs::invalidate_other_pseudos(file_entry_ptr entry, pseudofd_t except) {
+	notify_other_pseudos(entry, except, cosix::pseudo_fd_invalidate_cache);
+}
+
+void tmpfs::invalidate_other_dentries(file_entry_ptr directory, pseudofd_t except) {
+	notify_other_pseudos(directory, except, cosix::pseudo_fd_invalidate_dentries);
+}
+
+void tmpfs::notify_other_pseudos(file_entry_ptr const &entry, pseudofd_t except, void (*notify)(int, pseudofd_t)) {
+	if(reversefd < 0) {
+		return;
+	}
+	for(auto &p : pseudo_fds) {
+		if(p.first != except && p.second->file == entry) {
+			notify(reversefd, p.first);
+		}
+	}
+}
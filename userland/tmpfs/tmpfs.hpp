@@ -6,14 +6,18 @@
 #include <cosix/reverse.hpp>
 #include <memory>
 #include <vector>
+#include "page_store.hpp"
 
 struct tmpfs_file_entry;
 
 typedef std::shared_ptr<tmpfs_file_entry> file_entry_ptr;
 
 struct tmpfs_file_entry : public cosix::file_entry {
+	tmpfs_file_entry(page_accounting &accounting) : data(accounting) {}
+
 	std::map<std::string, file_entry_ptr> files;
-	std::string contents;
+	page_store data; // contents of a regular file
+	std::string symlink_target;
 	int hardlinks = 1;
 	cloudabi_timestamp_t access_time = 0; // Last time contents were read
 	cloudabi_timestamp_t content_time = 0; // Last time contents were changed
@@ -26,10 +30,13 @@ struct pseudo_fd_entry {
 
 typedef std::shared_ptr<pseudo_fd_entry> pseudo_fd_ptr;
 
-/** A temporary filesystem implementation.
+/** A temporary filesystem implementation. The pages of all its files are
+ * accounted for together; if size_limit is not 0, writes that would need
+ * more memory than that fail with ENOSPC.
  */
 struct tmpfs : public cosix::reverse_handler {
-	tmpfs(cloudabi_device_t);
+	tmpfs(cloudabi_device_t, int reversefd, uint64_t size_limit = 0);
+	~tmpfs() override;
 
 	typedef cosix::file_entry file_entry;
 	typedef cosix::pseudofd_t pseudofd_t;
@@ -37,6 +44,7 @@ struct tmpfs : public cosix::reverse_handler {
 	// Look up the file entry corresponding to the inode (if filename is empty), or the file entry
 	// corresponding to the file pointed to by filename in the directory pointed to by inode.
 	file_entry lookup(pseudofd_t pseudo, const char *file, size_t len, cloudabi_oflags_t oflags, cloudabi_filestat_t *filestat) override;
+	file_entry lookup_inode(pseudofd_t pseudo, cloudabi_inode_t directory, const char *file, size_t len, cloudabi_filestat_t *filestat) override;
 	std::pair<pseudofd_t, cloudabi_filetype_t> open(cloudabi_inode_t inode) override;
 	void allocate(pseudofd_t pseudo, off_t offset, off_t length) override;
 	size_t readlink(pseudofd_t pseudo, const char *path, size_t pathlen, char *buf, size_t buflen) override;
@@ -52,6 +60,7 @@ struct tmpfs : public cosix::reverse_handler {
 	void sync(pseudofd_t pseudo) override;
 
 	size_t readdir(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie) override;
+	size_t readdirplus(pseudofd_t pseudo, char *buffer, size_t buflen, cloudabi_dircookie_t &cookie) override;
 	void stat_fget(pseudofd_t pseudo, cloudabi_filestat_t *statbuf) override;
 	void stat_fput(pseudofd_t pseudo, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) override;
 	void stat_put(pseudofd_t pseudo, cloudabi_lookupflags_t lookupflags, const char *path, size_t pathlen, const cloudabi_filestat_t *buf, cloudabi_fsflags_t fsflags) override;
@@ -59,10 +68,27 @@ struct tmpfs : public cosix::reverse_handler {
 
 private:
 	const cloudabi_device_t device;
+	int reversefd;
+	// declared before the entries, so it outlives their pages
+	page_accounting accounting;
 
 	std::map<cloudabi_inode_t, file_entry_ptr> inodes;
 	std::map<pseudofd_t, pseudo_fd_ptr> pseudo_fds;
 
 	file_entry_ptr get_file_entry_from_inode(cloudabi_inode_t inode);
 	file_entry_ptr get_file_entry_from_pseudo(pseudofd_t pseudo);
+	file_entry_ptr new_file_entry(cloudabi_filetype_t type);
+
+	// Drops a reference to the entry from a directory. When the last one
+	// is gone, the inode is removed; its pages are freed once no pseudo
+	// FD has it open anymore.
+	void remove_link(file_entry_ptr entry);
+
+	// Tell the kernel to drop cached pages of all pseudo FDs opened on this
+	// entry, except the one that caused the change.
+	void invalidate_other_pseudos(file_entry_ptr entry, pseudofd_t except);
+	// Tell the kernel to drop the cached lookups in this directory, for all
+	// pseudo FDs opened on it except the one that caused the change.
+	void invalidate_other_dentries(file_entry_ptr directory, pseudofd_t except);
+	void notify_other_pseudos(file_entry_ptr const &entry, pseudofd_t except, void (*notify)(int, pseudofd_t));
 };
@@ -10,10 +10,69 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <cosix/bench.hpp>
 
 int stdout;
 int tmpdir;
 
+/* Writes and reads back total_size bytes in 64-byte buffers, passing iovcnt
+ * buffers per writev()/readv() call, and prints how long it took.
+ */
+static void benchmark_iovcnt(const char *filename, int oflags, int iovcnt, size_t total_size) {
+	const size_t buffer_size = 64;
+	char *data = reinterpret_cast<char*>(malloc(buffer_size * iovcnt));
+	memset(data, 'v', buffer_size * iovcnt);
+	struct iovec *iov = reinterpret_cast<struct iovec*>(calloc(iovcnt, sizeof(struct iovec)));
+	for(int i = 0; i < iovcnt; ++i) {
+		iov[i].iov_base = data + i * buffer_size;
+		iov[i].iov_len = buffer_size;
+	}
+
+	int fd = openat(tmpdir, filename, O_RDWR | O_CREAT | O_TRUNC | oflags);
+	if(fd < 0) {
+		dprintf(stdout, "Failed to open \"%s\": %s\n", filename, strerror(errno));
+		exit(1);
+	}
+
+	uint64_t start = cosix::now_ns();
+	size_t written = 0;
+	size_t calls = 0;
+	while(written < total_size) {
+		ssize_t res = writev(fd, iov, iovcnt);
+		if(res <= 0) {
+			dprintf(stdout, "writev failed: %s\n", strerror(errno));
+			exit(1);
+		}
+		written += res;
+		calls++;
+	}
+	uint64_t write_us = (cosix::now_ns() - start) / 1000;
+
+	start = cosix::now_ns();
+	size_t read = 0;
+	while(read < written) {
+		ssize_t res = preadv(fd, iov, iovcnt, read);
+		if(res <= 0) {
+			dprintf(stdout, "preadv failed: %s\n", strerror(errno));
+			exit(1);
+		}
+		read += res;
+	}
+	uint64_t read_us = (cosix::now_ns() - start) / 1000;
+
+	close(fd);
+	unlinkat(tmpdir, filename, 0);
+	free(iov);
+	free(data);
+
+	dprintf(stdout, "%s, iovcnt %2d: %zu bytes in %zu writev calls, write %llu us, read %llu us\n",
+		oflags & O_APPEND ? "append" : "cached", iovcnt, written, calls,
+		static_cast<unsigned long long>(write_us), static_cast<unsigned long long>(read_us));
+}
+
 void program_main(const argdata_t *ad) {
 	argdata_map_iterator_t it;
 	const argdata_t *key;
@@ -157,5 +216,14 @@ void program_main(const argdata_t *ad) {
 		exit(1);
 	}
 
+	/* vectored I/O */
+	dprintf(stdout, "Running vectored I/O benchmarks\n");
+	const int iovcnts[] = {1, 64};
+	for(int oflags : {0, O_APPEND}) {
+		for(int iovcnt : iovcnts) {
+			benchmark_iovcnt("iovbench", oflags, iovcnt, 1024 * 1024);
+		}
+	}
+
 	exit(0);
 }
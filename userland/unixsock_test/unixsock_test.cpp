@@ -16,6 +16,8 @@
 #include <sys/un.h>
 #include <sys/stat.h>
 
+#include <cosix/bench.hpp>
+
 int stdout;
 int tmpdir;
 
@@ -189,5 +191,43 @@ void program_main(const argdata_t *ad) {
 
 	dprintf(stdout, "[UNIXSOCK] SOCK_DGRAM test completed!\n");
 
+	const size_t message_sizes[] = {64, 4096, 65536};
+	const int socket_types[] = {SOCK_STREAM, SOCK_DGRAM};
+	for(int socket_type : socket_types) {
+		dprintf(stdout, "[UNIXSOCK] Running %s throughput benchmarks\n",
+			socket_type == SOCK_STREAM ? "SOCK_STREAM" : "SOCK_DGRAM");
+		for(size_t message_size : message_sizes) {
+			if(socketpair(AF_UNIX, socket_type, 0, fds) < 0) {
+				perror("socketpair");
+				exit(1);
+			}
+			cosix::benchmark_throughput(stdout, "[UNIXSOCK]", fds[1], fds[0], message_size, 16 * 1024 * 1024);
+		}
+	}
+
+	{
+		// open and close 10k fds, to see that fd allocation doesn't
+		// slow down with the number of open fds
+		const size_t num_pairs = 5000;
+		int *pairs = reinterpret_cast<int*>(malloc(num_pairs * 2 * sizeof(int)));
+		uint64_t start = cosix::now_ns();
+		for(size_t i = 0; i < num_pairs; ++i) {
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, pairs + i * 2) < 0) {
+				perror("socketpair");
+				exit(1);
+			}
+		}
+		uint64_t open_us = (cosix::now_ns() - start) / 1000;
+		start = cosix::now_ns();
+		for(size_t i = 0; i < num_pairs * 2; ++i) {
+			close(pairs[i]);
+		}
+		uint64_t close_us = (cosix::now_ns() - start) / 1000;
+		free(pairs);
+		dprintf(stdout, "[UNIXSOCK] Opened %zu fds in %llu us, closed them in %llu us\n",
+			num_pairs * 2, static_cast<unsigned long long>(open_us),
+			static_cast<unsigned long long>(close_us));
+	}
+
 	exit(0);
 }